@@ -0,0 +1,154 @@
+// Compares the file hashing paths on a generated corpus of many small
+// headers and a few large archives:
+//   stream    the original ifstream + per-file EVP context implementation
+//   engine    Utils::calculateFileHash (FileDigest) on one thread
+//   hasher    FileHasher with one lane per hardware thread
+//
+// Usage: bench_hash [small_files] [large_files] [large_file_mib]
+// The corpus is written below $TMPDIR and removed afterwards. Run it twice
+// or drop the page cache first to compare warm and cold reads.
+
+#include <unistd.h>
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <openssl/evp.h>
+
+#include "file_hasher.h"
+#include "utils.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+std::string streamHash(const std::string& filepath) {
+  std::ifstream file(filepath, std::ios::binary);
+  if (!file.is_open()) {
+    return "";
+  }
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
+    return "";
+  }
+  std::array<char, 64 * 1024> buffer;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    const std::streamsize bytes_read = file.gcount();
+    if (bytes_read > 0) {
+      EVP_DigestUpdate(ctx.get(), buffer.data(),
+                       static_cast<size_t>(bytes_read));
+    }
+  }
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_DigestFinal_ex(ctx.get(), digest, &digest_len);
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string hash(static_cast<size_t>(digest_len) * 2, '0');
+  for (unsigned int i = 0; i < digest_len; ++i) {
+    hash[2 * i] = kHex[digest[i] >> 4];
+    hash[2 * i + 1] = kHex[digest[i] & 0x0f];
+  }
+  return hash;
+}
+
+void writeRandomFile(const std::string& path, size_t size, std::mt19937& rng) {
+  std::vector<char> data(size);
+  for (auto& byte : data) {
+    byte = static_cast<char>(rng());
+  }
+  std::ofstream(path, std::ios::binary).write(data.data(), data.size());
+}
+
+template <class F>
+void report(const char* name, const std::vector<std::string>& files,
+            uint64_t total_bytes, F&& run) {
+  const auto start = Clock::now();
+  run(files);
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::printf("%-8s %8zu files %10.1f ms %9.1f MiB/s %10.0f files/s\n", name,
+              files.size(), seconds * 1000,
+              total_bytes / seconds / (1024 * 1024), files.size() / seconds);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t small_files = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                      : 5000;
+  const size_t large_files = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+  const size_t large_mib = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 64;
+
+  const std::filesystem::path dir =
+      std::filesystem::temp_directory_path() /
+      ("reprobuild_bench_hash_" + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> header_size(1024, 32 * 1024);
+  std::vector<std::string> small;
+  std::vector<std::string> large;
+  uint64_t small_bytes = 0;
+  uint64_t large_bytes = 0;
+  for (size_t i = 0; i < small_files; ++i) {
+    const size_t size = header_size(rng);
+    small.push_back((dir / ("h" + std::to_string(i) + ".h")).string());
+    writeRandomFile(small.back(), size, rng);
+    small_bytes += size;
+  }
+  for (size_t i = 0; i < large_files; ++i) {
+    const size_t size = large_mib * 1024 * 1024;
+    large.push_back((dir / ("lib" + std::to_string(i) + ".a")).string());
+    writeRandomFile(large.back(), size, rng);
+    large_bytes += size;
+  }
+
+  auto stream = [](const std::vector<std::string>& files) {
+    for (const auto& file : files) {
+      streamHash(file);
+    }
+  };
+  auto engine = [](const std::vector<std::string>& files) {
+    for (const auto& file : files) {
+      Utils::calculateFileHash(file);
+    }
+  };
+  auto hasher = [](const std::vector<std::string>& files) {
+    FileHasher lanes(std::thread::hardware_concurrency());
+    lanes.prefetch(files);
+    for (const auto& file : files) {
+      lanes.hash(file);
+    }
+  };
+
+  if (!small.empty() && streamHash(small[0]) !=
+                            Utils::calculateFileHash(small[0])) {
+    std::fprintf(stderr, "hash mismatch between implementations\n");
+    return 1;
+  }
+
+  if (!small.empty()) {
+    std::printf("small files (1-32 KiB):\n");
+    report("stream", small, small_bytes, stream);
+    report("engine", small, small_bytes, engine);
+    report("hasher", small, small_bytes, hasher);
+  }
+  if (!large.empty()) {
+    std::printf("large files (%zu MiB):\n", large_mib);
+    report("stream", large, large_bytes, stream);
+    report("engine", large, large_bytes, engine);
+    report("hasher", large, large_bytes, hasher);
+  }
+
+  std::filesystem::remove_all(dir);
+  return 0;
+}
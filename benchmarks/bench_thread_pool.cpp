@@ -0,0 +1,144 @@
+// Throughput of tiny tasks on the thread pool:
+//   legacy    the original pool: one mutex-guarded std::queue of
+//             std::function, a shared_ptr<packaged_task> per task
+//   enqueue   ThreadPool::enqueue, one future per task
+//   submit    ThreadPool::submit, fire and forget
+//   parallel  ThreadPool::parallel_for with one index per task body
+//
+// Usage: bench_thread_pool [tasks] [threads]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+class LegacyThreadPool {
+ public:
+  explicit LegacyThreadPool(size_t threads) {
+    for (size_t i = 0; i < threads; ++i) {
+      workers_.emplace_back([this] {
+        for (;;) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            condition_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  ~LegacyThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    condition_.notify_all();
+    for (auto& worker : workers_) worker.join();
+  }
+
+  template <class F>
+  std::future<void> enqueue(F f) {
+    auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+    std::future<void> result = task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace([task]() { (*task)(); });
+    }
+    condition_.notify_one();
+    return result;
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool stop_ = false;
+};
+
+// The task body: a little arithmetic on a shared counter.
+void tinyTask(std::atomic<uint64_t>& sink, size_t i) {
+  sink.fetch_add(i * 2654435761u % 1024, std::memory_order_relaxed);
+}
+
+template <class F>
+void report(const char* name, size_t tasks, F&& run) {
+  const auto start = Clock::now();
+  run();
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  std::printf("%-9s %8zu tasks %9.1f ms %12.0f tasks/s\n", name, tasks,
+              seconds * 1000, tasks / seconds);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const size_t tasks =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+  const size_t threads =
+      argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+               : std::max(1u, std::thread::hardware_concurrency());
+  std::atomic<uint64_t> sink{0};
+
+  std::printf("%zu threads\n", threads);
+  report("legacy", tasks, [&]() {
+    LegacyThreadPool pool(threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(tasks);
+    for (size_t i = 0; i < tasks; ++i) {
+      futures.push_back(pool.enqueue([&sink, i]() { tinyTask(sink, i); }));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  });
+  report("enqueue", tasks, [&]() {
+    ThreadPool pool(threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(tasks);
+    for (size_t i = 0; i < tasks; ++i) {
+      futures.push_back(pool.enqueue([&sink, i]() { tinyTask(sink, i); }));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+  });
+  report("submit", tasks, [&]() {
+    // Completion is observed through the destructor, which drains.
+    ThreadPool pool(threads);
+    for (size_t i = 0; i < tasks; ++i) {
+      pool.submit([&sink, i]() { tinyTask(sink, i); });
+    }
+  });
+  report("parallel", tasks, [&]() {
+    ThreadPool pool(threads - 1);
+    pool.parallel_for(0, tasks, 256, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        tinyTask(sink, i);
+      }
+    });
+  });
+
+  std::printf("checksum %llu\n", static_cast<unsigned long long>(sink.load()));
+  return 0;
+}
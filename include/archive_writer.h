@@ -0,0 +1,168 @@
+#ifndef ARCHIVE_WRITER_H
+#define ARCHIVE_WRITER_H
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Receives archive bytes in order; returns false to abort the archive.
+using ArchiveSink = std::function<bool(std::string_view)>;
+
+// Streaming zip writer. Entries are deflated as they are written and handed
+// to the sink in pieces, so neither the input nor the archive has to fit in
+// memory or on disk. Sizes and CRCs follow each entry in a data
+// descriptor, which every unzip understands. Entries, offsets and entry
+// counts past the classic 4 GiB / 65535 limits are recorded in ZIP64
+// fields, and only then, so small archives stay readable everywhere.
+class ZipWriter {
+ public:
+  explicit ZipWriter(ArchiveSink sink, int level = Z_DEFAULT_COMPRESSION);
+  ~ZipWriter();
+
+  ZipWriter(const ZipWriter&) = delete;
+  ZipWriter& operator=(const ZipWriter&) = delete;
+
+  // Start a deflated file entry; |mode| is the Unix permission bits.
+  bool beginFile(const std::string& name, time_t mtime, uint32_t mode);
+  bool write(std::string_view data);
+  bool endFile();
+  // Copy the file at |path| into a new entry named |name|.
+  bool addFile(const std::string& path, const std::string& name);
+  // Stored entry for a directory; |name| should end in '/'.
+  bool addDirectory(const std::string& name, time_t mtime, uint32_t mode);
+
+  // Write the central directory. No entries can be added afterwards.
+  bool finish();
+
+  bool ok() const { return ok_; }
+
+ private:
+  struct Entry {
+    std::string name;
+    bool directory;
+    uint16_t dos_time;
+    uint16_t dos_date;
+    uint32_t mode;
+    uint32_t crc;
+    uint64_t compressed_size;
+    uint64_t size;
+    uint64_t offset;
+  };
+
+  bool emit(std::string_view data);
+  // Run deflate over whatever is pending with |flush| and emit the output.
+  bool deflatePending(int flush);
+
+  ArchiveSink sink_;
+  int level_;
+  bool ok_ = true;
+  bool in_entry_ = false;
+  uint64_t offset_ = 0;
+  z_stream stream_;
+  std::vector<Entry> entries_;
+  std::string out_buffer_;
+};
+
+// Streaming tar writer (POSIX ustar, with pax headers for paths that do
+// not fit and files of 8 GiB or more). File contents are read and emitted
+// in pieces, so trees of any size can be archived without staging.
+class TarWriter {
+ public:
+  explicit TarWriter(ArchiveSink sink);
+
+  TarWriter(const TarWriter&) = delete;
+  TarWriter& operator=(const TarWriter&) = delete;
+
+  bool addDirectory(const std::string& name, const struct stat& st);
+  // Copy the file at |path|; symlinks are followed.
+  bool addFile(const std::string& path, const std::string& name);
+  bool addData(const std::string& name, std::string_view data, time_t mtime,
+               uint32_t mode);
+  // Write the end-of-archive blocks.
+  bool finish();
+
+  bool ok() const { return ok_; }
+
+ private:
+  bool emit(std::string_view data);
+  bool writeHeader(const std::string& name, char type, uint64_t size,
+                   time_t mtime, uint32_t mode, uint32_t uid, uint32_t gid);
+  bool pad(uint64_t size);
+
+  ArchiveSink sink_;
+  bool ok_ = true;
+};
+
+// Compresses a byte stream into |sink| as gzip, xz or bzip2. Output is
+// produced incrementally; finish() flushes the trailer.
+class StreamCompressor {
+ public:
+  virtual ~StreamCompressor() = default;
+  virtual bool write(std::string_view data) = 0;
+  virtual bool finish() = 0;
+
+  // Compressor for |format| ("gz", "xz" or "bz2"), or nullptr if this build
+  // has no library for it.
+  static std::unique_ptr<StreamCompressor> create(const std::string& format,
+                                                  ArchiveSink sink);
+  static bool supports(const std::string& format);
+};
+
+// Block-parallel compressor in the pigz style. Input is cut into blocks
+// that are compressed independently on a thread pool and emitted in order,
+// each as a complete gzip member, xz stream or bzip2 stream; gzip, xz and
+// bzip2 (and tar through them) read the concatenation as a single file.
+// At most two blocks per thread are in flight, which bounds memory use.
+class ParallelCompressor : public StreamCompressor {
+ public:
+  // |format| must be supported(); |block_size| 0 picks a per-format size.
+  ParallelCompressor(std::string format, ArchiveSink sink, size_t threads,
+                     size_t block_size = 0);
+  ~ParallelCompressor() override;
+
+  bool write(std::string_view data) override;
+  bool finish() override;
+
+  size_t blockCount() const { return blocks_; }
+  // Time spent compressing, summed over the threads.
+  long long compressMs() const { return compress_us_.load() / 1000; }
+  // Time the writer waited for a block to finish compressing.
+  long long waitMs() const { return wait_us_ / 1000; }
+
+  // Large enough that the ratio stays within a fraction of a percent of a
+  // single stream: 1 MiB for gzip (32 KiB window), a 900 kB bzip2 block
+  // and 8 MiB for xz (the default preset's dictionary).
+  static size_t defaultBlockSize(const std::string& format);
+
+ private:
+  void submitBlock();
+  // Emit the oldest pending block once it is compressed.
+  bool emitOldest();
+
+  std::string format_;
+  ArchiveSink sink_;
+  size_t block_size_;
+  size_t max_pending_;
+  bool ok_ = true;
+  std::string block_;
+  std::deque<std::future<std::string>> pending_;
+  size_t blocks_ = 0;
+  std::atomic<long long> compress_us_{0};
+  long long wait_us_ = 0;
+  // Last, so running blocks finish before the members they touch go.
+  std::unique_ptr<ThreadPool> pool_;
+};
+
+#endif  // ARCHIVE_WRITER_H
@@ -0,0 +1,89 @@
+#ifndef BPFTRACE_PROCESS_H
+#define BPFTRACE_PROCESS_H
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace_stream.h"
+
+// Render the bpftrace script template. |root_pid| is tracked from the
+// start (0 tracks nothing until a process registers itself with the
+// daemon probes), creat/openat calls under |ignore_prefixes| are filtered
+// in the probes and |extra_probes| is appended verbatim.
+std::string renderBpftraceScript(pid_t root_pid,
+                                 const std::vector<std::string>& ignore_prefixes,
+                                 const std::string& extra_probes = "");
+
+// Absolute entries of |ignore_patterns|, usable as probe prefix filters.
+// Patterns match anywhere in a path in userspace, so a prefix check only
+// drops paths that match would reject anyway. Userspace matches after
+// REPROBUILD_PATH_MAP remapping, though, so entries overlapping one of
+// the map's |observed_prefixes| are left to userspace.
+std::vector<std::string> probeIgnorePrefixes(
+    const std::vector<std::string>& ignore_patterns,
+    const std::vector<std::string>& observed_prefixes = {});
+
+// Path a traced process opens to mark a point in its own event stream.
+// Seeing the open come through means everything traced before it has been
+// read.
+std::string syncMarkerPath(pid_t pid);
+// Open and close |path| so that the probes see it; the file need not exist.
+void touchMarker(const std::string& path);
+
+// One-shot notification passed from trace reader threads to the thread
+// running the build.
+class OneShotEvent {
+ public:
+  void set();
+  bool waitFor(int timeout_ms);
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool set_ = false;
+};
+
+// A running `sudo bpftrace` child (REPROBUILD_BPFTRACE names another
+// command to run on the script). Its stderr is copied to a log file and
+// watched for the attach message; its stdout is either decoded as it
+// arrives or redirected to a log file.
+class BpftraceProcess {
+ public:
+  BpftraceProcess() = default;
+  ~BpftraceProcess();
+
+  BpftraceProcess(const BpftraceProcess&) = delete;
+  BpftraceProcess& operator=(const BpftraceProcess&) = delete;
+
+  // Write |script| to |script_path| and start bpftrace on it. With a
+  // |decoder|, stdout is fed into it on a reader thread; otherwise it is
+  // written to |stdout_log|.
+  bool start(const std::string& script, const std::string& script_path,
+             const std::string& stderr_log, BpftraceStreamDecoder* decoder,
+             const std::string& stdout_log = "");
+  // Block until bpftrace reports its probes attached. Returns false on
+  // timeout or if bpftrace exited first.
+  bool waitAttached(int timeout_ms);
+  bool attached() const { return attached_; }
+  // Interrupt bpftrace, read its output until EOF and reap the process.
+  // One that has not exited |timeout_ms| after SIGINT gets SIGTERM, and
+  // SIGKILL after as long again.
+  void stop(int timeout_ms = 10000);
+
+ private:
+  pid_t pid_ = -1;
+  std::string stderr_log_;
+  std::atomic<bool> attached_{false};
+  std::atomic<bool> abandon_reader_{false};
+  OneShotEvent ready_;
+  std::thread stderr_watcher_;
+  std::thread reader_;
+};
+
+#endif  // BPFTRACE_PROCESS_H
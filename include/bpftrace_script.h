@@ -6,16 +6,20 @@
 namespace BpftraceScript {
 
 const std::string SCRIPT_TEMPLATE = R"(let @tracked = hash(65536);
+let @dir_sent = lruhash(65536);
 BEGIN
 {
   $pid = *;
-  @tracked[$pid] = 1;
+  if ($pid > 0) {
+    @tracked[$pid] = 1;
+  }
 
 }
 
 END
 {
   clear(@tracked);
+  clear(@dir_sent);
 }
 
 tracepoint:sched:sched_process_fork
@@ -24,6 +28,20 @@ tracepoint:sched:sched_process_fork
   @tracked[(int64)args->child_pid] = 1;
 }
 
+// Threads are forgotten as they exit, the process once its last thread
+// has; the exit record tells userspace to drop its directory records.
+tracepoint:sched:sched_process_exit
+/@tracked[(int64)pid]/
+{
+  if (tid != pid) {
+    delete(@tracked[(int64)tid]);
+  }
+  if (curtask->signal->live.counter == 0) {
+    delete(@tracked[(int64)pid]);
+    printf("%d\x80exit\n\x80", pid);
+  }
+}
+
 tracepoint:syscalls:sys_enter_execve
 /@tracked[(int64)pid]/
 {
@@ -51,37 +69,94 @@ tracepoint:syscalls:sys_enter_execveat
 tracepoint:syscalls:sys_enter_creat
 /@tracked[(int64)pid]/
 {
-  printf("%d\x80creat %s\n\x80", pid, str(args->pathname));
+  $path = str(args->pathname);
+  // @PATH_FILTERS@
+  printf("%d\x80creat %s\n\x80", pid, $path);
 }
 
 tracepoint:syscalls:sys_enter_openat
 /@tracked[(int64)pid]/
 {
-  if (args->filename[0] != 47) {
-    
-    $d = (struct dentry *)((struct task_struct *)curtask)->fs->pwd.dentry;
+  // @OPEN_FLAG_FILTERS@
+  if (args->filename[0] == 47) {
+    $path = str(args->filename);
+    // @PATH_FILTERS@
+    printf("%d\x80openat %s %d\n\x80", pid, $path, args->flags);
+    return;
+  }
+
+  // Relative paths are resolved against dirfd (or the cwd for AT_FDCWD).
+  // The directory is described once per process; later opens only carry
+  // its id and userspace joins the two.
+  $task = (struct task_struct *)curtask;
+  if (args->dfd == -100) {
+    $dir = $task->fs->pwd.dentry;
+  } else {
+    // A dirfd that is not open fails the syscall; there is nothing to name.
+    if (args->dfd < 0 || (uint32)args->dfd >= $task->files->fdt->max_fds) {
+      return;
+    }
+    $file = *($task->files->fdt->fd + args->dfd);
+    if ($file == 0) {
+      return;
+    }
+    $dir = $file->f_path.dentry;
+  }
+  $dir_id = (uint64)$dir;
+
+  // The process start time tells a reused PID apart, the inode a dentry
+  // address recycled for another directory; either gets a fresh record.
+  $start = $task->group_leader->start_time;
+  $ino = $dir->d_inode->i_ino;
+  if (!@dir_sent[pid, $start, $dir_id, $ino]) {
+    @dir_sent[pid, $start, $dir_id, $ino] = 1;
+    $d = $dir;
     $i = 0;
     while ($i < 64) {
       $fname = $d->d_name.name;
       if ($d == $d->d_parent || *$fname == 0) {
         break;
       }
-      @path_parts[pid,$i] = $fname;
+      @path_parts[pid, $i] = $fname;
       $d = $d->d_parent;
       $i++;
     }
     $i = $i - 1;
-    printf("%d\x80openat \x80", pid);
+    printf("%d\x80dir %llu \x80", pid, $dir_id);
     while ($i >= 0) {
-      printf("%d\x80/%s\x80", pid, str(@path_parts[pid,$i]));
-      delete(@path_parts[pid,$i]);
+      printf("%d\x80/%s\x80", pid, str(@path_parts[pid, $i]));
+      delete(@path_parts[pid, $i]);
       $i--;
     }
-    printf("%d\x80/%s\x80", pid, str(args->filename));
-  } else {
-    printf("%d\x80openat %s\x80", pid, str(args->filename));
+    printf("%d\x80\n\x80", pid);
   }
-  printf("%d\x80 %d\n\x80", pid, args->flags);
+
+  printf("%d\x80openat_dir %llu %s %d\n\x80", pid, $dir_id,
+         str(args->filename), args->flags);
+}
+)";
+
+// Appended to SCRIPT_TEMPLATE by `reprobuild daemon`, which starts with an
+// empty @tracked map. A session adds its own process by opening
+// /.reprobuild_register and removes it again with /.reprobuild_unregister;
+// fork records let the daemon route each PID's lines to its session.
+const std::string DAEMON_PROBES = R"(
+tracepoint:syscalls:sys_enter_openat
+/args->filename[0] == 47 && args->filename[1] == 46/
+{
+  $marker = str(args->filename);
+  if (strncmp($marker, "/.reprobuild_register", 22) == 0) {
+    @tracked[(int64)pid] = 1;
+    printf("%d\x80register\n\x80", pid);
+  } else if (strncmp($marker, "/.reprobuild_unregister", 24) == 0) {
+    delete(@tracked[(int64)pid]);
+  }
+}
+
+tracepoint:sched:sched_process_fork
+/@tracked[(int64)args->parent_pid]/
+{
+  printf("%d\x80fork %d\n\x80", pid, args->child_pid);
 }
 )";
 
@@ -28,6 +28,8 @@ class BuildInfo {
   BuildRecord build_record_;
   BuildGraph build_graph_;
   std::string graph_output_file_;
+  // Reuse what the record at |output_file_| says about unchanged files.
+  bool incremental_ = false;
 
   void fillBuildRecordMetadata();
 };
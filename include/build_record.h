@@ -19,6 +19,21 @@ struct BuildArtifact {
       : path(p), hash(h), type(t) {}
 };
 
+// A traced dependency file as seen by an incremental run: the package it
+// resolved to, the canonical path and hash recorded for it, and its
+// Utils::statSignature() at resolution time.
+struct ResolvedFile {
+  std::string package;
+  std::string real_path;
+  std::string hash;
+  std::string signature;
+
+  ResolvedFile() = default;
+  ResolvedFile(const std::string& p, const std::string& r,
+               const std::string& h, const std::string& s)
+      : package(p), real_path(r), hash(h), signature(s) {}
+};
+
 class BuildRecord {
  public:
   BuildRecord();
@@ -31,6 +46,23 @@ class BuildRecord {
   void clearArtifacts();
   const std::vector<BuildArtifact>& getArtifacts() const;
 
+  // Files behind the dependencies, kept only by incremental runs so the
+  // next one can skip files that have not changed. Not part of matches().
+  void addResolvedFile(const std::string& path, const ResolvedFile& file);
+  // Note what |path| resolved to. A failed resolution (an invalid
+  // |package|) is not kept, so the next run resolves the file again.
+  void addResolvedFile(const std::string& path,
+                       const DependencyPackage& package,
+                       const std::string& signature);
+  const std::map<std::string, ResolvedFile>& getResolvedFiles() const {
+    return resolved_files_;
+  }
+  // If |path| was resolved by this record's run and |signature| (non-empty)
+  // still matches, set |package| to what it resolved to and return true.
+  bool reuseResolvedFile(const std::string& path,
+                         const std::string& signature,
+                         DependencyPackage& package) const;
+
   bool hasDependency(const std::string& package_name) const;
   DependencyPackage getDependency(const std::string& package_name) const;
   std::vector<DependencyPackage> getAllDependencies() const;
@@ -39,6 +71,8 @@ class BuildRecord {
 
   std::string toString() const;
   bool matches(const BuildRecord& other) const;
+  // The YAML document saveToFile() writes.
+  std::string toYaml() const;
   void saveToFile(const std::string& filepath) const;
   static BuildRecord loadFromFile(const std::string& filepath);
 
@@ -80,6 +114,7 @@ class BuildRecord {
   std::string project_name_;
   std::map<std::string, DependencyPackage> dependencies_;
   std::vector<BuildArtifact> artifacts_;
+  std::map<std::string, ResolvedFile> resolved_files_;
 
   // Metadata fields
   std::string architecture_;
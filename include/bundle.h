@@ -1,8 +1,25 @@
 #ifndef BUNDLE_H
 #define BUNDLE_H
 
+#include <cstddef>
+
 #include "build_record.h"
 
-void createBundle(const BuildRecord& record, const std::string& bundle_path);
+struct BundleTiming {
+  long long total_ms = 0;
+  // Compression time summed over the compression threads, and how long
+  // archiving stalled waiting for it. Both stay 0 for single-threaded
+  // output.
+  long long compress_ms = 0;
+  long long compress_wait_ms = 0;
+  size_t threads = 1;
+  size_t blocks = 0;
+};
+
+// Write the build tree, custom dependencies and |record| into a .tar.gz,
+// .tar.bz2, .tar.xz or .zip bundle. Tarballs are compressed in independent
+// blocks on |threads| threads (0 = the CPU thread count) when it is above 1.
+BundleTiming createBundle(const BuildRecord& record,
+                          const std::string& bundle_path, size_t threads = 0);
 
-#endif  // BUNDLE_H
\ No newline at end of file
+#endif  // BUNDLE_H
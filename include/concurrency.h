@@ -0,0 +1,48 @@
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+#include <cstddef>
+#include <string>
+
+// Thread counts for the tracker's parallel stages. I/O-bound work (hashing
+// files, package ownership lookups) spends most of its time blocked in
+// read() and stat(), so it is sized above the core count; CPU-bound work
+// (indexing and parsing the trace) gets one thread per usable core.
+//
+// Each count is taken from, in order: the command line, the environment
+// (REPROBUILD_IO_THREADS, REPROBUILD_CPU_THREADS) and the automatic
+// default. Usable cores are those in the process's affinity mask, so
+// taskset and cpuset limits are honoured.
+struct ConcurrencyPlan {
+  size_t io_threads = 1;
+  size_t cpu_threads = 1;
+  // Where each count came from: "cli", "env" or "auto".
+  std::string io_source = "auto";
+  std::string cpu_source = "auto";
+};
+
+class Concurrency {
+ public:
+  // Upper bound of the automatic I/O thread count.
+  static constexpr size_t kMaxAutoIoThreads = 64;
+
+  // Automatic plan for |cores| usable cores.
+  static ConcurrencyPlan automatic(size_t cores);
+  // Apply environment overrides, then |cli_io| and |cli_cpu| (0 = unset),
+  // to the automatic plan for this machine and make it current.
+  static const ConcurrencyPlan& configure(size_t cli_io = 0,
+                                          size_t cli_cpu = 0);
+  // The configured plan, or the automatic one if configure() was not
+  // called.
+  static const ConcurrencyPlan& current();
+
+  // Cores in the affinity mask, at least 1.
+  static size_t usableCores();
+  // Parse a positive thread count; returns 0 if |text| is not one.
+  static size_t parseThreadCount(const std::string& text);
+
+  // "io=N (source), cpu=M (source)" for logs.
+  static std::string describe(const ConcurrencyPlan& plan);
+};
+
+#endif  // CONCURRENCY_H
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 
 enum class PackageMgr;
 // enum class DependencyKind { ShareLibrary, StaticLibrary, Executable };
@@ -51,6 +52,12 @@ class DependencyPackage {
   bool operator<(const DependencyPackage& other) const;
 
   static DependencyPackage fromRawFile(const std::string& raw_file_path, PackageMgr pkg_mgr);
+  // fromRawFile for every path, in order. Paths are resolved in contiguous
+  // chunks on up to |max_threads| threads, each chunk consulting the
+  // resolution cache before and filling it after its lookups.
+  static std::vector<DependencyPackage> resolveAll(
+      const std::vector<std::string>& raw_file_paths, PackageMgr pkg_mgr,
+      size_t max_threads);
 
  private:
   std::string package_name_;
@@ -1,7 +1,9 @@
 #ifndef DEPENDENCY_RESOLVER_H
 #define DEPENDENCY_RESOLVER_H
 
+#include <cstddef>
 #include <string>
+#include <vector>
 
 #include "dependency_package.h"
 
@@ -13,9 +15,30 @@ bool getCachedPackage(PackageMgr pkg_mgr, const std::string& path,
                       DependencyPackage& package);
 DependencyPackage cachePackage(PackageMgr pkg_mgr, const std::string& path,
                                const DependencyPackage& package);
+// Batch forms over |paths[begin, end)|. getCachedPackages sets |found[i]|
+// and fills |packages[i]| on a hit; cachePackages stores |packages[i]|
+// unless |skip[i]| is set.
+void getCachedPackages(PackageMgr pkg_mgr,
+                       const std::vector<std::string>& paths, size_t begin,
+                       size_t end, std::vector<DependencyPackage>& packages,
+                       std::vector<char>& found);
+void cachePackages(PackageMgr pkg_mgr, const std::vector<std::string>& paths,
+                   size_t begin, size_t end,
+                   const std::vector<DependencyPackage>& packages,
+                   const std::vector<char>& skip);
+// Cache lookups answered and missed so far in this process.
+size_t cacheHitCount();
+size_t cacheMissCount();
 
 bool resolveAptPackage(const std::string& raw_file_path,
                        DependencyPackage& package);
+// Resolve through the in-process rpm database. |package| is untouched and
+// false returned if the file is unowned; |available| reports whether the
+// database could be read at all.
+bool resolveRpmPackage(const std::string& raw_file_path,
+                       DependencyPackage& package, bool& available);
+bool resolvePacmanPackage(const std::string& raw_file_path,
+                          DependencyPackage& package);
 DependencyPackage createDependencyPackage(
     const std::string& package_name, DependencyOrigin origin,
     const std::string& raw_file_path, const std::string& real_path,
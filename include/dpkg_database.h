@@ -0,0 +1,59 @@
+#ifndef DPKG_DATABASE_H
+#define DPKG_DATABASE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "ownership_index.h"
+
+struct DebianPackageOwner {
+  std::string query_name;    // name of the .list file, e.g. "libc6:amd64"
+  std::string display_name;  // without the architecture suffix
+  std::string version;       // empty if the status file has none
+};
+
+// File ownership and versions from the dpkg database.
+//
+// In the default INDEX mode every *.list file is read into an
+// OwnershipIndex, cached on disk until dpkg changes its status file. LAZY
+// mode (REPROBUILD_DPKG_LOOKUP=lazy) keeps only a directory-level index,
+// mapping each directory to the packages listing files in it, and reads
+// the .list files of those candidate packages on first use. The directory
+// index is cached as well and refreshed per package when a .list file
+// changes, so builds touching few system files read few lists.
+class DpkgDatabase {
+ public:
+  enum class Mode { INDEX, LAZY };
+
+  struct Options {
+    std::string status_path = "/var/lib/dpkg/status";
+    std::string info_dir = "/var/lib/dpkg/info";
+    // Cache file of the selected mode; "" keeps everything in memory.
+    std::string cache_path;
+    Mode mode = Mode::INDEX;
+  };
+
+  explicit DpkgDatabase(Options options);
+  ~DpkgDatabase();
+
+  // Database of the running system, configured from the environment.
+  static const DpkgDatabase& instance();
+
+  bool findOwner(const std::string& raw_path, const std::string& real_path,
+                 DebianPackageOwner& owner) const;
+  // |owner.version|, or the answer of dpkg-query if that is empty.
+  std::string findVersion(const DebianPackageOwner& owner) const;
+
+  // LAZY mode: number of .list files read so far.
+  size_t loadedListCount() const;
+
+ private:
+  class LazyIndex;
+
+  Options options_;
+  OwnershipIndex index_;
+  std::unique_ptr<LazyIndex> lazy_;
+};
+
+#endif  // DPKG_DATABASE_H
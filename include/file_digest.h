@@ -0,0 +1,25 @@
+#ifndef FILE_DIGEST_H
+#define FILE_DIGEST_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// SHA-256 engine behind Utils::calculateFileHash.
+//
+// Each thread keeps one digest context and one read buffer, so hashing a
+// small file costs an open, a read and the compression rounds. Large files
+// are read in 1 MiB blocks with sequential read-ahead. The SHA-256 code
+// itself is OpenSSL's, which picks SHA-NI/AVX2 at runtime; parallel lanes
+// across files come from FileHasher's workers.
+namespace FileDigest {
+using Digest = std::array<unsigned char, 32>;
+
+// Hash everything readable from |fd| until EOF. |size_hint| (from fstat)
+// selects the read strategy; the result does not depend on it.
+bool sha256(int fd, uint64_t size_hint, Digest& digest);
+
+std::string toHex(const Digest& digest);
+}  // namespace FileDigest
+
+#endif  // FILE_DIGEST_H
@@ -0,0 +1,71 @@
+#ifndef FILE_HASHER_H
+#define FILE_HASHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "thread_pool.h"
+
+// Process-wide hashing service shared by dependency resolution, artifact
+// detection and the build graph. Results are memoized per file (device and
+// inode, so different spellings of one path and hard links share an
+// entry) and every file is hashed exactly once per run.
+//
+// hash() computes on the calling thread when nobody else has claimed the
+// file yet; prefetch() queues files on the service's worker pool so that
+// callers walking a list serially still hash on every core.
+class FileHasher {
+ public:
+  explicit FileHasher(size_t threads);
+
+  FileHasher(const FileHasher&) = delete;
+  FileHasher& operator=(const FileHasher&) = delete;
+
+  // Shared instance sized by Concurrency::current().io_threads.
+  static FileHasher& instance();
+
+  // SHA-256 of |path| as lowercase hex, "" if it cannot be read. Blocks
+  // while another thread hashes the same file.
+  std::string hash(const std::string& path);
+  // Start hashing |paths| in the background.
+  void prefetch(const std::vector<std::string>& paths);
+
+  // Distinct files requested so far, and requests served by the memo.
+  size_t hashedCount() const;
+  size_t reusedCount() const;
+
+ private:
+  using Key = std::pair<uint64_t, uint64_t>;
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return std::hash<uint64_t>()(key.first * 0x9e3779b97f4a7c15ULL ^
+                                   key.second);
+    }
+  };
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, std::shared_future<std::string>, KeyHash> entries;
+    size_t reused = 0;
+  };
+  static constexpr size_t kShardCount = 16;
+
+  // Look up |path|. Returns false if it cannot be stat'ed. Otherwise
+  // |result| is the memoized future and, if this call created the entry,
+  // |claim| receives the promise the caller must fulfil.
+  bool claim(const std::string& path, std::shared_future<std::string>& result,
+             std::unique_ptr<std::promise<std::string>>& claim);
+  static void compute(const std::string& path,
+                      std::promise<std::string>& promise);
+
+  Shard shards_[kShardCount];
+  ThreadPool pool_;
+};
+
+#endif  // FILE_HASHER_H
@@ -0,0 +1,95 @@
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H
+
+#include <sys/stat.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_digest.h"
+
+// Persistent SHA-256 cache for Utils::calculateFileHash. Entries are keyed
+// by device and inode and stay valid while size, mtime and ctime are
+// unchanged, so unmodified system libraries and headers are hashed once
+// instead of on every run.
+//
+// The cache file is a header followed by fixed-size records sorted by
+// (device, inode). It is mmap'd read-only and searched in place; hashes
+// computed during the run are kept in memory and merged into a fresh file
+// by save(), which replaces the old one atomically.
+class HashCache {
+ public:
+  using Digest = FileDigest::Digest;
+
+  HashCache() = default;
+  ~HashCache();
+
+  HashCache(const HashCache&) = delete;
+  HashCache& operator=(const HashCache&) = delete;
+
+  // Process-wide cache consulted by Utils::calculateFileHash.
+  static HashCache& instance();
+
+  // Cache file location: REPROBUILD_HASH_CACHE if set ("0" or "off"
+  // disables the cache and yields ""), else
+  // $XDG_CACHE_HOME/reprobuild/hash_cache.bin, ~/.cache/... or, without a
+  // home directory, |log_dir|/reprobuild_hash_cache.bin.
+  static std::string defaultPath(const std::string& log_dir);
+
+  // Map the cache file at |path|. A missing or malformed file leaves the
+  // cache empty; it is still written by save(). Returns false if |path| is
+  // empty.
+  bool open(const std::string& path);
+  bool isOpen() const { return !path_.empty(); }
+
+  // Look up the digest of the file described by |st|.
+  bool lookup(const struct stat& st, Digest& digest);
+  // Remember |digest| for the file described by |st|. Files modified in the
+  // last few seconds are skipped: a later write within the timestamp
+  // granularity would not change the key.
+  void store(const struct stat& st, const Digest& digest);
+
+  // Write the merged cache back to disk. The current mapping stays valid.
+  bool save();
+
+  size_t hitCount() const { return hits_; }
+  size_t missCount() const { return misses_; }
+
+ private:
+  struct Record {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    Digest digest;
+  };
+  using Key = std::pair<uint64_t, uint64_t>;
+
+  static Record makeRecord(const struct stat& st);
+  static bool sameVersion(const Record& a, const Record& b);
+  const Record* findMapped(const Key& key) const;
+  void unmap();
+
+  std::string path_;
+  const Record* records_ = nullptr;
+  size_t record_count_ = 0;
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+
+  std::mutex mutex_;
+  // Mapped records looked up during this run; the rest are dropped first
+  // when the cache exceeds its size limit.
+  std::vector<bool> used_;
+  std::map<Key, Record> added_;
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
+};
+
+#endif  // HASH_CACHE_H
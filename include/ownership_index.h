@@ -0,0 +1,83 @@
+#ifndef OWNERSHIP_INDEX_H
+#define OWNERSHIP_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Compact map from installed file path to owning package, built from a
+// package manager's database and cached on disk between runs.
+//
+// The serialized form is a header, a package table (name and version), a
+// path table sorted by path and a string pool. It is used in place: a
+// cached index is mmap'd and binary-searched, so opening it costs a
+// page-in instead of a parse. Each index records a stamp of the database
+// it was built from (e.g. the dpkg status mtime) and is rejected when the
+// stamp no longer matches.
+class OwnershipIndex {
+ public:
+  struct Package {
+    std::string_view name;
+    std::string_view version;
+  };
+
+  class Builder {
+   public:
+    uint32_t addPackage(std::string name, std::string version);
+    // When several packages list the same path, the first one wins.
+    void addPath(std::string path, uint32_t package);
+    OwnershipIndex build(uint64_t stamp);
+
+   private:
+    struct PathEntry {
+      std::string path;
+      uint32_t package;
+      uint32_t order;
+    };
+    std::vector<std::pair<std::string, std::string>> packages_;
+    std::vector<PathEntry> paths_;
+  };
+
+  OwnershipIndex() = default;
+  ~OwnershipIndex();
+  OwnershipIndex(OwnershipIndex&& other) noexcept;
+  OwnershipIndex& operator=(OwnershipIndex&& other) noexcept;
+  OwnershipIndex(const OwnershipIndex&) = delete;
+  OwnershipIndex& operator=(const OwnershipIndex&) = delete;
+
+  // Map the index at |path|. Fails if it is missing, malformed or was
+  // built for a different |stamp|.
+  bool load(const std::string& path, uint64_t stamp);
+  // Write the index to |path| through a temporary file and rename.
+  bool save(const std::string& path) const;
+
+  bool valid() const { return data_ != nullptr; }
+  bool findOwner(std::string_view path, Package& package) const;
+
+  size_t packageCount() const;
+  size_t pathCount() const;
+
+ private:
+  struct Header;
+  struct PackageRecord;
+  struct PathRecord;
+
+  bool attach(const char* data, size_t size, uint64_t stamp);
+  std::string_view string(uint32_t offset, uint32_t length) const;
+  void reset();
+
+  std::vector<char> buffer_;
+  void* mapping_ = nullptr;
+  size_t mapping_size_ = 0;
+
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  const Header* header_ = nullptr;
+  const PackageRecord* packages_ = nullptr;
+  const PathRecord* paths_ = nullptr;
+  const char* strings_ = nullptr;
+};
+
+#endif  // OWNERSHIP_INDEX_H
@@ -0,0 +1,44 @@
+#ifndef PACMAN_DATABASE_H
+#define PACMAN_DATABASE_H
+
+#include <string>
+
+#include "ownership_index.h"
+
+struct PacmanPackageOwner {
+  std::string name;
+  std::string version;  // [epoch:]pkgver-pkgrel, as pacman reports it
+};
+
+// File ownership from pacman's local database: one directory per installed
+// package holding a `desc` file (%NAME%, %VERSION%, ...) and a `files` file
+// (%FILES%, paths relative to / with directories ending in '/'). Both are
+// read into an OwnershipIndex that is cached on disk and rebuilt when the
+// local directory changes, which pacman does on every install, upgrade or
+// removal.
+class PacmanDatabase {
+ public:
+  struct Options {
+    std::string local_dir = "/var/lib/pacman/local";
+    // Ownership index cache; "" keeps it in memory only.
+    std::string cache_path;
+  };
+
+  explicit PacmanDatabase(Options options);
+
+  // Database of the running system; the index is cached as
+  // pacman_owners.idx in the user cache directory, or at
+  // REPROBUILD_PACMAN_INDEX.
+  static const PacmanDatabase& instance();
+
+  bool findOwner(const std::string& raw_path, const std::string& real_path,
+                 PacmanPackageOwner& owner) const;
+
+ private:
+  void loadPackages(OwnershipIndex::Builder& builder) const;
+
+  Options options_;
+  OwnershipIndex index_;
+};
+
+#endif  // PACMAN_DATABASE_H
@@ -0,0 +1,46 @@
+#ifndef RINGBUF_TRACER_H
+#define RINGBUF_TRACER_H
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "trace_event.h"
+
+// Decode one binary record produced by src/bpf/trace.bpf.c. The event's
+// views point into |data|.
+bool decodeTraceRecord(const void* data, size_t size, TraceEvent& event);
+
+// Tracing backend that loads a libbpf CO-RE program and consumes its BPF
+// ring buffer in-process. Only functional when reprobuild is configured
+// with -DREPROBUILD_ENABLE_LIBBPF=ON; otherwise start() always fails and
+// the tracker falls back to bpftrace.
+class RingbufTracer {
+ public:
+  using EventHandler = std::function<void(const TraceEvent&)>;
+
+  explicit RingbufTracer(EventHandler handler);
+  ~RingbufTracer();
+
+  static bool isAvailable();
+
+  // Load and attach the probes, track |root_pid| and its descendants and
+  // start consuming records on a background thread. creat/openat records
+  // for paths under |ignore_prefixes| are dropped in the kernel.
+  bool start(pid_t root_pid, const std::vector<std::string>& ignore_prefixes);
+  // Stop polling and drain every record that is still buffered.
+  void stop();
+
+  size_t eventCount() const;
+  size_t droppedCount() const;
+
+ private:
+  struct Impl;
+  std::unique_ptr<Impl> impl_;
+};
+
+#endif  // RINGBUF_TRACER_H
@@ -0,0 +1,66 @@
+#ifndef RPM_DATABASE_H
+#define RPM_DATABASE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ownership_index.h"
+
+// Fields of one package header from the rpm database.
+struct RpmHeader {
+  std::string name;
+  std::string version;
+  std::string release;
+  uint32_t epoch = 0;
+  std::string arch;
+  std::vector<std::string> files;
+
+  // VERSION-RELEASE, as recorded for DNF/YUM dependencies.
+  std::string versionRelease() const { return version + "-" + release; }
+};
+
+struct RpmPackageOwner {
+  std::string name;
+  std::string version;  // VERSION-RELEASE
+};
+
+// File ownership from the rpm database, read in-process instead of through
+// `rpm -qf`. The header blobs of rpmdb.sqlite are decoded once into an
+// OwnershipIndex which, like the dpkg one, is cached on disk until the
+// database changes.
+//
+// Requires reprobuild to be built with SQLite (REPROBUILD_HAVE_SQLITE);
+// older Berkeley DB / NDB databases are not read. available() reports
+// whether the database could be loaded so callers can fall back to rpm.
+class RpmDatabase {
+ public:
+  struct Options {
+    std::string db_path = "/var/lib/rpm/rpmdb.sqlite";
+    // Ownership index cache; "" keeps it in memory only.
+    std::string cache_path;
+  };
+
+  explicit RpmDatabase(Options options);
+
+  // Database of the running system; the index is cached as rpm_owners.idx
+  // in the user cache directory, or at REPROBUILD_RPM_INDEX.
+  static const RpmDatabase& instance();
+
+  bool available() const { return index_.valid(); }
+  bool findOwner(const std::string& raw_path, const std::string& real_path,
+                 RpmPackageOwner& owner) const;
+
+  // Decode a header blob as stored in rpmdb.sqlite (index count and data
+  // length, entries, data store; all big-endian).
+  static bool parseHeader(const void* blob, size_t size, RpmHeader& header);
+
+ private:
+  bool loadPackages(OwnershipIndex::Builder& builder) const;
+
+  Options options_;
+  OwnershipIndex index_;
+};
+
+#endif  // RPM_DATABASE_H
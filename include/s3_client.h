@@ -0,0 +1,170 @@
+#ifndef S3_CLIENT_H
+#define S3_CLIENT_H
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct HttpResponse {
+  int status = 0;  // 0 if the request never got a response
+  // Header names are lowercased.
+  std::map<std::string, std::string> headers;
+  std::string body;
+};
+
+// One plain-HTTP/1.1 connection. Responses are read in full (by
+// Content-Length or chunked encoding), so the connection can carry the
+// next request unless the server asked to close it.
+class HttpConnection {
+ public:
+  HttpConnection(std::string host, int port);
+  ~HttpConnection();
+
+  HttpConnection(const HttpConnection&) = delete;
+  HttpConnection& operator=(const HttpConnection&) = delete;
+
+  // Send one request and read its response. |headers| are "Name: value"
+  // lines without CRLF; Host and Content-Length are added here. Returns
+  // false on a transport error, after which the connection is closed.
+  bool request(const std::string& method, const std::string& target,
+               const std::vector<std::string>& headers,
+               std::string_view body, HttpResponse& response);
+
+  bool isOpen() const { return fd_ >= 0; }
+  void close();
+
+ private:
+  bool connect();
+  bool sendAll(std::string_view data);
+  // Fill |buffer_| until it holds at least |size| bytes.
+  bool fill(size_t size);
+  bool readLine(std::string& line);
+  bool readResponse(bool head_request, HttpResponse& response);
+
+  std::string host_;
+  int port_;
+  int fd_ = -1;
+  std::string buffer_;  // bytes received but not yet consumed
+};
+
+// Minimal S3 client for the MinIO object store, signed with AWS signature
+// version 2. Idle connections are kept in a pool and shared by the threads
+// calling into the client, so concurrent uploads reuse keep-alive
+// connections instead of reconnecting per request.
+class S3Client {
+ public:
+  S3Client(std::string host, int port, std::string access_key,
+           std::string secret_key, std::string bucket);
+
+  S3Client(const S3Client&) = delete;
+  S3Client& operator=(const S3Client&) = delete;
+
+  // HTTP status of a HEAD of |key|, 0 on transport failure.
+  int headObject(const std::string& key);
+  // HTTP status of a PUT of |body| to |key|, 0 on transport failure.
+  int putObject(const std::string& key, std::string_view body,
+                const std::string& content_type);
+
+  // Multipart upload. create returns the upload id and uploadPart the
+  // part's ETag, both "" on failure. Parts are numbered from 1 and all but
+  // the last must be at least 5 MiB.
+  std::string createMultipartUpload(const std::string& key,
+                                    const std::string& content_type);
+  std::string uploadPart(const std::string& key, const std::string& upload_id,
+                         int part_number, std::string_view body);
+  bool completeMultipartUpload(const std::string& key,
+                               const std::string& upload_id,
+                               const std::vector<std::string>& etags);
+  void abortMultipartUpload(const std::string& key,
+                            const std::string& upload_id);
+
+  // Append every key under |prefix| to |keys|, following ListObjectsV2
+  // continuation tokens page by page, for at most |max_pages| pages (0 = no
+  // limit). Returns false (keeping the keys already appended) if any page
+  // fails; |complete| tells whether the listing reached its end.
+  bool listObjects(const std::string& prefix, std::vector<std::string>& keys,
+                   size_t max_pages = 0, bool* complete = nullptr);
+  // Requests sent so far, retries included.
+  size_t requestCount() const { return requests_.load(); }
+
+  // Connections opened so far; useful to see reuse in tests and logs.
+  size_t connectionCount() const;
+
+  // Signature over |string_to_sign|: base64 of its HMAC-SHA1 under
+  // |secret_key|.
+  static std::string sign(const std::string& secret_key,
+                          const std::string& string_to_sign);
+  static std::string rfc1123Date();
+  // Percent-encode |text| for a query string (RFC 3986 unreserved kept).
+  static std::string urlEncode(const std::string& text);
+
+ private:
+  // Send a signed request, retrying once on a new connection if a pooled
+  // one turns out to have been closed by the server. POSTs always use a
+  // new connection and are not retried.
+  HttpResponse send(const std::string& method, const std::string& key,
+                    const std::string& query,
+                    std::vector<std::string> headers,
+                    const std::string& content_type, std::string_view body);
+  // An idle connection if |allow_idle| and one is pooled, else a new one.
+  std::unique_ptr<HttpConnection> acquire(bool allow_idle, bool& reused);
+  void release(std::unique_ptr<HttpConnection> connection);
+  // Close every idle connection.
+  void dropIdle();
+
+  std::string host_;
+  int port_;
+  std::string access_key_;
+  std::string secret_key_;
+  std::string bucket_;
+
+  mutable std::mutex pool_mutex_;
+  std::vector<std::unique_ptr<HttpConnection>> idle_;
+  size_t opened_ = 0;
+  std::atomic<size_t> requests_{0};
+};
+
+// Streams one object to S3 without knowing its size up front. Data is
+// buffered up to |part_size|; an object that stays below it is sent with
+// a single PUT, a larger one as a multipart upload, one part per buffer.
+// Memory use is bounded by |part_size| whatever the object size.
+class S3ObjectWriter {
+ public:
+  static constexpr size_t kDefaultPartSize = 8 << 20;
+  // S3 rejects multipart uploads with smaller non-final parts.
+  static constexpr size_t kMinPartSize = 5 << 20;
+
+  S3ObjectWriter(S3Client& client, std::string key, std::string content_type,
+                 size_t part_size = kDefaultPartSize);
+  // Aborts a multipart upload that was not finished.
+  ~S3ObjectWriter();
+
+  S3ObjectWriter(const S3ObjectWriter&) = delete;
+  S3ObjectWriter& operator=(const S3ObjectWriter&) = delete;
+
+  bool write(std::string_view data);
+  // Send what is buffered and commit the object.
+  bool finish();
+
+  size_t partCount() const { return etags_.size(); }
+
+ private:
+  bool flushPart();
+
+  S3Client& client_;
+  std::string key_;
+  std::string content_type_;
+  size_t part_size_;
+  std::string buffer_;
+  std::string upload_id_;
+  std::vector<std::string> etags_;
+  bool failed_ = false;
+  bool finished_ = false;
+};
+
+#endif  // S3_CLIENT_H
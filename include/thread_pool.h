@@ -1,49 +1,258 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
-#include <stdexcept>
+#include <new>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+// Move-only type-erased void() callable. Callables up to kInlineSize bytes
+// are stored in place, so queueing a typical lambda does not allocate.
+class Task {
+ public:
+  static constexpr size_t kInlineSize = 48;
+
+  Task() = default;
+  template <class F, class = std::enable_if_t<
+                         !std::is_same<std::decay_t<F>, Task>::value>>
+  Task(F&& f);  // NOLINT(runtime/explicit)
+  Task(Task&& other) noexcept;
+  Task& operator=(Task&& other) noexcept;
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+  void operator()() { ops_->invoke(storage_); }
+
+ private:
+  struct Ops {
+    void (*invoke)(void* storage);
+    void (*move)(void* from, void* to);
+    void (*destroy)(void* storage);
+  };
+  template <class F>
+  struct InlineOps;
+  template <class F>
+  struct HeapOps;
+
+  void reset();
+
+  alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+  const Ops* ops_ = nullptr;
+};
+
+// Work-stealing thread pool. Every worker owns a deque: it takes its own
+// tasks from the back and, when that runs dry, steals from the front of the
+// others'. Tasks submitted from a worker go to its own deque, others are
+// spread round-robin.
+//
+// parallel_for() is the bulk entry point: it queues one helper per worker
+// at once, and the helpers and the calling thread then claim chunks of the
+// range from a shared counter until it is exhausted. The calling thread
+// always takes part, so nested use from inside a task cannot deadlock and a
+// pool with zero workers simply runs the loop inline.
 class ThreadPool {
  public:
   explicit ThreadPool(size_t threads);
   ~ThreadPool();
 
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  size_t size() const { return workers_.size(); }
+
+  // Run |task| on some worker; nothing reports its completion.
+  void submit(Task task);
+
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args)
-      -> std::future<typename std::result_of<F(Args...)>::type>;
+      -> std::future<std::invoke_result_t<std::decay_t<F>,
+                                          std::decay_t<Args>...>>;
+
+  // Call |fn(chunk_begin, chunk_end)| over [begin, end) in chunks of at
+  // most |grain| indices (0 picks one chunk per participating thread) and
+  // return when all are done. The first exception thrown by |fn| is
+  // rethrown here once the remaining chunks have finished.
+  template <class F>
+  void parallel_for(size_t begin, size_t end, size_t grain, F&& fn);
 
  private:
-  std::vector<std::thread> workers;
-  std::queue<std::function<void()>> tasks;
+  struct alignas(64) WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void workerLoop(size_t index);
+  bool takeTask(size_t index, Task& task);
+  // Queue |task| on the deque of the calling worker, or round-robin.
+  void push(Task task);
+  void wake(bool all);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> workers_;
+  std::atomic<size_t> next_queue_{0};
+
+  // Tasks queued but not yet taken; workers sleep only while it is zero.
+  std::atomic<size_t> pending_{0};
+  std::atomic<size_t> sleepers_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cv_;
+  bool stop_ = false;
+};
 
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop;
+template <class F>
+struct Task::InlineOps {
+  static void invoke(void* storage) { (*static_cast<F*>(storage))(); }
+  static void move(void* from, void* to) {
+    new (to) F(std::move(*static_cast<F*>(from)));
+    static_cast<F*>(from)->~F();
+  }
+  static void destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+  static constexpr Ops ops = {&invoke, &move, &destroy};
 };
 
+template <class F>
+struct Task::HeapOps {
+  static F*& target(void* storage) { return *static_cast<F**>(storage); }
+  static void invoke(void* storage) { (*target(storage))(); }
+  static void move(void* from, void* to) {
+    new (to) F*(target(from));
+  }
+  static void destroy(void* storage) { delete target(storage); }
+  static constexpr Ops ops = {&invoke, &move, &destroy};
+};
+
+template <class F, class>
+Task::Task(F&& f) {
+  using Fn = std::decay_t<F>;
+  if constexpr (sizeof(Fn) <= kInlineSize &&
+                alignof(Fn) <= alignof(std::max_align_t) &&
+                std::is_nothrow_move_constructible<Fn>::value) {
+    new (storage_) Fn(std::forward<F>(f));
+    ops_ = &InlineOps<Fn>::ops;
+  } else {
+    new (storage_) Fn*(new Fn(std::forward<F>(f)));
+    ops_ = &HeapOps<Fn>::ops;
+  }
+}
+
+inline Task::Task(Task&& other) noexcept : ops_(other.ops_) {
+  if (ops_) {
+    ops_->move(other.storage_, storage_);
+    other.ops_ = nullptr;
+  }
+}
+
+inline Task& Task::operator=(Task&& other) noexcept {
+  if (this != &other) {
+    reset();
+    ops_ = other.ops_;
+    if (ops_) {
+      ops_->move(other.storage_, storage_);
+      other.ops_ = nullptr;
+    }
+  }
+  return *this;
+}
+
+inline void Task::reset() {
+  if (ops_) {
+    ops_->destroy(storage_);
+    ops_ = nullptr;
+  }
+}
+
 template <class F, class... Args>
 auto ThreadPool::enqueue(F&& f, Args&&... args)
-    -> std::future<typename std::result_of<F(Args...)>::type> {
-  using return_type = typename std::result_of<F(Args...)>::type;
+    -> std::future<std::invoke_result_t<std::decay_t<F>,
+                                        std::decay_t<Args>...>> {
+  using return_type =
+      std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+
+  std::promise<return_type> promise;
+  std::future<return_type> result = promise.get_future();
+  submit([promise = std::move(promise), f = std::forward<F>(f),
+          args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+    try {
+      if constexpr (std::is_void<return_type>::value) {
+        std::apply(f, std::move(args));
+        promise.set_value();
+      } else {
+        promise.set_value(std::apply(f, std::move(args)));
+      }
+    } catch (...) {
+      promise.set_exception(std::current_exception());
+    }
+  });
+  return result;
+}
 
-  auto task = std::make_shared<std::packaged_task<return_type()>>(
-      std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+template <class F>
+void ThreadPool::parallel_for(size_t begin, size_t end, size_t grain,
+                              F&& fn) {
+  if (begin >= end) {
+    return;
+  }
+  const size_t count = end - begin;
+  const size_t participants = workers_.size() + 1;
+  if (grain == 0) {
+    grain = (count + participants - 1) / participants;
+  }
+  const size_t chunks = (count + grain - 1) / grain;
 
-  std::future<return_type> res = task->get_future();
-  {
-    std::unique_lock<std::mutex> lock(queue_mutex);
+  struct Loop {
+    std::atomic<size_t> next_chunk{0};
+    std::atomic<size_t> done_chunks{0};
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::exception_ptr error;
+  };
+  // Helpers that start after the range is exhausted still touch |loop|.
+  auto loop = std::make_shared<Loop>();
+  auto run_chunks = [loop, begin, end, grain, chunks, &fn]() {
+    size_t chunk;
+    while ((chunk = loop->next_chunk.fetch_add(1)) < chunks) {
+      const size_t chunk_begin = begin + chunk * grain;
+      try {
+        fn(chunk_begin, std::min(end, chunk_begin + grain));
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        if (!loop->error) {
+          loop->error = std::current_exception();
+        }
+      }
+      if (loop->done_chunks.fetch_add(1) + 1 == chunks) {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->finished.notify_all();
+      }
+    }
+  };
 
-    if (stop) throw std::runtime_error("enqueue on stopped ThreadPool");
+  const size_t helpers = std::min(workers_.size(), chunks - 1);
+  for (size_t i = 0; i < helpers; ++i) {
+    push(Task(run_chunks));
+  }
+  if (helpers > 0) {
+    wake(true);
+  }
 
-    tasks.emplace([task]() { (*task)(); });
+  run_chunks();
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->finished.wait(lock,
+                      [&]() { return loop->done_chunks.load() == chunks; });
+  if (loop->error) {
+    std::rethrow_exception(loop->error);
   }
-  condition.notify_one();
-  return res;
-}
\ No newline at end of file
+}
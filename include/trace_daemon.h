@@ -0,0 +1,126 @@
+#ifndef TRACE_DAEMON_H
+#define TRACE_DAEMON_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bpftrace_process.h"
+#include "trace_event.h"
+#include "trace_stream.h"
+
+// Socket used by `reprobuild daemon` and its clients:
+// REPROBUILD_DAEMON_SOCKET, or daemon.sock in the per-user directory
+// $XDG_RUNTIME_DIR/reprobuild (/tmp/reprobuild-<uid> without one), which
+// the daemon creates with mode 0700.
+std::string traceDaemonSocketPath();
+
+// Long-running tracer behind `reprobuild daemon`. It keeps one bpftrace
+// instance attached and serves build sessions over a UNIX socket, so a
+// tracked build no longer pays for compiling and attaching the probes.
+//
+// Session protocol (newline-terminated text):
+//   client -> daemon  "session <pid>"      announce the session's root PID,
+//                                          which must be the client's own
+//   daemon -> client  "ok"                 the PID can now register itself
+//   daemon -> client  "registered"         the probes track the PID
+//   daemon -> client  "<pid> <trace line>" one event of the process tree
+// The session ends when the client closes the connection.
+class TraceDaemon {
+ public:
+  TraceDaemon(std::string socket_path, std::string log_dir);
+  ~TraceDaemon();
+
+  // Serve sessions until SIGINT or SIGTERM. Returns the exit code.
+  int run();
+
+ private:
+  struct Session;
+
+  bool listen();
+  void acceptSession();
+  // Returns false once the client has disconnected.
+  bool readSession(const std::shared_ptr<Session>& session);
+  void closeSession(const std::shared_ptr<Session>& session);
+  // Drop parked lines whose PID never joined a session.
+  void expireParkedLines();
+
+  void handleTraceLine(int pid, std::string_view line);
+  // The helpers below expect |mutex_| to be held.
+  void handleTraceLineLocked(int pid, std::string_view line);
+  void routeEvent(const TraceEvent& event);
+  void mapPid(int pid, const std::shared_ptr<Session>& session);
+  void ignorePid(int pid);
+  // Queue |line| and write what the non-blocking socket takes; the poll
+  // loop writes the rest. A session whose queue outgrows its bound is
+  // dropped, so a stalled client never blocks the bpftrace reader.
+  void sendLine(Session& session, const std::string& line);
+  void flushSession(Session& session);
+
+  std::string socket_path_;
+  std::string log_dir_;
+  int listen_fd_ = -1;
+  // Wakes the poll loop when output is queued or a session is dropped.
+  int wake_pipe_[2] = {-1, -1};
+
+  std::mutex mutex_;
+  std::vector<std::shared_ptr<Session>> sessions_;
+  // PIDs of live sessions; a session's PIDs are removed when it ends.
+  std::unordered_map<int, std::shared_ptr<Session>> sessions_by_pid_;
+  // Traced PIDs no session of ours owns: processes that registered without
+  // being accepted over the socket, those left running by finished
+  // sessions, and their children. Their lines are dropped, never parked,
+  // until their exit record arrives.
+  std::unordered_set<int> ignored_pids_;
+  // Lines of PIDs whose fork record has not been decoded yet, since the
+  // first of them arrived.
+  struct ParkedLines {
+    std::chrono::steady_clock::time_point since;
+    std::vector<std::string> lines;
+  };
+  std::unordered_map<int, ParkedLines> parked_lines_;
+  size_t parked_line_count_ = 0;
+  size_t dropped_line_count_ = 0;
+  TraceEventDispatcher dispatcher_;
+};
+
+// Session side of the daemon protocol: registers the calling process and
+// receives the trace lines of its process tree.
+class TraceDaemonClient {
+ public:
+  explicit TraceDaemonClient(BpftraceStreamDecoder::LineHandler on_line);
+  ~TraceDaemonClient();
+
+  TraceDaemonClient(const TraceDaemonClient&) = delete;
+  TraceDaemonClient& operator=(const TraceDaemonClient&) = delete;
+
+  // Connect to the daemon and wait until the probes track this process.
+  bool connect(const std::string& socket_path, int timeout_ms);
+  // Wait until everything traced so far has arrived, then unregister and
+  // disconnect.
+  bool finish(int timeout_ms);
+
+ private:
+  void readLines();
+  void disconnect();
+
+  BpftraceStreamDecoder::LineHandler on_line_;
+  int fd_ = -1;
+  int pid_ = -1;
+  std::string sync_line_;
+  std::atomic<bool> disconnected_{false};
+  std::atomic<bool> sync_seen_{false};
+  OneShotEvent accepted_;
+  OneShotEvent registered_;
+  OneShotEvent synced_;
+  std::thread reader_;
+};
+
+#endif  // TRACE_DAEMON_H
@@ -0,0 +1,83 @@
+#ifndef TRACE_EVENT_H
+#define TRACE_EVENT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+enum class TraceEventType { EXEC, OPENAT, CREAT };
+
+// A traced syscall decoded from one line of a PID stream. The views point
+// into the line being dispatched and are only valid during the callback.
+struct TraceEvent {
+  TraceEventType type = TraceEventType::OPENAT;
+  int pid = -1;
+  std::string_view path;
+  std::string_view args;  // EXEC: argv after the executable, as traced
+  int flags = 0;          // OPENAT: open(2) flags
+};
+
+// Owning copy of an EXEC event for consumers that outlive the dispatch.
+struct ExecRecord {
+  int pid = -1;
+  std::string path;
+  std::string args;
+};
+
+// Decode a line such as "openat /usr/include/stdio.h 0" or
+// "execve /usr/bin/cc -c a.c". Returns false for any other line.
+bool parseTraceEvent(int pid, std::string_view line, TraceEvent& event);
+
+// Parses every trace line exactly once and fans the typed event out to the
+// consumers subscribed to its type.
+//
+// Relative opens arrive as "openat_dir <dir-id> <name> <flags>" and are
+// resolved against the "dir <dir-id> <path>" record the probe emits the
+// first time a process references that directory. Opens whose directory
+// record has not been seen yet are held back until it arrives. An "exit"
+// record drops the process's directories, so a reused PID starts afresh.
+class TraceEventDispatcher {
+ public:
+  using Subscriber = std::function<void(const TraceEvent&)>;
+
+  void subscribe(TraceEventType type, Subscriber subscriber);
+
+  void dispatch(int pid, std::string_view line);
+  void dispatch(const TraceEvent& event);
+
+  // Drop relative opens whose directory never arrived and return how many.
+  size_t finish();
+
+  size_t eventCount() const { return event_count_; }
+
+ private:
+  struct PendingOpen {
+    std::string name;
+    int flags = 0;
+  };
+
+  void forgetProcess(int pid);
+  void defineDirectory(int pid, std::string_view line);
+  void dispatchRelativeOpen(int pid, std::string_view line);
+  void dispatchResolvedOpen(int pid, const std::string& directory,
+                            std::string_view name, int flags);
+
+  std::array<std::vector<Subscriber>, 3> subscribers_;
+  size_t event_count_ = 0;
+  // Keyed by PID, then by the probe's directory id.
+  std::unordered_map<int, std::unordered_map<uint64_t, std::string>>
+      directories_;
+  std::unordered_map<int,
+                     std::unordered_map<uint64_t, std::vector<PendingOpen>>>
+      pending_opens_;
+  // Held-back opens of processes that exited before their directory came.
+  size_t dropped_opens_ = 0;
+  std::string resolved_path_;
+};
+
+#endif  // TRACE_EVENT_H
@@ -0,0 +1,46 @@
+#ifndef TRACE_RECORD_H
+#define TRACE_RECORD_H
+
+// Fixed-layout record shared by the BPF ring-buffer program
+// (src/bpf/trace.bpf.c) and its userspace consumer. Must stay valid C.
+
+#ifndef __VMLINUX_H__
+#include <linux/types.h>
+#endif
+
+#define REPROBUILD_TRACE_DIR_MAX 4096
+#define REPROBUILD_TRACE_PATH_MAX 4096
+#define REPROBUILD_TRACE_DATA_MAX \
+  (REPROBUILD_TRACE_DIR_MAX + REPROBUILD_TRACE_PATH_MAX)
+#define REPROBUILD_TRACE_ARG_MAX 256
+#define REPROBUILD_TRACE_MAX_ARGS 64
+#define REPROBUILD_TRACE_MAX_DEPTH 64
+#define REPROBUILD_TRACE_RINGBUF_SIZE (64 * 1024 * 1024)
+#define REPROBUILD_TRACE_MAX_IGNORE_PREFIXES 16
+#define REPROBUILD_TRACE_IGNORE_PREFIX_MAX 64
+
+enum reprobuild_trace_syscall {
+  REPROBUILD_SYSCALL_EXEC = 1,
+  REPROBUILD_SYSCALL_OPENAT = 2,
+  REPROBUILD_SYSCALL_CREAT = 3,
+};
+
+// data holds the (cwd-resolved) path followed, for exec records, by the
+// argv tokens each prefixed with a single space. Only the first
+// offsetof(data) + data_len bytes are written to the ring buffer.
+struct reprobuild_trace_record {
+  __u32 pid;
+  __u16 syscall;
+  __u16 path_len;
+  __s32 flags;
+  __u32 data_len;
+  char data[REPROBUILD_TRACE_DATA_MAX + REPROBUILD_TRACE_ARG_MAX];
+};
+
+// Path prefix whose creat/openat records are dropped in the kernel.
+struct reprobuild_ignore_prefix {
+  __u32 len;
+  char prefix[REPROBUILD_TRACE_IGNORE_PREFIX_MAX];
+};
+
+#endif  // TRACE_RECORD_H
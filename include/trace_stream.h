@@ -0,0 +1,90 @@
+#ifndef TRACE_STREAM_H
+#define TRACE_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Incremental decoder for the framed bpftrace output protocol.
+// Input:  PID\x80content\x80PID\x80content\x80...
+// Content fragments are appended to the stream of their PID and every
+// completed line of a PID stream is handed to the line handler as soon as
+// its newline arrives, so callers never hold the whole trace in memory.
+class BpftraceStreamDecoder {
+ public:
+  using LineHandler = std::function<void(int pid, std::string_view line)>;
+
+  explicit BpftraceStreamDecoder(LineHandler handler);
+
+  // Feed the next chunk of raw output. Records may span chunk boundaries.
+  void feed(std::string_view chunk);
+  // Flush partially received lines once the producer has exited.
+  void finish();
+
+  size_t lineCount() const { return line_count_; }
+  bool corrupted() const { return corrupted_; }
+
+ private:
+  // Returns the number of bytes of |data| consumed as complete records.
+  size_t decodeRecords(std::string_view data);
+  void appendContent(int pid, std::string_view content);
+  void emitLine(int pid, std::string_view line);
+
+  LineHandler handler_;
+  std::string pending_;  // Incomplete record carried over between chunks
+  std::unordered_map<int, std::string> partial_lines_;
+  size_t line_count_ = 0;
+  bool corrupted_ = false;
+};
+
+// Per-PID reassembly of a complete framed trace that is already in memory
+// (the log-file mode). Content fragments are recorded as spans into the
+// caller's buffer in one arena of linked fragments, so only lines that
+// span several fragments are ever copied. The scan is split into shards at
+// "\n\x80" boundaries, which always close a record, and the shards are
+// indexed in parallel without sharing state.
+class BpftraceTraceIndex {
+ public:
+  // |data| must outlive the index.
+  static BpftraceTraceIndex build(std::string_view data, size_t max_shards);
+
+  // Hand every line to |handler|, PID by PID in order of first appearance.
+  void forEachLine(const BpftraceStreamDecoder::LineHandler& handler) const;
+
+  size_t pidCount() const { return streams_.size(); }
+  size_t fragmentCount() const { return fragments_.size(); }
+
+ private:
+  static constexpr uint32_t kNoFragment = UINT32_MAX;
+
+  struct Fragment {
+    size_t offset = 0;
+    uint32_t length = 0;
+    uint32_t next = kNoFragment;
+  };
+  struct Stream {
+    int pid = 0;
+    uint32_t head = kNoFragment;
+    uint32_t tail = kNoFragment;
+  };
+  struct Shard {
+    std::vector<Fragment> fragments;
+    std::vector<Stream> streams;
+    bool stopped = false;  // hit unframed output
+  };
+
+  static Shard indexShard(std::string_view data, size_t begin, size_t end);
+  void appendShard(Shard&& shard);
+
+  std::string_view data_;
+  std::vector<Fragment> fragments_;
+  std::vector<Stream> streams_;
+  std::unordered_map<int, size_t> stream_index_;
+};
+
+#endif  // TRACE_STREAM_H
@@ -1,15 +1,21 @@
 #ifndef DEPENDENCY_TRACKER_H
 #define DEPENDENCY_TRACKER_H
 
+#include <chrono>
+#include <cstddef>
 #include <memory>
 #include <set>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
 #include "build_graph.h"
 #include "build_info.h"
 #include "build_record.h"
 #include "dependency_package.h"
+#include "trace_event.h"
+#include "trace_stream.h"
 
 struct TrackingTiming {
   long long preprocessing_ms = 0;
@@ -24,6 +30,11 @@ struct TrackingTiming {
   long long graph_total_ms = 0;
   long long postprocessing_ms = 0;
   long long total_ms = 0;
+  // Threads used for dependency resolution and for trace indexing.
+  size_t io_threads = 0;
+  size_t cpu_threads = 0;
+  // Dependency files taken from the previous record by an incremental run.
+  size_t reused_dependency_files = 0;
 };
 
 class Tracker {
@@ -35,21 +46,55 @@ class Tracker {
 
   void addIgnorePattern(const std::string& pattern);
 
+  static std::vector<std::string> defaultIgnorePatterns();
+  // Observed prefixes of the REPROBUILD_PATH_MAP in the environment.
+  static std::vector<std::string> pathMapPrefixes();
+
  private:
   std::vector<std::string> ignore_patterns_;
   std::shared_ptr<BuildInfo> build_info_;
   TrackingTiming timing_;
 
-  std::string executeWithBpftrace(const std::string& command);
-  std::string processBpftraceOutput(const std::string& raw_output);
-  std::set<std::string> parseLibFiles(const std::string& bpftrace_output);
-  std::set<std::string> parseHeaderFiles(const std::string& bpftrace_output);
-  std::set<std::string> parseExecutables(const std::string& bpftrace_output);
-  void detectBuildArtifacts(const std::string& bpftrace_output,
-                            BuildRecord& record);
+  // Candidate paths collected from the trace in a single pass. Filesystem
+  // checks and hashing happen once the build has finished.
+  struct TraceObservations {
+    std::unordered_set<std::string> opened_files;
+    std::unordered_set<std::string> created_files;
+    std::unordered_set<std::string> executed_files;
+    std::vector<ExecRecord> build_tool_execs;
+  };
+
+  std::chrono::steady_clock::time_point runBuildCommand(
+      const std::string& command,
+      std::chrono::steady_clock::time_point preprocessing_start);
+  // Ignore patterns the probes can apply before paths reach userspace.
+  std::vector<std::string> probePrefixes() const;
+  bool executeWithDaemon(const std::string& command,
+                         TraceEventDispatcher& dispatcher);
+  bool executeWithRingbuf(const std::string& command,
+                          TraceEventDispatcher& dispatcher);
+  void executeWithBpftrace(const std::string& command,
+                           const BpftraceStreamDecoder::LineHandler& on_line);
+  void processBpftraceOutput(std::string_view raw_output,
+                             const BpftraceStreamDecoder::LineHandler& on_line);
+  // resolveAll() over |paths|; incremental runs take unchanged files from
+  // the previous record and note every file in build_record_.
+  std::vector<DependencyPackage> resolveDependencyFiles(
+      const std::vector<std::string>& paths, size_t max_threads);
+  void subscribeConsumers(TraceEventDispatcher& dispatcher,
+                          TraceObservations& observations) const;
+  std::set<std::string> parseLibFiles(
+      const std::unordered_set<std::string>& opened_files);
+  std::set<std::string> parseHeaderFiles(
+      const std::unordered_set<std::string>& opened_files);
+  std::set<std::string> parseExecutables(
+      const std::unordered_set<std::string>& executed_files);
+  void detectBuildArtifacts(
+      const std::unordered_set<std::string>& created_files,
+      BuildRecord& record);
   void processCreatedFiles(const std::set<std::string>& created_files,
                            BuildRecord& record);
-  BuildGraph parseBuildGraph(const std::string& bpftrace_output);
+  BuildGraph parseBuildGraph(const std::vector<ExecRecord>& execs);
   std::string makeRelativePath(const std::string& filepath,
                                const std::string& base_dir);
   bool shouldIgnoreFile(const std::string& filepath) const;
@@ -1,17 +1,30 @@
 #ifndef UPLOADER_H
 #define UPLOADER_H
 
+#include <cstddef>
+#include <memory>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "dependency_package.h"
+#include "s3_client.h"
 
 class Uploader {
  public:
   Uploader();
 
   // Upload custom dependencies to MinIO server
-  // Each file is compressed (gzip) and uploaded with its hash as filename
+  // Each file is zipped in memory and streamed to <hash>.zip; files whose
+  // archive outgrows one part (MINIO_PART_SIZE bytes, default 8 MiB) go up
+  // as a multipart upload.
+  // Up to MINIO_UPLOAD_THREADS (default 8) files are uploaded at once over
+  // a shared pool of keep-alive connections. Which objects already exist
+  // is learned from a bucket listing, as long as it takes no more pages
+  // than there are objects to check; whatever it leaves open (or a refused
+  // listing) is checked with a HEAD per object. Objects found to exist are
+  // cached locally for MINIO_LISTING_TTL seconds (default 600, 0 disables
+  // the cache).
   // Returns number of files successfully uploaded
   int uploadCustomDependencies(
       const std::vector<DependencyPackage>& dependencies);
@@ -28,29 +41,30 @@ class Uploader {
   std::string minio_access_key_;
   std::string minio_secret_key_;
   std::string bucket_name_;
+  size_t upload_threads_;
+  size_t part_size_;
+  long long listing_ttl_seconds_;
+  std::string listing_cache_path_;
+  std::unique_ptr<S3Client> client_;
 
   // Load configuration from environment variables
   void loadConfig();
 
-  // Compress a file using gzip
-  // Returns path to compressed file, or empty string on failure
-  std::string compressFile(const std::string& file_path);
-
   // Check if a file already exists on MinIO (by hash)
   bool fileExistsOnMinio(const std::string& hash);
 
-  // Execute curl command to upload file to MinIO
-  bool uploadToMinioWithCurl(const std::string& local_file,
-                             const std::string& object_name);
-
-  // Generate RFC 1123 formatted date string
-  std::string getCurrentDateRFC1123();
-
-  // Calculate HMAC-SHA1 signature
-  std::string hmacSha1(const std::string& key, const std::string& data);
-
-  // Base64 encode
-  std::string base64Encode(const unsigned char* input, int length);
+  // Sort |wanted| into objects known to exist, added to |existing| along
+  // with the fresh cache entries, and objects the listing could not settle,
+  // left in |unresolved|; the rest are missing. Returns true if objects
+  // not in the cache were found.
+  bool findExistingObjects(const std::vector<std::string>& wanted,
+                           std::unordered_set<std::string>& existing,
+                           std::unordered_set<std::string>& unresolved,
+                           long long& listed_at);
+  bool loadListingCache(std::unordered_set<std::string>& keys,
+                        long long& listed_at) const;
+  void saveListingCache(const std::unordered_set<std::string>& keys,
+                        long long listed_at) const;
 };
 
 #endif  // UPLOADER_H
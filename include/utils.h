@@ -12,6 +12,13 @@ bool startsWith(const std::string& s, const std::string& prefix);
 bool endsWith(const std::string& s, const std::string& suffix);
 std::string executeCommand(const std::string& command);
 std::string calculateFileHash(const std::string& filepath);
+// "inode:size:mtime_ns:ctime_ns" of |filepath| after following symlinks.
+// "" if it cannot be stat'ed or changed within the last two seconds, when
+// a further write could leave the signature unchanged.
+std::string statSignature(const std::string& filepath);
+// Per-user directory for caches kept across runs: $XDG_CACHE_HOME/reprobuild
+// or ~/.cache/reprobuild, "" if neither is known. Not created here.
+std::string userCacheDir();
 std::string getCurrentTimestamp();
 std::string getArchitecture();
 std::string getDistribution();
@@ -0,0 +1,741 @@
+#include "archive_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "logger.h"
+
+#ifdef REPROBUILD_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef REPROBUILD_HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+namespace {
+const size_t kChunkSize = 1 << 16;
+const uint64_t kZip32Limit = std::numeric_limits<uint32_t>::max();
+const size_t kTarBlock = 512;
+// Largest size that fits the 11 octal digits of a ustar size field.
+const uint64_t kUstarSizeLimit = (uint64_t{1} << 33) - 1;
+
+void put16(std::string& out, uint16_t value) {
+  out += static_cast<char>(value & 0xff);
+  out += static_cast<char>(value >> 8);
+}
+
+void put32(std::string& out, uint32_t value) {
+  put16(out, static_cast<uint16_t>(value & 0xffff));
+  put16(out, static_cast<uint16_t>(value >> 16));
+}
+
+void put64(std::string& out, uint64_t value) {
+  put32(out, static_cast<uint32_t>(value & 0xffffffff));
+  put32(out, static_cast<uint32_t>(value >> 32));
+}
+
+// |value| for a 32-bit field, or the 0xffffffff marker pointing to ZIP64.
+uint32_t zip32(uint64_t value) {
+  return value >= kZip32Limit ? 0xffffffff : static_cast<uint32_t>(value);
+}
+
+void toDosTime(time_t mtime, uint16_t& dos_time, uint16_t& dos_date) {
+  struct tm local;
+  localtime_r(&mtime, &local);
+  if (local.tm_year < 80) {
+    // DOS dates start in 1980.
+    dos_time = 0;
+    dos_date = (1 << 5) | 1;
+    return;
+  }
+  dos_time = static_cast<uint16_t>((local.tm_hour << 11) |
+                                   (local.tm_min << 5) | (local.tm_sec / 2));
+  dos_date = static_cast<uint16_t>(((local.tm_year - 80) << 9) |
+                                   ((local.tm_mon + 1) << 5) | local.tm_mday);
+}
+
+// Zero-padded octal number filling |width| - 1 digits plus a NUL.
+void putOctal(char* field, size_t width, uint64_t value) {
+  for (size_t i = width - 1; i-- > 0;) {
+    field[i] = static_cast<char>('0' + (value & 7));
+    value >>= 3;
+  }
+  field[width - 1] = '\0';
+}
+
+// One "length key=value\n" pax record; the length counts itself.
+std::string paxRecord(const std::string& key, const std::string& value) {
+  const size_t base = key.size() + value.size() + 3;
+  size_t length = base + std::to_string(base).size();
+  if (std::to_string(length).size() != std::to_string(base).size()) {
+    ++length;
+  }
+  return std::to_string(length) + " " + key + "=" + value + "\n";
+}
+}  // namespace
+
+ZipWriter::ZipWriter(ArchiveSink sink, int level)
+    : sink_(std::move(sink)), level_(level) {
+  std::memset(&stream_, 0, sizeof(stream_));
+  out_buffer_.resize(kChunkSize);
+}
+
+ZipWriter::~ZipWriter() {
+  if (in_entry_) {
+    deflateEnd(&stream_);
+  }
+}
+
+bool ZipWriter::emit(std::string_view data) {
+  if (!ok_) {
+    return false;
+  }
+  if (!data.empty() && !sink_(data)) {
+    ok_ = false;
+    return false;
+  }
+  offset_ += data.size();
+  return true;
+}
+
+bool ZipWriter::beginFile(const std::string& name, time_t mtime,
+                          uint32_t mode) {
+  if (!ok_ || in_entry_) {
+    return false;
+  }
+  Entry entry{name, false, 0, 0, mode, 0, 0, 0, offset_};
+  toDosTime(mtime, entry.dos_time, entry.dos_date);
+  if (deflateInit2(&stream_, level_, Z_DEFLATED, -MAX_WBITS, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    ok_ = false;
+    return false;
+  }
+  in_entry_ = true;
+  entry.crc = crc32(0, Z_NULL, 0);
+  entries_.push_back(entry);
+
+  std::string header;
+  put32(header, 0x04034b50);
+  put16(header, 20);      // version needed: deflate
+  put16(header, 0x0008);  // sizes and CRC follow in a data descriptor
+  put16(header, 8);       // deflate
+  put16(header, entry.dos_time);
+  put16(header, entry.dos_date);
+  put32(header, 0);  // CRC
+  put32(header, 0);  // compressed size
+  put32(header, 0);  // size
+  put16(header, static_cast<uint16_t>(name.size()));
+  put16(header, 0);  // extra field length
+  header += name;
+  return emit(header);
+}
+
+bool ZipWriter::deflatePending(int flush) {
+  Entry& entry = entries_.back();
+  int result;
+  do {
+    stream_.next_out = reinterpret_cast<Bytef*>(&out_buffer_[0]);
+    stream_.avail_out = static_cast<uInt>(out_buffer_.size());
+    result = deflate(&stream_, flush);
+    if (result == Z_STREAM_ERROR) {
+      ok_ = false;
+      return false;
+    }
+    const size_t produced = out_buffer_.size() - stream_.avail_out;
+    entry.compressed_size += produced;
+    if (!emit(std::string_view(out_buffer_.data(), produced))) {
+      return false;
+    }
+  } while (stream_.avail_out == 0 ||
+           (flush == Z_FINISH && result != Z_STREAM_END));
+  return true;
+}
+
+bool ZipWriter::write(std::string_view data) {
+  if (!ok_ || !in_entry_) {
+    return false;
+  }
+  Entry& entry = entries_.back();
+  while (!data.empty()) {
+    const size_t piece = std::min<size_t>(data.size(), kChunkSize);
+    entry.crc = crc32(entry.crc, reinterpret_cast<const Bytef*>(data.data()),
+                      static_cast<uInt>(piece));
+    entry.size += piece;
+    stream_.next_in =
+        reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    stream_.avail_in = static_cast<uInt>(piece);
+    if (!deflatePending(Z_NO_FLUSH)) {
+      return false;
+    }
+    data.remove_prefix(piece);
+  }
+  return true;
+}
+
+bool ZipWriter::endFile() {
+  if (!ok_ || !in_entry_) {
+    return false;
+  }
+  const bool flushed = deflatePending(Z_FINISH);
+  deflateEnd(&stream_);
+  in_entry_ = false;
+  if (!flushed) {
+    return false;
+  }
+  const Entry& entry = entries_.back();
+
+  // Readers that stream the archive expect 8-byte sizes once they no
+  // longer fit in 4 bytes.
+  std::string descriptor;
+  put32(descriptor, 0x08074b50);
+  put32(descriptor, entry.crc);
+  if (entry.size >= kZip32Limit || entry.compressed_size >= kZip32Limit) {
+    put64(descriptor, entry.compressed_size);
+    put64(descriptor, entry.size);
+  } else {
+    put32(descriptor, static_cast<uint32_t>(entry.compressed_size));
+    put32(descriptor, static_cast<uint32_t>(entry.size));
+  }
+  return emit(descriptor);
+}
+
+bool ZipWriter::addFile(const std::string& path, const std::string& name) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logger::error("Cannot open " + path + ": " + std::strerror(errno));
+    ok_ = false;
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  bool success = beginFile(name, st.st_mtime, st.st_mode & 07777);
+  std::string buffer(kChunkSize * 4, '\0');
+  while (success) {
+    const ssize_t bytes = read(fd, &buffer[0], buffer.size());
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes < 0) {
+      Logger::error("Cannot read " + path + ": " + std::strerror(errno));
+      ok_ = false;
+      success = false;
+    } else if (bytes == 0) {
+      break;
+    } else {
+      success = write(std::string_view(buffer.data(), bytes));
+    }
+  }
+  close(fd);
+  return success && endFile();
+}
+
+bool ZipWriter::addDirectory(const std::string& name, time_t mtime,
+                             uint32_t mode) {
+  if (!ok_ || in_entry_) {
+    return false;
+  }
+  Entry entry{name, true, 0, 0, mode, 0, 0, 0, offset_};
+  toDosTime(mtime, entry.dos_time, entry.dos_date);
+  entries_.push_back(entry);
+
+  std::string header;
+  put32(header, 0x04034b50);
+  put16(header, 10);  // version needed: stored
+  put16(header, 0);
+  put16(header, 0);  // stored
+  put16(header, entry.dos_time);
+  put16(header, entry.dos_date);
+  put32(header, 0);  // CRC
+  put32(header, 0);  // compressed size
+  put32(header, 0);  // size
+  put16(header, static_cast<uint16_t>(name.size()));
+  put16(header, 0);  // extra field length
+  header += name;
+  return emit(header);
+}
+
+bool ZipWriter::finish() {
+  if (!ok_ || in_entry_) {
+    return false;
+  }
+  const uint64_t directory_offset = offset_;
+  std::string directory;
+  for (const Entry& entry : entries_) {
+    // Fields that overflow go, in this order, into a ZIP64 extra field.
+    std::string zip64;
+    if (entry.size >= kZip32Limit) {
+      put64(zip64, entry.size);
+    }
+    if (entry.compressed_size >= kZip32Limit) {
+      put64(zip64, entry.compressed_size);
+    }
+    if (entry.offset >= kZip32Limit) {
+      put64(zip64, entry.offset);
+    }
+    const uint16_t version =
+        !zip64.empty() ? 45 : entry.directory ? 10 : 20;
+
+    put32(directory, 0x02014b50);
+    put16(directory, (3 << 8) | 45);  // made by Unix, zip 4.5
+    put16(directory, version);
+    put16(directory, entry.directory ? 0 : 0x0008);
+    put16(directory, entry.directory ? 0 : 8);
+    put16(directory, entry.dos_time);
+    put16(directory, entry.dos_date);
+    put32(directory, entry.crc);
+    put32(directory, zip32(entry.compressed_size));
+    put32(directory, zip32(entry.size));
+    put16(directory, static_cast<uint16_t>(entry.name.size()));
+    put16(directory,  // extra field length
+          zip64.empty() ? 0 : static_cast<uint16_t>(zip64.size() + 4));
+    put16(directory, 0);  // comment length
+    put16(directory, 0);  // disk number
+    put16(directory, 0);  // internal attributes
+    // Unix mode in the high half; 0x10 is the MS-DOS directory bit.
+    put32(directory, (((entry.directory ? S_IFDIR : S_IFREG) | entry.mode)
+                      << 16) |
+                         (entry.directory ? 0x10 : 0));
+    put32(directory, zip32(entry.offset));
+    directory += entry.name;
+    if (!zip64.empty()) {
+      put16(directory, 0x0001);
+      put16(directory, static_cast<uint16_t>(zip64.size()));
+      directory += zip64;
+    }
+  }
+
+  const uint64_t end_offset = directory_offset + directory.size();
+  std::string end;
+  if (entries_.size() >= 0xffff || directory.size() >= kZip32Limit ||
+      directory_offset >= kZip32Limit) {
+    put32(end, 0x06064b50);  // ZIP64 end of central directory record
+    put64(end, 44);          // size of the rest of the record
+    put16(end, (3 << 8) | 45);
+    put16(end, 45);
+    put32(end, 0);  // this disk
+    put32(end, 0);  // disk with the central directory
+    put64(end, entries_.size());
+    put64(end, entries_.size());
+    put64(end, directory.size());
+    put64(end, directory_offset);
+
+    put32(end, 0x07064b50);  // ZIP64 end of central directory locator
+    put32(end, 0);           // disk with the ZIP64 record
+    put64(end, end_offset);
+    put32(end, 1);  // total disks
+  }
+  const uint16_t entry_count =
+      entries_.size() >= 0xffff ? 0xffff
+                                : static_cast<uint16_t>(entries_.size());
+  put32(end, 0x06054b50);
+  put16(end, 0);  // this disk
+  put16(end, 0);  // disk with the central directory
+  put16(end, entry_count);
+  put16(end, entry_count);
+  put32(end, zip32(directory.size()));
+  put32(end, zip32(directory_offset));
+  put16(end, 0);  // comment length
+  return emit(directory) && emit(end);
+}
+
+TarWriter::TarWriter(ArchiveSink sink) : sink_(std::move(sink)) {}
+
+bool TarWriter::emit(std::string_view data) {
+  if (!ok_) {
+    return false;
+  }
+  if (!data.empty() && !sink_(data)) {
+    ok_ = false;
+    return false;
+  }
+  return true;
+}
+
+bool TarWriter::pad(uint64_t size) {
+  const size_t remainder = size % kTarBlock;
+  if (remainder == 0) {
+    return ok_;
+  }
+  return emit(std::string(kTarBlock - remainder, '\0'));
+}
+
+bool TarWriter::writeHeader(const std::string& name, char type, uint64_t size,
+                            time_t mtime, uint32_t mode, uint32_t uid,
+                            uint32_t gid) {
+  // Anything ustar cannot hold goes into a pax extended header first.
+  std::string pax;
+  if (name.size() > 100) {
+    pax += paxRecord("path", name);
+  }
+  if (size > kUstarSizeLimit) {
+    pax += paxRecord("size", std::to_string(size));
+  }
+  if (!pax.empty()) {
+    if (!writeHeader("././@PaxHeader", 'x', pax.size(), mtime, 0644, uid,
+                     gid) ||
+        !emit(pax) || !pad(pax.size())) {
+      return false;
+    }
+  }
+
+  char header[kTarBlock];
+  std::memset(header, 0, sizeof(header));
+  std::memcpy(header, name.data(), std::min<size_t>(name.size(), 100));
+  putOctal(header + 100, 8, mode & 07777);
+  putOctal(header + 108, 8, uid & 07777777);
+  putOctal(header + 116, 8, gid & 07777777);
+  putOctal(header + 124, 12, std::min(size, kUstarSizeLimit));
+  putOctal(header + 136, 12, static_cast<uint64_t>(std::max<time_t>(mtime, 0)));
+  header[156] = type;
+  std::memcpy(header + 257, "ustar", 6);
+  std::memcpy(header + 263, "00", 2);
+
+  // The checksum is computed with its own field set to spaces.
+  std::memset(header + 148, ' ', 8);
+  unsigned int checksum = 0;
+  for (unsigned char byte : header) {
+    checksum += byte;
+  }
+  putOctal(header + 148, 7, checksum);
+  header[155] = ' ';
+  return emit(std::string_view(header, sizeof(header)));
+}
+
+bool TarWriter::addDirectory(const std::string& name, const struct stat& st) {
+  return writeHeader(name.back() == '/' ? name : name + "/", '5', 0,
+                     st.st_mtime, st.st_mode, st.st_uid, st.st_gid);
+}
+
+bool TarWriter::addFile(const std::string& path, const std::string& name) {
+  if (!ok_) {
+    return false;
+  }
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logger::error("Cannot open " + path + ": " + std::strerror(errno));
+    ok_ = false;
+    return false;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  const uint64_t size = static_cast<uint64_t>(st.st_size);
+  bool success = writeHeader(name, '0', size, st.st_mtime, st.st_mode,
+                             st.st_uid, st.st_gid);
+
+  // The header already promised |size| bytes: stop there if the file grows
+  // and pad with zeros if it shrinks, so the archive stays well-formed.
+  std::string buffer(kChunkSize * 4, '\0');
+  uint64_t remaining = size;
+  while (success && remaining > 0) {
+    const ssize_t bytes = read(fd, &buffer[0],
+                               std::min<uint64_t>(buffer.size(), remaining));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes < 0) {
+      Logger::error("Cannot read " + path + ": " + std::strerror(errno));
+      ok_ = false;
+      success = false;
+    } else if (bytes == 0) {
+      Logger::warn("File shrank while archiving: " + path);
+      std::fill(buffer.begin(), buffer.end(), '\0');
+      while (success && remaining > 0) {
+        const size_t piece = std::min<uint64_t>(buffer.size(), remaining);
+        success = emit(std::string_view(buffer.data(), piece));
+        remaining -= piece;
+      }
+    } else {
+      success = emit(std::string_view(buffer.data(), bytes));
+      remaining -= static_cast<uint64_t>(bytes);
+    }
+  }
+  close(fd);
+  return success && pad(size);
+}
+
+bool TarWriter::addData(const std::string& name, std::string_view data,
+                        time_t mtime, uint32_t mode) {
+  return writeHeader(name, '0', data.size(), mtime, mode, getuid(),
+                     getgid()) &&
+         emit(data) && pad(data.size());
+}
+
+bool TarWriter::finish() { return emit(std::string(2 * kTarBlock, '\0')); }
+
+namespace {
+class GzipCompressor : public StreamCompressor {
+ public:
+  explicit GzipCompressor(ArchiveSink sink) : sink_(std::move(sink)) {
+    std::memset(&stream_, 0, sizeof(stream_));
+    // 16 added to the window bits selects the gzip wrapper.
+    ok_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                       MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    out_buffer_.resize(kChunkSize);
+  }
+  ~GzipCompressor() override { deflateEnd(&stream_); }
+
+  bool write(std::string_view data) override {
+    while (ok_ && !data.empty()) {
+      const size_t piece = std::min<size_t>(data.size(), kChunkSize);
+      stream_.next_in =
+          reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+      stream_.avail_in = static_cast<uInt>(piece);
+      run(Z_NO_FLUSH);
+      data.remove_prefix(piece);
+    }
+    return ok_;
+  }
+
+  bool finish() override { return ok_ && run(Z_FINISH); }
+
+ private:
+  bool run(int flush) {
+    int result;
+    do {
+      stream_.next_out = reinterpret_cast<Bytef*>(&out_buffer_[0]);
+      stream_.avail_out = static_cast<uInt>(out_buffer_.size());
+      result = deflate(&stream_, flush);
+      const size_t produced = out_buffer_.size() - stream_.avail_out;
+      if (result == Z_STREAM_ERROR ||
+          (produced > 0 &&
+           !sink_(std::string_view(out_buffer_.data(), produced)))) {
+        ok_ = false;
+        return false;
+      }
+    } while (stream_.avail_out == 0 ||
+             (flush == Z_FINISH && result != Z_STREAM_END));
+    return true;
+  }
+
+  ArchiveSink sink_;
+  z_stream stream_;
+  std::string out_buffer_;
+  bool ok_;
+};
+
+#ifdef REPROBUILD_HAVE_LZMA
+class XzCompressor : public StreamCompressor {
+ public:
+  explicit XzCompressor(ArchiveSink sink) : sink_(std::move(sink)) {
+    ok_ = lzma_easy_encoder(&stream_, LZMA_PRESET_DEFAULT,
+                            LZMA_CHECK_CRC64) == LZMA_OK;
+    out_buffer_.resize(kChunkSize);
+  }
+  ~XzCompressor() override { lzma_end(&stream_); }
+
+  bool write(std::string_view data) override {
+    stream_.next_in = reinterpret_cast<const uint8_t*>(data.data());
+    stream_.avail_in = data.size();
+    while (ok_ && stream_.avail_in > 0) {
+      run(LZMA_RUN);
+    }
+    return ok_;
+  }
+
+  bool finish() override {
+    while (ok_ && run(LZMA_FINISH) != LZMA_STREAM_END) {
+    }
+    return ok_;
+  }
+
+ private:
+  lzma_ret run(lzma_action action) {
+    stream_.next_out = reinterpret_cast<uint8_t*>(&out_buffer_[0]);
+    stream_.avail_out = out_buffer_.size();
+    const lzma_ret result = lzma_code(&stream_, action);
+    const size_t produced = out_buffer_.size() - stream_.avail_out;
+    if ((result != LZMA_OK && result != LZMA_STREAM_END) ||
+        (produced > 0 &&
+         !sink_(std::string_view(out_buffer_.data(), produced)))) {
+      ok_ = false;
+    }
+    return result;
+  }
+
+  ArchiveSink sink_;
+  lzma_stream stream_ = LZMA_STREAM_INIT;
+  std::string out_buffer_;
+  bool ok_;
+};
+#endif
+
+#ifdef REPROBUILD_HAVE_BZIP2
+class Bzip2Compressor : public StreamCompressor {
+ public:
+  explicit Bzip2Compressor(ArchiveSink sink) : sink_(std::move(sink)) {
+    std::memset(&stream_, 0, sizeof(stream_));
+    ok_ = BZ2_bzCompressInit(&stream_, 9, 0, 0) == BZ_OK;
+    out_buffer_.resize(kChunkSize);
+  }
+  ~Bzip2Compressor() override { BZ2_bzCompressEnd(&stream_); }
+
+  bool write(std::string_view data) override {
+    while (ok_ && !data.empty()) {
+      const size_t piece = std::min<size_t>(data.size(), kChunkSize);
+      stream_.next_in = const_cast<char*>(data.data());
+      stream_.avail_in = static_cast<unsigned int>(piece);
+      while (ok_ && stream_.avail_in > 0) {
+        run(BZ_RUN);
+      }
+      data.remove_prefix(piece);
+    }
+    return ok_;
+  }
+
+  bool finish() override {
+    while (ok_ && run(BZ_FINISH) != BZ_STREAM_END) {
+    }
+    return ok_;
+  }
+
+ private:
+  int run(int action) {
+    stream_.next_out = &out_buffer_[0];
+    stream_.avail_out = static_cast<unsigned int>(out_buffer_.size());
+    const int result = BZ2_bzCompress(&stream_, action);
+    const size_t produced = out_buffer_.size() - stream_.avail_out;
+    if (result < 0 || (produced > 0 && !sink_(std::string_view(
+                                           out_buffer_.data(), produced)))) {
+      ok_ = false;
+    }
+    return result;
+  }
+
+  ArchiveSink sink_;
+  bz_stream stream_;
+  std::string out_buffer_;
+  bool ok_;
+};
+#endif
+}  // namespace
+
+std::unique_ptr<StreamCompressor> StreamCompressor::create(
+    const std::string& format, ArchiveSink sink) {
+  if (format == "gz") {
+    return std::make_unique<GzipCompressor>(std::move(sink));
+  }
+#ifdef REPROBUILD_HAVE_LZMA
+  if (format == "xz") {
+    return std::make_unique<XzCompressor>(std::move(sink));
+  }
+#endif
+#ifdef REPROBUILD_HAVE_BZIP2
+  if (format == "bz2") {
+    return std::make_unique<Bzip2Compressor>(std::move(sink));
+  }
+#endif
+  return nullptr;
+}
+
+bool StreamCompressor::supports(const std::string& format) {
+  return create(format, nullptr) != nullptr;
+}
+
+size_t ParallelCompressor::defaultBlockSize(const std::string& format) {
+  if (format == "xz") {
+    return 8 << 20;
+  }
+  if (format == "bz2") {
+    return 900000;
+  }
+  return 1 << 20;
+}
+
+ParallelCompressor::ParallelCompressor(std::string format, ArchiveSink sink,
+                                       size_t threads, size_t block_size)
+    : format_(std::move(format)),
+      sink_(std::move(sink)),
+      block_size_(block_size > 0 ? block_size : defaultBlockSize(format_)),
+      max_pending_(2 * std::max<size_t>(threads, 1)),
+      pool_(std::make_unique<ThreadPool>(std::max<size_t>(threads, 1))) {
+  block_.reserve(block_size_);
+}
+
+ParallelCompressor::~ParallelCompressor() {
+  // Let queued blocks run out before the pool is torn down.
+  for (auto& block : pending_) {
+    block.wait();
+  }
+}
+
+void ParallelCompressor::submitBlock() {
+  std::string input;
+  input.swap(block_);
+  block_.reserve(block_size_);
+  ++blocks_;
+  pending_.push_back(pool_->enqueue(
+      [this, format = format_](const std::string& data) {
+        const auto start = std::chrono::steady_clock::now();
+        std::string output;
+        auto compressor =
+            StreamCompressor::create(format, [&output](std::string_view out) {
+              output.append(out);
+              return true;
+            });
+        if (!compressor || !compressor->write(data) || !compressor->finish()) {
+          throw std::runtime_error("Cannot compress " + format + " block");
+        }
+        compress_us_.fetch_add(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count());
+        return output;
+      },
+      std::move(input)));
+}
+
+bool ParallelCompressor::emitOldest() {
+  std::future<std::string> block = std::move(pending_.front());
+  pending_.pop_front();
+  const auto start = std::chrono::steady_clock::now();
+  std::string output;
+  try {
+    output = block.get();
+  } catch (const std::exception& e) {
+    Logger::error(e.what());
+    ok_ = false;
+    return false;
+  }
+  wait_us_ += std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  if (!sink_(output)) {
+    ok_ = false;
+  }
+  return ok_;
+}
+
+bool ParallelCompressor::write(std::string_view data) {
+  while (ok_ && !data.empty()) {
+    const size_t piece =
+        std::min(data.size(), block_size_ - block_.size());
+    block_.append(data.data(), piece);
+    data.remove_prefix(piece);
+    if (block_.size() == block_size_) {
+      submitBlock();
+      while (ok_ && pending_.size() > max_pending_) {
+        emitOldest();
+      }
+    }
+  }
+  return ok_;
+}
+
+bool ParallelCompressor::finish() {
+  // An empty input still needs one (empty) stream to be a valid file.
+  if (ok_ && (!block_.empty() || blocks_ == 0)) {
+    submitBlock();
+  }
+  while (ok_ && !pending_.empty()) {
+    emitOldest();
+  }
+  return ok_;
+}
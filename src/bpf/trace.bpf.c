@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: GPL-2.0
+// Ring-buffer tracing backend: emits one fixed-layout record per traced
+// exec/openat/creat into a BPF ring buffer consumed by RingbufTracer.
+
+#include "vmlinux.h"
+
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+
+#include "trace_record.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+#define DATA_MASK (REPROBUILD_TRACE_DATA_MAX - 1)
+#define DIR_MASK (REPROBUILD_TRACE_DIR_MAX - 1)
+#define NAME_MASK 255
+#define AT_FDCWD -100
+#define O_CREAT 0100
+
+// Filters filled in by userspace before the program is loaded.
+const volatile __u32 ignore_prefix_count = 0;
+const volatile struct reprobuild_ignore_prefix
+    ignore_prefixes[REPROBUILD_TRACE_MAX_IGNORE_PREFIXES] = {};
+// openat calls with any of these flags set and without O_CREAT are skipped
+// (O_DIRECTORY: directory handles are never dependencies).
+const volatile __s32 skipped_open_flags = 0;
+
+// Processes whose syscalls are recorded. Userspace inserts the root PID;
+// children are added on fork.
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 65536);
+  __type(key, __u32);
+  __type(value, __u8);
+} tracked SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, REPROBUILD_TRACE_RINGBUF_SIZE);
+} events SEC(".maps");
+
+// Records that did not fit into the ring buffer.
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, __u64);
+} dropped SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, struct reprobuild_trace_record);
+} record_scratch SEC(".maps");
+
+struct dir_buffer {
+  char data[REPROBUILD_TRACE_DIR_MAX + NAME_MASK + 1];
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, __u32);
+  __type(value, struct dir_buffer);
+} dir_scratch SEC(".maps");
+
+static __always_inline int current_is_tracked(__u32 *tgid) {
+  *tgid = bpf_get_current_pid_tgid() >> 32;
+  return bpf_map_lookup_elem(&tracked, tgid) != NULL;
+}
+
+static __always_inline struct reprobuild_trace_record *new_record(
+    __u32 tgid, __u16 syscall, __s32 flags) {
+  __u32 zero = 0;
+  struct reprobuild_trace_record *rec =
+      bpf_map_lookup_elem(&record_scratch, &zero);
+  if (!rec) {
+    return NULL;
+  }
+  rec->pid = tgid;
+  rec->syscall = syscall;
+  rec->flags = flags;
+  rec->path_len = 0;
+  rec->data_len = 0;
+  return rec;
+}
+
+static __always_inline void submit(struct reprobuild_trace_record *rec) {
+  __u64 size = __builtin_offsetof(struct reprobuild_trace_record, data) +
+               (rec->data_len & DATA_MASK);
+  if (bpf_ringbuf_output(&events, rec, size, 0) != 0) {
+    __u32 zero = 0;
+    __u64 *count = bpf_map_lookup_elem(&dropped, &zero);
+    if (count) {
+      *count += 1;
+    }
+  }
+}
+
+// Directory a relative path passed with |dfd| is looked up in: the cwd for
+// AT_FDCWD, otherwise the dentry behind the descriptor.
+static __always_inline struct dentry *lookup_base_dir(int dfd) {
+  struct task_struct *task = (struct task_struct *)bpf_get_current_task();
+  if (dfd == AT_FDCWD) {
+    return BPF_CORE_READ(task, fs, pwd.dentry);
+  }
+  if (dfd < 0) {
+    return NULL;
+  }
+
+  struct fdtable *fdt = BPF_CORE_READ(task, files, fdt);
+  if (!fdt || (unsigned int)dfd >= BPF_CORE_READ(fdt, max_fds)) {
+    return NULL;
+  }
+  struct file **fds = BPF_CORE_READ(fdt, fd);
+  struct file *file = NULL;
+  bpf_probe_read_kernel(&file, sizeof(file), &fds[dfd]);
+  if (!file) {
+    return NULL;
+  }
+  return BPF_CORE_READ(file, f_path.dentry);
+}
+
+// Write the path of |dentry| into rec->data (without a trailing slash) and
+// return its length. Like the bpftrace probe, the walk stops at the root
+// of the mount that contains the directory.
+static __always_inline __u32 write_dir(struct reprobuild_trace_record *rec,
+                                       struct dentry *dentry) {
+  __u32 zero = 0;
+  struct dir_buffer *dir = bpf_map_lookup_elem(&dir_scratch, &zero);
+  if (!dir) {
+    return 0;
+  }
+
+  // Components are written right to left so that one upward walk is enough.
+  __u32 off = REPROBUILD_TRACE_DIR_MAX;
+  for (int i = 0; i < REPROBUILD_TRACE_MAX_DEPTH; i++) {
+    struct dentry *parent = BPF_CORE_READ(dentry, d_parent);
+    if (!parent || dentry == parent) {
+      break;
+    }
+    __u32 len = BPF_CORE_READ(dentry, d_name.len) & NAME_MASK;
+    const unsigned char *name = BPF_CORE_READ(dentry, d_name.name);
+    if (len + 2 >= off) {
+      break;
+    }
+    off -= len;
+    bpf_probe_read_kernel(&dir->data[off & DIR_MASK], len, name);
+    off -= 1;
+    dir->data[off & DIR_MASK] = '/';
+    dentry = parent;
+  }
+
+  __u32 dir_len = (REPROBUILD_TRACE_DIR_MAX - off) & DIR_MASK;
+  bpf_probe_read_kernel(rec->data, dir_len, &dir->data[off & DIR_MASK]);
+  return dir_len;
+}
+
+// Record |filename|, resolving relative names against |dfd| when
+// |resolve_relative| is set. Names whose base directory cannot be found
+// are recorded as passed.
+static __always_inline void record_path(struct reprobuild_trace_record *rec,
+                                        const char *filename,
+                                        int resolve_relative, int dfd) {
+  __u32 off = 0;
+  char first = 0;
+  bpf_probe_read_user(&first, sizeof(first), filename);
+  if (resolve_relative && first != '/') {
+    struct dentry *base = lookup_base_dir(dfd);
+    if (base) {
+      off = write_dir(rec, base);
+      rec->data[off & DATA_MASK] = '/';
+      off += 1;
+    }
+  }
+
+  long len = bpf_probe_read_user_str(&rec->data[off & DIR_MASK],
+                                     REPROBUILD_TRACE_PATH_MAX, filename);
+  if (len > 0) {
+    off += len - 1;
+  }
+  if (off > REPROBUILD_TRACE_PATH_MAX - 1) {
+    off = REPROBUILD_TRACE_PATH_MAX - 1;
+  }
+  rec->path_len = off;
+  rec->data_len = off;
+}
+
+static __always_inline int is_ignored(struct reprobuild_trace_record *rec) {
+  if (rec->data[0] != '/') {
+    return 0;
+  }
+  for (__u32 i = 0; i < REPROBUILD_TRACE_MAX_IGNORE_PREFIXES; i++) {
+    if (i >= ignore_prefix_count) {
+      break;
+    }
+    __u32 len = ignore_prefixes[i].len;
+    if (len == 0 || len > rec->path_len) {
+      continue;
+    }
+    int match = 1;
+    for (__u32 j = 0; j < REPROBUILD_TRACE_IGNORE_PREFIX_MAX; j++) {
+      if (j >= len) {
+        break;
+      }
+      if (rec->data[j] != ignore_prefixes[i].prefix[j]) {
+        match = 0;
+        break;
+      }
+    }
+    if (match) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static __always_inline void record_args(struct reprobuild_trace_record *rec,
+                                        const char *const *argv) {
+  __u32 off = rec->data_len;
+  for (int i = 1; i < REPROBUILD_TRACE_MAX_ARGS; i++) {
+    const char *arg = NULL;
+    if (bpf_probe_read_user(&arg, sizeof(arg), &argv[i]) != 0 || !arg) {
+      break;
+    }
+    if (off >= REPROBUILD_TRACE_DATA_MAX - REPROBUILD_TRACE_ARG_MAX - 1) {
+      break;
+    }
+    rec->data[off & DATA_MASK] = ' ';
+    off += 1;
+    long len = bpf_probe_read_user_str(&rec->data[off & DATA_MASK],
+                                       REPROBUILD_TRACE_ARG_MAX, arg);
+    if (len <= 0) {
+      break;
+    }
+    off += len - 1;
+  }
+  rec->data_len = off;
+}
+
+static __always_inline int trace_exec(const char *filename,
+                                      const char *const *argv) {
+  __u32 tgid;
+  if (!current_is_tracked(&tgid)) {
+    return 0;
+  }
+  struct reprobuild_trace_record *rec =
+      new_record(tgid, REPROBUILD_SYSCALL_EXEC, 0);
+  if (!rec) {
+    return 0;
+  }
+  // Exec paths are reported as passed, like the bpftrace probe does.
+  record_path(rec, filename, 0, AT_FDCWD);
+  record_args(rec, argv);
+  submit(rec);
+  return 0;
+}
+
+SEC("tracepoint/sched/sched_process_fork")
+int handle_fork(struct trace_event_raw_sched_process_fork *ctx) {
+  __u32 parent = ctx->parent_pid;
+  if (!bpf_map_lookup_elem(&tracked, &parent)) {
+    return 0;
+  }
+  __u32 child = ctx->child_pid;
+  __u8 one = 1;
+  bpf_map_update_elem(&tracked, &child, &one, BPF_ANY);
+  return 0;
+}
+
+SEC("tracepoint/sched/sched_process_exit")
+int handle_exit(struct trace_event_raw_sched_process_template *ctx) {
+  __u32 tid = (__u32)bpf_get_current_pid_tgid();
+  bpf_map_delete_elem(&tracked, &tid);
+  return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_execve")
+int handle_execve(struct trace_event_raw_sys_enter *ctx) {
+  return trace_exec((const char *)ctx->args[0],
+                    (const char *const *)ctx->args[1]);
+}
+
+SEC("tracepoint/syscalls/sys_enter_execveat")
+int handle_execveat(struct trace_event_raw_sys_enter *ctx) {
+  return trace_exec((const char *)ctx->args[1],
+                    (const char *const *)ctx->args[2]);
+}
+
+SEC("tracepoint/syscalls/sys_enter_creat")
+int handle_creat(struct trace_event_raw_sys_enter *ctx) {
+  __u32 tgid;
+  if (!current_is_tracked(&tgid)) {
+    return 0;
+  }
+  struct reprobuild_trace_record *rec =
+      new_record(tgid, REPROBUILD_SYSCALL_CREAT, 0);
+  if (!rec) {
+    return 0;
+  }
+  record_path(rec, (const char *)ctx->args[0], 1, AT_FDCWD);
+  if (!is_ignored(rec)) {
+    submit(rec);
+  }
+  return 0;
+}
+
+SEC("tracepoint/syscalls/sys_enter_openat")
+int handle_openat(struct trace_event_raw_sys_enter *ctx) {
+  __u32 tgid;
+  if (!current_is_tracked(&tgid)) {
+    return 0;
+  }
+  __s32 flags = (__s32)ctx->args[2];
+  if ((flags & skipped_open_flags) != 0 && (flags & O_CREAT) == 0) {
+    return 0;
+  }
+  struct reprobuild_trace_record *rec =
+      new_record(tgid, REPROBUILD_SYSCALL_OPENAT, flags);
+  if (!rec) {
+    return 0;
+  }
+  record_path(rec, (const char *)ctx->args[1], 1, (int)ctx->args[0]);
+  if (!is_ignored(rec)) {
+    submit(rec);
+  }
+  return 0;
+}
@@ -0,0 +1,383 @@
+#include "bpftrace_process.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+
+#include "bpftrace_script.h"
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+// REPROBUILD_BPFTRACE replaces this command, e.g. for another bpftrace
+// build or a stand-in in tests.
+const char* const kBpftraceCommand = "sudo bpftrace0.24";
+const char* const kSyncMarkerPrefix = "/.reprobuild_sync_";
+
+const char* const kPidPlaceholder = "$pid = *;";
+const char* const kPathFiltersPlaceholder = "// @PATH_FILTERS@";
+const char* const kOpenFlagFiltersPlaceholder = "// @OPEN_FLAG_FILTERS@";
+
+const int kStreamPollInterval = 100;
+
+const int kReapPollInterval = 10;
+
+// Streaming reads bpftrace stdout through a pipe in chunks of this size.
+const size_t kStreamReadBufferSize = 256 * 1024;
+
+// Replace every occurrence of |placeholder|; continuation lines of
+// |replacement| get the placeholder's indentation.
+void replaceAll(std::string& text, const std::string& placeholder,
+                const std::string& replacement) {
+  size_t pos = 0;
+  while ((pos = text.find(placeholder, pos)) != std::string::npos) {
+    const size_t line_start = text.rfind('\n', pos) + 1;
+    const std::string indent = "\n" + text.substr(line_start, pos - line_start);
+    std::string indented = replacement;
+    for (size_t nl = indented.find('\n'); nl != std::string::npos;
+         nl = indented.find('\n', nl + indent.size())) {
+      indented.replace(nl, 1, indent);
+    }
+    text.replace(pos, placeholder.size(), indented);
+    pos += indented.size();
+  }
+}
+
+// bpftrace statements dropping $path when it starts with one of |prefixes|.
+std::string bpftracePathFilters(const std::vector<std::string>& prefixes) {
+  std::string filters;
+  for (const auto& prefix : prefixes) {
+    if (!filters.empty()) {
+      filters += '\n';
+    }
+    filters += "if (strncmp($path, \"" + prefix + "\", " +
+               std::to_string(prefix.size()) + ") == 0) { return; }";
+  }
+  return filters;
+}
+
+// Run |shell_command| through /bin/sh with its stderr connected to a pipe
+// whose read end is stored in |stderr_fd|. If |stdout_fd| is given, stdout
+// is piped as well. Returns the child PID.
+pid_t spawnWithPipes(const std::string& shell_command, int* stdout_fd,
+                     int& stderr_fd) {
+  int out_fds[2] = {-1, -1};
+  int err_fds[2];
+  if (pipe2(err_fds, O_CLOEXEC) != 0) {
+    return -1;
+  }
+  if (stdout_fd && pipe2(out_fds, O_CLOEXEC) != 0) {
+    close(err_fds[0]);
+    close(err_fds[1]);
+    return -1;
+  }
+
+  const pid_t child = fork();
+  if (child < 0) {
+    for (int fd : {out_fds[0], out_fds[1], err_fds[0], err_fds[1]}) {
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+    return -1;
+  }
+
+  if (child == 0) {
+    if (stdout_fd) {
+      dup2(out_fds[1], STDOUT_FILENO);
+    }
+    dup2(err_fds[1], STDERR_FILENO);
+    execl("/bin/sh", "sh", "-c", shell_command.c_str(),
+          static_cast<char*>(nullptr));
+    _exit(127);
+  }
+
+  close(err_fds[1]);
+  stderr_fd = err_fds[0];
+  if (stdout_fd) {
+    close(out_fds[1]);
+    *stdout_fd = out_fds[0];
+  }
+  return child;
+}
+
+// Copy bpftrace's stderr into |log_path| until EOF, or until |abandon| is
+// raised. |attached| is raised when bpftrace reports its probes as
+// attached; |ready| is set then, or at the end if bpftrace exits first.
+void watchStderr(int fd, const std::string& log_path,
+                 std::atomic<bool>& attached, OneShotEvent& ready,
+                 const std::atomic<bool>& abandon) {
+  std::ofstream log_file(log_path);
+  std::string line;
+  char buffer[4096];
+  pollfd pfd{fd, POLLIN, 0};
+  while (!abandon) {
+    const int polled = poll(&pfd, 1, kStreamPollInterval);
+    if (polled < 0 && errno != EINTR) {
+      break;
+    }
+    if (polled <= 0) {
+      continue;
+    }
+    const ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    log_file.write(buffer, bytes_read);
+    log_file.flush();
+    for (ssize_t i = 0; i < bytes_read; ++i) {
+      if (buffer[i] != '\n') {
+        line.push_back(buffer[i]);
+        continue;
+      }
+      if (!attached && line.find("Attached") != std::string::npos) {
+        Logger::debug("Bpftrace attached: " + line);
+        attached = true;
+        ready.set();
+      }
+      line.clear();
+    }
+  }
+  close(fd);
+  ready.set();
+}
+
+// Reap |pid| if it exits within |timeout_ms|.
+bool reapWithin(pid_t pid, int timeout_ms) {
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+  while (true) {
+    const pid_t result = waitpid(pid, nullptr, WNOHANG);
+    if (result == pid || (result < 0 && errno != EINTR)) {
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    usleep(kReapPollInterval * 1000);
+  }
+}
+
+// Feed everything readable from |fd| into |decoder| until EOF, or until
+// |abandon| is raised by a caller that can no longer expect EOF.
+void readStream(int fd, BpftraceStreamDecoder& decoder,
+                const std::atomic<bool>& abandon) {
+  std::vector<char> buffer(kStreamReadBufferSize);
+  pollfd pfd{fd, POLLIN, 0};
+  while (!abandon) {
+    const int ready = poll(&pfd, 1, kStreamPollInterval);
+    if (ready < 0 && errno != EINTR) {
+      Logger::warn("Failed to poll bpftrace output: " +
+                   std::string(std::strerror(errno)));
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+
+    const ssize_t bytes_read = read(fd, buffer.data(), buffer.size());
+    if (bytes_read == 0) {
+      break;  // bpftrace exited and closed its stdout
+    }
+    if (bytes_read < 0) {
+      if (errno == EINTR || errno == EAGAIN) {
+        continue;
+      }
+      Logger::warn("Failed to read bpftrace output: " +
+                   std::string(std::strerror(errno)));
+      break;
+    }
+    decoder.feed(
+        std::string_view(buffer.data(), static_cast<size_t>(bytes_read)));
+  }
+  close(fd);
+}
+}  // namespace
+
+std::string renderBpftraceScript(pid_t root_pid,
+                                 const std::vector<std::string>& ignore_prefixes,
+                                 const std::string& extra_probes) {
+  std::string script = BpftraceScript::SCRIPT_TEMPLATE;
+
+  const size_t placeholder_pos = script.find(kPidPlaceholder);
+  if (placeholder_pos != std::string::npos) {
+    script.replace(placeholder_pos, strlen(kPidPlaceholder),
+                   "$pid = " + std::to_string(root_pid) + ";");
+  } else {
+    Logger::warn("Could not find PID placeholder in bpftrace script");
+  }
+
+  // Drop ignored paths and directory handles before they are printed.
+  replaceAll(script, kPathFiltersPlaceholder,
+             bpftracePathFilters(ignore_prefixes));
+  replaceAll(script, kOpenFlagFiltersPlaceholder,
+             "if ((args->flags & " + std::to_string(O_DIRECTORY) +
+                 ") != 0 && (args->flags & " + std::to_string(O_CREAT) +
+                 ") == 0) { return; }");
+
+  return script + extra_probes;
+}
+
+std::vector<std::string> probeIgnorePrefixes(
+    const std::vector<std::string>& ignore_patterns,
+    const std::vector<std::string>& observed_prefixes) {
+  auto overlaps_path_map = [&](const std::string& pattern) {
+    for (const auto& observed : observed_prefixes) {
+      const std::string directory =
+          observed.back() == '/' ? observed : observed + "/";
+      if (Utils::startsWith(directory, pattern) ||
+          Utils::startsWith(pattern, directory)) {
+        return true;
+      }
+    }
+    return false;
+  };
+  std::vector<std::string> prefixes;
+  for (const auto& pattern : ignore_patterns) {
+    if (pattern.size() < 2 || pattern[0] != '/' ||
+        pattern.find_first_of("\"\\%") != std::string::npos ||
+        overlaps_path_map(pattern)) {
+      continue;
+    }
+    prefixes.push_back(pattern);
+  }
+  return prefixes;
+}
+
+std::string syncMarkerPath(pid_t pid) {
+  return kSyncMarkerPrefix + std::to_string(pid);
+}
+
+void touchMarker(const std::string& path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void OneShotEvent::set() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    set_ = true;
+  }
+  cv_.notify_all();
+}
+
+bool OneShotEvent::waitFor(int timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                      [this]() { return set_; });
+}
+
+BpftraceProcess::~BpftraceProcess() { stop(); }
+
+bool BpftraceProcess::start(const std::string& script,
+                            const std::string& script_path,
+                            const std::string& stderr_log,
+                            BpftraceStreamDecoder* decoder,
+                            const std::string& stdout_log) {
+  {
+    std::ofstream script_file(script_path);
+    if (!script_file.is_open()) {
+      Logger::error("Failed to create temporary bpftrace script: " +
+                    script_path);
+      return false;
+    }
+    script_file << script;
+  }  // File auto-closed by RAII
+
+  const char* command_env = std::getenv("REPROBUILD_BPFTRACE");
+  const std::string command =
+      command_env && command_env[0] != '\0' ? command_env : kBpftraceCommand;
+  std::string bpftrace_cmd = "exec " + command + " " + script_path;
+  if (!decoder) {
+    bpftrace_cmd += " > " + stdout_log;
+  }
+  Logger::debug("Starting bpftrace: " + bpftrace_cmd);
+
+  int stdout_fd = -1;
+  int stderr_fd = -1;
+  pid_ = spawnWithPipes(bpftrace_cmd, decoder ? &stdout_fd : nullptr,
+                        stderr_fd);
+  if (pid_ < 0) {
+    Logger::warn("Failed to start bpftrace: " +
+                 std::string(std::strerror(errno)));
+    return false;
+  }
+
+  stderr_log_ = stderr_log;
+  stderr_watcher_ = std::thread([this, stderr_fd]() {
+    watchStderr(stderr_fd, stderr_log_, attached_, ready_, abandon_reader_);
+  });
+  if (decoder) {
+    reader_ = std::thread([this, decoder, stdout_fd]() {
+      readStream(stdout_fd, *decoder, abandon_reader_);
+    });
+  }
+  return true;
+}
+
+bool BpftraceProcess::waitAttached(int timeout_ms) {
+  if (pid_ < 0) {
+    return false;
+  }
+  if (!ready_.waitFor(timeout_ms)) {
+    Logger::warn("Timeout waiting for bpftrace to attach");
+    return false;
+  }
+  if (!attached_) {
+    Logger::warn("Bpftrace exited before attaching, see " + stderr_log_);
+    return false;
+  }
+  return true;
+}
+
+void BpftraceProcess::stop(int timeout_ms) {
+  if (pid_ < 0) {
+    return;
+  }
+
+  Logger::debug("Stopping bpftrace PID " + std::to_string(pid_));
+  if (kill(pid_, SIGINT) == 0 || errno == ESRCH) {
+    Logger::debug("Successfully sent SIGINT to bpftrace");
+  } else {
+    // Without a signal bpftrace never closes the pipe, so stop reading.
+    Logger::warn("Failed to send SIGINT to bpftrace: " +
+                 std::string(std::strerror(errno)));
+    abandon_reader_ = true;
+  }
+
+  // bpftrace flushes its output before exiting, so the process being
+  // reaped and the pipe reaching EOF mean the trace is complete. One stuck
+  // (say, while detaching probes) is terminated and then killed; a killed
+  // sudo leaves bpftrace holding the pipes, so reading stops there.
+  if (!reapWithin(pid_, timeout_ms)) {
+    Logger::warn("Bpftrace did not exit after SIGINT, terminating it");
+    kill(pid_, SIGTERM);
+    if (!reapWithin(pid_, timeout_ms)) {
+      Logger::warn("Bpftrace did not exit after SIGTERM, killing it");
+      kill(pid_, SIGKILL);
+      waitpid(pid_, nullptr, 0);
+      abandon_reader_ = true;
+    }
+  }
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+  if (stderr_watcher_.joinable()) {
+    stderr_watcher_.join();
+  }
+  pid_ = -1;
+}
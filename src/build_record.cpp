@@ -32,6 +32,48 @@ const std::vector<BuildArtifact>& BuildRecord::getArtifacts() const {
   return artifacts_;
 }
 
+void BuildRecord::addResolvedFile(const std::string& path,
+                                  const ResolvedFile& file) {
+  resolved_files_[path] = file;
+}
+
+void BuildRecord::addResolvedFile(const std::string& path,
+                                  const DependencyPackage& package,
+                                  const std::string& signature) {
+  if (!package.isValid()) {
+    resolved_files_.erase(path);
+    return;
+  }
+  resolved_files_[path] =
+      ResolvedFile(package.getPackageName(), package.getOriginalPath(),
+                   package.getHashValue(), signature);
+}
+
+bool BuildRecord::reuseResolvedFile(const std::string& path,
+                                    const std::string& signature,
+                                    DependencyPackage& package) const {
+  auto it = resolved_files_.find(path);
+  if (signature.empty() || it == resolved_files_.end() ||
+      it->second.signature != signature) {
+    return false;
+  }
+  // Records written before failed resolutions were left out hold them as
+  // entries without a package; those are resolved again too.
+  const ResolvedFile& file = it->second;
+  if (file.package.empty()) {
+    return false;
+  }
+  auto dep = dependencies_.find(file.package);
+  if (dep == dependencies_.end()) {
+    return false;
+  }
+  // Name, origin and version are per package; path and hash per file.
+  package =
+      DependencyPackage(file.package, dep->second.getOrigin(), file.real_path,
+                        dep->second.getVersion(), file.hash);
+  return true;
+}
+
 bool BuildRecord::hasDependency(const std::string& package_name) const {
   return dependencies_.find(package_name) != dependencies_.end();
 }
@@ -94,7 +136,7 @@ std::string BuildRecord::toString() const {
   return oss.str();
 }
 
-void BuildRecord::saveToFile(const std::string& filepath) const {
+std::string BuildRecord::toYaml() const {
   YAML::Node root;
   root["project"] = project_name_;
 
@@ -158,13 +200,31 @@ void BuildRecord::saveToFile(const std::string& filepath) const {
   }
   if (!git_commit_ids_.empty()) root["git_commit_ids"] = git_commits_node;
 
+  YAML::Node resolved_files_node;
+  for (const auto& [path, resolved] : resolved_files_) {
+    YAML::Node file_node;
+    file_node["path"] = path;
+    file_node["package"] = resolved.package;
+    file_node["real_path"] = resolved.real_path;
+    file_node["hash"] = resolved.hash;
+    file_node["signature"] = resolved.signature;
+    resolved_files_node.push_back(file_node);
+  }
+  if (!resolved_files_.empty()) root["resolved_files"] = resolved_files_node;
+
+  std::ostringstream out;
+  out << "# Build Record for " << project_name_ << std::endl;
+  out << root << std::endl;
+  return out.str();
+}
+
+void BuildRecord::saveToFile(const std::string& filepath) const {
   std::ofstream file(filepath);
   if (!file.is_open()) {
     throw std::runtime_error("Cannot open file for writing: " + filepath);
   }
 
-  file << "# Build Record for " << project_name_ << std::endl;
-  file << root << std::endl;
+  file << toYaml();
   file.close();
 }
 
@@ -263,5 +323,19 @@ BuildRecord BuildRecord::loadFromFile(const std::string& filepath) {
     }
   }
 
+  if (root["resolved_files"] && root["resolved_files"].IsSequence()) {
+    for (const auto& file_node : root["resolved_files"]) {
+      if (file_node["path"] && file_node["package"] &&
+          file_node["real_path"] && file_node["hash"] &&
+          file_node["signature"]) {
+        record.resolved_files_[file_node["path"].as<std::string>()] =
+            ResolvedFile(file_node["package"].as<std::string>(),
+                         file_node["real_path"].as<std::string>(),
+                         file_node["hash"].as<std::string>(),
+                         file_node["signature"].as<std::string>());
+      }
+    }
+  }
+
   return record;
 }
@@ -1,130 +1,340 @@
 #include "bundle.h"
 
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <chrono>
-#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
 #include <filesystem>
-#include <fstream>
-#include <iomanip>
-#include <sstream>
+#include <memory>
 #include <stdexcept>
 
+#include "archive_writer.h"
+#include "concurrency.h"
 #include "logger.h"
 
 namespace fs = std::filesystem;
 
-void createBundle(const BuildRecord& record, const std::string& bundle_path) {
-  try {
-    // Generate unique temporary directory name
-    auto now = std::chrono::system_clock::now();
-    auto time_t = std::chrono::system_clock::to_time_t(now);
-    std::ostringstream oss;
-    oss << "reprobuild_tmp_"
-        << std::put_time(std::localtime(&time_t), "%Y%m%d_%H%M%S") << "_"
-        << std::rand() % 10000;
-    std::string temp_dir = "/tmp/" + oss.str();
-
-    std::string abs_bundle_path = fs::absolute(bundle_path).string();
-
-    // Create temporary directory for staging
-    fs::create_directories(temp_dir);
-    Logger::debug("Created temporary directory: " + temp_dir);
-
-    // 1. Copy build_path folder if it exists and is not empty
-    std::string build_path = record.getBuildPath();
-    if (!build_path.empty() && fs::exists(build_path)) {
-      std::string dest_build_path = temp_dir + "/src";
-      fs::create_directories(dest_build_path);
-
-      // Copy the entire build directory
-      fs::copy(
-          build_path, dest_build_path,
-          fs::copy_options::recursive | fs::copy_options::overwrite_existing);
-    } else {
-      Logger::warn("Build path '" + build_path +
-                   "' does not exist or is empty");
-    }
-
-    // 2. Copy all custom dependencies
-    std::string deps_dir = temp_dir + "/deps";
-    fs::create_directories(deps_dir);
-
-    auto dependencies = record.getAllDependencies();
-    int custom_dep_count = 0;
-
-    for (const auto& dep : dependencies) {
-      if (dep.getOrigin() == DependencyOrigin::CUSTOM) {
-        std::string original_path = dep.getOriginalPath();
-
-        if (!original_path.empty() && fs::exists(original_path)) {
-          std::string dep_name = dep.getPackageName();
-          std::string dest_path = deps_dir + "/" + dep_name;
-
-          if (fs::is_directory(original_path)) {
-            // Copy directory
-            fs::copy(original_path, dest_path,
-                     fs::copy_options::recursive |
-                         fs::copy_options::overwrite_existing);
-          } else {
-            // Copy file and create directory structure if needed
-            fs::create_directories(fs::path(dest_path).parent_path());
-            fs::copy_file(original_path, dest_path,
-                          fs::copy_options::overwrite_existing);
-          }
-
-          Logger::info("Copied custom dependency: " + dep_name);
-          custom_dep_count++;
-        } else {
-          Logger::warn("Original path for dependency '" + dep.getPackageName() +
-                       "' does not exist: " + original_path);
-        }
+namespace {
+enum class BundleFormat { TAR_GZ, TAR_BZ2, TAR_XZ, ZIP };
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+  return text.size() >= suffix.size() &&
+         text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Pick the format from the file name. An unrecognised name gets ".tar.gz"
+// appended.
+BundleFormat detectFormat(std::string& bundle_path) {
+  if (endsWith(bundle_path, ".tar.gz") || endsWith(bundle_path, ".tgz")) {
+    return BundleFormat::TAR_GZ;
+  }
+  if (endsWith(bundle_path, ".tar.bz2") || endsWith(bundle_path, ".tbz2")) {
+    return BundleFormat::TAR_BZ2;
+  }
+  if (endsWith(bundle_path, ".tar.xz")) {
+    return BundleFormat::TAR_XZ;
+  }
+  if (endsWith(bundle_path, ".zip")) {
+    return BundleFormat::ZIP;
+  }
+  Logger::warn("Unrecognized extension '" +
+               fs::path(bundle_path).extension().string() +
+               "', defaulting to .tar.gz format");
+  bundle_path += ".tar.gz";
+  return BundleFormat::TAR_GZ;
+}
+
+// StreamCompressor name for a tar format.
+const char* compressionName(BundleFormat format) {
+  switch (format) {
+    case BundleFormat::TAR_BZ2:
+      return "bz2";
+    case BundleFormat::TAR_XZ:
+      return "xz";
+    default:
+      return "gz";
+  }
+}
+
+std::string shellQuote(const std::string& text) {
+  std::string quoted = "'";
+  for (char c : text) {
+    quoted += c == '\'' ? std::string("'\\''") : std::string(1, c);
+  }
+  return quoted + "'";
+}
+
+// Where the compressed bytes go: the bundle file itself, or the stdin of
+// an external compressor when this build has no library for the format.
+class BundleOutput {
+ public:
+  BundleOutput(const std::string& path, const std::string& external_tool)
+      : piped_(!external_tool.empty()) {
+    // The file is created here even when a compressor writes it, so its
+    // identity is known before anything is archived; the shell's
+    // redirection truncates the same inode.
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_ || fstat(fileno(file_), &stat_) != 0) {
+      throw std::runtime_error("Cannot open " + path + ": " +
+                               std::strerror(errno));
+    }
+    if (piped_) {
+      std::fclose(file_);
+      const std::string command =
+          external_tool + " -c > " + shellQuote(path);
+      Logger::debug("Compressing through: " + command);
+      file_ = popen(command.c_str(), "w");
+      if (!file_) {
+        throw std::runtime_error("Cannot run " + external_tool + ": " +
+                                 std::strerror(errno));
       }
     }
+  }
+  ~BundleOutput() { close(); }
 
-    Logger::debug("Copied " + std::to_string(custom_dep_count) +
-                  " custom dependencies");
-
-    // 3. Save build_record.yaml
-    std::string yaml_path = temp_dir + "/build_record.yaml";
-    record.saveToFile(yaml_path);
-
-    // 4. Create compressed archive
-    std::string bundle_name = fs::path(abs_bundle_path).stem().string();
-    std::string archive_cmd;
-
-    // Determine compression format based on file extension
-    std::string ext = fs::path(abs_bundle_path).extension().string();
-    if (ext == ".tar.gz" || ext == ".tgz") {
-      archive_cmd = "cd " + temp_dir + " && tar -czf " + abs_bundle_path + " .";
-    } else if (ext == ".tar.bz2" || ext == ".tbz2") {
-      archive_cmd = "cd " + temp_dir + " && tar -cjf " + abs_bundle_path + " .";
-    } else if (ext == ".tar.xz") {
-      archive_cmd = "cd " + temp_dir + " && tar -cJf " + abs_bundle_path + " .";
-    } else if (ext == ".zip") {
-      archive_cmd =
-          "cd " + temp_dir + " && zip -q -r " + abs_bundle_path + " .";
+  bool write(std::string_view data) {
+    return std::fwrite(data.data(), 1, data.size(), file_) == data.size();
+  }
+
+  bool close() {
+    if (!file_) {
+      return true;
+    }
+    const int result = piped_ ? pclose(file_) : std::fclose(file_);
+    file_ = nullptr;
+    return result == 0;
+  }
+
+  // Device and inode of the bundle file.
+  const struct stat& fileStat() const { return stat_; }
+
+ private:
+  bool piped_;
+  FILE* file_ = nullptr;
+  struct stat stat_ {};
+};
+
+// Streams the bundle layout (src/, deps/<name>, build_record.yaml) into a
+// tar or zip archive. Names are "./"-prefixed in tars like `tar -C dir .`
+// produces and bare in zips like `zip -r`.
+class BundleArchive {
+ public:
+  BundleArchive(BundleFormat format, ArchiveSink sink) {
+    if (format == BundleFormat::ZIP) {
+      zip_ = std::make_unique<ZipWriter>(std::move(sink));
     } else {
-      // Default to tar.gz
-      archive_cmd =
-          "cd " + temp_dir + " && tar -czf " + abs_bundle_path + ".tar.gz .";
-      Logger::warn("Unrecognized extension '" + ext +
-                   "', defaulting to .tar.gz format");
+      tar_ = std::make_unique<TarWriter>(std::move(sink));
+    }
+  }
+
+  // An empty |name| is the archive root, which only tars list.
+  bool addDirectory(const std::string& name, const struct stat& st) {
+    if (zip_ && name.empty()) {
+      return true;
+    }
+    if (zip_) {
+      return zip_->addDirectory(name + "/", st.st_mtime, st.st_mode & 07777);
     }
+    return tar_->addDirectory("./" + name, st);
+  }
 
-    Logger::info("Creating archive with command: " + archive_cmd);
-    int result = std::system(archive_cmd.c_str());
+  bool addFile(const std::string& path, const std::string& name) {
+    return zip_ ? zip_->addFile(path, name) : tar_->addFile(path, "./" + name);
+  }
 
-    if (result != 0) {
-      throw std::runtime_error("Failed to create archive. Command returned: " +
-                               std::to_string(result));
+  bool addData(const std::string& name, std::string_view data) {
+    const time_t now = std::time(nullptr);
+    if (zip_) {
+      return zip_->beginFile(name, now, 0644) && zip_->write(data) &&
+             zip_->endFile();
     }
+    return tar_->addData("./" + name, data, now, 0644);
+  }
 
-    // 5. Clean up temporary directory
-    fs::remove_all(temp_dir);
+  // Add |source| as |name|: a file as-is, a directory with everything
+  // below it. Symlinks are followed, as a recursive copy would.
+  bool addTree(const fs::path& source, const std::string& name) {
+    struct stat st;
+    if (stat(source.c_str(), &st) != 0) {
+      Logger::warn("Skipping " + source.string() + ": " +
+                   std::strerror(errno));
+      return true;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+      return isExcluded(st) || addFile(source.string(), name);
+    }
+    if (!addDirectory(name, st)) {
+      return false;
+    }
+    for (auto it = fs::recursive_directory_iterator(
+             source, fs::directory_options::follow_directory_symlink);
+         it != fs::recursive_directory_iterator(); ++it) {
+      const std::string entry_name =
+          name + "/" + it->path().lexically_relative(source).string();
+      if (stat(it->path().c_str(), &st) != 0) {
+        Logger::warn("Skipping " + it->path().string() + ": " +
+                     std::strerror(errno));
+        continue;
+      }
+      bool added = true;
+      if (S_ISDIR(st.st_mode)) {
+        added = addDirectory(entry_name, st);
+      } else if (S_ISREG(st.st_mode) && isExcluded(st)) {
+        Logger::debug("Skipping the bundle itself: " + it->path().string());
+      } else if (S_ISREG(st.st_mode)) {
+        added = addFile(it->path().string(), entry_name);
+      } else {
+        Logger::debug("Skipping special file " + it->path().string());
+      }
+      if (!added) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool finish() { return zip_ ? zip_->finish() : tar_->finish(); }
+
+  // Leave out the file |st| describes: the bundle being written, when it
+  // lies inside a tree being archived.
+  void exclude(const struct stat& st) {
+    excluded_dev_ = st.st_dev;
+    excluded_ino_ = st.st_ino;
+  }
+
+ private:
+  bool isExcluded(const struct stat& st) const {
+    return st.st_dev == excluded_dev_ && st.st_ino == excluded_ino_;
+  }
+
+  dev_t excluded_dev_ = 0;
+  ino_t excluded_ino_ = 0;
+  std::unique_ptr<ZipWriter> zip_;
+  std::unique_ptr<TarWriter> tar_;
+};
+
+void writeBundle(const BuildRecord& record, BundleArchive& archive) {
+  const time_t now = std::time(nullptr);
+  struct stat dir_stat {};
+  dir_stat.st_mode = S_IFDIR | 0755;
+  dir_stat.st_mtime = now;
+  dir_stat.st_uid = getuid();
+  dir_stat.st_gid = getgid();
+  if (!archive.addDirectory("", dir_stat)) {
+    throw std::runtime_error("Failed to write archive");
+  }
+
+  // 1. The build directory, as src/
+  std::string build_path = record.getBuildPath();
+  if (!build_path.empty() && fs::exists(build_path)) {
+    if (!archive.addTree(build_path, "src")) {
+      throw std::runtime_error("Failed to archive " + build_path);
+    }
+  } else {
+    Logger::warn("Build path '" + build_path + "' does not exist or is empty");
+  }
 
-    Logger::info("Bundle created successfully: " + bundle_path);
+  // 2. Custom dependencies, as deps/<package name>
+  if (!archive.addDirectory("deps", dir_stat)) {
+    throw std::runtime_error("Failed to write archive");
+  }
+  int custom_dep_count = 0;
+  for (const auto& dep : record.getAllDependencies()) {
+    if (dep.getOrigin() != DependencyOrigin::CUSTOM) {
+      continue;
+    }
+    const std::string& original_path = dep.getOriginalPath();
+    if (original_path.empty() || !fs::exists(original_path)) {
+      Logger::warn("Original path for dependency '" + dep.getPackageName() +
+                   "' does not exist: " + original_path);
+      continue;
+    }
+    const std::string name = "deps/" + dep.getPackageName();
+    // Package names may contain '/'; tar and unzip create the parents.
+    if (!archive.addTree(original_path, name)) {
+      throw std::runtime_error("Failed to archive " + original_path);
+    }
+    Logger::info("Added custom dependency: " + dep.getPackageName());
+    custom_dep_count++;
+  }
+  Logger::debug("Added " + std::to_string(custom_dep_count) +
+                " custom dependencies");
+
+  // 3. The build record itself
+  if (!archive.addData("build_record.yaml", record.toYaml()) ||
+      !archive.finish()) {
+    throw std::runtime_error("Failed to write archive");
+  }
+}
+}  // namespace
+
+BundleTiming createBundle(const BuildRecord& record,
+                          const std::string& bundle_path, size_t threads) {
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now();
+  BundleTiming timing;
+  std::string output_path = fs::absolute(bundle_path).string();
+  try {
+    const BundleFormat format = detectFormat(output_path);
+    if (threads == 0) {
+      threads = Concurrency::current().cpu_threads;
+    }
+    Logger::info("Creating archive: " + output_path);
+
+    // Everything is read from where it lies and compressed on the way to
+    // the output, so no staging copy of the tree is made.
+    std::unique_ptr<BundleOutput> output;
+    ArchiveSink file_sink = [&output](std::string_view data) {
+      return output->write(data);
+    };
+    std::unique_ptr<StreamCompressor> compressor;
+    ParallelCompressor* parallel = nullptr;
+    std::string external_tool;
+    if (format != BundleFormat::ZIP) {
+      const std::string name = compressionName(format);
+      if (!StreamCompressor::supports(name)) {
+        external_tool = format == BundleFormat::TAR_XZ ? "xz" : "bzip2";
+      } else if (threads > 1) {
+        auto blocks =
+            std::make_unique<ParallelCompressor>(name, file_sink, threads);
+        parallel = blocks.get();
+        compressor = std::move(blocks);
+        timing.threads = threads;
+      } else {
+        compressor = StreamCompressor::create(name, file_sink);
+      }
+    }
+    output = std::make_unique<BundleOutput>(output_path, external_tool);
+    BundleArchive archive(
+        format, compressor ? ArchiveSink([&compressor](std::string_view data) {
+          return compressor->write(data);
+        })
+                           : file_sink);
+    archive.exclude(output->fileStat());
+    writeBundle(record, archive);
+    if ((compressor && !compressor->finish()) || !output->close()) {
+      throw std::runtime_error("Failed to write " + output_path);
+    }
+
+    if (parallel) {
+      timing.compress_ms = parallel->compressMs();
+      timing.compress_wait_ms = parallel->waitMs();
+      timing.blocks = parallel->blockCount();
+    }
+    timing.total_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          Clock::now() - start)
+                          .count();
+    Logger::info("Bundle created successfully: " + output_path);
+    return timing;
 
   } catch (const std::exception& e) {
+    std::error_code ignored;
+    fs::remove(output_path, ignored);
     Logger::error("Error creating bundle: " + std::string(e.what()));
     throw;
   }
-}
\ No newline at end of file
+}
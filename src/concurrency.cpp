@@ -0,0 +1,103 @@
+#include "concurrency.h"
+
+#include <sched.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+#include "logger.h"
+
+namespace {
+std::mutex plan_mutex;
+ConcurrencyPlan configured_plan;
+bool plan_configured = false;
+
+// Read |name| as a thread count; 0 if unset or invalid.
+size_t envThreadCount(const char* name) {
+  const char* raw_env = std::getenv(name);
+  if (!raw_env || raw_env[0] == '\0') {
+    return 0;
+  }
+  const size_t count = Concurrency::parseThreadCount(raw_env);
+  if (count == 0) {
+    Logger::warn(std::string("Ignoring invalid ") + name + "=" + raw_env);
+  }
+  return count;
+}
+}  // namespace
+
+ConcurrencyPlan Concurrency::automatic(size_t cores) {
+  cores = std::max<size_t>(1, cores);
+  ConcurrencyPlan plan;
+  plan.cpu_threads = cores;
+  // Two threads per core keeps the disk queue full while half of them
+  // wait; past the cap extra threads only add contention.
+  plan.io_threads = std::min(kMaxAutoIoThreads, cores * 2);
+  return plan;
+}
+
+const ConcurrencyPlan& Concurrency::configure(size_t cli_io, size_t cli_cpu) {
+  ConcurrencyPlan plan = automatic(usableCores());
+  if (const size_t env_io = envThreadCount("REPROBUILD_IO_THREADS")) {
+    plan.io_threads = env_io;
+    plan.io_source = "env";
+  }
+  if (const size_t env_cpu = envThreadCount("REPROBUILD_CPU_THREADS")) {
+    plan.cpu_threads = env_cpu;
+    plan.cpu_source = "env";
+  }
+  if (cli_io > 0) {
+    plan.io_threads = cli_io;
+    plan.io_source = "cli";
+  }
+  if (cli_cpu > 0) {
+    plan.cpu_threads = cli_cpu;
+    plan.cpu_source = "cli";
+  }
+
+  std::lock_guard<std::mutex> lock(plan_mutex);
+  configured_plan = plan;
+  plan_configured = true;
+  return configured_plan;
+}
+
+const ConcurrencyPlan& Concurrency::current() {
+  {
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    if (plan_configured) {
+      return configured_plan;
+    }
+  }
+  return configure();
+}
+
+size_t Concurrency::usableCores() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    const int count = CPU_COUNT(&set);
+    if (count > 0) {
+      return static_cast<size_t>(count);
+    }
+  }
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+size_t Concurrency::parseThreadCount(const std::string& text) {
+  size_t count = 0;
+  const char* end = text.data() + text.size();
+  const auto result = std::from_chars(text.data(), end, count);
+  if (result.ec != std::errc() || result.ptr != end) {
+    return 0;
+  }
+  return count;
+}
+
+std::string Concurrency::describe(const ConcurrencyPlan& plan) {
+  return "io=" + std::to_string(plan.io_threads) + " (" + plan.io_source +
+         "), cpu=" + std::to_string(plan.cpu_threads) + " (" +
+         plan.cpu_source + ")";
+}
@@ -1,10 +1,12 @@
 #include "dependency_package.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <sstream>
 #include <stdexcept>
 
 #include "dependency_resolver.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 DependencyPackage::DependencyPackage()
@@ -92,6 +94,16 @@ bool checkPackageWithDpkg(const std::string& raw_file_path,
 
 bool checkPackageWithRpm(const std::string& raw_file_path,
                          DependencyPackage& package) {
+  bool database_available = false;
+  if (DependencyResolver::resolveRpmPackage(raw_file_path, package,
+                                            database_available)) {
+    return true;
+  }
+  if (database_available) {
+    return false;  // Package not found
+  }
+
+  // No readable rpmdb.sqlite: ask the rpm command.
   std::string real_path = DependencyResolver::canonicalizePath(raw_file_path);
 
   // Use rpm -qf to find which package owns the file
@@ -134,15 +146,14 @@ bool checkPackageWithRpm(const std::string& raw_file_path,
   return true;
 }
 
-// Static method to create a DependencyPackage from a raw file
-DependencyPackage DependencyPackage::fromRawFile(
-    const std::string& raw_file_path, PackageMgr pkg_mgr) {
-  DependencyPackage cached_package;
-  if (DependencyResolver::getCachedPackage(pkg_mgr, raw_file_path,
-                                           cached_package)) {
-    return cached_package;
-  }
+bool checkPackageWithPacman(const std::string& raw_file_path,
+                            DependencyPackage& package) {
+  return DependencyResolver::resolvePacmanPackage(raw_file_path, package);
+}
 
+// Resolve |raw_file_path| without consulting the resolution cache
+DependencyPackage resolveRawFile(const std::string& raw_file_path,
+                                 PackageMgr pkg_mgr) {
   try {
     // Check if file exists
     if (!std::filesystem::exists(raw_file_path)) {
@@ -160,25 +171,71 @@ DependencyPackage DependencyPackage::fromRawFile(
       case PackageMgr::YUM:
         success = checkPackageWithRpm(raw_file_path, package);
         break;
+      case PackageMgr::PACMAN:
+        success = checkPackageWithPacman(raw_file_path, package);
+        break;
       default:
         throw std::runtime_error("Unsupported package manager");
     }
 
     if (success) {
-      return DependencyResolver::cachePackage(pkg_mgr, raw_file_path, package);
-    } else {
-      // Custom file not owned by any package
-      return DependencyResolver::cachePackage(
-          pkg_mgr, raw_file_path,
-          DependencyResolver::createCustomDependency(raw_file_path));
+      return package;
     }
+    // Custom file not owned by any package
+    return DependencyResolver::createCustomDependency(raw_file_path);
 
   } catch (const std::exception& e) {
     // If any step fails, return an invalid package with error information
     DependencyPackage invalid_package;
     invalid_package.setOriginalPath(raw_file_path);
     invalid_package.setHashValue("ERROR: " + std::string(e.what()));
-    return DependencyResolver::cachePackage(pkg_mgr, raw_file_path,
-                                            invalid_package);
+    return invalid_package;
   }
 }
+
+// Static method to create a DependencyPackage from a raw file
+DependencyPackage DependencyPackage::fromRawFile(
+    const std::string& raw_file_path, PackageMgr pkg_mgr) {
+  DependencyPackage cached_package;
+  if (DependencyResolver::getCachedPackage(pkg_mgr, raw_file_path,
+                                           cached_package)) {
+    return cached_package;
+  }
+  return DependencyResolver::cachePackage(
+      pkg_mgr, raw_file_path, resolveRawFile(raw_file_path, pkg_mgr));
+}
+
+std::vector<DependencyPackage> DependencyPackage::resolveAll(
+    const std::vector<std::string>& raw_file_paths, PackageMgr pkg_mgr,
+    size_t max_threads) {
+  const size_t count = raw_file_paths.size();
+  std::vector<DependencyPackage> packages(count);
+  std::vector<char> cached(count, 0);
+  if (count == 0) {
+    return packages;
+  }
+
+  // A few chunks per thread keeps the threads busy when some chunks hit
+  // slow lookups.
+  const size_t threads = std::max<size_t>(1, std::min(max_threads, count));
+  const size_t chunk_count = std::min(count, threads * 4);
+  const size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+
+  // Chunks write disjoint slices of |packages| and |cached|.
+  auto resolve_chunk = [&](size_t begin, size_t end) {
+    DependencyResolver::getCachedPackages(pkg_mgr, raw_file_paths, begin, end,
+                                          packages, cached);
+    for (size_t i = begin; i < end; ++i) {
+      if (!cached[i]) {
+        packages[i] = resolveRawFile(raw_file_paths[i], pkg_mgr);
+      }
+    }
+    DependencyResolver::cachePackages(pkg_mgr, raw_file_paths, begin, end,
+                                      packages, cached);
+  };
+
+  // The calling thread resolves chunks too.
+  ThreadPool pool(threads - 1);
+  pool.parallel_for(0, count, chunk_size, resolve_chunk);
+  return packages;
+}
@@ -1,26 +1,25 @@
 #include "dependency_resolver.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
-#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <unordered_map>
+#include <vector>
 
-#include "utils.h"
+#include "dpkg_database.h"
+#include "file_hasher.h"
+#include "pacman_database.h"
+#include "rpm_database.h"
 
 namespace {
 
-constexpr char kDpkgStatusPath[] = "/var/lib/dpkg/status";
-constexpr char kDpkgInfoDir[] = "/var/lib/dpkg/info";
-
-std::string stripArchitectureSuffix(const std::string& package_name) {
-  const auto colon_pos = package_name.find(':');
-  if (colon_pos == std::string::npos) {
-    return package_name;
-  }
-  return package_name.substr(0, colon_pos);
-}
-
+// Resolved packages by package manager and path. Entries are spread over
+// shards by a hash of the path computed once per call; lookups take the
+// shard lock shared, so concurrent resolver threads only serialize on
+// inserts into the same shard.
 class DependencyResolutionCache {
  public:
   static DependencyResolutionCache& instance() {
@@ -30,169 +29,169 @@ class DependencyResolutionCache {
 
   bool get(PackageMgr pkg_mgr, const std::string& path,
            DependencyPackage& package) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    auto it = packages_.find(makeKey(pkg_mgr, path));
-    if (it == packages_.end()) {
-      return false;
+    const uint64_t hash = hashKey(pkg_mgr, path);
+    Shard& shard = shardFor(hash);
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      if (const Entry* entry = find(shard, hash, pkg_mgr, path)) {
+        package = entry->package;
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
     }
-    package = it->second;
-    return true;
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    return false;
   }
 
   DependencyPackage put(PackageMgr pkg_mgr, const std::string& path,
                         const DependencyPackage& package) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    packages_[makeKey(pkg_mgr, path)] = package;
-    return package;
-  }
-
- private:
-  static std::string makeKey(PackageMgr pkg_mgr, const std::string& path) {
-    return std::to_string(static_cast<int>(pkg_mgr)) + "\n" + path;
-  }
-
-  std::mutex mutex_;
-  std::unordered_map<std::string, DependencyPackage> packages_;
-};
-
-struct DebianPackageOwner {
-  std::string query_name;
-  std::string display_name;
-};
-
-class DpkgDatabase {
- public:
-  static const DpkgDatabase& instance() {
-    static const DpkgDatabase database;
-    return database;
-  }
-
-  const DebianPackageOwner* findOwner(const std::string& raw_path,
-                                      const std::string& real_path) const {
-    if (const DebianPackageOwner* owner = findOwnerByExactPath(raw_path)) {
-      return owner;
+    const uint64_t hash = hashKey(pkg_mgr, path);
+    Shard& shard = shardFor(hash);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    if (Entry* entry = find(shard, hash, pkg_mgr, path)) {
+      entry->package = package;
+    } else {
+      shard.entries[hash].push_back({pkg_mgr, path, package});
     }
-    return findOwnerByExactPath(real_path);
-  }
-
-  std::string findVersion(const DebianPackageOwner& owner) const {
-    auto it = package_versions_.find(owner.query_name);
-    if (it != package_versions_.end()) {
-      return it->second;
-    }
-
-    it = package_versions_.find(owner.display_name);
-    if (it != package_versions_.end()) {
-      return it->second;
-    }
-
-    return fallbackDpkgQuery(owner);
-  }
-
- private:
-  DpkgDatabase() {
-    loadInstalledVersions();
-    loadFileOwners();
+    return package;
   }
 
-  const DebianPackageOwner* findOwnerByExactPath(
-      const std::string& path) const {
-    auto it = path_to_package_.find(path);
-    if (it == path_to_package_.end()) {
-      return nullptr;
+  // The batch versions take each shard lock once per batch and update the
+  // hit and miss counters once.
+  void getMany(PackageMgr pkg_mgr, const std::vector<std::string>& paths,
+               size_t begin, size_t end,
+               std::vector<DependencyPackage>& packages,
+               std::vector<char>& found) {
+    const std::vector<BatchKey> keys =
+        batchKeys(pkg_mgr, paths, begin, end, nullptr);
+    size_t hits = 0;
+    for (size_t k = 0; k < keys.size();) {
+      Shard& shard = shards_[keys[k].shard];
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const size_t shard_end = shardEnd(keys, k); k < shard_end; ++k) {
+        const size_t i = keys[k].index;
+        const Entry* entry = find(shard, keys[k].hash, pkg_mgr, paths[i]);
+        found[i] = entry != nullptr;
+        if (entry) {
+          packages[i] = entry->package;
+          ++hits;
+        }
+      }
     }
-    return &it->second;
+    hits_.fetch_add(hits, std::memory_order_relaxed);
+    misses_.fetch_add(keys.size() - hits, std::memory_order_relaxed);
   }
 
-  void loadInstalledVersions() {
-    std::ifstream status_file(kDpkgStatusPath);
-    if (!status_file.is_open()) return;
-
-    std::string line;
-    std::string package_name;
-    std::string architecture;
-    std::string version;
-
-    auto flush_stanza = [&]() {
-      if (!package_name.empty() && !version.empty()) {
-        package_versions_[package_name] = version;
-        if (!architecture.empty()) {
-          package_versions_[package_name + ":" + architecture] = version;
+  void putMany(PackageMgr pkg_mgr, const std::vector<std::string>& paths,
+               size_t begin, size_t end,
+               const std::vector<DependencyPackage>& packages,
+               const std::vector<char>& skip) {
+    const std::vector<BatchKey> keys =
+        batchKeys(pkg_mgr, paths, begin, end, &skip);
+    for (size_t k = 0; k < keys.size();) {
+      Shard& shard = shards_[keys[k].shard];
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (const size_t shard_end = shardEnd(keys, k); k < shard_end; ++k) {
+        const size_t i = keys[k].index;
+        if (Entry* entry = find(shard, keys[k].hash, pkg_mgr, paths[i])) {
+          entry->package = packages[i];
+        } else {
+          shard.entries[keys[k].hash].push_back(
+              {pkg_mgr, paths[i], packages[i]});
         }
       }
-      package_name.clear();
-      architecture.clear();
-      version.clear();
-    };
-
-    while (std::getline(status_file, line)) {
-      if (line.empty()) {
-        flush_stanza();
-        continue;
-      }
-
-      readField(line, "Package: ", package_name);
-      readField(line, "Architecture: ", architecture);
-      readField(line, "Version: ", version);
     }
-    flush_stanza();
   }
 
-  void loadFileOwners() {
-    const std::filesystem::path info_dir(kDpkgInfoDir);
-    std::error_code ec;
-    if (!std::filesystem::exists(info_dir, ec)) return;
-
-    for (const auto& entry : std::filesystem::directory_iterator(info_dir, ec)) {
-      if (ec) {
-        break;
-      }
-      if (!isDpkgFileList(entry)) continue;
+  size_t hitCount() const { return hits_.load(std::memory_order_relaxed); }
+  size_t missCount() const { return misses_.load(std::memory_order_relaxed); }
 
-      const std::string query_name = entry.path().stem().string();
-      DebianPackageOwner owner{query_name, stripArchitectureSuffix(query_name)};
-      loadFileList(entry.path(), owner);
+ private:
+  struct Entry {
+    PackageMgr pkg_mgr;
+    std::string path;
+    DependencyPackage package;
+  };
+  // The stored hash is already mixed, use it as is.
+  struct IdentityHash {
+    size_t operator()(uint64_t hash) const { return static_cast<size_t>(hash); }
+  };
+  struct Shard {
+    std::shared_mutex mutex;
+    // Entries whose keys collide on the 64-bit hash share a bucket.
+    std::unordered_map<uint64_t, std::vector<Entry>, IdentityHash> entries;
+  };
+  static constexpr size_t kShardCount = 64;
+
+  struct BatchKey {
+    size_t shard;
+    uint64_t hash;
+    size_t index;
+  };
+
+  static uint64_t hashKey(PackageMgr pkg_mgr, const std::string& path) {
+    // FNV-1a over the path, seeded with the package manager.
+    uint64_t hash = 0xcbf29ce484222325ULL ^ static_cast<uint64_t>(pkg_mgr);
+    for (const char c : path) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
     }
+    return hash;
   }
 
-  bool isDpkgFileList(const std::filesystem::directory_entry& entry) const {
-    std::error_code ec;
-    return entry.is_regular_file(ec) && entry.path().extension() == ".list";
+  static size_t shardIndex(uint64_t hash) {
+    // The low bits pick the bucket inside the shard; use the high ones here.
+    return (hash >> 58) % kShardCount;
   }
 
-  void loadFileList(const std::filesystem::path& list_path,
-                    const DebianPackageOwner& owner) {
-    std::ifstream list_file(list_path);
-    std::string owned_path;
-    while (std::getline(list_file, owned_path)) {
-      if (!owned_path.empty()) {
-        path_to_package_.emplace(owned_path, owner);
+  Shard& shardFor(uint64_t hash) { return shards_[shardIndex(hash)]; }
+
+  // Keys of paths[begin, end) not marked in |skip|, grouped by shard.
+  static std::vector<BatchKey> batchKeys(PackageMgr pkg_mgr,
+                                         const std::vector<std::string>& paths,
+                                         size_t begin, size_t end,
+                                         const std::vector<char>* skip) {
+    std::vector<BatchKey> keys;
+    keys.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i) {
+      if (skip && (*skip)[i]) {
+        continue;
       }
+      const uint64_t hash = hashKey(pkg_mgr, paths[i]);
+      keys.push_back({shardIndex(hash), hash, i});
     }
+    std::sort(keys.begin(), keys.end(),
+              [](const BatchKey& lhs, const BatchKey& rhs) {
+                return lhs.shard < rhs.shard;
+              });
+    return keys;
   }
 
-  static void readField(const std::string& line, const std::string& prefix,
-                        std::string& value) {
-    if (Utils::startsWith(line, prefix)) {
-      value = line.substr(prefix.size());
+  // End of the run of |keys| starting at |k| that shares its shard.
+  static size_t shardEnd(const std::vector<BatchKey>& keys, size_t k) {
+    size_t end = k;
+    while (end < keys.size() && keys[end].shard == keys[k].shard) {
+      ++end;
     }
+    return end;
   }
 
-  static std::string fallbackDpkgQuery(const DebianPackageOwner& owner) {
-    std::string version_command = "dpkg-query -W -f='${Version}\\n' " +
-                                  owner.query_name + " 2>/dev/null";
-    std::string version = Utils::executeCommand(version_command);
-    if (!version.empty()) {
-      return version;
+  static Entry* find(Shard& shard, uint64_t hash, PackageMgr pkg_mgr,
+                     const std::string& path) {
+    auto it = shard.entries.find(hash);
+    if (it == shard.entries.end()) {
+      return nullptr;
     }
-
-    version_command = "dpkg-query -W -f='${Version}\\n' " +
-                      owner.display_name + " 2>/dev/null";
-    return Utils::executeCommand(version_command);
+    for (Entry& entry : it->second) {
+      if (entry.pkg_mgr == pkg_mgr && entry.path == path) {
+        return &entry;
+      }
+    }
+    return nullptr;
   }
 
-  std::unordered_map<std::string, DebianPackageOwner> path_to_package_;
-  std::unordered_map<std::string, std::string> package_versions_;
+  Shard shards_[kShardCount];
+  std::atomic<size_t> hits_{0};
+  std::atomic<size_t> misses_{0};
 };
 
 }  // namespace
@@ -225,31 +224,90 @@ DependencyPackage cachePackage(PackageMgr pkg_mgr, const std::string& path,
   return DependencyResolutionCache::instance().put(pkg_mgr, path, package);
 }
 
+void getCachedPackages(PackageMgr pkg_mgr,
+                       const std::vector<std::string>& paths, size_t begin,
+                       size_t end, std::vector<DependencyPackage>& packages,
+                       std::vector<char>& found) {
+  DependencyResolutionCache::instance().getMany(pkg_mgr, paths, begin, end,
+                                                packages, found);
+}
+
+void cachePackages(PackageMgr pkg_mgr, const std::vector<std::string>& paths,
+                   size_t begin, size_t end,
+                   const std::vector<DependencyPackage>& packages,
+                   const std::vector<char>& skip) {
+  DependencyResolutionCache::instance().putMany(pkg_mgr, paths, begin, end,
+                                                packages, skip);
+}
+
+size_t cacheHitCount() {
+  return DependencyResolutionCache::instance().hitCount();
+}
+
+size_t cacheMissCount() {
+  return DependencyResolutionCache::instance().missCount();
+}
+
 bool resolveAptPackage(const std::string& raw_file_path,
                        DependencyPackage& package) {
   const std::string real_path = canonicalizePath(raw_file_path);
-  const DebianPackageOwner* owner =
-      DpkgDatabase::instance().findOwner(raw_file_path, real_path);
-  if (!owner) {
+  DebianPackageOwner owner;
+  if (!DpkgDatabase::instance().findOwner(raw_file_path, real_path, owner)) {
     return false;
   }
 
-  const std::string version = DpkgDatabase::instance().findVersion(*owner);
+  const std::string version = DpkgDatabase::instance().findVersion(owner);
   if (version.empty()) {
     throw std::runtime_error("Could not get version for package: " +
-                             owner->query_name);
+                             owner.query_name);
   }
 
-  package = createDependencyPackage(owner->display_name, DependencyOrigin::APT,
+  package = createDependencyPackage(owner.display_name, DependencyOrigin::APT,
                                     raw_file_path, real_path, version);
   return true;
 }
 
+bool resolveRpmPackage(const std::string& raw_file_path,
+                       DependencyPackage& package, bool& available) {
+  const RpmDatabase& database = RpmDatabase::instance();
+  available = database.available();
+  if (!available) {
+    return false;
+  }
+
+  const std::string real_path = canonicalizePath(raw_file_path);
+  RpmPackageOwner owner;
+  if (!database.findOwner(raw_file_path, real_path, owner)) {
+    return false;
+  }
+
+  package = createDependencyPackage(owner.name, DependencyOrigin::DNF,
+                                    raw_file_path, real_path, owner.version);
+  return true;
+}
+
+bool resolvePacmanPackage(const std::string& raw_file_path,
+                          DependencyPackage& package) {
+  const std::string real_path = canonicalizePath(raw_file_path);
+  PacmanPackageOwner owner;
+  if (!PacmanDatabase::instance().findOwner(raw_file_path, real_path, owner)) {
+    return false;
+  }
+  if (owner.version.empty()) {
+    throw std::runtime_error("Could not get version for package: " +
+                             owner.name);
+  }
+
+  package = createDependencyPackage(owner.name, DependencyOrigin::PACMAN,
+                                    raw_file_path, real_path, owner.version);
+  return true;
+}
+
 DependencyPackage createDependencyPackage(
     const std::string& package_name, DependencyOrigin origin,
     const std::string& raw_file_path, const std::string& real_path,
     const std::string& version) {
-  std::string hash_value = Utils::calculateFileHash(real_path);
+  std::string hash_value = FileHasher::instance().hash(real_path);
   if (hash_value.empty()) {
     throw std::runtime_error("Could not calculate hash for file: " +
                              raw_file_path);
@@ -0,0 +1,421 @@
+#include "dpkg_database.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+
+const char kDirIndexHeader[] = "reprobuild-dpkg-dirs 1";
+
+std::string stripArchitectureSuffix(const std::string& package_name) {
+  const auto colon_pos = package_name.find(':');
+  if (colon_pos == std::string::npos) {
+    return package_name;
+  }
+  return package_name.substr(0, colon_pos);
+}
+
+uint64_t mtimeNs(const struct stat& st) {
+  return static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL +
+         static_cast<uint64_t>(st.st_mtim.tv_nsec);
+}
+
+void readField(const std::string& line, const std::string& prefix,
+               std::string& value) {
+  if (Utils::startsWith(line, prefix)) {
+    value = line.substr(prefix.size());
+  }
+}
+
+// Installed versions by package name, and by name:architecture.
+std::unordered_map<std::string, std::string> loadInstalledVersions(
+    const std::string& status_path) {
+  std::unordered_map<std::string, std::string> package_versions;
+  std::ifstream status_file(status_path);
+  if (!status_file.is_open()) return package_versions;
+
+  std::string line;
+  std::string package_name;
+  std::string architecture;
+  std::string version;
+
+  auto flush_stanza = [&]() {
+    if (!package_name.empty() && !version.empty()) {
+      package_versions[package_name] = version;
+      if (!architecture.empty()) {
+        package_versions[package_name + ":" + architecture] = version;
+      }
+    }
+    package_name.clear();
+    architecture.clear();
+    version.clear();
+  };
+
+  while (std::getline(status_file, line)) {
+    if (line.empty()) {
+      flush_stanza();
+      continue;
+    }
+
+    readField(line, "Package: ", package_name);
+    readField(line, "Architecture: ", architecture);
+    readField(line, "Version: ", version);
+  }
+  flush_stanza();
+  return package_versions;
+}
+
+std::string findInstalledVersion(
+    const std::unordered_map<std::string, std::string>& package_versions,
+    const std::string& query_name) {
+  auto it = package_versions.find(query_name);
+  if (it == package_versions.end()) {
+    it = package_versions.find(stripArchitectureSuffix(query_name));
+  }
+  return it != package_versions.end() ? it->second : "";
+}
+
+bool isDpkgFileList(const std::filesystem::directory_entry& entry) {
+  std::error_code ec;
+  return entry.is_regular_file(ec) && entry.path().extension() == ".list";
+}
+
+std::string parentDirectory(const std::string& path) {
+  const size_t slash = path.rfind('/');
+  if (slash == std::string::npos) {
+    return "";
+  }
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::string fallbackDpkgQuery(const DebianPackageOwner& owner) {
+  std::string version_command = "dpkg-query -W -f='${Version}\\n' " +
+                                owner.query_name + " 2>/dev/null";
+  std::string version = Utils::executeCommand(version_command);
+  if (!version.empty()) {
+    return version;
+  }
+
+  version_command = "dpkg-query -W -f='${Version}\\n' " +
+                    owner.display_name + " 2>/dev/null";
+  return Utils::executeCommand(version_command);
+}
+
+}  // namespace
+
+// The directory index is built in the constructor and read-only after
+// that, so lookups share it without locking. Each .list file is read once,
+// under its own once_flag: resolver threads wait only for a list they
+// need that another thread is still reading.
+class DpkgDatabase::LazyIndex {
+ public:
+  explicit LazyIndex(const Options& options) : options_(options) {
+    refresh();
+    lists_ = std::make_unique<PackageList[]>(packages_.size());
+  }
+
+  bool findOwner(const std::string& path, DebianPackageOwner& owner) {
+    auto candidates = dir_packages_.find(parentDirectory(path));
+    if (candidates == dir_packages_.end()) {
+      return false;
+    }
+    for (uint32_t id : candidates->second) {
+      const Package& package = packages_[id];
+      PackageList& list = lists_[id];
+      std::call_once(list.loaded, [&] { loadList(package, list); });
+      if (list.paths.count(path) == 0) {
+        continue;
+      }
+      std::call_once(versions_loaded_, [&] {
+        versions_ = loadInstalledVersions(options_.status_path);
+      });
+      owner.query_name = package.query_name;
+      owner.display_name = stripArchitectureSuffix(package.query_name);
+      owner.version = findInstalledVersion(versions_, package.query_name);
+      return true;
+    }
+    return false;
+  }
+
+  size_t loadedListCount() const { return loaded_lists_.load(); }
+
+ private:
+  struct Package {
+    std::string query_name;
+    uint64_t mtime_ns = 0;
+    uint64_t size = 0;
+    std::vector<std::string> dirs;
+  };
+
+  // Paths owned by a package, read on first use.
+  struct PackageList {
+    std::once_flag loaded;
+    std::unordered_set<std::string> paths;
+  };
+
+  std::string listPath(const Package& package) const {
+    return options_.info_dir + "/" + package.query_name + ".list";
+  }
+
+  // Rebuild the directory index, re-reading only the .list files that
+  // changed since the cached index was written.
+  void refresh() {
+    std::unordered_map<std::string, Package> cached = loadCache();
+    bool changed = false;
+    size_t scanned = 0;
+
+    std::error_code ec;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(options_.info_dir, ec)) {
+      if (!isDpkgFileList(entry)) continue;
+
+      struct stat st;
+      if (stat(entry.path().c_str(), &st) != 0) continue;
+      Package package;
+      package.query_name = entry.path().stem().string();
+      package.mtime_ns = mtimeNs(st);
+      package.size = static_cast<uint64_t>(st.st_size);
+
+      auto it = cached.find(package.query_name);
+      if (it != cached.end() && it->second.mtime_ns == package.mtime_ns &&
+          it->second.size == package.size) {
+        package.dirs = std::move(it->second.dirs);
+        cached.erase(it);
+      } else {
+        scanDirectories(package);
+        ++scanned;
+        changed = true;
+      }
+      packages_.push_back(std::move(package));
+    }
+    // Whatever is left in |cached| has been removed from the system.
+    changed = changed || !cached.empty();
+
+    std::sort(packages_.begin(), packages_.end(),
+              [](const Package& a, const Package& b) {
+                return a.query_name < b.query_name;
+              });
+    for (uint32_t id = 0; id < packages_.size(); ++id) {
+      for (const auto& dir : packages_[id].dirs) {
+        dir_packages_[dir].push_back(id);
+      }
+    }
+    Logger::debug("dpkg directory index: " + std::to_string(packages_.size()) +
+                  " packages, " + std::to_string(dir_packages_.size()) +
+                  " directories, " + std::to_string(scanned) + " lists read");
+
+    if (changed && !options_.cache_path.empty() && !saveCache()) {
+      Logger::debug("Could not cache dpkg directory index at " +
+                    options_.cache_path);
+    }
+  }
+
+  void scanDirectories(Package& package) const {
+    std::unordered_set<std::string> dirs;
+    std::ifstream list_file(listPath(package));
+    std::string owned_path;
+    while (std::getline(list_file, owned_path)) {
+      if (!owned_path.empty()) {
+        dirs.insert(parentDirectory(owned_path));
+      }
+    }
+    package.dirs.assign(dirs.begin(), dirs.end());
+    std::sort(package.dirs.begin(), package.dirs.end());
+  }
+
+  void loadList(const Package& package, PackageList& list) {
+    std::ifstream list_file(listPath(package));
+    std::string owned_path;
+    while (std::getline(list_file, owned_path)) {
+      if (!owned_path.empty()) {
+        list.paths.insert(owned_path);
+      }
+    }
+    loaded_lists_.fetch_add(1);
+  }
+
+  // Cache format: a header line, then per package a line
+  // "P <mtime_ns> <size> <query_name>" followed by its directories, one
+  // per line.
+  std::unordered_map<std::string, Package> loadCache() const {
+    std::unordered_map<std::string, Package> cached;
+    if (options_.cache_path.empty()) {
+      return cached;
+    }
+    std::ifstream cache_file(options_.cache_path);
+    std::string line;
+    if (!std::getline(cache_file, line) || line != kDirIndexHeader) {
+      return cached;
+    }
+    Package* package = nullptr;
+    while (std::getline(cache_file, line)) {
+      if (Utils::startsWith(line, "P ")) {
+        Package entry;
+        const size_t size_pos = line.find(' ', 2);
+        const size_t name_pos =
+            size_pos == std::string::npos ? size_pos : line.find(' ', size_pos + 1);
+        if (name_pos == std::string::npos) {
+          return {};
+        }
+        entry.mtime_ns = std::strtoull(line.c_str() + 2, nullptr, 10);
+        entry.size = std::strtoull(line.c_str() + size_pos + 1, nullptr, 10);
+        entry.query_name = line.substr(name_pos + 1);
+        package = &(cached[entry.query_name] = std::move(entry));
+      } else if (package && !line.empty() && line[0] == '/') {
+        package->dirs.push_back(line);
+      } else {
+        return {};
+      }
+    }
+    return cached;
+  }
+
+  bool saveCache() const {
+    std::error_code ec;
+    std::filesystem::create_directories(
+        std::filesystem::path(options_.cache_path).parent_path(), ec);
+    const std::string tmp_path = options_.cache_path + ".tmp." +
+                                 std::to_string(getpid());
+    {
+      std::ofstream cache_file(tmp_path);
+      cache_file << kDirIndexHeader << '\n';
+      for (const auto& package : packages_) {
+        cache_file << "P " << package.mtime_ns << ' ' << package.size << ' '
+                   << package.query_name << '\n';
+        for (const auto& dir : package.dirs) {
+          cache_file << dir << '\n';
+        }
+      }
+      if (!cache_file.flush()) {
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+      }
+    }
+    std::filesystem::rename(tmp_path, options_.cache_path, ec);
+    if (ec) {
+      std::filesystem::remove(tmp_path, ec);
+      return false;
+    }
+    return true;
+  }
+
+  const Options& options_;
+  std::vector<Package> packages_;
+  std::unordered_map<std::string, std::vector<uint32_t>> dir_packages_;
+  std::unique_ptr<PackageList[]> lists_;  // indexed like |packages_|
+  std::once_flag versions_loaded_;
+  std::unordered_map<std::string, std::string> versions_;
+  std::atomic<size_t> loaded_lists_{0};
+};
+
+DpkgDatabase::DpkgDatabase(Options options) : options_(std::move(options)) {
+  if (options_.mode == Mode::LAZY) {
+    lazy_ = std::make_unique<LazyIndex>(options_);
+    return;
+  }
+
+  // The index is rebuilt whenever dpkg rewrites its status file, which it
+  // does on every package change.
+  struct stat st;
+  const uint64_t stamp =
+      stat(options_.status_path.c_str(), &st) == 0 ? mtimeNs(st) : 0;
+  if (!options_.cache_path.empty() &&
+      index_.load(options_.cache_path, stamp)) {
+    Logger::debug("Loaded dpkg ownership index " + options_.cache_path);
+    return;
+  }
+
+  const auto package_versions = loadInstalledVersions(options_.status_path);
+  OwnershipIndex::Builder builder;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(options_.info_dir, ec)) {
+    if (!isDpkgFileList(entry)) continue;
+
+    const std::string query_name = entry.path().stem().string();
+    const uint32_t package = builder.addPackage(
+        query_name, findInstalledVersion(package_versions, query_name));
+    std::ifstream list_file(entry.path());
+    std::string owned_path;
+    while (std::getline(list_file, owned_path)) {
+      if (!owned_path.empty()) {
+        builder.addPath(owned_path, package);
+      }
+    }
+  }
+  index_ = builder.build(stamp);
+  Logger::debug("Indexed " + std::to_string(index_.pathCount()) +
+                " paths of " + std::to_string(index_.packageCount()) +
+                " dpkg packages");
+  if (!options_.cache_path.empty() && !index_.save(options_.cache_path)) {
+    Logger::debug("Could not cache dpkg ownership index at " +
+                  options_.cache_path);
+  }
+}
+
+DpkgDatabase::~DpkgDatabase() = default;
+
+const DpkgDatabase& DpkgDatabase::instance() {
+  static const DpkgDatabase database([]() {
+    Options options;
+    const char* lookup = std::getenv("REPROBUILD_DPKG_LOOKUP");
+    options.mode = lookup && std::string(lookup) == "lazy" ? Mode::LAZY
+                                                           : Mode::INDEX;
+    // REPROBUILD_DPKG_INDEX overrides the cache file of either mode.
+    if (const char* env = std::getenv("REPROBUILD_DPKG_INDEX")) {
+      options.cache_path = env;
+    } else if (const std::string cache_dir = Utils::userCacheDir();
+               !cache_dir.empty()) {
+      options.cache_path = cache_dir + (options.mode == Mode::LAZY
+                                            ? "/dpkg_dirs.idx"
+                                            : "/dpkg_owners.idx");
+    }
+    return options;
+  }());
+  return database;
+}
+
+bool DpkgDatabase::findOwner(const std::string& raw_path,
+                             const std::string& real_path,
+                             DebianPackageOwner& owner) const {
+  if (lazy_) {
+    return lazy_->findOwner(raw_path, owner) ||
+           lazy_->findOwner(real_path, owner);
+  }
+
+  OwnershipIndex::Package package;
+  if (!index_.findOwner(raw_path, package) &&
+      !index_.findOwner(real_path, package)) {
+    return false;
+  }
+  owner.query_name.assign(package.name);
+  owner.display_name = stripArchitectureSuffix(owner.query_name);
+  owner.version.assign(package.version);
+  return true;
+}
+
+std::string DpkgDatabase::findVersion(const DebianPackageOwner& owner) const {
+  if (!owner.version.empty()) {
+    return owner.version;
+  }
+  return fallbackDpkgQuery(owner);
+}
+
+size_t DpkgDatabase::loadedListCount() const {
+  return lazy_ ? lazy_->loadedListCount() : 0;
+}
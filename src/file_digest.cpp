@@ -0,0 +1,97 @@
+#include "file_digest.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+#include <openssl/evp.h>
+
+namespace {
+// Files up to this size are read with a single read() call.
+const size_t kMaxBlockSize = 1024 * 1024;
+const size_t kMinBlockSize = 64 * 1024;
+
+const EVP_MD* sha256Method() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  // Fetch once; EVP_sha256() makes every EVP_DigestInit_ex() look the
+  // implementation up again.
+  static EVP_MD* const md = EVP_MD_fetch(nullptr, "SHA256", nullptr);
+  return md ? md : EVP_sha256();
+#else
+  return EVP_sha256();
+#endif
+}
+
+struct ThreadState {
+  ThreadState() : ctx(EVP_MD_CTX_new()) {}
+  ~ThreadState() { EVP_MD_CTX_free(ctx); }
+
+  EVP_MD_CTX* ctx;
+  std::vector<unsigned char> buffer;
+};
+
+ThreadState& threadState() {
+  thread_local ThreadState state;
+  return state;
+}
+}  // namespace
+
+namespace FileDigest {
+
+bool sha256(int fd, uint64_t size_hint, Digest& digest) {
+  ThreadState& state = threadState();
+  if (!state.ctx || EVP_DigestInit_ex(state.ctx, sha256Method(), nullptr) != 1) {
+    return false;
+  }
+
+  // One extra byte lets a file of exactly |size_hint| bytes hit EOF
+  // without a second full-sized read.
+  const size_t block_size = static_cast<size_t>(std::clamp<uint64_t>(
+      size_hint + 1, kMinBlockSize, kMaxBlockSize));
+  if (state.buffer.size() < block_size) {
+    state.buffer.resize(block_size);
+  }
+  // Large files are read front to back with plain read() calls rather
+  // than mapped, so a file truncated while it is hashed ends the loop
+  // early instead of raising SIGBUS.
+  if (size_hint >= kMaxBlockSize) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+  while (true) {
+    const ssize_t bytes_read = read(fd, state.buffer.data(), block_size);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0) {
+      return false;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    if (EVP_DigestUpdate(state.ctx, state.buffer.data(),
+                         static_cast<size_t>(bytes_read)) != 1) {
+      return false;
+    }
+  }
+
+  unsigned int digest_len = 0;
+  return EVP_DigestFinal_ex(state.ctx, digest.data(), &digest_len) == 1 &&
+         digest_len == digest.size();
+}
+
+std::string toHex(const Digest& digest) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string hex;
+  hex.resize(digest.size() * 2);
+  for (size_t i = 0; i < digest.size(); ++i) {
+    hex[2 * i] = kHex[digest[i] >> 4];
+    hex[2 * i + 1] = kHex[digest[i] & 0x0f];
+  }
+  return hex;
+}
+
+}  // namespace FileDigest
@@ -0,0 +1,92 @@
+#include "file_hasher.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <exception>
+
+#include "concurrency.h"
+#include "utils.h"
+
+FileHasher::FileHasher(size_t threads) : pool_(std::max<size_t>(1, threads)) {}
+
+FileHasher& FileHasher::instance() {
+  static FileHasher hasher(Concurrency::current().io_threads);
+  return hasher;
+}
+
+std::string FileHasher::hash(const std::string& path) {
+  std::shared_future<std::string> result;
+  std::unique_ptr<std::promise<std::string>> promise;
+  if (!claim(path, result, promise)) {
+    return "";
+  }
+  if (promise) {
+    compute(path, *promise);
+  }
+  return result.get();
+}
+
+void FileHasher::prefetch(const std::vector<std::string>& paths) {
+  for (const auto& path : paths) {
+    std::shared_future<std::string> result;
+    std::unique_ptr<std::promise<std::string>> promise;
+    if (!claim(path, result, promise) || !promise) {
+      continue;
+    }
+    pool_.submit([path, promise = std::move(promise)]() {
+      compute(path, *promise);
+    });
+  }
+}
+
+size_t FileHasher::hashedCount() const {
+  size_t count = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    count += shard.entries.size();
+  }
+  return count;
+}
+
+size_t FileHasher::reusedCount() const {
+  size_t count = 0;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    count += shard.reused;
+  }
+  return count;
+}
+
+bool FileHasher::claim(const std::string& path,
+                       std::shared_future<std::string>& result,
+                       std::unique_ptr<std::promise<std::string>>& claim) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  const Key key{static_cast<uint64_t>(st.st_dev),
+                static_cast<uint64_t>(st.st_ino)};
+  Shard& shard = shards_[KeyHash()(key) % kShardCount];
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    ++shard.reused;
+    result = it->second;
+    return true;
+  }
+  claim = std::make_unique<std::promise<std::string>>();
+  result = claim->get_future().share();
+  shard.entries.emplace(key, result);
+  return true;
+}
+
+void FileHasher::compute(const std::string& path,
+                         std::promise<std::string>& promise) {
+  try {
+    promise.set_value(Utils::calculateFileHash(path));
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+  }
+}
@@ -0,0 +1,280 @@
+#include "hash_cache.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+const char kMagic[8] = {'R', 'B', 'H', 'A', 'S', 'H', 'C', '\0'};
+const uint32_t kVersion = 1;
+
+// Upper bound on records kept on disk (about 70 MiB).
+const size_t kMaxRecords = 1000000;
+
+// Files changed this recently are not cached, see HashCache::store().
+const int64_t kRacyWindowNs = 2LL * 1000 * 1000 * 1000;
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t record_count;
+};
+
+int64_t toNs(const struct timespec& ts) {
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+bool writeAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t written = write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+  return true;
+}
+}  // namespace
+
+HashCache::~HashCache() { unmap(); }
+
+HashCache& HashCache::instance() {
+  static HashCache cache;
+  return cache;
+}
+
+std::string HashCache::defaultPath(const std::string& log_dir) {
+  if (const char* env = std::getenv("REPROBUILD_HASH_CACHE")) {
+    const std::string value = env;
+    if (value == "0" || value == "off") {
+      return "";
+    }
+    if (!value.empty()) {
+      return value;
+    }
+  }
+  const std::string cache_dir = Utils::userCacheDir();
+  if (!cache_dir.empty()) {
+    return cache_dir + "/hash_cache.bin";
+  }
+  return log_dir + "/reprobuild_hash_cache.bin";
+}
+
+bool HashCache::open(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  unmap();
+  added_.clear();
+  path_ = path;
+  if (path_.empty()) {
+    return false;
+  }
+
+  const int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    Logger::debug("No hash cache at " + path_);
+    return true;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+    close(fd);
+    return true;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    Logger::warn("Failed to map hash cache " + path_ + ": " +
+                 std::string(std::strerror(errno)));
+    return true;
+  }
+
+  FileHeader header;
+  std::memcpy(&header, mapping, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.record_size != sizeof(Record) ||
+      header.record_count != (size - sizeof(FileHeader)) / sizeof(Record) ||
+      (size - sizeof(FileHeader)) % sizeof(Record) != 0) {
+    Logger::warn("Ignoring malformed hash cache " + path_);
+    munmap(mapping, size);
+    return true;
+  }
+
+  mapping_ = mapping;
+  mapping_size_ = size;
+  records_ = reinterpret_cast<const Record*>(static_cast<const char*>(mapping) +
+                                             sizeof(FileHeader));
+  record_count_ = static_cast<size_t>(header.record_count);
+  used_.assign(record_count_, false);
+  Logger::debug("Loaded " + std::to_string(record_count_) +
+                " hash cache entries from " + path_);
+  return true;
+}
+
+bool HashCache::lookup(const struct stat& st, Digest& digest) {
+  if (!isOpen()) {
+    return false;
+  }
+  const Record wanted = makeRecord(st);
+  const Key key{wanted.dev, wanted.ino};
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto added = added_.find(key);
+  if (added != added_.end() && sameVersion(added->second, wanted)) {
+    digest = added->second.digest;
+    ++hits_;
+    return true;
+  }
+  const Record* mapped = findMapped(key);
+  if (mapped && sameVersion(*mapped, wanted)) {
+    used_[static_cast<size_t>(mapped - records_)] = true;
+    digest = mapped->digest;
+    ++hits_;
+    return true;
+  }
+  ++misses_;
+  return false;
+}
+
+void HashCache::store(const struct stat& st, const Digest& digest) {
+  if (!isOpen()) {
+    return;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  const int64_t racy_since = toNs(now) - kRacyWindowNs;
+  if (toNs(st.st_mtim) >= racy_since || toNs(st.st_ctim) >= racy_since) {
+    return;
+  }
+
+  Record record = makeRecord(st);
+  record.digest = digest;
+  std::lock_guard<std::mutex> lock(mutex_);
+  added_[Key{record.dev, record.ino}] = record;
+}
+
+bool HashCache::save() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (path_.empty()) {
+    return false;
+  }
+
+  // Merge both sorted sources. Records added this run replace mapped ones
+  // for the same inode; unused mapped records are dropped first when the
+  // cache is over its limit.
+  size_t unused = 0;
+  for (size_t i = 0; i < record_count_; ++i) {
+    unused += used_[i] ? 0 : 1;
+  }
+  const size_t total = record_count_ + added_.size();
+  size_t droppable = total > kMaxRecords ? total - kMaxRecords : 0;
+
+  std::vector<Record> merged;
+  merged.reserve(std::min(total, kMaxRecords + unused));
+  auto added = added_.begin();
+  for (size_t i = 0; i < record_count_; ++i) {
+    const Record& mapped = records_[i];
+    const Key key{mapped.dev, mapped.ino};
+    while (added != added_.end() && added->first < key) {
+      merged.push_back(added->second);
+      ++added;
+    }
+    if (added != added_.end() && added->first == key) {
+      continue;
+    }
+    if (!used_[i] && droppable > 0) {
+      --droppable;
+      continue;
+    }
+    merged.push_back(mapped);
+  }
+  for (; added != added_.end(); ++added) {
+    merged.push_back(added->second);
+  }
+
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path_).parent_path(), ec);
+  const std::string tmp_path = path_ + ".tmp." + std::to_string(getpid());
+  const int fd =
+      ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    Logger::warn("Failed to write hash cache " + tmp_path + ": " +
+                 std::string(std::strerror(errno)));
+    return false;
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.record_size = sizeof(Record);
+  header.record_count = merged.size();
+  const bool written =
+      writeAll(fd, &header, sizeof(header)) &&
+      writeAll(fd, merged.data(), merged.size() * sizeof(Record));
+  if (close(fd) != 0 || !written ||
+      rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    Logger::warn("Failed to write hash cache " + path_ + ": " +
+                 std::string(std::strerror(errno)));
+    unlink(tmp_path.c_str());
+    return false;
+  }
+
+  Logger::debug("Saved " + std::to_string(merged.size()) +
+                " hash cache entries to " + path_);
+  return true;
+}
+
+HashCache::Record HashCache::makeRecord(const struct stat& st) {
+  Record record{};
+  record.dev = static_cast<uint64_t>(st.st_dev);
+  record.ino = static_cast<uint64_t>(st.st_ino);
+  record.size = static_cast<uint64_t>(st.st_size);
+  record.mtime_ns = toNs(st.st_mtim);
+  record.ctime_ns = toNs(st.st_ctim);
+  return record;
+}
+
+bool HashCache::sameVersion(const Record& a, const Record& b) {
+  return a.size == b.size && a.mtime_ns == b.mtime_ns &&
+         a.ctime_ns == b.ctime_ns;
+}
+
+const HashCache::Record* HashCache::findMapped(const Key& key) const {
+  const Record* end = records_ + record_count_;
+  const Record* it = std::lower_bound(
+      records_, end, key, [](const Record& record, const Key& k) {
+        return Key{record.dev, record.ino} < k;
+      });
+  if (it == end || it->dev != key.first || it->ino != key.second) {
+    return nullptr;
+  }
+  return it;
+}
+
+void HashCache::unmap() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  records_ = nullptr;
+  record_count_ = 0;
+  used_.clear();
+}
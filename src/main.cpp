@@ -8,9 +8,12 @@
 
 #include "build_info.h"
 #include "bundle.h"
+#include "concurrency.h"
+#include "hash_cache.h"
 #include "logger.h"
 #include "postprocessor.h"
 #include "preprocessor.h"
+#include "trace_daemon.h"
 #include "tracker.h"
 #include "uploader.h"
 #include "utils.h"
@@ -44,14 +47,34 @@ void printUsage(const char* program_name) {
   std::cerr
       << "  -b, --bundle           Create a bundle from existing build record"
       << std::endl;
+  std::cerr << "  -i, --incremental      Reuse the existing output record for "
+               "dependency files that have not changed since it was written"
+            << std::endl;
+  std::cerr << "      --io-threads <n>   Threads for hashing and dependency "
+               "resolution (env: REPROBUILD_IO_THREADS; default: 2 per "
+               "core, at most 64)"
+            << std::endl;
+  std::cerr << "      --cpu-threads <n>  Threads for trace indexing (env: "
+               "REPROBUILD_CPU_THREADS; default: 1 per core)"
+            << std::endl;
+  std::cerr << "      --bundle-threads <n>  Threads compressing a .tar.* "
+               "bundle in parallel blocks (default: the CPU thread count; "
+               "1 writes a single stream)"
+            << std::endl;
   std::cerr << "  -h, --help             Show this help message" << std::endl;
+  std::cerr << std::string("Daemon: ") + program_name +
+                   " [-l <dir>] daemon  keeps the probes attached; builds "
+                   "run with REPROBUILD_TRACE_BACKEND=daemon or "
+                   "REPROBUILD_DAEMON_SOCKET are traced through it "
+                   "(default socket: $XDG_RUNTIME_DIR/reprobuild/daemon.sock)"
+            << std::endl;
   std::cerr << std::string("Example: ") + program_name +
                    " -o my_build.yaml -l /tmp/logs -g make clean all"
             << std::endl;
 }
 
 bool handleBundle(const std::string& record_path,
-                  const std::string& bundle_path) {
+                  const std::string& bundle_path, size_t threads) {
   BuildRecord record;
   try {
     record = BuildRecord::loadFromFile(record_path);
@@ -60,13 +83,22 @@ bool handleBundle(const std::string& record_path,
     return false;
   }
 
+  BundleTiming timing;
   try {
-    createBundle(record, bundle_path);
+    timing = createBundle(record, bundle_path, threads);
   } catch (const std::exception& e) {
     Logger::error("Failed to create bundle: " + std::string(e.what()));
     return false;
   }
 
+  Logger::info("Bundle time: " + std::to_string(timing.total_ms) + " ms");
+  Logger::info("Bundle detail: compress=" +
+               std::to_string(timing.compress_ms) +
+               " ms (summed over threads), compress_wait=" +
+               std::to_string(timing.compress_wait_ms) +
+               " ms, threads=" + std::to_string(timing.threads) +
+               ", blocks=" + std::to_string(timing.blocks));
+
   return true;
 }
 
@@ -76,6 +108,10 @@ int main(int argc, char* argv[]) {
   std::string graph_file;  // empty = disabled
   bool bundle = false;
   bool no_upload = false;
+  bool incremental = false;
+  size_t io_threads = 0;   // 0 = environment or automatic
+  size_t cpu_threads = 0;
+  size_t bundle_threads = 0;
 
   // Parse command line options
   // -g / --graph uses optional_argument: value attached with '=' or next token
@@ -84,12 +120,19 @@ int main(int argc, char* argv[]) {
                                          {"graph", optional_argument, 0, 'g'},
                                          {"bundle", no_argument, 0, 'b'},
                                          {"no-upload", no_argument, 0, 'n'},
+                                         {"incremental", no_argument, 0, 'i'},
                                          {"help", no_argument, 0, 'h'},
+                                         {"io-threads", required_argument, 0,
+                                          'I'},
+                                         {"cpu-threads", required_argument, 0,
+                                          'C'},
+                                         {"bundle-threads", required_argument,
+                                          0, 'B'},
                                          {0, 0, 0, 0}};
 
   int c;
   int option_index = 0;
-  while ((c = getopt_long(argc, argv, "o:l:g::bhn", long_options,
+  while ((c = getopt_long(argc, argv, "o:l:g::bhni", long_options,
                           &option_index)) != -1) {
     switch (c) {
       case 'o':
@@ -116,6 +159,23 @@ int main(int argc, char* argv[]) {
       case 'n':
         no_upload = true;
         break;
+      case 'i':
+        incremental = true;
+        break;
+      case 'I':
+      case 'C':
+      case 'B': {
+        const size_t count = Concurrency::parseThreadCount(optarg);
+        if (count == 0) {
+          std::cerr << "Invalid thread count: " << optarg << std::endl;
+          printUsage(argv[0]);
+          return 1;
+        }
+        (c == 'I'   ? io_threads
+         : c == 'C' ? cpu_threads
+                    : bundle_threads) = count;
+        break;
+      }
       default:
         break;
     }
@@ -127,10 +187,18 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  if (optind + 1 == argc && std::string(argv[optind]) == "daemon") {
+    Logger::setLevel(LogLevel::INFO);
+    Logger::setLevel();
+    TraceDaemon daemon(traceDaemonSocketPath(), log_dir);
+    return daemon.run();
+  }
+
   if (bundle) {
     std::string record_path = argv[optind];   // Input build record file
     std::string bundle_output = output_file;  // Output bundle file
-    if (!handleBundle(record_path, bundle_output)) {
+    Concurrency::configure(io_threads, cpu_threads);
+    if (!handleBundle(record_path, bundle_output, bundle_threads)) {
       return 1;
     }
     return 0;
@@ -147,6 +215,7 @@ int main(int argc, char* argv[]) {
   std::shared_ptr<BuildInfo> build_info = std::make_shared<BuildInfo>(
       Utils::joinCommand(build_command), output_file, log_dir);
   build_info->graph_output_file_ = graph_file;
+  build_info->incremental_ = incremental;
 
   Logger::setLevel(LogLevel::INFO);
   Logger::setLevel();
@@ -156,6 +225,8 @@ int main(int argc, char* argv[]) {
   preprocessor.fixMakefile();
 
   build_info->fillBuildRecordMetadata();
+  Concurrency::configure(io_threads, cpu_threads);
+  HashCache::instance().open(HashCache::defaultPath(log_dir));
   const auto preprocessing_end = Clock::now();
 
   Tracker tracker(build_info);
@@ -168,6 +239,17 @@ int main(int argc, char* argv[]) {
   }
 
   const auto postprocessing_start = Clock::now();
+  const auto hash_cache_save_start = Clock::now();
+  HashCache& hash_cache = HashCache::instance();
+  if (hash_cache.isOpen()) {
+    hash_cache.save();
+    Logger::info("Hash cache: " + std::to_string(hash_cache.hitCount()) +
+                 " hits, " + std::to_string(hash_cache.missCount()) +
+                 " misses");
+  }
+  const long long hash_cache_save_ms =
+      elapsedMs(hash_cache_save_start, Clock::now());
+
   const auto record_postprocess_start = Clock::now();
   Postprocessor postprocessor(build_info);
   postprocessor.postprocess();
@@ -216,6 +298,7 @@ int main(int argc, char* argv[]) {
                " ms");
   Logger::info("Postprocessing detail: tracker=" +
                std::to_string(tracker_timing.postprocessing_ms) +
+               " ms, hash_cache_save=" + std::to_string(hash_cache_save_ms) +
                " ms, git_postprocess=" +
                std::to_string(record_postprocess_ms) +
                " ms, record_save=" + std::to_string(record_save_ms) +
@@ -223,6 +306,8 @@ int main(int argc, char* argv[]) {
                " ms, upload=" + std::to_string(upload_ms) + " ms");
   Logger::info("Total tracking time: " + std::to_string(total_tracking_ms) +
                " ms");
+  Logger::info("Parallelism: " +
+               Concurrency::describe(Concurrency::current()));
   Logger::info("Build completed.");
   return 0;
 }
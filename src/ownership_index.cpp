@@ -0,0 +1,292 @@
+#include "ownership_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <utility>
+
+#include "logger.h"
+
+namespace {
+const char kMagic[8] = {'R', 'B', 'O', 'W', 'N', 'I', 'D', 'X'};
+const uint32_t kVersion = 1;
+}  // namespace
+
+struct OwnershipIndex::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t package_count;
+  uint64_t path_count;
+  uint64_t stamp;
+  uint64_t strings_size;
+};
+
+struct OwnershipIndex::PackageRecord {
+  uint32_t name_offset;
+  uint32_t name_length;
+  uint32_t version_offset;
+  uint32_t version_length;
+};
+
+struct OwnershipIndex::PathRecord {
+  uint32_t offset;
+  uint32_t length;
+  uint32_t package;
+};
+
+uint32_t OwnershipIndex::Builder::addPackage(std::string name,
+                                             std::string version) {
+  packages_.emplace_back(std::move(name), std::move(version));
+  return static_cast<uint32_t>(packages_.size() - 1);
+}
+
+void OwnershipIndex::Builder::addPath(std::string path, uint32_t package) {
+  const uint32_t order = static_cast<uint32_t>(paths_.size());
+  paths_.push_back({std::move(path), package, order});
+}
+
+OwnershipIndex OwnershipIndex::Builder::build(uint64_t stamp) {
+  std::sort(paths_.begin(), paths_.end(),
+            [](const PathEntry& a, const PathEntry& b) {
+              const int cmp = a.path.compare(b.path);
+              return cmp != 0 ? cmp < 0 : a.order < b.order;
+            });
+  paths_.erase(std::unique(paths_.begin(), paths_.end(),
+                           [](const PathEntry& a, const PathEntry& b) {
+                             return a.path == b.path;
+                           }),
+               paths_.end());
+
+  uint64_t strings_size = 0;
+  for (const auto& [name, version] : packages_) {
+    strings_size += name.size() + version.size();
+  }
+  for (const auto& entry : paths_) {
+    strings_size += entry.path.size();
+  }
+  if (strings_size > std::numeric_limits<uint32_t>::max()) {
+    Logger::warn("Package ownership index too large, not building it");
+    return OwnershipIndex();
+  }
+
+  const size_t size = sizeof(Header) + packages_.size() * sizeof(PackageRecord) +
+                      paths_.size() * sizeof(PathRecord) + strings_size;
+  OwnershipIndex index;
+  index.buffer_.resize(size);
+  char* out = index.buffer_.data();
+
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.package_count = static_cast<uint32_t>(packages_.size());
+  header.path_count = paths_.size();
+  header.stamp = stamp;
+  header.strings_size = strings_size;
+  std::memcpy(out, &header, sizeof(header));
+
+  char* records = out + sizeof(Header);
+  char* strings = records + packages_.size() * sizeof(PackageRecord) +
+                  paths_.size() * sizeof(PathRecord);
+  uint32_t string_offset = 0;
+  auto append_string = [&](const std::string& value) {
+    std::memcpy(strings + string_offset, value.data(), value.size());
+    const uint32_t offset = string_offset;
+    string_offset += static_cast<uint32_t>(value.size());
+    return offset;
+  };
+
+  for (const auto& [name, version] : packages_) {
+    PackageRecord record;
+    record.name_length = static_cast<uint32_t>(name.size());
+    record.name_offset = append_string(name);
+    record.version_length = static_cast<uint32_t>(version.size());
+    record.version_offset = append_string(version);
+    std::memcpy(records, &record, sizeof(record));
+    records += sizeof(record);
+  }
+  for (const auto& entry : paths_) {
+    PathRecord record;
+    record.length = static_cast<uint32_t>(entry.path.size());
+    record.offset = append_string(entry.path);
+    record.package = entry.package;
+    std::memcpy(records, &record, sizeof(record));
+    records += sizeof(record);
+  }
+
+  packages_.clear();
+  paths_.clear();
+  index.attach(index.buffer_.data(), index.buffer_.size(), stamp);
+  return index;
+}
+
+OwnershipIndex::~OwnershipIndex() { reset(); }
+
+OwnershipIndex::OwnershipIndex(OwnershipIndex&& other) noexcept {
+  *this = std::move(other);
+}
+
+OwnershipIndex& OwnershipIndex::operator=(OwnershipIndex&& other) noexcept {
+  if (this != &other) {
+    reset();
+    // Moving a vector keeps its heap block, so the view pointers stay valid.
+    buffer_ = std::move(other.buffer_);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+    mapping_size_ = std::exchange(other.mapping_size_, 0);
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    header_ = std::exchange(other.header_, nullptr);
+    packages_ = std::exchange(other.packages_, nullptr);
+    paths_ = std::exchange(other.paths_, nullptr);
+    strings_ = std::exchange(other.strings_, nullptr);
+  }
+  return *this;
+}
+
+bool OwnershipIndex::load(const std::string& path, uint64_t stamp) {
+  reset();
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(Header)) {
+    close(fd);
+    return false;
+  }
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+  if (!attach(static_cast<const char*>(mapping), size, stamp)) {
+    munmap(mapping, size);
+    return false;
+  }
+  mapping_ = mapping;
+  mapping_size_ = size;
+  return true;
+}
+
+bool OwnershipIndex::save(const std::string& path) const {
+  if (!valid()) {
+    return false;
+  }
+  std::error_code ec;
+  std::filesystem::create_directories(
+      std::filesystem::path(path).parent_path(), ec);
+
+  const std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  const int fd =
+      open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  const char* data = data_;
+  size_t remaining = size_;
+  bool written = true;
+  while (remaining > 0) {
+    const ssize_t n = write(fd, data, remaining);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      written = false;
+      break;
+    }
+    data += n;
+    remaining -= static_cast<size_t>(n);
+  }
+  if (close(fd) != 0 || !written ||
+      rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool OwnershipIndex::findOwner(std::string_view path, Package& package) const {
+  if (!valid()) {
+    return false;
+  }
+  const PathRecord* begin = paths_;
+  const PathRecord* end = paths_ + header_->path_count;
+  const PathRecord* it = std::lower_bound(
+      begin, end, path, [this](const PathRecord& record, std::string_view p) {
+        return string(record.offset, record.length) < p;
+      });
+  if (it == end || string(it->offset, it->length) != path ||
+      it->package >= header_->package_count) {
+    return false;
+  }
+  const PackageRecord& record = packages_[it->package];
+  package.name = string(record.name_offset, record.name_length);
+  package.version = string(record.version_offset, record.version_length);
+  return true;
+}
+
+size_t OwnershipIndex::packageCount() const {
+  return header_ ? header_->package_count : 0;
+}
+
+size_t OwnershipIndex::pathCount() const {
+  return header_ ? static_cast<size_t>(header_->path_count) : 0;
+}
+
+bool OwnershipIndex::attach(const char* data, size_t size, uint64_t stamp) {
+  if (size < sizeof(Header)) {
+    return false;
+  }
+  const Header* header = reinterpret_cast<const Header*>(data);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->stamp != stamp) {
+    return false;
+  }
+  const uint64_t expected_size =
+      sizeof(Header) +
+      static_cast<uint64_t>(header->package_count) * sizeof(PackageRecord) +
+      header->path_count * sizeof(PathRecord) + header->strings_size;
+  if (header->path_count > size || expected_size != size) {
+    return false;
+  }
+
+  data_ = data;
+  size_ = size;
+  header_ = header;
+  packages_ = reinterpret_cast<const PackageRecord*>(data + sizeof(Header));
+  paths_ = reinterpret_cast<const PathRecord*>(packages_ +
+                                               header->package_count);
+  strings_ = reinterpret_cast<const char*>(paths_ + header->path_count);
+  return true;
+}
+
+std::string_view OwnershipIndex::string(uint32_t offset,
+                                        uint32_t length) const {
+  if (static_cast<uint64_t>(offset) + length > header_->strings_size) {
+    return {};
+  }
+  return std::string_view(strings_ + offset, length);
+}
+
+void OwnershipIndex::reset() {
+  if (mapping_) {
+    munmap(mapping_, mapping_size_);
+  }
+  mapping_ = nullptr;
+  mapping_size_ = 0;
+  buffer_.clear();
+  data_ = nullptr;
+  size_ = 0;
+  header_ = nullptr;
+  packages_ = nullptr;
+  paths_ = nullptr;
+  strings_ = nullptr;
+}
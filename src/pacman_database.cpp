@@ -0,0 +1,123 @@
+#include "pacman_database.h"
+
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <utility>
+
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+
+// Call |on_value| with each value line of a pacman database file and the
+// section it belongs to. Sections start with a "%NAME%" line and end at an
+// empty line.
+void readSections(
+    const std::filesystem::path& path,
+    const std::function<void(const std::string& section,
+                             const std::string& value)>& on_value) {
+  std::ifstream file(path);
+  std::string line;
+  std::string section;
+  while (std::getline(file, line)) {
+    if (line.empty()) {
+      section.clear();
+    } else if (line.front() == '%' && line.back() == '%') {
+      section = line;
+    } else if (!section.empty()) {
+      on_value(section, line);
+    }
+  }
+}
+
+}  // namespace
+
+PacmanDatabase::PacmanDatabase(Options options) : options_(std::move(options)) {
+  struct stat st;
+  if (stat(options_.local_dir.c_str(), &st) != 0) {
+    return;
+  }
+  const uint64_t stamp =
+      static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL +
+      static_cast<uint64_t>(st.st_mtim.tv_nsec);
+  if (!options_.cache_path.empty() &&
+      index_.load(options_.cache_path, stamp)) {
+    Logger::debug("Loaded pacman ownership index " + options_.cache_path);
+    return;
+  }
+
+  OwnershipIndex::Builder builder;
+  loadPackages(builder);
+  index_ = builder.build(stamp);
+  Logger::debug("Indexed " + std::to_string(index_.pathCount()) +
+                " paths of " + std::to_string(index_.packageCount()) +
+                " pacman packages");
+  if (!options_.cache_path.empty() && !index_.save(options_.cache_path)) {
+    Logger::debug("Could not cache pacman ownership index at " +
+                  options_.cache_path);
+  }
+}
+
+const PacmanDatabase& PacmanDatabase::instance() {
+  static const PacmanDatabase database([]() {
+    Options options;
+    if (const char* env = std::getenv("REPROBUILD_PACMAN_INDEX")) {
+      options.cache_path = env;
+    } else if (const std::string cache_dir = Utils::userCacheDir();
+               !cache_dir.empty()) {
+      options.cache_path = cache_dir + "/pacman_owners.idx";
+    }
+    return options;
+  }());
+  return database;
+}
+
+bool PacmanDatabase::findOwner(const std::string& raw_path,
+                               const std::string& real_path,
+                               PacmanPackageOwner& owner) const {
+  OwnershipIndex::Package package;
+  if (!index_.findOwner(raw_path, package) &&
+      !index_.findOwner(real_path, package)) {
+    return false;
+  }
+  owner.name.assign(package.name);
+  owner.version.assign(package.version);
+  return true;
+}
+
+void PacmanDatabase::loadPackages(OwnershipIndex::Builder& builder) const {
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(options_.local_dir, ec)) {
+    if (!entry.is_directory(ec)) continue;
+
+    std::string name;
+    std::string version;
+    readSections(entry.path() / "desc",
+                 [&](const std::string& section, const std::string& value) {
+                   if (section == "%NAME%" && name.empty()) {
+                     name = value;
+                   } else if (section == "%VERSION%" && version.empty()) {
+                     version = value;
+                   }
+                 });
+    if (name.empty()) continue;
+    const uint32_t package = builder.addPackage(name, version);
+
+    readSections(entry.path() / "files",
+                 [&](const std::string& section, const std::string& value) {
+                   if (section != "%FILES%") {
+                     return;
+                   }
+                   std::string path = "/" + value;
+                   if (path.size() > 1 && path.back() == '/') {
+                     path.pop_back();
+                   }
+                   builder.addPath(std::move(path), package);
+                 });
+  }
+}
@@ -0,0 +1,266 @@
+#include "ringbuf_tracer.h"
+
+#include <cstddef>
+#include <string_view>
+#include <utility>
+
+#include "trace_record.h"
+
+#ifdef REPROBUILD_HAVE_LIBBPF
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <fcntl.h>
+
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "logger.h"
+#include "trace.skel.h"
+#endif
+
+namespace {
+constexpr size_t kRecordHeaderSize = offsetof(reprobuild_trace_record, data);
+}  // namespace
+
+bool decodeTraceRecord(const void* data, size_t size, TraceEvent& event) {
+  if (size < kRecordHeaderSize) {
+    return false;
+  }
+
+  const auto* record = static_cast<const reprobuild_trace_record*>(data);
+  if (record->data_len > size - kRecordHeaderSize ||
+      record->path_len > record->data_len) {
+    return false;
+  }
+
+  event = TraceEvent{};
+  event.pid = static_cast<int>(record->pid);
+  switch (record->syscall) {
+    case REPROBUILD_SYSCALL_EXEC:
+      event.type = TraceEventType::EXEC;
+      break;
+    case REPROBUILD_SYSCALL_OPENAT:
+      event.type = TraceEventType::OPENAT;
+      event.flags = record->flags;
+      break;
+    case REPROBUILD_SYSCALL_CREAT:
+      event.type = TraceEventType::CREAT;
+      break;
+    default:
+      return false;
+  }
+
+  event.path = std::string_view(record->data, record->path_len);
+  if (event.type == TraceEventType::EXEC) {
+    std::string_view args(record->data + record->path_len,
+                          record->data_len - record->path_len);
+    if (!args.empty() && args.front() == ' ') {
+      args.remove_prefix(1);
+    }
+    event.args = args;
+  }
+  return !event.path.empty();
+}
+
+#ifdef REPROBUILD_HAVE_LIBBPF
+
+namespace {
+const int kRingbufPollTimeoutMs = 100;
+
+int forwardLibbpfLog(enum libbpf_print_level level, const char* format,
+                     va_list args) {
+  if (level == LIBBPF_DEBUG) {
+    return 0;
+  }
+  char buffer[512];
+  const int written = std::vsnprintf(buffer, sizeof(buffer), format, args);
+  std::string message(buffer);
+  while (!message.empty() && message.back() == '\n') {
+    message.pop_back();
+  }
+  Logger::debug("libbpf: " + message);
+  return written;
+}
+}  // namespace
+
+struct RingbufTracer::Impl {
+  EventHandler handler;
+  trace_bpf* skeleton = nullptr;
+  ring_buffer* ring = nullptr;
+  std::thread consumer;
+  std::atomic<bool> stopping{false};
+  size_t events = 0;
+  size_t dropped = 0;
+
+  static int onRecord(void* ctx, void* data, size_t size) {
+    auto* impl = static_cast<Impl*>(ctx);
+    TraceEvent event;
+    if (decodeTraceRecord(data, size, event)) {
+      ++impl->events;
+      impl->handler(event);
+    }
+    return 0;
+  }
+
+  size_t readDroppedCount() const {
+    const int cpus = libbpf_num_possible_cpus();
+    if (cpus <= 0) {
+      return 0;
+    }
+    std::vector<__u64> per_cpu(static_cast<size_t>(cpus), 0);
+    __u32 key = 0;
+    if (bpf_map_lookup_elem(bpf_map__fd(skeleton->maps.dropped), &key,
+                            per_cpu.data()) != 0) {
+      return 0;
+    }
+    size_t total = 0;
+    for (__u64 count : per_cpu) {
+      total += count;
+    }
+    return total;
+  }
+
+  void release() {
+    if (ring) {
+      ring_buffer__free(ring);
+      ring = nullptr;
+    }
+    if (skeleton) {
+      trace_bpf__destroy(skeleton);
+      skeleton = nullptr;
+    }
+  }
+};
+
+RingbufTracer::RingbufTracer(EventHandler handler) : impl_(new Impl) {
+  impl_->handler = std::move(handler);
+}
+
+RingbufTracer::~RingbufTracer() { stop(); }
+
+bool RingbufTracer::isAvailable() { return true; }
+
+bool RingbufTracer::start(pid_t root_pid,
+                          const std::vector<std::string>& ignore_prefixes) {
+  libbpf_set_print(forwardLibbpfLog);
+
+  impl_->skeleton = trace_bpf__open();
+  if (!impl_->skeleton) {
+    Logger::warn("Failed to open ring-buffer tracing program");
+    return false;
+  }
+
+  auto* rodata = impl_->skeleton->rodata;
+  __u32 prefix_count = 0;
+  for (const auto& prefix : ignore_prefixes) {
+    // A truncated prefix would drop more than was asked for.
+    if (prefix.empty() || prefix.size() >= REPROBUILD_TRACE_IGNORE_PREFIX_MAX) {
+      continue;
+    }
+    if (prefix_count == REPROBUILD_TRACE_MAX_IGNORE_PREFIXES) {
+      break;
+    }
+    auto& entry = rodata->ignore_prefixes[prefix_count++];
+    entry.len = static_cast<__u32>(prefix.size());
+    std::memcpy(entry.prefix, prefix.data(), prefix.size());
+  }
+  rodata->ignore_prefix_count = prefix_count;
+  rodata->skipped_open_flags = O_DIRECTORY;
+
+  if (trace_bpf__load(impl_->skeleton) != 0) {
+    Logger::warn("Failed to load ring-buffer tracing program");
+    impl_->release();
+    return false;
+  }
+
+  __u32 key = static_cast<__u32>(root_pid);
+  __u8 value = 1;
+  if (bpf_map_update_elem(bpf_map__fd(impl_->skeleton->maps.tracked), &key,
+                          &value, BPF_ANY) != 0) {
+    Logger::warn("Failed to register root PID with tracing program");
+    impl_->release();
+    return false;
+  }
+
+  if (trace_bpf__attach(impl_->skeleton) != 0) {
+    Logger::warn("Failed to attach ring-buffer tracing program");
+    impl_->release();
+    return false;
+  }
+
+  impl_->ring =
+      ring_buffer__new(bpf_map__fd(impl_->skeleton->maps.events),
+                       &Impl::onRecord, impl_.get(), nullptr);
+  if (!impl_->ring) {
+    Logger::warn("Failed to open tracing ring buffer");
+    impl_->release();
+    return false;
+  }
+
+  Impl* impl = impl_.get();
+  impl_->consumer = std::thread([impl]() {
+    while (!impl->stopping) {
+      const int result = ring_buffer__poll(impl->ring, kRingbufPollTimeoutMs);
+      if (result < 0 && result != -EINTR) {
+        Logger::warn("Failed to poll tracing ring buffer: " +
+                     std::to_string(result));
+        break;
+      }
+    }
+  });
+  return true;
+}
+
+void RingbufTracer::stop() {
+  if (!impl_->skeleton) {
+    return;
+  }
+
+  impl_->stopping = true;
+  if (impl_->consumer.joinable()) {
+    impl_->consumer.join();
+  }
+
+  // Records committed before the probes were detached are still buffered.
+  trace_bpf__detach(impl_->skeleton);
+  ring_buffer__consume(impl_->ring);
+  impl_->dropped = impl_->readDroppedCount();
+  if (impl_->dropped > 0) {
+    Logger::warn("Tracing ring buffer dropped " +
+                 std::to_string(impl_->dropped) + " records");
+  }
+  impl_->release();
+}
+
+size_t RingbufTracer::eventCount() const { return impl_->events; }
+
+size_t RingbufTracer::droppedCount() const { return impl_->dropped; }
+
+#else  // !REPROBUILD_HAVE_LIBBPF
+
+struct RingbufTracer::Impl {
+  EventHandler handler;
+};
+
+RingbufTracer::RingbufTracer(EventHandler handler) : impl_(new Impl) {
+  impl_->handler = std::move(handler);
+}
+
+RingbufTracer::~RingbufTracer() = default;
+
+bool RingbufTracer::isAvailable() { return false; }
+
+bool RingbufTracer::start(pid_t, const std::vector<std::string>&) {
+  return false;
+}
+
+void RingbufTracer::stop() {}
+
+size_t RingbufTracer::eventCount() const { return 0; }
+
+size_t RingbufTracer::droppedCount() const { return 0; }
+
+#endif  // REPROBUILD_HAVE_LIBBPF
@@ -0,0 +1,285 @@
+#include "rpm_database.h"
+
+#include <arpa/inet.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#ifdef REPROBUILD_HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include "logger.h"
+#include "utils.h"
+
+namespace {
+
+// Header tags and types used here, from rpm's rpmtag.h.
+const uint32_t kTagName = 1000;
+const uint32_t kTagVersion = 1001;
+const uint32_t kTagRelease = 1002;
+const uint32_t kTagEpoch = 1003;
+const uint32_t kTagArch = 1022;
+const uint32_t kTagOldFilenames = 1027;
+const uint32_t kTagDirIndexes = 1116;
+const uint32_t kTagBasenames = 1117;
+const uint32_t kTagDirnames = 1118;
+
+const uint32_t kTypeInt32 = 4;
+const uint32_t kTypeString = 6;
+const uint32_t kTypeStringArray = 8;
+const uint32_t kTypeI18nString = 9;
+
+const size_t kEntrySize = 16;
+
+uint32_t readBigEndian32(const unsigned char* data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return ntohl(value);
+}
+
+// Read |count| NUL-terminated strings starting at |offset| of |store|.
+bool readStrings(const unsigned char* store, size_t store_size, size_t offset,
+                 uint32_t count, std::vector<std::string>& strings) {
+  strings.clear();
+  for (uint32_t i = 0; i < count; ++i) {
+    if (offset >= store_size) {
+      return false;
+    }
+    const char* begin = reinterpret_cast<const char*>(store + offset);
+    const size_t length = strnlen(begin, store_size - offset);
+    if (offset + length >= store_size) {
+      return false;
+    }
+    strings.emplace_back(begin, length);
+    offset += length + 1;
+  }
+  return true;
+}
+
+uint64_t databaseStamp(const std::string& db_path) {
+  // rpm keeps the database in WAL mode; a transaction may only touch the
+  // -wal file until it is checkpointed.
+  uint64_t stamp = 0;
+  for (const std::string& path : {db_path, db_path + "-wal"}) {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      const uint64_t mtime_ns =
+          static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL +
+          static_cast<uint64_t>(st.st_mtim.tv_nsec);
+      stamp = std::max(stamp, mtime_ns);
+    }
+  }
+  return stamp;
+}
+
+}  // namespace
+
+RpmDatabase::RpmDatabase(Options options) : options_(std::move(options)) {
+  struct stat st;
+  if (stat(options_.db_path.c_str(), &st) != 0) {
+    return;
+  }
+  const uint64_t stamp = databaseStamp(options_.db_path);
+  if (!options_.cache_path.empty() &&
+      index_.load(options_.cache_path, stamp)) {
+    Logger::debug("Loaded rpm ownership index " + options_.cache_path);
+    return;
+  }
+
+  OwnershipIndex::Builder builder;
+  if (!loadPackages(builder)) {
+    return;
+  }
+  index_ = builder.build(stamp);
+  Logger::debug("Indexed " + std::to_string(index_.pathCount()) +
+                " paths of " + std::to_string(index_.packageCount()) +
+                " rpm packages");
+  if (!options_.cache_path.empty() && !index_.save(options_.cache_path)) {
+    Logger::debug("Could not cache rpm ownership index at " +
+                  options_.cache_path);
+  }
+}
+
+const RpmDatabase& RpmDatabase::instance() {
+  static const RpmDatabase database([]() {
+    Options options;
+    if (const char* env = std::getenv("REPROBUILD_RPM_INDEX")) {
+      options.cache_path = env;
+    } else if (const std::string cache_dir = Utils::userCacheDir();
+               !cache_dir.empty()) {
+      options.cache_path = cache_dir + "/rpm_owners.idx";
+    }
+    return options;
+  }());
+  return database;
+}
+
+bool RpmDatabase::findOwner(const std::string& raw_path,
+                            const std::string& real_path,
+                            RpmPackageOwner& owner) const {
+  OwnershipIndex::Package package;
+  if (!index_.findOwner(raw_path, package) &&
+      !index_.findOwner(real_path, package)) {
+    return false;
+  }
+  owner.name.assign(package.name);
+  owner.version.assign(package.version);
+  return true;
+}
+
+bool RpmDatabase::parseHeader(const void* blob, size_t size,
+                              RpmHeader& header) {
+  const auto* data = static_cast<const unsigned char*>(blob);
+  if (size < 8) {
+    return false;
+  }
+  const uint32_t index_count = readBigEndian32(data);
+  const uint32_t store_size = readBigEndian32(data + 4);
+  if (index_count > (size - 8) / kEntrySize ||
+      8 + index_count * kEntrySize + static_cast<size_t>(store_size) > size) {
+    return false;
+  }
+  const unsigned char* store = data + 8 + index_count * kEntrySize;
+
+  header = RpmHeader();
+  std::vector<std::string> basenames;
+  std::vector<std::string> dirnames;
+  std::vector<uint32_t> dir_indexes;
+  std::vector<std::string> strings;
+  for (uint32_t i = 0; i < index_count; ++i) {
+    const unsigned char* entry = data + 8 + i * kEntrySize;
+    const uint32_t tag = readBigEndian32(entry);
+    const uint32_t type = readBigEndian32(entry + 4);
+    const uint32_t offset = readBigEndian32(entry + 8);
+    const uint32_t count = readBigEndian32(entry + 12);
+    if (offset >= store_size) {
+      continue;  // ignore entries pointing outside the data store
+    }
+
+    if (type == kTypeString || type == kTypeI18nString) {
+      if (!readStrings(store, store_size, offset, 1, strings)) {
+        return false;
+      }
+      switch (tag) {
+        case kTagName:
+          header.name = std::move(strings[0]);
+          break;
+        case kTagVersion:
+          header.version = std::move(strings[0]);
+          break;
+        case kTagRelease:
+          header.release = std::move(strings[0]);
+          break;
+        case kTagArch:
+          header.arch = std::move(strings[0]);
+          break;
+        default:
+          break;
+      }
+    } else if (type == kTypeStringArray &&
+               (tag == kTagBasenames || tag == kTagDirnames ||
+                tag == kTagOldFilenames)) {
+      if (!readStrings(store, store_size, offset, count, strings)) {
+        return false;
+      }
+      if (tag == kTagBasenames) {
+        basenames = std::move(strings);
+      } else if (tag == kTagDirnames) {
+        dirnames = std::move(strings);
+      } else {
+        header.files = std::move(strings);
+      }
+    } else if (type == kTypeInt32 &&
+               (tag == kTagDirIndexes || tag == kTagEpoch)) {
+      if (count > (store_size - offset) / 4) {
+        return false;
+      }
+      if (tag == kTagEpoch) {
+        header.epoch = count > 0 ? readBigEndian32(store + offset) : 0;
+        continue;
+      }
+      dir_indexes.resize(count);
+      for (uint32_t j = 0; j < count; ++j) {
+        dir_indexes[j] = readBigEndian32(store + offset + 4 * j);
+      }
+    }
+  }
+
+  if (header.name.empty()) {
+    return false;
+  }
+  if (!basenames.empty()) {
+    if (dir_indexes.size() != basenames.size()) {
+      return false;
+    }
+    header.files.clear();
+    header.files.reserve(basenames.size());
+    for (size_t j = 0; j < basenames.size(); ++j) {
+      if (dir_indexes[j] >= dirnames.size()) {
+        return false;
+      }
+      header.files.push_back(dirnames[dir_indexes[j]] + basenames[j]);
+    }
+  }
+  return true;
+}
+
+bool RpmDatabase::loadPackages(OwnershipIndex::Builder& builder) const {
+#ifdef REPROBUILD_HAVE_SQLITE
+  sqlite3* db = nullptr;
+  if (sqlite3_open_v2(options_.db_path.c_str(), &db, SQLITE_OPEN_READONLY,
+                      nullptr) != SQLITE_OK) {
+    Logger::warn("Failed to open rpm database " + options_.db_path + ": " +
+                 std::string(db ? sqlite3_errmsg(db) : "out of memory"));
+    sqlite3_close(db);
+    return false;
+  }
+
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v2(db, "SELECT blob FROM Packages", -1, &statement,
+                         nullptr) != SQLITE_OK) {
+    Logger::warn("Failed to read rpm database " + options_.db_path + ": " +
+                 std::string(sqlite3_errmsg(db)));
+    sqlite3_close(db);
+    return false;
+  }
+
+  size_t malformed = 0;
+  int rc;
+  RpmHeader header;
+  while ((rc = sqlite3_step(statement)) == SQLITE_ROW) {
+    const void* blob = sqlite3_column_blob(statement, 0);
+    const int size = sqlite3_column_bytes(statement, 0);
+    if (!blob || size <= 0 ||
+        !parseHeader(blob, static_cast<size_t>(size), header)) {
+      ++malformed;
+      continue;
+    }
+    const uint32_t package =
+        builder.addPackage(header.name, header.versionRelease());
+    for (auto& file : header.files) {
+      builder.addPath(std::move(file), package);
+    }
+  }
+  const bool ok = rc == SQLITE_DONE;
+  if (!ok) {
+    Logger::warn("Failed to read rpm database " + options_.db_path + ": " +
+                 std::string(sqlite3_errmsg(db)));
+  }
+  if (malformed > 0) {
+    Logger::warn("Skipped " + std::to_string(malformed) +
+                 " unreadable rpm headers in " + options_.db_path);
+  }
+  sqlite3_finalize(statement);
+  sqlite3_close(db);
+  return ok;
+#else
+  Logger::debug("Built without SQLite, cannot read " + options_.db_path);
+  (void)builder;
+  return false;
+#endif
+}
@@ -0,0 +1,611 @@
+#include "s3_client.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/hmac.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+
+#include "logger.h"
+
+namespace {
+// Idle connections kept per client; more than the upload threads is waste.
+const size_t kMaxIdleConnections = 32;
+
+// Page size requested from ListObjectsV2; 1000 is the S3 maximum.
+const int kListPageSize = 1000;
+
+// Query parameters that are part of the resource signed by AWS v2.
+const char* const kSubresources[] = {"partNumber", "uploadId", "uploads"};
+
+std::string toLower(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return text;
+}
+
+std::string base64Encode(const unsigned char* input, size_t length) {
+  static const char encoding_table[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string encoded;
+  encoded.reserve((length + 2) / 3 * 4);
+  size_t i = 0;
+  for (; i + 2 < length; i += 3) {
+    const unsigned value =
+        (input[i] << 16) | (input[i + 1] << 8) | input[i + 2];
+    encoded += encoding_table[(value >> 18) & 0x3f];
+    encoded += encoding_table[(value >> 12) & 0x3f];
+    encoded += encoding_table[(value >> 6) & 0x3f];
+    encoded += encoding_table[value & 0x3f];
+  }
+  if (i < length) {
+    unsigned value = input[i] << 16;
+    if (i + 1 < length) {
+      value |= input[i + 1] << 8;
+    }
+    encoded += encoding_table[(value >> 18) & 0x3f];
+    encoded += encoding_table[(value >> 12) & 0x3f];
+    encoded += i + 1 < length ? encoding_table[(value >> 6) & 0x3f] : '=';
+    encoded += '=';
+  }
+  return encoded;
+}
+
+// Contents of every <tag>...</tag> in |xml|, with the five predefined
+// entities decoded.
+std::vector<std::string> xmlElements(const std::string& xml,
+                                     const std::string& tag) {
+  std::vector<std::string> values;
+  const std::string open = "<" + tag + ">";
+  const std::string close = "</" + tag + ">";
+  size_t pos = 0;
+  while ((pos = xml.find(open, pos)) != std::string::npos) {
+    pos += open.size();
+    const size_t end = xml.find(close, pos);
+    if (end == std::string::npos) {
+      break;
+    }
+    std::string value;
+    for (size_t i = pos; i < end; ++i) {
+      if (xml[i] != '&') {
+        value += xml[i];
+        continue;
+      }
+      static const std::pair<const char*, char> kEntities[] = {
+          {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'},
+          {"&apos;", '\''}};
+      bool decoded = false;
+      for (const auto& [entity, character] : kEntities) {
+        if (xml.compare(i, std::strlen(entity), entity) == 0) {
+          value += character;
+          i += std::strlen(entity) - 1;
+          decoded = true;
+          break;
+        }
+      }
+      if (!decoded) {
+        value += '&';
+      }
+    }
+    values.push_back(std::move(value));
+    pos = end + close.size();
+  }
+  return values;
+}
+
+// "?a=1&b" -> the sub-resources among them, sorted, as signed by AWS v2.
+std::string canonicalSubresources(const std::string& query) {
+  std::vector<std::string> kept;
+  std::istringstream stream(query);
+  std::string param;
+  while (std::getline(stream, param, '&')) {
+    const std::string name = param.substr(0, param.find('='));
+    for (const char* subresource : kSubresources) {
+      if (name == subresource) {
+        kept.push_back(param);
+      }
+    }
+  }
+  std::sort(kept.begin(), kept.end());
+  std::string result;
+  for (const auto& item : kept) {
+    result += (result.empty() ? "?" : "&") + item;
+  }
+  return result;
+}
+}  // namespace
+
+HttpConnection::HttpConnection(std::string host, int port)
+    : host_(std::move(host)), port_(port) {}
+
+HttpConnection::~HttpConnection() { close(); }
+
+void HttpConnection::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  buffer_.clear();
+}
+
+bool HttpConnection::connect() {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = nullptr;
+  const std::string port = std::to_string(port_);
+  if (getaddrinfo(host_.c_str(), port.c_str(), &hints, &addresses) != 0) {
+    Logger::error("Cannot resolve " + host_);
+    return false;
+  }
+  for (struct addrinfo* address = addresses; address;
+       address = address->ai_next) {
+    fd_ = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+                 address->ai_protocol);
+    if (fd_ < 0) {
+      continue;
+    }
+    if (::connect(fd_, address->ai_addr, address->ai_addrlen) == 0) {
+      break;
+    }
+    ::close(fd_);
+    fd_ = -1;
+  }
+  freeaddrinfo(addresses);
+  if (fd_ < 0) {
+    Logger::error("Cannot connect to " + host_ + ":" + port + ": " +
+                  std::strerror(errno));
+    return false;
+  }
+  // Requests are written in one piece; do not hold back the last segment.
+  const int enable = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  return true;
+}
+
+bool HttpConnection::sendAll(std::string_view data) {
+  while (!data.empty()) {
+    const ssize_t written =
+        ::send(fd_, data.data(), data.size(), MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data.remove_prefix(static_cast<size_t>(written));
+  }
+  return true;
+}
+
+bool HttpConnection::fill(size_t size) {
+  char chunk[16384];
+  while (buffer_.size() < size) {
+    const ssize_t received = ::recv(fd_, chunk, sizeof(chunk), 0);
+    if (received < 0 && errno == EINTR) {
+      continue;
+    }
+    if (received <= 0) {
+      return false;
+    }
+    buffer_.append(chunk, static_cast<size_t>(received));
+  }
+  return true;
+}
+
+bool HttpConnection::readLine(std::string& line) {
+  size_t end;
+  while ((end = buffer_.find("\r\n")) == std::string::npos) {
+    if (!fill(buffer_.size() + 1)) {
+      return false;
+    }
+  }
+  line = buffer_.substr(0, end);
+  buffer_.erase(0, end + 2);
+  return true;
+}
+
+bool HttpConnection::readResponse(bool head_request, HttpResponse& response) {
+  std::string line;
+  if (!readLine(line) || line.compare(0, 5, "HTTP/") != 0) {
+    return false;
+  }
+  const size_t space = line.find(' ');
+  if (space == std::string::npos) {
+    return false;
+  }
+  response.status = std::atoi(line.c_str() + space + 1);
+
+  response.headers.clear();
+  while (readLine(line)) {
+    if (line.empty()) {
+      break;
+    }
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos) {
+      continue;
+    }
+    size_t value = colon + 1;
+    while (value < line.size() && line[value] == ' ') {
+      ++value;
+    }
+    response.headers[toLower(line.substr(0, colon))] = line.substr(value);
+  }
+  if (!line.empty()) {
+    return false;
+  }
+
+  response.body.clear();
+  const bool no_body = head_request || response.status == 204 ||
+                       response.status == 304 || response.status / 100 == 1;
+  auto encoding = response.headers.find("transfer-encoding");
+  auto length = response.headers.find("content-length");
+  if (no_body) {
+    // Nothing follows the headers.
+  } else if (encoding != response.headers.end() &&
+             toLower(encoding->second).find("chunked") != std::string::npos) {
+    for (;;) {
+      if (!readLine(line)) {
+        return false;
+      }
+      const size_t chunk_size = std::strtoul(line.c_str(), nullptr, 16);
+      if (chunk_size == 0) {
+        // Trailers, then the blank line ending the message.
+        while (readLine(line) && !line.empty()) {
+        }
+        break;
+      }
+      if (!fill(chunk_size + 2)) {
+        return false;
+      }
+      response.body.append(buffer_, 0, chunk_size);
+      buffer_.erase(0, chunk_size + 2);
+    }
+  } else if (length != response.headers.end()) {
+    const size_t size = std::strtoul(length->second.c_str(), nullptr, 10);
+    if (!fill(size)) {
+      return false;
+    }
+    response.body = buffer_.substr(0, size);
+    buffer_.erase(0, size);
+  } else {
+    // Delimited by the server closing the connection.
+    while (fill(buffer_.size() + 1)) {
+    }
+    response.body = std::move(buffer_);
+    close();
+    return true;
+  }
+
+  auto connection = response.headers.find("connection");
+  if (connection != response.headers.end() &&
+      toLower(connection->second) == "close") {
+    close();
+  }
+  return true;
+}
+
+bool HttpConnection::request(const std::string& method,
+                             const std::string& target,
+                             const std::vector<std::string>& headers,
+                             std::string_view body, HttpResponse& response) {
+  if (fd_ < 0 && !connect()) {
+    return false;
+  }
+  std::string head = method + " " + target + " HTTP/1.1\r\n";
+  head += "Host: " + host_ + ":" + std::to_string(port_) + "\r\n";
+  for (const auto& header : headers) {
+    head += header + "\r\n";
+  }
+  if (!body.empty() || method == "PUT" || method == "POST") {
+    head += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+  }
+  head += "\r\n";
+
+  if (!sendAll(head) || !sendAll(body) ||
+      !readResponse(method == "HEAD", response)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+S3Client::S3Client(std::string host, int port, std::string access_key,
+                   std::string secret_key, std::string bucket)
+    : host_(std::move(host)),
+      port_(port),
+      access_key_(std::move(access_key)),
+      secret_key_(std::move(secret_key)),
+      bucket_(std::move(bucket)) {}
+
+int S3Client::headObject(const std::string& key) {
+  return send("HEAD", key, "", {}, "", {}).status;
+}
+
+int S3Client::putObject(const std::string& key, std::string_view body,
+                        const std::string& content_type) {
+  return send("PUT", key, "", {}, content_type, body).status;
+}
+
+std::string S3Client::createMultipartUpload(const std::string& key,
+                                            const std::string& content_type) {
+  const HttpResponse response =
+      send("POST", key, "uploads", {}, content_type, {});
+  const auto ids = xmlElements(response.body, "UploadId");
+  if (response.status != 200 || ids.empty()) {
+    Logger::warn("Starting multipart upload of " + key + " failed (HTTP " +
+                 std::to_string(response.status) + ")");
+    return "";
+  }
+  return ids[0];
+}
+
+std::string S3Client::uploadPart(const std::string& key,
+                                 const std::string& upload_id,
+                                 int part_number, std::string_view body) {
+  const HttpResponse response =
+      send("PUT", key,
+           "partNumber=" + std::to_string(part_number) +
+               "&uploadId=" + urlEncode(upload_id),
+           {}, "", body);
+  auto etag = response.headers.find("etag");
+  if (response.status != 200 || etag == response.headers.end()) {
+    Logger::warn("Uploading part " + std::to_string(part_number) + " of " +
+                 key + " failed (HTTP " + std::to_string(response.status) +
+                 ")");
+    return "";
+  }
+  return etag->second;
+}
+
+bool S3Client::completeMultipartUpload(const std::string& key,
+                                       const std::string& upload_id,
+                                       const std::vector<std::string>& etags) {
+  std::string xml = "<CompleteMultipartUpload>";
+  for (size_t i = 0; i < etags.size(); ++i) {
+    xml += "<Part><PartNumber>" + std::to_string(i + 1) +
+           "</PartNumber><ETag>" + etags[i] + "</ETag></Part>";
+  }
+  xml += "</CompleteMultipartUpload>";
+  const HttpResponse response = send(
+      "POST", key, "uploadId=" + urlEncode(upload_id), {}, "application/xml",
+      xml);
+  // S3 may report a failed completion with 200 and an <Error> body.
+  if (response.status != 200 ||
+      response.body.find("<Error>") != std::string::npos) {
+    Logger::warn("Completing multipart upload of " + key + " failed (HTTP " +
+                 std::to_string(response.status) + ")");
+    return false;
+  }
+  return true;
+}
+
+void S3Client::abortMultipartUpload(const std::string& key,
+                                    const std::string& upload_id) {
+  send("DELETE", key, "uploadId=" + urlEncode(upload_id), {}, "", {});
+}
+
+bool S3Client::listObjects(const std::string& prefix,
+                           std::vector<std::string>& keys, size_t max_pages,
+                           bool* complete) {
+  if (complete) {
+    *complete = false;
+  }
+  std::string token;
+  for (size_t page = 0; max_pages == 0 || page < max_pages; ++page) {
+    std::string query = "list-type=2&max-keys=" +
+                        std::to_string(kListPageSize) +
+                        "&prefix=" + urlEncode(prefix);
+    if (!token.empty()) {
+      query += "&continuation-token=" + urlEncode(token);
+    }
+    const HttpResponse response = send("GET", "", query, {}, "", {});
+    if (response.status != 200) {
+      Logger::warn("Listing bucket " + bucket_ + " failed (HTTP " +
+                   std::to_string(response.status) + ")");
+      return false;
+    }
+    for (auto& key : xmlElements(response.body, "Key")) {
+      keys.push_back(std::move(key));
+    }
+    const auto truncated = xmlElements(response.body, "IsTruncated");
+    const auto next = xmlElements(response.body, "NextContinuationToken");
+    if (truncated.empty() || truncated[0] != "true" || next.empty()) {
+      if (complete) {
+        *complete = true;
+      }
+      return true;
+    }
+    token = next[0];
+  }
+  return true;
+}
+
+size_t S3Client::connectionCount() const {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  return opened_;
+}
+
+std::string S3Client::sign(const std::string& secret_key,
+                           const std::string& string_to_sign) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC(EVP_sha1(), secret_key.data(), static_cast<int>(secret_key.size()),
+       reinterpret_cast<const unsigned char*>(string_to_sign.data()),
+       string_to_sign.size(), digest, &digest_len);
+  return base64Encode(digest, digest_len);
+}
+
+std::string S3Client::rfc1123Date() {
+  time_t now = time(nullptr);
+  struct tm tm_info;
+  gmtime_r(&now, &tm_info);
+  char buffer[128];
+  strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+  return buffer;
+}
+
+std::string S3Client::urlEncode(const std::string& text) {
+  static const char kHex[] = "0123456789ABCDEF";
+  std::string encoded;
+  for (unsigned char c : text) {
+    if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      encoded += static_cast<char>(c);
+    } else {
+      encoded += '%';
+      encoded += kHex[c >> 4];
+      encoded += kHex[c & 0xf];
+    }
+  }
+  return encoded;
+}
+
+HttpResponse S3Client::send(const std::string& method, const std::string& key,
+                            const std::string& query,
+                            std::vector<std::string> headers,
+                            const std::string& content_type,
+                            std::string_view body) {
+  const std::string resource = "/" + bucket_ + "/" + key;
+  const std::string date = rfc1123Date();
+  // HTTP-VERB\nContent-MD5\nContent-Type\nDate\nCanonicalizedResource
+  const std::string string_to_sign = method + "\n\n" + content_type + "\n" +
+                                     date + "\n" + resource +
+                                     canonicalSubresources(query);
+  headers.push_back("Date: " + date);
+  if (!content_type.empty()) {
+    headers.push_back("Content-Type: " + content_type);
+  }
+  headers.push_back("Authorization: AWS " + access_key_ + ":" +
+                    sign(secret_key_, string_to_sign));
+  const std::string target = query.empty() ? resource : resource + "?" + query;
+
+  // POSTs (create and complete multipart) are not idempotent: they get a
+  // fresh connection, so a failure cannot be a stale socket, and are never
+  // replayed.
+  const bool replayable = method != "POST";
+  HttpResponse response;
+  bool allow_idle = replayable;
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    requests_.fetch_add(1);
+    bool reused = false;
+    std::unique_ptr<HttpConnection> connection = acquire(allow_idle, reused);
+    if (connection->request(method, target, headers, body, response)) {
+      release(std::move(connection));
+      return response;
+    }
+    // A pooled connection may have been closed by the server while idle,
+    // and then its pool mates most likely were too: drop them all and
+    // retry on a new connection. A fresh one failing means the server is
+    // unreachable.
+    if (!reused) {
+      break;
+    }
+    dropIdle();
+    allow_idle = false;
+  }
+  Logger::warn("S3 " + method + " " + resource + " failed");
+  response.status = 0;
+  return response;
+}
+
+std::unique_ptr<HttpConnection> S3Client::acquire(bool allow_idle,
+                                                  bool& reused) {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  if (allow_idle && !idle_.empty()) {
+    std::unique_ptr<HttpConnection> connection = std::move(idle_.back());
+    idle_.pop_back();
+    reused = true;
+    return connection;
+  }
+  ++opened_;
+  reused = false;
+  return std::make_unique<HttpConnection>(host_, port_);
+}
+
+void S3Client::dropIdle() {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  idle_.clear();
+}
+
+void S3Client::release(std::unique_ptr<HttpConnection> connection) {
+  if (!connection->isOpen()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  if (idle_.size() < kMaxIdleConnections) {
+    idle_.push_back(std::move(connection));
+  }
+}
+
+S3ObjectWriter::S3ObjectWriter(S3Client& client, std::string key,
+                               std::string content_type, size_t part_size)
+    : client_(client),
+      key_(std::move(key)),
+      content_type_(std::move(content_type)),
+      part_size_(part_size) {
+  buffer_.reserve(part_size_);
+}
+
+S3ObjectWriter::~S3ObjectWriter() {
+  if (!upload_id_.empty() && !finished_) {
+    client_.abortMultipartUpload(key_, upload_id_);
+  }
+}
+
+bool S3ObjectWriter::write(std::string_view data) {
+  while (!failed_ && !data.empty()) {
+    const size_t piece = std::min(data.size(), part_size_ - buffer_.size());
+    buffer_.append(data.data(), piece);
+    data.remove_prefix(piece);
+    // Keep a full buffer until more data arrives: the last part may not be
+    // empty, and a single-part object is cheaper as a plain PUT.
+    if (!data.empty() && buffer_.size() == part_size_) {
+      failed_ = !flushPart();
+    }
+  }
+  return !failed_;
+}
+
+bool S3ObjectWriter::flushPart() {
+  if (upload_id_.empty()) {
+    upload_id_ = client_.createMultipartUpload(key_, content_type_);
+    if (upload_id_.empty()) {
+      return false;
+    }
+  }
+  const std::string etag = client_.uploadPart(
+      key_, upload_id_, static_cast<int>(etags_.size() + 1), buffer_);
+  if (etag.empty()) {
+    return false;
+  }
+  etags_.push_back(etag);
+  buffer_.clear();
+  return true;
+}
+
+bool S3ObjectWriter::finish() {
+  if (failed_ || finished_) {
+    return false;
+  }
+  finished_ = true;
+  if (upload_id_.empty()) {
+    const int status = client_.putObject(key_, buffer_, content_type_);
+    return status == 200 || status == 201;
+  }
+  if (!flushPart() ||
+      !client_.completeMultipartUpload(key_, upload_id_, etags_)) {
+    client_.abortMultipartUpload(key_, upload_id_);
+    return false;
+  }
+  return true;
+}
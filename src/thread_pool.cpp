@@ -1,30 +1,107 @@
 #include "thread_pool.h"
 
-ThreadPool::ThreadPool(size_t threads) : stop(false) {
-  for (size_t i = 0; i < threads; ++i)
-    workers.emplace_back([this] {
-      for (;;) {
-        std::function<void()> task;
-
-        {
-          std::unique_lock<std::mutex> lock(this->queue_mutex);
-          this->condition.wait(
-              lock, [this] { return this->stop || !this->tasks.empty(); });
-          if (this->stop && this->tasks.empty()) return;
-          task = std::move(this->tasks.front());
-          this->tasks.pop();
-        }
-
-        task();
-      }
-    });
+namespace {
+// Pool and deque index of the calling thread if it is a pool worker.
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+  for (size_t i = 0; i < threads; ++i) {
+    queues_.push_back(std::make_unique<WorkerQueue>());
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    workers_.emplace_back([this, i] { workerLoop(i); });
+  }
 }
 
 ThreadPool::~ThreadPool() {
   {
-    std::unique_lock<std::mutex> lock(queue_mutex);
-    stop = true;
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stop_ = true;
+  }
+  sleep_cv_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+}
+
+void ThreadPool::submit(Task task) {
+  if (workers_.empty()) {
+    task();
+    return;
+  }
+  push(std::move(task));
+  wake(false);
+}
+
+void ThreadPool::push(Task task) {
+  const size_t index = current_pool == this
+                           ? current_queue
+                           : next_queue_.fetch_add(1) % queues_.size();
+  // Count the task before it becomes visible so takers never underflow.
+  pending_.fetch_add(1);
+  WorkerQueue& queue = *queues_[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  queue.tasks.push_back(std::move(task));
+}
+
+void ThreadPool::wake(bool all) {
+  // A worker registers as sleeper before its last look at |pending_|, so
+  // either it sees the new task or we see it and notify under the lock.
+  if (sleepers_.load() == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(sleep_mutex_);
+  if (all) {
+    sleep_cv_.notify_all();
+  } else {
+    sleep_cv_.notify_one();
+  }
+}
+
+bool ThreadPool::takeTask(size_t index, Task& task) {
+  {
+    WorkerQueue& own = *queues_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      pending_.fetch_sub(1);
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    WorkerQueue& victim = *queues_[(index + i) % queues_.size()];
+    std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+    if (lock.owns_lock() && !victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending_.fetch_sub(1);
+      return true;
+    }
   }
-  condition.notify_all();
-  for (std::thread& worker : workers) worker.join();
-}
\ No newline at end of file
+  return false;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+  current_pool = this;
+  current_queue = index;
+  Task task;
+  for (;;) {
+    if (takeTask(index, task)) {
+      task();
+      task = Task();
+      continue;
+    }
+    if (pending_.load() > 0) {
+      // Queued somewhere, but the deque was busy or not yet filled.
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleepers_.fetch_add(1);
+    sleep_cv_.wait(lock, [this] { return stop_ || pending_.load() > 0; });
+    sleepers_.fetch_sub(1);
+    if (stop_ && pending_.load() == 0) return;
+  }
+}
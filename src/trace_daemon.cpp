@@ -0,0 +1,668 @@
+#include "trace_daemon.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#include "bpftrace_script.h"
+#include "logger.h"
+#include "tracker.h"
+
+namespace {
+const char* const kSocketName = "daemon.sock";
+
+// Must match the paths checked by BpftraceScript::DAEMON_PROBES.
+const char* const kRegisterMarker = "/.reprobuild_register";
+const char* const kUnregisterMarker = "/.reprobuild_unregister";
+
+const int kBpftraceAttachTimeout = 10000;  // 10 seconds
+const int kListenBacklog = 16;
+// Lines of not yet routable PIDs kept per live session before new ones are
+// dropped. A line cannot be told apart by session before its PID's fork
+// record arrives, so every session adds this much room to one pool and
+// nothing is parked while no session is live.
+const size_t kMaxParkedLinesPerSession = 100000;
+// How long such lines wait for their PID's fork record. Lines of processes
+// left over from finished sessions never get one.
+const auto kParkedLineTimeout = std::chrono::seconds(5);
+const int kSweepIntervalMs = 1000;
+// Trace output queued for a session that is not reading it before the
+// session is dropped.
+const size_t kMaxSessionOutput = 64 << 20;
+
+int g_signal_pipe[2] = {-1, -1};
+
+void onTerminationSignal(int) {
+  const char byte = 0;
+  const ssize_t ignored = write(g_signal_pipe[1], &byte, 1);
+  (void)ignored;
+}
+
+// $XDG_RUNTIME_DIR/reprobuild, or /tmp/reprobuild-<uid> without one.
+std::string defaultSocketDirectory() {
+  const char* runtime_dir = std::getenv("XDG_RUNTIME_DIR");
+  if (runtime_dir && runtime_dir[0] == '/') {
+    return std::string(runtime_dir) + "/reprobuild";
+  }
+  return "/tmp/reprobuild-" + std::to_string(geteuid());
+}
+
+// Create |directory| for our user alone, or check that an existing one is
+// still ours and closed to everyone else, so no other user can connect or
+// put a socket of their own in its place.
+bool makePrivateDirectory(const std::string& directory) {
+  if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+    Logger::error("Failed to create " + directory + ": " +
+                  std::string(std::strerror(errno)));
+    return false;
+  }
+  struct stat st;
+  if (lstat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) ||
+      st.st_uid != geteuid() || (st.st_mode & 077) != 0) {
+    Logger::error(directory +
+                  " is not a directory private to this user, refusing to "
+                  "listen there");
+    return false;
+  }
+  return true;
+}
+
+bool startsWith(std::string_view text, std::string_view prefix) {
+  return text.size() >= prefix.size() &&
+         text.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool parsePid(std::string_view token, int& pid) {
+  const auto result =
+      std::from_chars(token.data(), token.data() + token.size(), pid);
+  return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+bool sendAll(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    const ssize_t written =
+        send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+// Serialize |event| back into the line format parseTraceEvent() accepts.
+std::string formatEvent(const TraceEvent& event) {
+  std::string line;
+  switch (event.type) {
+    case TraceEventType::EXEC:
+      line = "execve " + std::string(event.path);
+      if (!event.args.empty()) {
+        line += ' ';
+        line += event.args;
+      }
+      break;
+    case TraceEventType::OPENAT:
+      line = "openat " + std::string(event.path) + " " +
+             std::to_string(event.flags);
+      break;
+    case TraceEventType::CREAT:
+      line = "creat " + std::string(event.path);
+      break;
+  }
+  return line;
+}
+}  // namespace
+
+std::string traceDaemonSocketPath() {
+  const char* raw_env = std::getenv("REPROBUILD_DAEMON_SOCKET");
+  if (raw_env && raw_env[0] != '\0') {
+    return raw_env;
+  }
+  return defaultSocketDirectory() + "/" + kSocketName;
+}
+
+struct TraceDaemon::Session {
+  int fd = -1;
+  int peer_pid = -1;  // from SO_PEERCRED
+  bool alive = true;
+  std::string input;   // partially received client line
+  std::string output;  // lines the socket did not take yet
+  std::vector<int> pids;
+  std::unordered_set<int> running;  // pids that have not exited yet
+};
+
+TraceDaemon::TraceDaemon(std::string socket_path, std::string log_dir)
+    : socket_path_(std::move(socket_path)), log_dir_(std::move(log_dir)) {
+  for (auto type : {TraceEventType::EXEC, TraceEventType::OPENAT,
+                    TraceEventType::CREAT}) {
+    dispatcher_.subscribe(
+        type, [this](const TraceEvent& event) { routeEvent(event); });
+  }
+}
+
+TraceDaemon::~TraceDaemon() {
+  for (const auto& session : sessions_) {
+    close(session->fd);
+  }
+  for (int fd : wake_pipe_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    unlink(socket_path_.c_str());
+  }
+}
+
+int TraceDaemon::run() {
+  if (pipe2(g_signal_pipe, O_CLOEXEC) != 0 ||
+      pipe2(wake_pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+    Logger::error("Failed to create signal pipe: " +
+                  std::string(std::strerror(errno)));
+    return 1;
+  }
+  struct sigaction action {};
+  action.sa_handler = onTerminationSignal;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  if (!listen()) {
+    return 1;
+  }
+
+  // The daemon itself is never tracked; sessions register their own PID.
+  const std::string pid_str = std::to_string(getpid());
+  const std::string script = renderBpftraceScript(
+      0,
+      probeIgnorePrefixes(Tracker::defaultIgnorePatterns(),
+                          Tracker::pathMapPrefixes()),
+      BpftraceScript::DAEMON_PROBES);
+  BpftraceStreamDecoder decoder([this](int pid, std::string_view line) {
+    handleTraceLine(pid, line);
+  });
+  BpftraceProcess bpftrace;
+  if (!bpftrace.start(script, log_dir_ + "/script_daemon_" + pid_str + ".bt",
+                      log_dir_ + "/bpftrace_stderr_daemon_" + pid_str + ".log",
+                      &decoder) ||
+      !bpftrace.waitAttached(kBpftraceAttachTimeout)) {
+    Logger::error("Trace daemon could not attach bpftrace");
+    return 1;
+  }
+  Logger::info("Trace daemon listening on " + socket_path_);
+
+  while (true) {
+    std::vector<pollfd> fds = {{g_signal_pipe[0], POLLIN, 0},
+                               {listen_fd_, POLLIN, 0},
+                               {wake_pipe_[0], POLLIN, 0}};
+    // Sessions dropped by the bpftrace reader thread are closed here.
+    std::vector<std::shared_ptr<Session>> sessions;
+    std::vector<std::shared_ptr<Session>> dropped;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& session : sessions_) {
+        if (!session->alive) {
+          dropped.push_back(session);
+          continue;
+        }
+        sessions.push_back(session);
+        const short events =
+            POLLIN | (session->output.empty() ? 0 : POLLOUT);
+        fds.push_back({session->fd, events, 0});
+      }
+    }
+    for (const auto& session : dropped) {
+      closeSession(session);
+    }
+
+    if (poll(fds.data(), fds.size(), kSweepIntervalMs) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      Logger::error("Trace daemon poll failed: " +
+                    std::string(std::strerror(errno)));
+      break;
+    }
+    if (fds[0].revents != 0) {
+      Logger::info("Trace daemon shutting down");
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      acceptSession();
+    }
+    if (fds[2].revents & POLLIN) {
+      char buffer[64];
+      while (read(wake_pipe_[0], buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    for (size_t i = 0; i < sessions.size(); ++i) {
+      const short revents = fds[i + 3].revents;
+      if (revents & POLLOUT) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flushSession(*sessions[i]);
+      }
+      if ((revents & ~POLLOUT) != 0 && !readSession(sessions[i])) {
+        closeSession(sessions[i]);
+      }
+    }
+    expireParkedLines();
+  }
+
+  bpftrace.stop();
+  decoder.finish();
+  close(g_signal_pipe[0]);
+  close(g_signal_pipe[1]);
+  if (dropped_line_count_ > 0) {
+    Logger::warn("Trace daemon dropped " +
+                 std::to_string(dropped_line_count_) + " unroutable lines");
+  }
+  return 0;
+}
+
+bool TraceDaemon::listen() {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path_.size() >= sizeof(address.sun_path)) {
+    Logger::error("Daemon socket path is too long: " + socket_path_);
+    return false;
+  }
+  std::memcpy(address.sun_path, socket_path_.c_str(), socket_path_.size());
+  if (socket_path_ == defaultSocketDirectory() + "/" + kSocketName &&
+      !makePrivateDirectory(defaultSocketDirectory())) {
+    return false;
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    Logger::error("Failed to create daemon socket: " +
+                  std::string(std::strerror(errno)));
+    return false;
+  }
+  // A socket left behind by a previous daemon would make bind() fail.
+  unlink(socket_path_.c_str());
+  if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      ::listen(listen_fd_, kListenBacklog) != 0) {
+    Logger::error("Failed to listen on " + socket_path_ + ": " +
+                  std::string(std::strerror(errno)));
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+void TraceDaemon::acceptSession() {
+  const int fd =
+      accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+  if (fd < 0) {
+    Logger::warn("Failed to accept session: " +
+                 std::string(std::strerror(errno)));
+    return;
+  }
+  ucred credentials{};
+  socklen_t length = sizeof(credentials);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0 ||
+      credentials.pid <= 0) {
+    Logger::warn("Cannot identify a session's process, closing it");
+    close(fd);
+    return;
+  }
+  auto session = std::make_shared<Session>();
+  session->fd = fd;
+  session->peer_pid = credentials.pid;
+  std::lock_guard<std::mutex> lock(mutex_);
+  sessions_.push_back(std::move(session));
+}
+
+bool TraceDaemon::readSession(const std::shared_ptr<Session>& session) {
+  char buffer[512];
+  const ssize_t bytes_read = read(session->fd, buffer, sizeof(buffer));
+  if (bytes_read < 0 &&
+      (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return true;
+  }
+  if (bytes_read <= 0) {
+    return false;
+  }
+  session->input.append(buffer, static_cast<size_t>(bytes_read));
+
+  size_t line_end;
+  while ((line_end = session->input.find('\n')) != std::string::npos) {
+    const std::string line = session->input.substr(0, line_end);
+    session->input.erase(0, line_end + 1);
+
+    int pid = -1;
+    if (!startsWith(line, "session ") ||
+        !parsePid(std::string_view(line).substr(8), pid) || pid <= 0) {
+      Logger::warn("Unexpected daemon request: " + line);
+      return false;
+    }
+    // A session only ever traces the process on the other end of the
+    // socket, never a PID it merely names.
+    if (pid != session->peer_pid) {
+      Logger::warn("Refusing session for PID " + std::to_string(pid) +
+                   " requested by PID " + std::to_string(session->peer_pid));
+      return false;
+    }
+    Logger::info("Trace daemon session started for PID " +
+                 std::to_string(pid));
+    std::lock_guard<std::mutex> lock(mutex_);
+    mapPid(pid, session);
+    sendLine(*session, "ok");
+  }
+  return true;
+}
+
+void TraceDaemon::closeSession(const std::shared_ptr<Session>& session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int pid : session->pids) {
+    sessions_by_pid_.erase(pid);
+  }
+  // Processes the build left running stay traced until they exit. The
+  // client itself has unregistered.
+  for (int pid : session->running) {
+    if (pid != session->peer_pid) {
+      ignorePid(pid);
+    }
+  }
+  session->alive = false;
+  close(session->fd);
+  sessions_.erase(std::remove(sessions_.begin(), sessions_.end(), session),
+                  sessions_.end());
+}
+
+void TraceDaemon::handleTraceLine(int pid, std::string_view line) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  handleTraceLineLocked(pid, line);
+}
+
+void TraceDaemon::handleTraceLineLocked(int pid, std::string_view line) {
+  int child = -1;
+  const bool fork =
+      startsWith(line, "fork ") && parsePid(line.substr(5), child);
+  const auto it = sessions_by_pid_.find(pid);
+  if (it == sessions_by_pid_.end()) {
+    if (ignored_pids_.count(pid) > 0) {
+      if (fork) {
+        ignorePid(child);
+      } else if (line == "exit") {
+        ignored_pids_.erase(pid);
+        dispatcher_.dispatch(pid, line);
+      }
+      return;
+    }
+    // Anyone can open the register marker; only a client accepted over the
+    // socket has a session waiting for it.
+    if (line == "register") {
+      Logger::warn("Ignoring PID " + std::to_string(pid) +
+                   ", which registered without a session");
+      ignorePid(pid);
+      return;
+    }
+    // The fork record of this PID may still be in another CPU's buffer.
+    if (parked_line_count_ >=
+        kMaxParkedLinesPerSession * sessions_.size()) {
+      ++dropped_line_count_;
+      return;
+    }
+    auto parked = parked_lines_.try_emplace(pid).first;
+    if (parked->second.lines.empty()) {
+      parked->second.since = std::chrono::steady_clock::now();
+    }
+    parked->second.lines.emplace_back(line);
+    ++parked_line_count_;
+    return;
+  }
+
+  const std::shared_ptr<Session> session = it->second;
+  if (line == "register") {
+    if (pid == session->peer_pid) {
+      sendLine(*session, "registered");
+    }
+    return;
+  }
+  if (fork) {
+    mapPid(child, session);
+    return;
+  }
+  if (line == "exit") {
+    session->running.erase(pid);
+  }
+  dispatcher_.dispatch(pid, line);
+}
+
+void TraceDaemon::routeEvent(const TraceEvent& event) {
+  const auto it = sessions_by_pid_.find(event.pid);
+  if (it == sessions_by_pid_.end()) {
+    return;
+  }
+  sendLine(*it->second, std::to_string(event.pid) + " " + formatEvent(event));
+}
+
+void TraceDaemon::mapPid(int pid, const std::shared_ptr<Session>& session) {
+  sessions_by_pid_[pid] = session;
+  session->pids.push_back(pid);
+  session->running.insert(pid);
+  ignored_pids_.erase(pid);
+
+  const auto parked = parked_lines_.find(pid);
+  if (parked == parked_lines_.end()) {
+    return;
+  }
+  const std::vector<std::string> lines = std::move(parked->second.lines);
+  parked_lines_.erase(parked);
+  parked_line_count_ -= lines.size();
+  for (const auto& line : lines) {
+    handleTraceLineLocked(pid, line);
+  }
+}
+
+void TraceDaemon::ignorePid(int pid) {
+  const auto parked = parked_lines_.find(pid);
+  if (parked == parked_lines_.end()) {
+    ignored_pids_.insert(pid);
+    return;
+  }
+  const auto& lines = parked->second.lines;
+  // A process whose exit is already in has nothing left to ignore.
+  if (std::find(lines.begin(), lines.end(), "exit") == lines.end()) {
+    ignored_pids_.insert(pid);
+  }
+  parked_line_count_ -= parked->second.lines.size();
+  dropped_line_count_ += parked->second.lines.size();
+  parked_lines_.erase(parked);
+}
+
+void TraceDaemon::expireParkedLines() {
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = parked_lines_.begin(); it != parked_lines_.end();) {
+    if (now - it->second.since < kParkedLineTimeout) {
+      ++it;
+      continue;
+    }
+    parked_line_count_ -= it->second.lines.size();
+    dropped_line_count_ += it->second.lines.size();
+    it = parked_lines_.erase(it);
+  }
+}
+
+void TraceDaemon::sendLine(Session& session, const std::string& line) {
+  if (!session.alive) {
+    return;
+  }
+  const bool was_idle = session.output.empty();
+  session.output += line;
+  session.output += '\n';
+  if (session.output.size() > kMaxSessionOutput) {
+    Logger::warn("A daemon session stopped reading its trace, dropping it");
+    session.alive = false;
+    session.output.clear();
+  } else if (was_idle) {
+    flushSession(session);
+  }
+  // Let the poll loop close the session, or wait for its socket to drain.
+  if (!session.alive || (was_idle && !session.output.empty())) {
+    const char byte = 0;
+    const ssize_t ignored = write(wake_pipe_[1], &byte, 1);
+    (void)ignored;
+  }
+}
+
+void TraceDaemon::flushSession(Session& session) {
+  size_t sent = 0;
+  while (session.alive && sent < session.output.size()) {
+    const ssize_t written =
+        send(session.fd, session.output.data() + sent,
+             session.output.size() - sent, MSG_NOSIGNAL);
+    if (written >= 0) {
+      sent += static_cast<size_t>(written);
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      Logger::warn("Lost connection to a daemon session: " +
+                   std::string(std::strerror(errno)));
+      session.alive = false;
+    }
+  }
+  session.output.erase(0, sent);
+}
+
+TraceDaemonClient::TraceDaemonClient(BpftraceStreamDecoder::LineHandler on_line)
+    : on_line_(std::move(on_line)) {}
+
+TraceDaemonClient::~TraceDaemonClient() { disconnect(); }
+
+bool TraceDaemonClient::connect(const std::string& socket_path,
+                                int timeout_ms) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr*>(&address),
+                           sizeof(address)) != 0) {
+    Logger::debug("No trace daemon at " + socket_path + ": " +
+                  std::string(std::strerror(errno)));
+    disconnect();
+    return false;
+  }
+
+  pid_ = getpid();
+  sync_line_ = "openat " + syncMarkerPath(pid_) + " ";
+  reader_ = std::thread([this]() { readLines(); });
+
+  if (!sendAll(fd_, "session " + std::to_string(pid_) + "\n") ||
+      !accepted_.waitFor(timeout_ms) || disconnected_) {
+    Logger::warn("Trace daemon did not accept the session");
+    disconnect();
+    return false;
+  }
+
+  touchMarker(kRegisterMarker);
+  if (!registered_.waitFor(timeout_ms) || disconnected_) {
+    Logger::warn("Trace daemon did not register the session");
+    touchMarker(kUnregisterMarker);
+    disconnect();
+    return false;
+  }
+  Logger::debug("Registered with trace daemon at " + socket_path);
+  return true;
+}
+
+bool TraceDaemonClient::finish(int timeout_ms) {
+  if (fd_ < 0) {
+    return false;
+  }
+  touchMarker(syncMarkerPath(pid_));
+  const bool synced = synced_.waitFor(timeout_ms) && sync_seen_;
+  // Stop tracing the rest of this process before leaving the session.
+  touchMarker(kUnregisterMarker);
+  disconnect();
+  return synced;
+}
+
+void TraceDaemonClient::readLines() {
+  std::string pending;
+  char buffer[64 * 1024];
+  while (true) {
+    const ssize_t bytes_read = read(fd_, buffer, sizeof(buffer));
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    pending.append(buffer, static_cast<size_t>(bytes_read));
+
+    size_t line_start = 0;
+    size_t line_end;
+    while ((line_end = pending.find('\n', line_start)) != std::string::npos) {
+      const std::string_view line(pending.data() + line_start,
+                                  line_end - line_start);
+      line_start = line_end + 1;
+
+      if (line == "ok") {
+        accepted_.set();
+        continue;
+      }
+      if (line == "registered") {
+        registered_.set();
+        continue;
+      }
+      const size_t space = line.find(' ');
+      int pid = -1;
+      if (space == std::string_view::npos ||
+          !parsePid(line.substr(0, space), pid)) {
+        continue;
+      }
+      const std::string_view trace_line = line.substr(space + 1);
+      if (pid == pid_ && startsWith(trace_line, sync_line_)) {
+        sync_seen_ = true;
+        synced_.set();
+        continue;
+      }
+      on_line_(pid, trace_line);
+    }
+    pending.erase(0, line_start);
+  }
+
+  // Wake up any waiter; the daemon is gone.
+  disconnected_ = true;
+  accepted_.set();
+  registered_.set();
+  synced_.set();
+}
+
+void TraceDaemonClient::disconnect() {
+  if (fd_ < 0) {
+    return;
+  }
+  shutdown(fd_, SHUT_RDWR);
+  if (reader_.joinable()) {
+    reader_.join();
+  }
+  close(fd_);
+  fd_ = -1;
+}
@@ -0,0 +1,188 @@
+#include "trace_event.h"
+
+#include <cctype>
+#include <charconv>
+#include <system_error>
+#include <utility>
+
+namespace {
+
+bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+
+void skipSpaces(std::string_view& text) {
+  size_t pos = 0;
+  while (pos < text.size() && isSpace(text[pos])) {
+    ++pos;
+  }
+  text.remove_prefix(pos);
+}
+
+std::string_view nextToken(std::string_view& text) {
+  skipSpaces(text);
+  size_t end = 0;
+  while (end < text.size() && !isSpace(text[end])) {
+    ++end;
+  }
+  const std::string_view token = text.substr(0, end);
+  text.remove_prefix(end);
+  return token;
+}
+
+bool consumeKeyword(std::string_view& line, std::string_view keyword) {
+  if (line.size() <= keyword.size() ||
+      line.compare(0, keyword.size(), keyword) != 0 ||
+      line[keyword.size()] != ' ') {
+    return false;
+  }
+  line.remove_prefix(keyword.size() + 1);
+  return true;
+}
+
+size_t typeIndex(TraceEventType type) { return static_cast<size_t>(type); }
+
+bool parseNumber(std::string_view token, uint64_t& value) {
+  const auto result =
+      std::from_chars(token.data(), token.data() + token.size(), value);
+  return result.ec == std::errc() && result.ptr == token.data() + token.size();
+}
+
+}  // namespace
+
+bool parseTraceEvent(int pid, std::string_view line, TraceEvent& event) {
+  event = TraceEvent{};
+  event.pid = pid;
+
+  if (consumeKeyword(line, "openat")) {
+    event.type = TraceEventType::OPENAT;
+    event.path = nextToken(line);
+    const std::string_view flags = nextToken(line);
+    std::from_chars(flags.data(), flags.data() + flags.size(), event.flags);
+  } else if (consumeKeyword(line, "execve") ||
+             consumeKeyword(line, "execveat")) {
+    event.type = TraceEventType::EXEC;
+    event.path = nextToken(line);
+    skipSpaces(line);
+    event.args = line;
+  } else if (consumeKeyword(line, "creat")) {
+    event.type = TraceEventType::CREAT;
+    event.path = nextToken(line);
+  } else {
+    return false;
+  }
+  return !event.path.empty();
+}
+
+void TraceEventDispatcher::subscribe(TraceEventType type,
+                                     Subscriber subscriber) {
+  subscribers_[typeIndex(type)].push_back(std::move(subscriber));
+}
+
+void TraceEventDispatcher::dispatch(int pid, std::string_view line) {
+  TraceEvent event;
+  if (parseTraceEvent(pid, line, event)) {
+    dispatch(event);
+  } else if (consumeKeyword(line, "openat_dir")) {
+    dispatchRelativeOpen(pid, line);
+  } else if (consumeKeyword(line, "dir")) {
+    defineDirectory(pid, line);
+  } else if (line == "exit") {
+    forgetProcess(pid);
+  }
+}
+
+void TraceEventDispatcher::dispatch(const TraceEvent& event) {
+  ++event_count_;
+  for (const auto& subscriber : subscribers_[typeIndex(event.type)]) {
+    subscriber(event);
+  }
+}
+
+size_t TraceEventDispatcher::finish() {
+  size_t dropped = dropped_opens_;
+  dropped_opens_ = 0;
+  for (const auto& [pid, by_directory] : pending_opens_) {
+    for (const auto& [id, opens] : by_directory) {
+      dropped += opens.size();
+    }
+  }
+  pending_opens_.clear();
+  directories_.clear();
+  return dropped;
+}
+
+void TraceEventDispatcher::forgetProcess(int pid) {
+  const auto pid_it = pending_opens_.find(pid);
+  if (pid_it != pending_opens_.end()) {
+    for (const auto& [id, opens] : pid_it->second) {
+      dropped_opens_ += opens.size();
+    }
+    pending_opens_.erase(pid_it);
+  }
+  directories_.erase(pid);
+}
+
+void TraceEventDispatcher::defineDirectory(int pid, std::string_view line) {
+  uint64_t id = 0;
+  if (!parseNumber(nextToken(line), id)) {
+    return;
+  }
+  // The root directory is sent with an empty path.
+  std::string& directory = directories_[pid][id];
+  directory = std::string(nextToken(line));
+
+  auto pid_it = pending_opens_.find(pid);
+  if (pid_it == pending_opens_.end()) {
+    return;
+  }
+  auto pending_it = pid_it->second.find(id);
+  if (pending_it == pid_it->second.end()) {
+    return;
+  }
+  const std::vector<PendingOpen> opens = std::move(pending_it->second);
+  pid_it->second.erase(pending_it);
+  for (const auto& open : opens) {
+    dispatchResolvedOpen(pid, directory, open.name, open.flags);
+  }
+}
+
+void TraceEventDispatcher::dispatchRelativeOpen(int pid,
+                                                std::string_view line) {
+  uint64_t id = 0;
+  if (!parseNumber(nextToken(line), id)) {
+    return;
+  }
+  const std::string_view name = nextToken(line);
+  const std::string_view flags_token = nextToken(line);
+  if (name.empty()) {
+    return;
+  }
+  int flags = 0;
+  std::from_chars(flags_token.data(), flags_token.data() + flags_token.size(),
+                  flags);
+
+  auto pid_it = directories_.find(pid);
+  if (pid_it != directories_.end()) {
+    auto dir_it = pid_it->second.find(id);
+    if (dir_it != pid_it->second.end()) {
+      dispatchResolvedOpen(pid, dir_it->second, name, flags);
+      return;
+    }
+  }
+  pending_opens_[pid][id].push_back({std::string(name), flags});
+}
+
+void TraceEventDispatcher::dispatchResolvedOpen(int pid,
+                                                const std::string& directory,
+                                                std::string_view name,
+                                                int flags) {
+  resolved_path_.assign(directory);
+  resolved_path_.push_back('/');
+  resolved_path_.append(name);
+
+  TraceEvent event;
+  event.type = TraceEventType::OPENAT;
+  event.pid = pid;
+  event.path = resolved_path_;
+  event.flags = flags;
+  dispatch(event);
+}
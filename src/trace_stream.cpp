@@ -0,0 +1,296 @@
+#include "trace_stream.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <future>
+#include <utility>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+namespace {
+constexpr char kFrameDelimiter = static_cast<char>(0x80);
+
+// Smaller traces are indexed on the calling thread.
+constexpr size_t kMinShardBytes = 4 * 1024 * 1024;
+
+// Every line-terminating fragment ends with "\n" right before its closing
+// delimiter, and an opening delimiter always follows PID digits, so a
+// record starts right after this sequence.
+constexpr std::string_view kShardBoundary("\n\x80", 2);
+
+bool isSpace(char c) { return std::isspace(static_cast<unsigned char>(c)); }
+bool isDigit(char c) { return std::isdigit(static_cast<unsigned char>(c)); }
+}  // namespace
+
+BpftraceStreamDecoder::BpftraceStreamDecoder(LineHandler handler)
+    : handler_(std::move(handler)) {}
+
+void BpftraceStreamDecoder::feed(std::string_view chunk) {
+  if (corrupted_ || chunk.empty()) {
+    return;
+  }
+
+  if (pending_.empty()) {
+    const size_t consumed = decodeRecords(chunk);
+    if (!corrupted_) {
+      pending_.assign(chunk.substr(consumed));
+    }
+    return;
+  }
+
+  pending_.append(chunk);
+  const size_t consumed = decodeRecords(pending_);
+  if (corrupted_) {
+    pending_.clear();
+  } else {
+    pending_.erase(0, consumed);
+  }
+}
+
+void BpftraceStreamDecoder::finish() {
+  for (auto& [pid, partial] : partial_lines_) {
+    if (!partial.empty()) {
+      emitLine(pid, partial);
+    }
+  }
+  partial_lines_.clear();
+
+  if (!pending_.empty()) {
+    Logger::debug("Dropping " + std::to_string(pending_.size()) +
+                  " bytes of incomplete bpftrace record");
+    pending_.clear();
+  }
+}
+
+size_t BpftraceStreamDecoder::decodeRecords(std::string_view data) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    const size_t record_start = pos;
+
+    // Skip leading whitespace
+    while (pos < data.size() &&
+           std::isspace(static_cast<unsigned char>(data[pos]))) {
+      ++pos;
+    }
+
+    // Parse PID (sequence of digits)
+    const size_t pid_start = pos;
+    while (pos < data.size() &&
+           std::isdigit(static_cast<unsigned char>(data[pos]))) {
+      ++pos;
+    }
+
+    if (pos >= data.size()) {
+      return record_start;  // Record continues in the next chunk
+    }
+
+    int pid = 0;
+    const auto result =
+        std::from_chars(data.data() + pid_start, data.data() + pos, pid);
+    if (data[pos] != kFrameDelimiter || result.ec != std::errc()) {
+      // Anything that is not a framed record (e.g. map dumps printed by
+      // bpftrace on exit) ends the usable part of the stream.
+      Logger::debug("Stopping bpftrace stream decoding at unframed output");
+      corrupted_ = true;
+      return data.size();
+    }
+    ++pos;  // Skip delimiter 0x80
+
+    // Content runs until the closing delimiter
+    const size_t content_end = data.find(kFrameDelimiter, pos);
+    if (content_end == std::string_view::npos) {
+      return record_start;
+    }
+
+    appendContent(pid, data.substr(pos, content_end - pos));
+    pos = content_end + 1;  // Skip delimiter 0x80
+  }
+  return pos;
+}
+
+void BpftraceStreamDecoder::appendContent(int pid, std::string_view content) {
+  while (!content.empty()) {
+    const size_t newline = content.find('\n');
+    if (newline == std::string_view::npos) {
+      partial_lines_[pid].append(content);
+      return;
+    }
+
+    const std::string_view piece = content.substr(0, newline);
+    auto it = partial_lines_.find(pid);
+    if (it == partial_lines_.end()) {
+      emitLine(pid, piece);
+    } else {
+      std::string line = std::move(it->second);
+      partial_lines_.erase(it);
+      line.append(piece);
+      emitLine(pid, line);
+    }
+    content.remove_prefix(newline + 1);
+  }
+}
+
+void BpftraceStreamDecoder::emitLine(int pid, std::string_view line) {
+  if (line.empty()) {
+    return;
+  }
+  ++line_count_;
+  handler_(pid, line);
+}
+
+BpftraceTraceIndex BpftraceTraceIndex::build(std::string_view data,
+                                             size_t max_shards) {
+  const size_t shard_count = std::max<size_t>(
+      1, std::min(max_shards, data.size() / kMinShardBytes));
+
+  std::vector<size_t> bounds = {0};
+  for (size_t i = 1; i < shard_count; ++i) {
+    const size_t boundary =
+        data.find(kShardBoundary, std::max(bounds.back(),
+                                           data.size() / shard_count * i));
+    if (boundary == std::string_view::npos) {
+      break;
+    }
+    bounds.push_back(boundary + kShardBoundary.size());
+  }
+  bounds.push_back(data.size());
+
+  std::vector<Shard> shards;
+  if (bounds.size() == 2) {
+    shards.push_back(indexShard(data, 0, data.size()));
+  } else {
+    // The calling thread indexes shards as well.
+    shards.resize(bounds.size() - 1);
+    ThreadPool pool(shards.size() - 1);
+    pool.parallel_for(0, shards.size(), 1, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        shards[i] = indexShard(data, bounds[i], bounds[i + 1]);
+      }
+    });
+  }
+
+  BpftraceTraceIndex index;
+  index.data_ = data;
+  for (auto& shard : shards) {
+    const bool stopped = shard.stopped;
+    index.appendShard(std::move(shard));
+    if (stopped) {
+      // Like the streaming decoder, nothing after unframed output is used.
+      Logger::debug("Stopping bpftrace log decoding at unframed output");
+      break;
+    }
+  }
+  return index;
+}
+
+BpftraceTraceIndex::Shard BpftraceTraceIndex::indexShard(std::string_view data,
+                                                         size_t begin,
+                                                         size_t end) {
+  Shard shard;
+  std::unordered_map<int, size_t> stream_index;
+
+  size_t pos = begin;
+  while (pos < end) {
+    // Skip leading whitespace
+    while (pos < end && isSpace(data[pos])) {
+      ++pos;
+    }
+
+    // Parse PID (sequence of digits)
+    const size_t pid_start = pos;
+    while (pos < end && isDigit(data[pos])) {
+      ++pos;
+    }
+    if (pos >= end) {
+      break;  // End of data
+    }
+
+    int pid = 0;
+    const auto result =
+        std::from_chars(data.data() + pid_start, data.data() + pos, pid);
+    if (data[pos] != kFrameDelimiter || result.ec != std::errc()) {
+      shard.stopped = true;
+      break;
+    }
+    ++pos;  // Skip delimiter 0x80
+
+    // Content runs until the closing delimiter
+    const size_t content_end = data.substr(0, end).find(kFrameDelimiter, pos);
+    if (content_end == std::string_view::npos) {
+      shard.stopped = true;  // Missing closing delimiter
+      break;
+    }
+
+    if (content_end > pos) {
+      const uint32_t fragment = static_cast<uint32_t>(shard.fragments.size());
+      shard.fragments.push_back(
+          {pos, static_cast<uint32_t>(content_end - pos), kNoFragment});
+
+      const auto [it, inserted] =
+          stream_index.emplace(pid, shard.streams.size());
+      if (inserted) {
+        shard.streams.push_back({pid, fragment, fragment});
+      } else {
+        Stream& stream = shard.streams[it->second];
+        shard.fragments[stream.tail].next = fragment;
+        stream.tail = fragment;
+      }
+    }
+    pos = content_end + 1;  // Skip delimiter 0x80
+  }
+  return shard;
+}
+
+void BpftraceTraceIndex::appendShard(Shard&& shard) {
+  const uint32_t base = static_cast<uint32_t>(fragments_.size());
+  for (Fragment& fragment : shard.fragments) {
+    if (fragment.next != kNoFragment) {
+      fragment.next += base;
+    }
+    fragments_.push_back(fragment);
+  }
+
+  for (const Stream& local : shard.streams) {
+    const auto [it, inserted] =
+        stream_index_.emplace(local.pid, streams_.size());
+    if (inserted) {
+      streams_.push_back({local.pid, local.head + base, local.tail + base});
+      continue;
+    }
+    Stream& stream = streams_[it->second];
+    fragments_[stream.tail].next = local.head + base;
+    stream.tail = local.tail + base;
+  }
+}
+
+void BpftraceTraceIndex::forEachLine(
+    const BpftraceStreamDecoder::LineHandler& handler) const {
+  std::string partial;
+  for (const Stream& stream : streams_) {
+    partial.clear();
+    for (uint32_t i = stream.head; i != kNoFragment; i = fragments_[i].next) {
+      std::string_view content =
+          data_.substr(fragments_[i].offset, fragments_[i].length);
+      size_t newline;
+      while ((newline = content.find('\n')) != std::string_view::npos) {
+        const std::string_view piece = content.substr(0, newline);
+        if (partial.empty()) {
+          if (!piece.empty()) {
+            handler(stream.pid, piece);
+          }
+        } else {
+          partial.append(piece);
+          handler(stream.pid, partial);
+          partial.clear();
+        }
+        content.remove_prefix(newline + 1);
+      }
+      partial.append(content);
+    }
+    if (!partial.empty()) {
+      handler(stream.pid, partial);
+    }
+  }
+}
@@ -15,32 +15,29 @@
 #include <fstream>
 #include <iostream>
 #include <memory>
-#include <mutex>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string_view>
-#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
-#include "bpftrace_script.h"
+#include "bpftrace_process.h"
 #include "build_graph.h"
+#include "concurrency.h"
+#include "dependency_resolver.h"
+#include "file_hasher.h"
 #include "interceptor_embedded.h"
 #include "logger.h"
-#include "thread_pool.h"
+#include "ringbuf_tracer.h"
+#include "trace_daemon.h"
+#include "trace_stream.h"
 #include "utils.h"
 
 namespace {
-// Bpftrace configuration
-const char* const kPidPlaceholder = "$pid = *;";
-const char* const kBpftraceCommand = "sudo bpftrace0.24";
-
 // Timing constants (milliseconds)
-const int kBpftraceAttachCheckInterval = 100;
-const int kBpftraceProcessingDelay = 200;
-const int kBpftraceFlushDelay = 500;
 const int kBpftraceAttachTimeout = 10000;  // 10 seconds
+const int kBpftraceSyncTimeout = 5000;
 
 using Clock = std::chrono::steady_clock;
 
@@ -147,6 +144,63 @@ bool isSharedLibPath(std::string_view path) {
   return true;
 }
 
+bool isLibraryPath(std::string_view path) {
+  return endsWithView(path, ".a") || isSharedLibPath(path);
+}
+
+bool isHeaderPath(std::string_view path) {
+  // Recognized header file extensions
+  static constexpr std::array<std::string_view, 5> kHeaderExtensions = {
+      ".h", ".hpp", ".hxx", ".hh", ".H"};
+  for (const auto& ext : kHeaderExtensions) {
+    if (endsWithView(path, ext)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Longer tool names come first so suffix matching keeps ld.gold/clang++
+// distinct from ld/g++.
+constexpr std::array<std::string_view, 15> kBuildTools = {
+    "clang++", "clang", "ld.gold", "ld.lld", "ld.bfd",
+    "libtool", "ranlib", "objcopy", "strip", "gcc",
+    "g++",     "c++",   "cc",      "ar",     "ld"};
+
+bool isBuildTool(std::string_view tool) {
+  return std::find(kBuildTools.begin(), kBuildTools.end(), tool) !=
+         kBuildTools.end();
+}
+
+// - strip numeric version suffixes ("gcc-12" -> "gcc")
+//   ("x86_64-linux-gnu-g++-14" -> "g++")
+std::string_view normalizeTool(std::string_view name) {
+  std::string_view normalized = name;
+
+  const size_t dash = normalized.rfind('-');
+  bool has_numeric_suffix =
+      dash != std::string_view::npos && dash + 1 < normalized.size();
+  for (size_t i = dash + 1; has_numeric_suffix && i < normalized.size(); ++i) {
+    has_numeric_suffix =
+        std::isdigit(static_cast<unsigned char>(normalized[i])) != 0;
+  }
+  if (has_numeric_suffix) {
+    normalized.remove_suffix(normalized.size() - dash);
+  }
+
+  if (isBuildTool(normalized)) {
+    return normalized;
+  }
+
+  for (const auto& tool : kBuildTools) {
+    if (endsWithView(normalized, tool)) {
+      return tool;
+    }
+  }
+
+  return normalized;
+}
+
 bool isInputExtension(std::string_view ext) {
   static constexpr std::array<std::string_view, 11> kInputExts = {
       ".c", ".cpp", ".cc", ".cxx", ".C", ".s",
@@ -223,104 +277,60 @@ std::string remapObservedPath(const std::string& original_path) {
   return normalized;
 }
 
-}  // namespace
-
-Tracker::Tracker(std::shared_ptr<BuildInfo> build_info)
-    : build_info_(build_info) {
-  // Initialize default ignore patterns for system directories
-  ignore_patterns_.push_back("/tmp/");
-  ignore_patterns_.push_back("/proc/");
-  ignore_patterns_.push_back("/sys/");
-  ignore_patterns_.push_back("/dev/");
-  ignore_patterns_.push_back("libreprobuild_interceptor.so");
+// Streaming is the default; REPROBUILD_BPFTRACE_STREAM=0 falls back to
+// writing the raw trace to a log file and parsing it after the build.
+bool streamingEnabled() {
+  const char* raw_env = std::getenv("REPROBUILD_BPFTRACE_STREAM");
+  return !raw_env || std::string(raw_env) != "0";
 }
 
-void Tracker::addIgnorePattern(const std::string& pattern) {
-  ignore_patterns_.push_back(pattern);
+// Builds are traced through `reprobuild daemon` only when asked to, with
+// REPROBUILD_DAEMON_SOCKET or REPROBUILD_TRACE_BACKEND=daemon; a socket
+// lying around is not enough.
+bool daemonBackendRequested() {
+  const char* backend = std::getenv("REPROBUILD_TRACE_BACKEND");
+  return std::getenv("REPROBUILD_DAEMON_SOCKET") ||
+         (backend && std::string(backend) == "daemon");
 }
 
-const TrackingTiming& Tracker::getTiming() const { return timing_; }
+bool ringbufBackendRequested() {
+  if (!RingbufTracer::isAvailable()) {
+    return false;
+  }
+  const char* raw_env = std::getenv("REPROBUILD_TRACE_BACKEND");
+  return !raw_env || std::string(raw_env) != "bpftrace";
+}
 
-std::string Tracker::executeWithBpftrace(const std::string& command) {
-  const auto preprocessing_start = Clock::now();
-  const pid_t current_pid = getpid();
-  const std::string pid_str = std::to_string(current_pid);
+}  // namespace
 
-  // Generate file paths for bpftrace artifacts
-  const std::string bpftrace_script =
-      build_info_->log_dir_ + "/script_" + pid_str + ".bt";
-  const std::string bpftrace_log =
-      build_info_->log_dir_ + "/bpftrace_" + pid_str + ".log";
-  const std::string bpftrace_stderr_log =
-      build_info_->log_dir_ + "/bpftrace_stderr_" + pid_str + ".log";
-  const std::string bpftrace_pidfile =
-      build_info_->log_dir_ + "/bpftrace_pid_" + pid_str + ".pid";
+Tracker::Tracker(std::shared_ptr<BuildInfo> build_info)
+    : ignore_patterns_(defaultIgnorePatterns()), build_info_(build_info) {}
 
-  // Prepare bpftrace script with current PID
-  std::string script_content = BpftraceScript::SCRIPT_TEMPLATE;
-  const std::string pid_replacement = "$pid = " + pid_str + ";";
+std::vector<std::string> Tracker::defaultIgnorePatterns() {
+  // System directories and the interceptor itself
+  return {"/tmp/", "/proc/", "/sys/", "/dev/", "libreprobuild_interceptor.so"};
+}
 
-  const size_t placeholder_pos = script_content.find(kPidPlaceholder);
-  if (placeholder_pos != std::string::npos) {
-    script_content.replace(placeholder_pos, strlen(kPidPlaceholder),
-                           pid_replacement);
-  } else {
-    Logger::warn("Could not find PID placeholder in bpftrace script");
+std::vector<std::string> Tracker::pathMapPrefixes() {
+  std::vector<std::string> prefixes;
+  for (const auto& mapping : loadPathMappings()) {
+    prefixes.push_back(mapping.observed_prefix);
   }
+  return prefixes;
+}
 
-  // Write the modified script to temporary file
-  {
-    std::ofstream script_file(bpftrace_script);
-    if (!script_file.is_open()) {
-      Logger::error("Failed to create temporary bpftrace script: " +
-                    bpftrace_script);
-      return "";
-    }
-    script_file << script_content;
-  }  // File auto-closed by RAII
-
-  // Start bpftrace in background and capture its PID
-  const std::string bpftrace_cmd = std::string(kBpftraceCommand) + " " +
-                                   bpftrace_script + " > " + bpftrace_log +
-                                   " 2> " + bpftrace_stderr_log +
-                                   " & echo $! > " + bpftrace_pidfile;
-
-  Logger::debug("Starting bpftrace: " + bpftrace_cmd);
-  const int bpftrace_ret = std::system(bpftrace_cmd.c_str());
-  if (bpftrace_ret != 0) {
-    Logger::warn("Failed to start bpftrace (exit code: " +
-                 std::to_string(bpftrace_ret) + ")");
-  }
-
-  // Wait for bpftrace to attach by monitoring stderr output
-  bool attached = false;
-  const auto start_wait = std::chrono::steady_clock::now();
-  const auto timeout = std::chrono::milliseconds(kBpftraceAttachTimeout);
-
-  while (!attached) {
-    std::ifstream stderr_file(bpftrace_stderr_log);
-    if (stderr_file.is_open()) {
-      std::string line;
-      while (std::getline(stderr_file, line)) {
-        if (line.find("Attached") != std::string::npos) {
-          Logger::debug("Bpftrace attached: " + line);
-          attached = true;
-          break;
-        }
-      }
-    }
+std::vector<std::string> Tracker::probePrefixes() const {
+  return probeIgnorePrefixes(ignore_patterns_, pathMapPrefixes());
+}
 
-    if (!attached) {
-      const auto elapsed = std::chrono::steady_clock::now() - start_wait;
-      if (elapsed > timeout) {
-        Logger::warn("Timeout waiting for bpftrace to attach");
-        break;
-      }
-      std::this_thread::sleep_for(
-          std::chrono::milliseconds(kBpftraceAttachCheckInterval));
-    }
-  }
+void Tracker::addIgnorePattern(const std::string& pattern) {
+  ignore_patterns_.push_back(pattern);
+}
+
+const TrackingTiming& Tracker::getTiming() const { return timing_; }
 
+Clock::time_point Tracker::runBuildCommand(
+    const std::string& command, Clock::time_point preprocessing_start) {
   // Execute the actual build command
   const auto build_start = Clock::now();
   timing_.preprocessing_ms += elapsedMs(preprocessing_start, build_start);
@@ -333,145 +343,255 @@ std::string Tracker::executeWithBpftrace(const std::string& command) {
   if (exit_code != 0) {
     Logger::warn("Command exited with code: " + std::to_string(exit_code));
   }
+  return build_end;
+}
 
-  const auto postprocessing_start = build_end;
+bool Tracker::executeWithDaemon(const std::string& command,
+                                TraceEventDispatcher& dispatcher) {
+  const auto preprocessing_start = Clock::now();
+  if (!daemonBackendRequested()) {
+    return false;
+  }
+  // The daemon filters with its own environment's path map; paths this
+  // build maps could be dropped there before they are remapped here.
+  const auto defaults = defaultIgnorePatterns();
+  if (probeIgnorePrefixes(defaults, pathMapPrefixes()) !=
+      probeIgnorePrefixes(defaults)) {
+    Logger::warn("REPROBUILD_PATH_MAP covers paths the trace daemon "
+                 "filters, tracing this build on its own");
+    return false;
+  }
 
-  // Give bpftrace time to finish processing
-  std::this_thread::sleep_for(
-      std::chrono::milliseconds(kBpftraceProcessingDelay));
+  const std::string socket_path = traceDaemonSocketPath();
+  TraceDaemonClient client([&dispatcher](int pid, std::string_view line) {
+    dispatcher.dispatch(pid, line);
+  });
+  if (!client.connect(socket_path, kBpftraceAttachTimeout)) {
+    Logger::warn("Trace daemon unavailable at " + socket_path +
+                 ", tracing this build on its own");
+    return false;
+  }
 
-  // Stop bpftrace by reading its PID and sending SIGINT
-  {
-    std::ifstream pidfile(bpftrace_pidfile);
-    if (pidfile.is_open()) {
-      std::string bpftrace_pid_str;
-      std::getline(pidfile, bpftrace_pid_str);
+  const auto postprocessing_start =
+      runBuildCommand(command, preprocessing_start);
 
-      if (!bpftrace_pid_str.empty()) {
-        try {
-          const pid_t bpftrace_pid = std::stoi(bpftrace_pid_str);
-          Logger::debug("Stopping bpftrace PID " + bpftrace_pid_str);
+  if (!client.finish(kBpftraceSyncTimeout)) {
+    Logger::warn("Timeout waiting for the trace daemon to catch up");
+  }
 
-          // Use kill() syscall directly to avoid creating traced processes
-          if (kill(bpftrace_pid, SIGINT) == 0) {
-            Logger::debug("Successfully sent SIGINT to bpftrace");
-          } else {
-            Logger::warn("Failed to send SIGINT to bpftrace: " +
-                         std::string(std::strerror(errno)));
-          }
+  timing_.bpftrace_finalization_ms +=
+      elapsedMs(postprocessing_start, Clock::now());
+  timing_.postprocessing_ms += timing_.bpftrace_finalization_ms;
+  return true;
+}
 
-          // Clean up PID file
-          std::filesystem::remove(bpftrace_pidfile);
-        } catch (const std::exception& e) {
-          Logger::warn("Failed to parse bpftrace PID: " +
-                       std::string(e.what()));
-        }
-      }
-    } else {
-      Logger::warn("Failed to read bpftrace PID file: " + bpftrace_pidfile);
-    }
-  }  // File auto-closed by RAII
-
-  // Wait for bpftrace to flush output
-  std::this_thread::sleep_for(std::chrono::milliseconds(kBpftraceFlushDelay));
-
-  // Read bpftrace output from log file
-  std::string raw_output;
-  {
-    std::ifstream bpftrace_file(bpftrace_log);
-    if (bpftrace_file.is_open()) {
-      std::string line;
-      while (std::getline(bpftrace_file, line)) {
-        raw_output += line + "\n";
-      }
-      // Note: Temporary files cleanup is disabled for debugging
-      // std::filesystem::remove(bpftrace_script);
-      // std::filesystem::remove(bpftrace_log);
-    } else {
-      Logger::warn("Failed to read bpftrace log file: " + bpftrace_log);
-    }
+bool Tracker::executeWithRingbuf(const std::string& command,
+                                 TraceEventDispatcher& dispatcher) {
+  const auto preprocessing_start = Clock::now();
+
+  RingbufTracer tracer(
+      [&dispatcher](const TraceEvent& event) { dispatcher.dispatch(event); });
+  if (!tracer.start(getpid(), probePrefixes())) {
+    Logger::warn("Ring-buffer tracing unavailable, falling back to bpftrace");
+    return false;
   }
+  Logger::debug("Ring-buffer tracing attached");
+
+  const auto postprocessing_start =
+      runBuildCommand(command, preprocessing_start);
+
+  tracer.stop();
+  Logger::debug("Consumed " + std::to_string(tracer.eventCount()) +
+                " ring-buffer records, dropped " +
+                std::to_string(tracer.droppedCount()));
 
-  std::string processed_output = processBpftraceOutput(raw_output);
   timing_.bpftrace_finalization_ms +=
       elapsedMs(postprocessing_start, Clock::now());
   timing_.postprocessing_ms += timing_.bpftrace_finalization_ms;
-  return processed_output;
+  return true;
 }
 
-std::string Tracker::processBpftraceOutput(const std::string& raw_output) {
-  // Convert bpftrace raw output to c1 format
-  // Input:  PID|content|PID|content|...
-  // Output: ID PID: \n content \n
-  std::unordered_map<int, std::string> pid_streams;
-
-  size_t pos = 0;
-  while (pos < raw_output.size()) {
-    // Skip leading whitespace
-    while (pos < raw_output.size() && std::isspace(raw_output[pos])) {
-      ++pos;
-    }
+void Tracker::executeWithBpftrace(
+    const std::string& command,
+    const BpftraceStreamDecoder::LineHandler& on_line) {
+  const auto preprocessing_start = Clock::now();
+  const pid_t current_pid = getpid();
+  const std::string pid_str = std::to_string(current_pid);
+  const bool streaming = streamingEnabled();
 
-    // Parse PID (sequence of digits)
-    const size_t pid_start = pos;
-    while (pos < raw_output.size() && std::isdigit(raw_output[pos])) {
-      ++pos;
-    }
+  // Generate file paths for bpftrace artifacts
+  const std::string bpftrace_script =
+      build_info_->log_dir_ + "/script_" + pid_str + ".bt";
+  const std::string bpftrace_log =
+      build_info_->log_dir_ + "/bpftrace_" + pid_str + ".log";
+  const std::string bpftrace_stderr_log =
+      build_info_->log_dir_ + "/bpftrace_stderr_" + pid_str + ".log";
 
-    if (pos >= raw_output.size() || raw_output[pos] != (char)0x80) {
-      break;  // Invalid format or end of data
-    }
+  // In streaming mode bpftrace writes into a pipe that a reader thread
+  // decodes while the build runs; otherwise it writes a log file that is
+  // parsed after the build.
+  const std::string sync_marker = syncMarkerPath(current_pid);
+  const std::string sync_line = "openat " + sync_marker + " ";
+  OneShotEvent synced;
+  BpftraceStreamDecoder decoder(
+      [&](int pid, std::string_view line) {
+        if (pid == current_pid && startsWithView(line, sync_line)) {
+          synced.set();
+          return;
+        }
+        on_line(pid, line);
+      });
+
+  BpftraceProcess bpftrace;
+  const std::string script = renderBpftraceScript(current_pid, probePrefixes());
+  if (bpftrace.start(script, bpftrace_script, bpftrace_stderr_log,
+                     streaming ? &decoder : nullptr, bpftrace_log)) {
+    bpftrace.waitAttached(kBpftraceAttachTimeout);
+  }
 
-    int pid = std::stoi(raw_output.substr(pid_start, pos - pid_start));
-    ++pos;  // Skip delimiter 0x80
+  const auto postprocessing_start =
+      runBuildCommand(command, preprocessing_start);
 
-    // Parse content until next delimiter
-    const size_t content_start = pos;
-    while (pos < raw_output.size() && raw_output[pos] != (char)0x80) {
-      ++pos;
+  // Everything the build did is in the stream once our own marker open has
+  // come through it.
+  if (streaming && bpftrace.attached()) {
+    touchMarker(sync_marker);
+    if (!synced.waitFor(kBpftraceSyncTimeout)) {
+      Logger::warn("Timeout waiting for bpftrace to catch up with the build");
     }
+  }
+  bpftrace.stop();
 
-    if (pos >= raw_output.size()) {
-      break;  // Missing closing delimiter
+  if (streaming) {
+    decoder.finish();
+    Logger::debug("Decoded " + std::to_string(decoder.lineCount()) +
+                  " bpftrace lines while streaming");
+  } else {
+    // Read bpftrace output from log file in one piece; the index below
+    // refers into this buffer instead of copying it.
+    std::string raw_output;
+    {
+      std::ifstream bpftrace_file(bpftrace_log, std::ios::binary);
+      if (bpftrace_file.is_open()) {
+        bpftrace_file.seekg(0, std::ios::end);
+        raw_output.resize(static_cast<size_t>(bpftrace_file.tellg()));
+        bpftrace_file.seekg(0, std::ios::beg);
+        bpftrace_file.read(raw_output.data(),
+                           static_cast<std::streamsize>(raw_output.size()));
+        // Note: Temporary files cleanup is disabled for debugging
+        // std::filesystem::remove(bpftrace_script);
+        // std::filesystem::remove(bpftrace_log);
+      } else {
+        Logger::warn("Failed to read bpftrace log file: " + bpftrace_log);
+      }
     }
 
-    const std::string content =
-        raw_output.substr(content_start, pos - content_start);
-    pid_streams[pid] += content;
-    ++pos;  // Skip delimiter 0x80
+    processBpftraceOutput(raw_output, on_line);
   }
 
-  // Format output in c1 format: group by PID
-  std::ostringstream result;
-  for (const auto& [pid, content] : pid_streams) {
-    result << "ID " << pid << ": \n" << content << "\n";
-  }
+  timing_.bpftrace_finalization_ms +=
+      elapsedMs(postprocessing_start, Clock::now());
+  timing_.postprocessing_ms += timing_.bpftrace_finalization_ms;
+}
 
-  return result.str();
+void Tracker::processBpftraceOutput(
+    std::string_view raw_output,
+    const BpftraceStreamDecoder::LineHandler& on_line) {
+  // Input: PID|content|PID|content|... Content is reassembled per PID and
+  // every completed line is handed to |on_line| with its PID.
+  const BpftraceTraceIndex index = BpftraceTraceIndex::build(
+      raw_output, Concurrency::current().cpu_threads);
+  Logger::debug("Indexed " + std::to_string(index.fragmentCount()) +
+                " bpftrace fragments from " +
+                std::to_string(index.pidCount()) + " processes");
+  index.forEachLine(on_line);
 }
 
-std::set<std::string> Tracker::parseLibFiles(
-    const std::string& bpftrace_output) {
-  std::set<std::string> library_files;
-  std::istringstream input_stream(bpftrace_output);
-  std::string line;
+std::vector<DependencyPackage> Tracker::resolveDependencyFiles(
+    const std::vector<std::string>& paths, size_t max_threads) {
+  const PackageMgr pkg_mgr = build_info_->package_mgr_;
+  if (!build_info_->incremental_) {
+    return DependencyPackage::resolveAll(paths, pkg_mgr, max_threads);
+  }
 
-  while (std::getline(input_stream, line)) {
-    // Skip ID header lines and empty lines
-    if (line.empty() || Utils::startsWith(line, "ID ")) {
-      continue;
+  BuildRecord previous;
+  if (std::filesystem::exists(build_info_->output_file_)) {
+    try {
+      previous = BuildRecord::loadFromFile(build_info_->output_file_);
+    } catch (const std::exception& e) {
+      Logger::warn("Ignoring previous build record: " +
+                   std::string(e.what()));
     }
+  }
 
-    // Match openat syscall lines: "openat /path/to/file flags"
-    if (!Utils::startsWith(line, "openat ")) {
-      continue;
+  std::vector<std::string> signatures(paths.size());
+  std::vector<DependencyPackage> packages(paths.size());
+  std::vector<size_t> changed;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    signatures[i] = Utils::statSignature(paths[i]);
+    if (!previous.reuseResolvedFile(paths[i], signatures[i], packages[i])) {
+      changed.push_back(i);
     }
+  }
+  timing_.reused_dependency_files += paths.size() - changed.size();
+  Logger::info("Incremental: reusing " +
+               std::to_string(paths.size() - changed.size()) +
+               " dependency files, resolving " +
+               std::to_string(changed.size()));
+
+  std::vector<std::string> changed_paths;
+  changed_paths.reserve(changed.size());
+  for (size_t i : changed) {
+    changed_paths.push_back(paths[i]);
+  }
+  auto resolved =
+      DependencyPackage::resolveAll(changed_paths, pkg_mgr, max_threads);
+  for (size_t j = 0; j < changed.size(); ++j) {
+    packages[changed[j]] = std::move(resolved[j]);
+  }
+
+  BuildRecord& record = build_info_->build_record_;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    record.addResolvedFile(paths[i], packages[i], signatures[i]);
+  }
+  return packages;
+}
 
-    std::istringstream line_stream(line);
-    std::string syscall, filepath;
-    line_stream >> syscall >> filepath;
-    filepath = remapObservedPath(filepath);
+void Tracker::subscribeConsumers(TraceEventDispatcher& dispatcher,
+                                 TraceObservations& observations) const {
+  // Only libraries, headers and created files are of interest among the
+  // opened paths; everything else is dropped before it is copied.
+  dispatcher.subscribe(TraceEventType::OPENAT, [&](const TraceEvent& event) {
+    // Check if O_CREAT flag is set (64 = 0100 octal)
+    if ((event.flags & 64) != 0) {
+      observations.created_files.emplace(event.path);
+    }
+    if (isLibraryPath(event.path) || isHeaderPath(event.path)) {
+      observations.opened_files.emplace(event.path);
+    }
+  });
+
+  dispatcher.subscribe(TraceEventType::CREAT, [&](const TraceEvent& event) {
+    observations.created_files.emplace(event.path);
+  });
+
+  const bool collect_graph = !build_info_->graph_output_file_.empty();
+  dispatcher.subscribe(TraceEventType::EXEC, [&, collect_graph](
+                                                 const TraceEvent& event) {
+    observations.executed_files.emplace(event.path);
+    if (collect_graph && isBuildTool(normalizeTool(filenameView(event.path)))) {
+      observations.build_tool_execs.push_back(
+          {event.pid, std::string(event.path), std::string(event.args)});
+    }
+  });
+}
 
+std::set<std::string> Tracker::parseLibFiles(
+    const std::unordered_set<std::string>& opened_files) {
+  std::set<std::string> library_files;
+
+  for (const auto& opened_file : opened_files) {
+    const std::string filepath = remapObservedPath(opened_file);
     if (filepath.empty()) {
       continue;
     }
@@ -497,45 +617,12 @@ std::set<std::string> Tracker::parseLibFiles(
 }
 
 std::set<std::string> Tracker::parseHeaderFiles(
-    const std::string& bpftrace_output) {
-  // Recognized header file extensions
-  static const std::vector<std::string> kHeaderExtensions = {
-      ".h", ".hpp", ".hxx", ".hh", ".H"};
-
+    const std::unordered_set<std::string>& opened_files) {
   std::set<std::string> header_files;
-  std::istringstream input_stream(bpftrace_output);
-  std::string line;
-
-  while (std::getline(input_stream, line)) {
-    // Skip ID header lines and empty lines
-    if (line.empty() || Utils::startsWith(line, "ID ")) {
-      continue;
-    }
-
-    // Match openat syscall lines: "openat /path/to/file flags"
-    if (!Utils::startsWith(line, "openat ")) {
-      continue;
-    }
-
-    std::istringstream line_stream(line);
-    std::string syscall, filepath;
-    line_stream >> syscall >> filepath;
-    filepath = remapObservedPath(filepath);
-
-    if (filepath.empty()) {
-      continue;
-    }
 
-    // Check if file has a header extension
-    bool is_header_file = false;
-    for (const auto& ext : kHeaderExtensions) {
-      if (Utils::endsWith(filepath, ext)) {
-        is_header_file = true;
-        break;
-      }
-    }
-
-    if (!is_header_file) {
+  for (const auto& opened_file : opened_files) {
+    const std::string filepath = remapObservedPath(opened_file);
+    if (filepath.empty() || !isHeaderPath(filepath)) {
       continue;
     }
 
@@ -551,30 +638,11 @@ std::set<std::string> Tracker::parseHeaderFiles(
 }
 
 std::set<std::string> Tracker::parseExecutables(
-    const std::string& bpftrace_output) {
+    const std::unordered_set<std::string>& executed_files) {
   std::set<std::string> executables;
-  std::istringstream input_stream(bpftrace_output);
-  std::string line;
-
-  while (std::getline(input_stream, line)) {
-    // Skip ID header lines and empty lines
-    if (line.empty() || Utils::startsWith(line, "ID ")) {
-      continue;
-    }
-
-    // Match execve/execveat syscalls: "execve /path/to/executable arg1 ..."
-    const bool is_execve = Utils::startsWith(line, "execve ");
-    const bool is_execveat = Utils::startsWith(line, "execveat ");
-
-    if (!is_execve && !is_execveat) {
-      continue;
-    }
-
-    std::istringstream line_stream(line);
-    std::string syscall, exec_path;
-    line_stream >> syscall >> exec_path;
-    exec_path = remapObservedPath(exec_path);
 
+  for (const auto& executed_file : executed_files) {
+    const std::string exec_path = remapObservedPath(executed_file);
     if (exec_path.empty()) {
       continue;
     }
@@ -696,33 +764,79 @@ void Tracker::trackBuild() {
   timing_ = TrackingTiming{};
   Logger::info("Build command: " + build_info_->build_command_);
   const auto tracking_start = Clock::now();
-  std::string bpftrace_output;
+
+  TraceEventDispatcher dispatcher;
+  TraceObservations observations;
+  subscribeConsumers(dispatcher, observations);
+
+  // Keep the decoded trace on disk for debugging. The file is opened before
+  // tracing starts so that opening it is not itself traced.
+  const std::string raw_output_path = build_info_->log_dir_ +
+                                      "/bpftrace_raw_output_" +
+                                      std::to_string(getpid()) + ".log";
+  std::ofstream raw_output_file(raw_output_path);
+  int last_output_pid = -1;
+  auto write_raw_output = [&](const TraceEvent& event) {
+    if (event.pid != last_output_pid) {
+      raw_output_file << "ID " << event.pid << ": \n";
+      last_output_pid = event.pid;
+    }
+    switch (event.type) {
+      case TraceEventType::EXEC:
+        raw_output_file << "execve " << event.path << ' ' << event.args;
+        break;
+      case TraceEventType::OPENAT:
+        raw_output_file << "openat " << event.path << ' ' << event.flags;
+        break;
+      case TraceEventType::CREAT:
+        raw_output_file << "creat " << event.path;
+        break;
+    }
+    raw_output_file << '\n';
+  };
+  if (raw_output_file.is_open()) {
+    for (auto type : {TraceEventType::EXEC, TraceEventType::OPENAT,
+                      TraceEventType::CREAT}) {
+      dispatcher.subscribe(type, write_raw_output);
+    }
+  }
+
   try {
-    bpftrace_output = executeWithBpftrace(build_info_->build_command_);
+    // A trace daemon is used first when one was asked for. Otherwise the
+    // ring-buffer backend is preferred when it was compiled in;
+    // REPROBUILD_TRACE_BACKEND=bpftrace forces the bpftrace script.
+    bool traced = executeWithDaemon(build_info_->build_command_, dispatcher);
+    if (!traced && ringbufBackendRequested()) {
+      traced = executeWithRingbuf(build_info_->build_command_, dispatcher);
+    }
+    if (!traced) {
+      executeWithBpftrace(build_info_->build_command_,
+                          [&dispatcher](int pid, std::string_view line) {
+                            dispatcher.dispatch(pid, line);
+                          });
+    }
   } catch (const std::exception& e) {
     Logger::error("Error executing build command: " + std::string(e.what()));
     return;
   }
+  const size_t unresolved_opens = dispatcher.finish();
+  if (unresolved_opens > 0) {
+    Logger::debug("Dropped " + std::to_string(unresolved_opens) +
+                  " relative opens without a directory record");
+  }
   const auto analysis_start = Clock::now();
 
-  // Write raw bpftrace output to a file for debugging
-  const std::string raw_output_path = build_info_->log_dir_ +
-                                      "/bpftrace_raw_output_" +
-                                      std::to_string(getpid()) + ".log";
   const auto raw_output_write_start = Clock::now();
-  {
-    std::ofstream raw_output_file(raw_output_path);
-    if (raw_output_file.is_open()) {
-      raw_output_file << bpftrace_output;
-    }
-  }
+  raw_output_file.close();
   timing_.raw_output_write_ms +=
       elapsedMs(raw_output_write_start, Clock::now());
+  Logger::debug("Dispatched " + std::to_string(dispatcher.eventCount()) +
+                " trace events");
 
   const auto dependency_file_parse_start = Clock::now();
-  auto library_files = parseLibFiles(bpftrace_output);
-  auto header_files = parseHeaderFiles(bpftrace_output);
-  auto executables = parseExecutables(bpftrace_output);
+  auto library_files = parseLibFiles(observations.opened_files);
+  auto header_files = parseHeaderFiles(observations.opened_files);
+  auto executables = parseExecutables(observations.executed_files);
   timing_.dependency_file_parse_ms +=
       elapsedMs(dependency_file_parse_start, Clock::now());
   Logger::info("Found " + std::to_string(library_files.size()) + " libraries");
@@ -732,54 +846,38 @@ void Tracker::trackBuild() {
 
   BuildRecord& record = build_info_->build_record_;
 
-  // Process all files concurrently using thread pool
-  const size_t max_threads =
-      std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
-  ThreadPool pool(max_threads);
-  std::mutex record_mutex;  // Protect record operations
-  std::vector<std::future<void>> futures;
-
-  auto process_file = [&](const std::string& file_path) {
-    try {
-      Logger::debug("Processing file: " + file_path);
-
-      DependencyPackage dep =
-          DependencyPackage::fromRawFile(file_path, build_info_->package_mgr_);
-      if (dep.isValid()) {
-        {
-          std::lock_guard<std::mutex> lock(record_mutex);
-          record.addDependency(dep);
-        }
-        Logger::debug("  Added: " + dep.getPackageName() + " v" +
-                      dep.getVersion());
-      } else {
-        Logger::debug("  Skipped invalid dependency: " + file_path);
-      }
-    } catch (const std::exception& e) {
-      Logger::warn("Error processing file " + file_path + ": " + e.what());
-    }
-  };
-
   auto dependency_files =
       mergeDependencyFiles(library_files, header_files, executables);
   Logger::info("Processing " + std::to_string(dependency_files.size()) +
                " unique dependency files");
 
+  // Resolve all files in one batch; the record is filled afterwards on this
+  // thread, in path order.
+  const ConcurrencyPlan& concurrency = Concurrency::current();
+  timing_.io_threads = concurrency.io_threads;
+  timing_.cpu_threads = concurrency.cpu_threads;
+  const std::vector<std::string> dependency_paths(dependency_files.begin(),
+                                                  dependency_files.end());
   const auto dependency_resolution_start = Clock::now();
-  for (const auto& dependency_file : dependency_files) {
-    futures.emplace_back(pool.enqueue(process_file, dependency_file));
-  }
-
-  // Wait for all tasks to complete
-  for (auto& future : futures) {
-    future.get();
+  const auto dependencies =
+      resolveDependencyFiles(dependency_paths, concurrency.io_threads);
+  for (size_t i = 0; i < dependencies.size(); ++i) {
+    const DependencyPackage& dep = dependencies[i];
+    Logger::debug("Processing file: " + dependency_paths[i]);
+    if (dep.isValid()) {
+      record.addDependency(dep);
+      Logger::debug("  Added: " + dep.getPackageName() + " v" +
+                    dep.getVersion());
+    } else {
+      Logger::debug("  Skipped invalid dependency: " + dependency_paths[i]);
+    }
   }
   timing_.dependency_resolution_ms +=
       elapsedMs(dependency_resolution_start, Clock::now());
 
-  // Detect build artifacts from bpftrace output
+  // Detect build artifacts from the created files seen in the trace
   const auto artifact_detection_start = Clock::now();
-  detectBuildArtifacts(bpftrace_output, record);
+  detectBuildArtifacts(observations.created_files, record);
   timing_.artifact_detection_ms +=
       elapsedMs(artifact_detection_start, Clock::now());
 
@@ -787,7 +885,8 @@ void Tracker::trackBuild() {
   try {
     if (!build_info_->graph_output_file_.empty()) {
       const auto graph_start = Clock::now();
-      build_info_->build_graph_ = parseBuildGraph(bpftrace_output);
+      build_info_->build_graph_ =
+          parseBuildGraph(observations.build_tool_execs);
       timing_.graph_parse_ms += elapsedMs(graph_start, Clock::now());
       // Prune to only edges reachable from detected artifacts.
       // Use basenames only to avoid path-form mismatches between what
@@ -805,6 +904,17 @@ void Tracker::trackBuild() {
     Logger::warn("Failed to save build graph: " + std::string(e.what()));
   }
 
+  Logger::debug("Hashed " +
+                std::to_string(FileHasher::instance().hashedCount()) +
+                " files, " +
+                std::to_string(FileHasher::instance().reusedCount()) +
+                " repeated requests served from memo");
+  Logger::debug("Dependency resolution cache: " +
+                std::to_string(DependencyResolver::cacheHitCount()) +
+                " hits, " +
+                std::to_string(DependencyResolver::cacheMissCount()) +
+                " misses");
+
   const auto analysis_end = Clock::now();
   timing_.postprocessing_ms += elapsedMs(analysis_start, analysis_end);
   timing_.total_ms = elapsedMs(tracking_start, analysis_end);
@@ -829,57 +939,37 @@ void Tracker::trackBuild() {
                std::to_string(timing_.artifact_detection_ms) +
                " ms, graph_parse=" + std::to_string(timing_.graph_parse_ms) +
                " ms, graph_prune=" + std::to_string(timing_.graph_prune_ms) +
-               " ms");
+               " ms, io_threads=" + std::to_string(timing_.io_threads) +
+               ", cpu_threads=" + std::to_string(timing_.cpu_threads) +
+               ", reused_dependency_files=" +
+               std::to_string(timing_.reused_dependency_files));
 }
 
-void Tracker::detectBuildArtifacts(const std::string& bpftrace_output,
-                                   BuildRecord& record) {
+void Tracker::detectBuildArtifacts(
+    const std::unordered_set<std::string>& created_files,
+    BuildRecord& record) {
   Logger::debug("Detecting build artifacts from bpftrace output");
 
-  std::istringstream input_stream(bpftrace_output);
-  std::string line;
-  std::set<std::string> created_files;
-
-  while (std::getline(input_stream, line)) {
-    // Skip ID header lines and empty lines
-    if (line.empty() || Utils::startsWith(line, "ID ")) {
-      continue;
-    }
-
-    std::string filepath;
-
-    // Match creat syscall: "creat /path/to/file"
-    if (Utils::startsWith(line, "creat ")) {
-      std::istringstream line_stream(line);
-      std::string syscall;
-      line_stream >> syscall >> filepath;
-    }
-    // Match openat with O_CREAT flag: "openat /path/to/file flags"
-    else if (Utils::startsWith(line, "openat ")) {
-      std::istringstream line_stream(line);
-      std::string syscall, path;
-      int flags;
-      line_stream >> syscall >> path >> flags;
-
-      // Check if O_CREAT flag is set (64 = 0100 octal)
-      if ((flags & 64) != 0) {
-        filepath = path;
-      }
-    }
-
-    filepath = remapObservedPath(filepath);
+  std::set<std::string> existing_files;
+  for (const auto& created_file : created_files) {
+    const std::string filepath = remapObservedPath(created_file);
     if (!filepath.empty() && std::filesystem::exists(filepath)) {
       Logger::debug("Found created file: " + filepath);
-      created_files.insert(filepath);
+      existing_files.insert(filepath);
     }
   }
 
   // Process created files and identify build artifacts
-  processCreatedFiles(created_files, record);
+  processCreatedFiles(existing_files, record);
 }
 
 void Tracker::processCreatedFiles(const std::set<std::string>& created_files,
                                   BuildRecord& record) {
+  struct Candidate {
+    std::string path;
+    std::string type;
+  };
+  std::vector<Candidate> candidates;
   for (const auto& filepath : created_files) {
     try {
       if (shouldIgnoreArtifact(filepath)) {
@@ -907,71 +997,46 @@ void Tracker::processCreatedFiles(const std::set<std::string>& created_files,
                     (is_shared_lib ? " is shared library." : "") +
                     (is_static_lib ? " is static library." : ""));
 
-      // Add artifact to build record
-      const std::string hash = Utils::calculateFileHash(filepath);
-      const std::string display_path = makeRelativePath(filepath, ".");
       std::string artifact_type = "executable";
       if (is_shared_lib) {
         artifact_type = "shared_library";
       } else if (is_static_lib) {
         artifact_type = "static_library";
       }
-
-      BuildArtifact artifact(display_path, hash, artifact_type);
-      record.addArtifact(artifact);
-
-      Logger::debug("Added artifact: " + display_path + " (" + artifact_type +
-                    ")");
+      candidates.push_back({filepath, std::move(artifact_type)});
     } catch (const std::exception& e) {
       Logger::warn("Error processing created file " + filepath + ": " +
                    e.what());
     }
   }
-}
-
-BuildGraph Tracker::parseBuildGraph(const std::string& bpftrace_output) {
-  // Longer tool names come first so suffix matching keeps ld.gold/clang++
-  // distinct from ld/g++.
-  static constexpr std::array<std::string_view, 15> kBuildTools = {
-      "clang++", "clang", "ld.gold", "ld.lld", "ld.bfd",
-      "libtool", "ranlib", "objcopy", "strip", "gcc",
-      "g++",     "c++",   "cc",      "ar",     "ld"};
-
-  auto is_build_tool = [&](std::string_view tool) -> bool {
-    return std::find(kBuildTools.begin(), kBuildTools.end(), tool) !=
-           kBuildTools.end();
-  };
 
-  // - strip numeric version suffixes ("gcc-12" -> "gcc")
-  //   ("x86_64-linux-gnu-g++-14" -> "g++")
-  auto normalize_tool = [&](std::string_view name) -> std::string_view {
-    std::string_view normalized = name;
-
-    const size_t dash = normalized.rfind('-');
-    bool has_numeric_suffix = dash != std::string_view::npos &&
-                              dash + 1 < normalized.size();
-    for (size_t i = dash + 1; has_numeric_suffix && i < normalized.size();
-         ++i) {
-      has_numeric_suffix =
-          std::isdigit(static_cast<unsigned char>(normalized[i])) != 0;
-    }
-    if (has_numeric_suffix) {
-      normalized.remove_suffix(normalized.size() - dash);
-    }
+  // Hash all artifacts on the hasher's workers, then record them in order.
+  std::vector<std::string> paths;
+  paths.reserve(candidates.size());
+  for (const auto& candidate : candidates) {
+    paths.push_back(candidate.path);
+  }
+  FileHasher& hasher = FileHasher::instance();
+  hasher.prefetch(paths);
 
-    if (is_build_tool(normalized)) {
-      return normalized;
-    }
+  for (const auto& candidate : candidates) {
+    try {
+      // Add artifact to build record
+      const std::string hash = hasher.hash(candidate.path);
+      const std::string display_path = makeRelativePath(candidate.path, ".");
+      BuildArtifact artifact(display_path, hash, candidate.type);
+      record.addArtifact(artifact);
 
-    for (const auto& tool : kBuildTools) {
-      if (endsWithView(normalized, tool)) {
-        return tool;
-      }
+      Logger::debug("Added artifact: " + display_path + " (" +
+                    candidate.type + ")");
+    } catch (const std::exception& e) {
+      Logger::warn("Error processing created file " + candidate.path + ": " +
+                   e.what());
     }
+  }
+}
 
-    return normalized;
-  };
-
+BuildGraph Tracker::parseBuildGraph(const std::vector<ExecRecord>& execs) {
   // Determine a node's type from its file extension / properties.
   auto classify = [&](const std::string& p, bool is_output) -> BuildNodeType {
     const std::string_view ext = extensionView(p);
@@ -989,8 +1054,11 @@ BuildGraph Tracker::parseBuildGraph(const std::string& bpftrace_output) {
 
   BuildGraph graph;
   std::unordered_set<std::string> seen_node_paths;
+  // Nodes are hashed in parallel once all edges are known.
+  std::vector<BuildNode> nodes;
+  std::vector<std::string> node_paths;
 
-  // Lazily add (or update) a node; compute hash only once per path.
+  // Lazily add a node; the first reference decides its type.
   auto ensure_node = [&](const std::string& path, bool is_output) {
     if (path.empty()) return;
     if (!seen_node_paths.insert(path).second) return;
@@ -998,35 +1066,25 @@ BuildGraph Tracker::parseBuildGraph(const std::string& bpftrace_output) {
     BuildNode node;
     node.path = path;
     node.type = classify(path, is_output);
-    if (std::filesystem::exists(path)) {
-      node.hash = Utils::calculateFileHash(path);
-    }
-    graph.addNode(std::move(node));
+    nodes.push_back(std::move(node));
+    node_paths.push_back(path);
   };
 
-  int current_pid = -1;
-
-  auto process_exec = [&](std::string_view rest) {
-    const std::string_view command_path_view = nextToken(rest);
-    if (command_path_view.empty()) {
-      return;
-    }
-
-    const std::string_view tool =
-        normalize_tool(filenameView(command_path_view));
-    if (!is_build_tool(tool)) {
+  auto process_exec = [&](const ExecRecord& exec) {
+    const std::string_view tool = normalizeTool(filenameView(exec.path));
+    if (!isBuildTool(tool)) {
       return;
     }
 
-    std::string command_path(command_path_view);
-    if (!std::filesystem::exists(command_path)) {
+    if (!std::filesystem::exists(exec.path)) {
       return;
     }
 
+    std::string_view rest = exec.args;
     BuildEdge edge;
     edge.command.assign(tool.data(), tool.size());
-    edge.command_path = std::move(command_path);
-    edge.pid = current_pid;
+    edge.command_path = exec.path;
+    edge.pid = exec.pid;
     edge.args.reserve(16);
 
     while (true) {
@@ -1119,38 +1177,16 @@ BuildGraph Tracker::parseBuildGraph(const std::string& bpftrace_output) {
     graph.addEdge(std::move(edge));
   };
 
-  size_t line_start = 0;
-  while (line_start <= bpftrace_output.size()) {
-    size_t line_end = bpftrace_output.find('\n', line_start);
-    if (line_end == std::string::npos) {
-      line_end = bpftrace_output.size();
-    }
-    std::string_view line(bpftrace_output.data() + line_start,
-                          line_end - line_start);
-
-    if (!line.empty()) {
-      // "ID <PID>: " header -> update PID context for subsequent exec lines.
-      if (startsWithView(line, "ID ")) {
-        const char* first = line.data() + 3;
-        const char* last = line.data() + line.size();
-        int parsed_pid = -1;
-        const auto result = std::from_chars(first, last, parsed_pid);
-        if (result.ec == std::errc()) {
-          current_pid = parsed_pid;
-        } else {
-          current_pid = -1;
-        }
-      } else if (startsWithView(line, "execve ")) {
-        process_exec(line.substr(7));
-      } else if (startsWithView(line, "execveat ")) {
-        process_exec(line.substr(9));
-      }
-    }
+  for (const auto& exec : execs) {
+    process_exec(exec);
+  }
 
-    if (line_end == bpftrace_output.size()) {
-      break;
-    }
-    line_start = line_end + 1;
+  // Missing files keep an empty hash.
+  FileHasher& hasher = FileHasher::instance();
+  hasher.prefetch(node_paths);
+  for (auto& node : nodes) {
+    node.hash = hasher.hash(node.path);
+    graph.addNode(std::move(node));
   }
 
   Logger::debug("Build graph: " + std::to_string(graph.nodeCount()) +
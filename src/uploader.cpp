@@ -1,21 +1,39 @@
 #include "uploader.h"
 
-#include <openssl/hmac.h>
-#include <openssl/sha.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cstdlib>
-#include <cstring>
-#include <ctime>
 #include <filesystem>
 #include <fstream>
-#include <iomanip>
-#include <sstream>
+#include <mutex>
 
+#include "archive_writer.h"
+#include "concurrency.h"
 #include "logger.h"
+#include "thread_pool.h"
 #include "utils.h"
 
 namespace fs = std::filesystem;
 
+namespace {
+const size_t kDefaultUploadThreads = 8;
+const long long kDefaultListingTtlSeconds = 600;
+// Version 2 holds only objects this client asked about, not whole listings.
+const char kListingCacheMagic[] = "reprobuild-minio-listing 2";
+
+std::string objectName(const std::string& hash) { return hash + ".zip"; }
+
+long long nowSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+}  // namespace
+
 Uploader::Uploader() { loadConfig(); }
 
 void Uploader::loadConfig() {
@@ -40,48 +58,126 @@ void Uploader::loadConfig() {
   const char* bucket_env = std::getenv("MINIO_BUCKET");
   bucket_name_ = bucket_env ? std::string(bucket_env) : "reprobuild";
 
+  // Uploads wait on the network, not on local cores.
+  const char* threads_env = std::getenv("MINIO_UPLOAD_THREADS");
+  const size_t threads =
+      threads_env ? Concurrency::parseThreadCount(threads_env) : 0;
+  upload_threads_ = threads > 0 ? threads : kDefaultUploadThreads;
+
+  const char* part_env = std::getenv("MINIO_PART_SIZE");
+  const long long part_size = part_env ? std::atoll(part_env) : 0;
+  part_size_ = part_size > 0 ? static_cast<size_t>(part_size)
+                             : S3ObjectWriter::kDefaultPartSize;
+  if (part_size_ < S3ObjectWriter::kMinPartSize) {
+    Logger::warn("MINIO_PART_SIZE " + std::to_string(part_size_) +
+                 " is below the 5 MiB S3 minimum; using 5 MiB");
+    part_size_ = S3ObjectWriter::kMinPartSize;
+  }
+
+  const char* ttl_env = std::getenv("MINIO_LISTING_TTL");
+  listing_ttl_seconds_ =
+      ttl_env ? std::atoll(ttl_env) : kDefaultListingTtlSeconds;
+  const std::string cache_dir = Utils::userCacheDir();
+  if (listing_ttl_seconds_ > 0 && !cache_dir.empty()) {
+    std::string name = minio_host_ + "_" + std::to_string(minio_port_) + "_" +
+                       bucket_name_;
+    std::replace_if(
+        name.begin(), name.end(),
+        [](unsigned char c) { return !std::isalnum(c) && c != '.'; }, '_');
+    listing_cache_path_ = cache_dir + "/minio_listing_" + name;
+  }
+
+  client_ = std::make_unique<S3Client>(minio_host_, minio_port_,
+                                       minio_access_key_, minio_secret_key_,
+                                       bucket_name_);
+
   Logger::debug("MinIO configuration: " + minio_host_ + ":" +
-                std::to_string(minio_port_) + ", bucket: " + bucket_name_);
+                std::to_string(minio_port_) + ", bucket: " + bucket_name_ +
+                ", upload threads: " + std::to_string(upload_threads_));
 }
 
 int Uploader::uploadCustomDependencies(
     const std::vector<DependencyPackage>& dependencies) {
-  int uploaded_count = 0;
-  int skipped_count = 0;
-
   Logger::info("Starting upload of custom dependencies to MinIO");
 
+  std::vector<const DependencyPackage*> custom;
   for (const auto& dep : dependencies) {
     if (dep.getOrigin() != DependencyOrigin::CUSTOM) {
       continue;
     }
-
-    const std::string original_path = dep.getOriginalPath();
-    const std::string hash = dep.getHashValue();
-
-    if (!fs::exists(original_path)) {
-      Logger::warn("Custom dependency file does not exist: " + original_path);
+    if (!fs::exists(dep.getOriginalPath())) {
+      Logger::warn("Custom dependency file does not exist: " +
+                   dep.getOriginalPath());
       continue;
     }
+    custom.push_back(&dep);
+  }
+
+  std::vector<std::string> wanted;
+  wanted.reserve(custom.size());
+  for (const DependencyPackage* dep : custom) {
+    wanted.push_back(objectName(dep->getHashValue()));
+  }
+  std::unordered_set<std::string> existing;
+  std::unordered_set<std::string> unresolved;
+  long long listed_at = 0;
+  bool learned = findExistingObjects(wanted, existing, unresolved, listed_at);
+
+  std::mutex uploaded_mutex;
+  std::vector<std::string> uploaded;
+  std::vector<std::string> found;  // by HEAD
+  std::atomic<int> skipped_count{0};
+  auto upload_one = [&](const DependencyPackage& dep) {
+    const std::string& hash = dep.getHashValue();
+    const std::string name = objectName(hash);
 
     // Check if file already exists on MinIO
-    if (fileExistsOnMinio(hash)) {
+    bool exists = existing.count(name) > 0;
+    if (!exists && unresolved.count(name) > 0 && fileExistsOnMinio(hash)) {
+      std::lock_guard<std::mutex> lock(uploaded_mutex);
+      found.push_back(name);
+      exists = true;
+    }
+    if (exists) {
       Logger::debug("File already exists on MinIO (hash: " + hash +
                     "), skipping: " + dep.getPackageName());
       skipped_count++;
-      continue;
+      return;
     }
 
     // Upload file
-    if (uploadFile(original_path, hash)) {
-      uploaded_count++;
+    if (uploadFile(dep.getOriginalPath(), hash)) {
+      std::lock_guard<std::mutex> lock(uploaded_mutex);
+      uploaded.push_back(name);
     } else {
       Logger::error("Failed to upload: " + dep.getPackageName());
     }
+  };
+
+  // The calling thread uploads as well.
+  const size_t threads = std::min(upload_threads_, custom.size());
+  ThreadPool pool(threads > 0 ? threads - 1 : 0);
+  pool.parallel_for(0, custom.size(), 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      upload_one(*custom[i]);
+    }
+  });
+
+  // Keep the cache's age, so what it records is re-checked in time even
+  // if every run adds to it.
+  learned = learned || !uploaded.empty() || !found.empty();
+  if (learned) {
+    existing.insert(uploaded.begin(), uploaded.end());
+    existing.insert(found.begin(), found.end());
+    saveListingCache(existing, listed_at);
   }
+  const int uploaded_count = static_cast<int>(uploaded.size());
 
   Logger::info("Upload complete: " + std::to_string(uploaded_count) +
-               " uploaded, " + std::to_string(skipped_count) + " skipped");
+               " uploaded, " + std::to_string(skipped_count.load()) +
+               " skipped in " + std::to_string(client_->requestCount()) +
+               " requests over " +
+               std::to_string(client_->connectionCount()) + " connections");
 
   return uploaded_count;
 }
@@ -89,20 +185,27 @@ int Uploader::uploadCustomDependencies(
 bool Uploader::uploadFile(const std::string& file_path,
                           const std::string& hash) {
   try {
-    // Compress the file
-    std::string compressed_file = compressFile(file_path);
-    if (compressed_file.empty()) {
-      Logger::error("Failed to compress file: " + file_path);
+    // Zip the file straight into the request bodies: a single-entry
+    // archive named after the file, as `zip -j` would write it.
+    S3ObjectWriter object(*client_, objectName(hash),
+                          "application/octet-stream", part_size_);
+    ZipWriter zip(
+        [&object](std::string_view data) { return object.write(data); });
+    if (!zip.addFile(file_path, fs::path(file_path).filename().string()) ||
+        !zip.finish()) {
+      Logger::error("Failed to compress or send file: " + file_path);
       return false;
     }
 
     // Upload to MinIO with hash as object name
-    std::string object_name = hash + ".zip";
-    bool success = uploadToMinioWithCurl(compressed_file, object_name);
-
-    // Clean up compressed file
-    fs::remove(compressed_file);
-
+    const bool success = object.finish();
+    if (success) {
+      Logger::debug("Uploaded " + objectName(hash) + " in " +
+                    std::to_string(std::max<size_t>(1, object.partCount())) +
+                    " part(s)");
+    } else {
+      Logger::error("Upload failed: " + objectName(hash));
+    }
     return success;
   } catch (const std::exception& e) {
     Logger::error("Error uploading file: " + std::string(e.what()));
@@ -110,226 +213,101 @@ bool Uploader::uploadFile(const std::string& file_path,
   }
 }
 
-std::string Uploader::compressFile(const std::string& file_path) {
-  try {
-    // Create temporary output path
-    std::string output_path = file_path + ".zip";
-
-    // Use zip to compress the file
-    std::string cmd = "zip -r -j " + output_path + " \"" + file_path + "\"";
-    int result = std::system(cmd.c_str());
-
-    if (result != 0) {
-      Logger::error("zip command failed with code: " + std::to_string(result));
-      return "";
-    }
+bool Uploader::fileExistsOnMinio(const std::string& hash) {
+  // HTTP 200 means file exists
+  return client_->headObject(objectName(hash)) == 200;
+}
 
-    if (!fs::exists(output_path)) {
-      Logger::error("Compressed file was not created: " + output_path);
-      return "";
+bool Uploader::findExistingObjects(
+    const std::vector<std::string>& wanted,
+    std::unordered_set<std::string>& existing,
+    std::unordered_set<std::string>& unresolved, long long& listed_at) {
+  if (!loadListingCache(existing, listed_at)) {
+    existing.clear();
+    listed_at = nowSeconds();
+  }
+  for (const auto& key : wanted) {
+    if (existing.count(key) == 0) {
+      unresolved.insert(key);
     }
-
-    return output_path;
-  } catch (const std::exception& e) {
-    Logger::error("Error compressing file: " + std::string(e.what()));
-    return "";
   }
-}
-
-bool Uploader::fileExistsOnMinio(const std::string& hash) {
-  std::string object_name = hash + ".zip";
-
-  // Build resource path and URL
-  std::string resource = "/" + bucket_name_ + "/" + object_name;
-  std::string url =
-      "http://" + minio_host_ + ":" + std::to_string(minio_port_) + resource;
-
-  // Generate date string (RFC 1123)
-  std::string date = getCurrentDateRFC1123();
-
-  // Build string to sign (AWS Signature Version 2 for HEAD request)
-  // Format: HTTP-VERB\n\nCONTENT-TYPE\nDATE\nCanonicalizedResource
-  std::string string_to_sign = "HEAD\n\n\n" + date + "\n" + resource;
-
-  // Calculate HMAC-SHA1 signature
-  std::string signature = hmacSha1(minio_secret_key_, string_to_sign);
-
-  // Build Authorization header
-  std::string auth_header =
-      "Authorization: AWS " + minio_access_key_ + ":" + signature;
-
-  // Build curl command with proper headers
-  std::ostringstream cmd;
-  cmd << "curl -s -o /dev/null -w \"%{http_code}\" --head \"" << url << "\"";
-  cmd << " -H \"Host: " << minio_host_ << ":" << minio_port_ << "\"";
-  cmd << " -H \"Date: " << date << "\"";
-  cmd << " -H \"" << auth_header << "\"";
-
-  Logger::debug("Checking existence: " + url);
-
-  // Execute curl command
-  FILE* pipe = popen(cmd.str().c_str(), "r");
-  if (!pipe) {
-    Logger::warn("Failed to execute curl command for existence check");
+  if (unresolved.empty()) {
+    Logger::debug("All objects found in the cached bucket listing");
     return false;
   }
 
-  char buffer[128];
-  std::string result;
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    result += buffer;
+  // A listing page costs a request, as a HEAD does: on a bucket shared
+  // with many other objects, stop listing once it would cost more than
+  // checking what is left one by one.
+  std::vector<std::string> keys;
+  bool complete = false;
+  const bool listed =
+      client_->listObjects("", keys, unresolved.size(), &complete);
+  bool learned = false;
+  for (const auto& key : keys) {
+    if (unresolved.erase(key) > 0) {
+      existing.insert(key);
+      learned = true;
+    }
   }
-  pclose(pipe);
-
-  // HTTP 200 means file exists
-  return result.find("200") != std::string::npos;
+  if (listed && complete) {
+    // Whatever the full listing did not show is missing.
+    unresolved.clear();
+  } else {
+    Logger::debug("Bucket " + bucket_name_ + " not fully listed after " +
+                  std::to_string(keys.size()) + " objects; checking " +
+                  std::to_string(unresolved.size()) + " with HEAD");
+  }
+  return learned;
 }
 
-bool Uploader::uploadToMinioWithCurl(const std::string& local_file,
-                                     const std::string& object_name) {
-  // Check if file exists
-  if (!fs::exists(local_file)) {
-    Logger::error("File does not exist: " + local_file);
+bool Uploader::loadListingCache(std::unordered_set<std::string>& keys,
+                                long long& listed_at) const {
+  if (listing_cache_path_.empty()) {
     return false;
   }
-
-  // Get file size
-  uintmax_t file_size = fs::file_size(local_file);
-
-  // Build resource path and URL
-  std::string resource = "/" + bucket_name_ + "/" + object_name;
-  std::string url =
-      "http://" + minio_host_ + ":" + std::to_string(minio_port_) + resource;
-
-  // Generate date string (RFC 1123)
-  std::string date = getCurrentDateRFC1123();
-
-  // Content type
-  std::string content_type = "application/octet-stream";
-
-  // Build string to sign (AWS Signature Version 2)
-  // Format: HTTP-VERB\n\nCONTENT-TYPE\nDATE\nCanonicalizedResource
-  std::string string_to_sign =
-      "PUT\n\n" + content_type + "\n" + date + "\n" + resource;
-
-  // Calculate HMAC-SHA1 signature
-  std::string signature = hmacSha1(minio_secret_key_, string_to_sign);
-
-  // Build Authorization header
-  std::string auth_header =
-      "Authorization: AWS " + minio_access_key_ + ":" + signature;
-
-  // Build curl command with proper headers
-  std::ostringstream cmd;
-  cmd << "curl -s -X PUT -T \"" << local_file << "\" \"" << url << "\"";
-  cmd << " -H \"Host: " << minio_host_ << ":" << minio_port_ << "\"";
-  cmd << " -H \"Date: " << date << "\"";
-  cmd << " -H \"Content-Type: " << content_type << "\"";
-  cmd << " -H \"" << auth_header << "\"";
-  cmd << " -w \"\\nHTTP_CODE:%{http_code}\"";
-
-  Logger::debug("Upload URL: " + url);
-  Logger::debug("String to sign: " + string_to_sign);
-  Logger::debug("Signature: " + signature);
-
-  // Execute curl command
-  FILE* pipe = popen(cmd.str().c_str(), "r");
-  if (!pipe) {
-    Logger::error("Failed to execute curl command");
+  std::ifstream file(listing_cache_path_);
+  std::string magic;
+  if (!std::getline(file, magic) || magic != kListingCacheMagic ||
+      !(file >> listed_at)) {
     return false;
   }
-
-  // Read response
-  char buffer[256];
-  std::string response;
-  while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-    response += buffer;
-  }
-  pclose(pipe);
-
-  // Extract HTTP status code
-  size_t code_pos = response.find("HTTP_CODE:");
-  int http_code = 0;
-  if (code_pos != std::string::npos) {
-    http_code = std::stoi(response.substr(code_pos + 10));
+  if (nowSeconds() - listed_at > listing_ttl_seconds_) {
+    return false;
   }
-
-  // Check if upload was successful
-  if (http_code == 200 || http_code == 201) {
-    Logger::debug("Upload successful (HTTP " + std::to_string(http_code) + ")");
-    return true;
-  } else {
-    Logger::error("Upload failed (HTTP " + std::to_string(http_code) + ")");
-    if (!response.empty()) {
-      Logger::error("Response: " + response);
+  std::string key;
+  std::getline(file, key);  // rest of the timestamp line
+  while (std::getline(file, key)) {
+    if (!key.empty()) {
+      keys.insert(key);
     }
-    return false;
   }
+  return true;
 }
 
-std::string Uploader::getCurrentDateRFC1123() {
-  time_t now = time(nullptr);
-  struct tm tm_info;
-  gmtime_r(&now, &tm_info);
-
-  char buffer[128];
-  strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
-  return std::string(buffer);
-}
-
-std::string Uploader::base64Encode(const unsigned char* input, int length) {
-  static const char encoding_table[] =
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-  std::string encoded;
-  int i = 0;
-  unsigned char array_3[3];
-  unsigned char array_4[4];
-
-  while (length--) {
-    array_3[i++] = *(input++);
-    if (i == 3) {
-      array_4[0] = (array_3[0] & 0xfc) >> 2;
-      array_4[1] = ((array_3[0] & 0x03) << 4) + ((array_3[1] & 0xf0) >> 4);
-      array_4[2] = ((array_3[1] & 0x0f) << 2) + ((array_3[2] & 0xc0) >> 6);
-      array_4[3] = array_3[2] & 0x3f;
-
-      for (i = 0; i < 4; i++) {
-        encoded += encoding_table[array_4[i]];
-      }
-      i = 0;
-    }
+void Uploader::saveListingCache(const std::unordered_set<std::string>& keys,
+                                long long listed_at) const {
+  if (listing_cache_path_.empty()) {
+    return;
   }
-
-  if (i) {
-    for (int j = i; j < 3; j++) {
-      array_3[j] = '\0';
-    }
-
-    array_4[0] = (array_3[0] & 0xfc) >> 2;
-    array_4[1] = ((array_3[0] & 0x03) << 4) + ((array_3[1] & 0xf0) >> 4);
-    array_4[2] = ((array_3[1] & 0x0f) << 2) + ((array_3[2] & 0xc0) >> 6);
-
-    for (int j = 0; j < i + 1; j++) {
-      encoded += encoding_table[array_4[j]];
-    }
-
-    while (i++ < 3) {
-      encoded += '=';
+  try {
+    fs::create_directories(fs::path(listing_cache_path_).parent_path());
+    const std::string temp_path =
+        listing_cache_path_ + ".tmp." + std::to_string(getpid());
+    {
+      std::ofstream file(temp_path, std::ios::trunc);
+      file << kListingCacheMagic << "\n" << listed_at << "\n";
+      for (const auto& key : keys) {
+        file << key << "\n";
+      }
+      if (!file) {
+        Logger::warn("Failed to write bucket listing cache " + temp_path);
+        return;
+      }
     }
+    fs::rename(temp_path, listing_cache_path_);
+  } catch (const std::exception& e) {
+    Logger::warn("Failed to save bucket listing cache: " +
+                 std::string(e.what()));
   }
-
-  return encoded;
-}
-
-std::string Uploader::hmacSha1(const std::string& key,
-                               const std::string& data) {
-  unsigned char* digest;
-  unsigned int digest_len;
-
-  digest = HMAC(EVP_sha1(), key.c_str(), key.length(),
-                reinterpret_cast<const unsigned char*>(data.c_str()),
-                data.length(), nullptr, &digest_len);
-
-  return base64Encode(digest, digest_len);
 }
@@ -1,20 +1,30 @@
 #include "utils.h"
 
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include <array>
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <fstream>
 #include <iomanip>
 #include <memory>
 #include <sstream>
 #include <vector>
 
-#include <openssl/evp.h>
-
+#include "file_digest.h"
+#include "hash_cache.h"
 #include "logger.h"
 
+namespace {
+struct ScopedFd {
+  int fd;
+  ~ScopedFd() { close(fd); }
+};
+}  // namespace
+
 namespace Utils {
 
 bool contains(const std::string& s, const std::string& key) {
@@ -58,51 +68,60 @@ std::string executeCommand(const std::string& command) {
 }
 
 std::string calculateFileHash(const std::string& filepath) {
-  std::ifstream file(filepath, std::ios::binary);
-  if (!file.is_open()) {
+  const int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
     return "";
   }
+  const ScopedFd fd_guard{fd};
+
+  // The cache key comes from the descriptor that is hashed, so a file
+  // replaced in between cannot be cached under the old key.
+  struct stat st;
+  const bool have_stat = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  HashCache::Digest digest;
+  HashCache& cache = HashCache::instance();
+  if (have_stat && cache.lookup(st, digest)) {
+    return FileDigest::toHex(digest);
+  }
 
-  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
-      EVP_MD_CTX_new(), EVP_MD_CTX_free);
-  if (!ctx ||
-      EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) != 1) {
-    Logger::warn("Error initializing SHA-256 for " + filepath);
+  if (!FileDigest::sha256(fd, have_stat ? st.st_size : 0, digest)) {
+    Logger::warn("Error calculating SHA-256 for " + filepath);
     return "";
   }
 
-  std::array<char, 64 * 1024> buffer;
-  while (file) {
-    file.read(buffer.data(), buffer.size());
-    const std::streamsize bytes_read = file.gcount();
-    if (bytes_read > 0 &&
-        EVP_DigestUpdate(ctx.get(), buffer.data(),
-                         static_cast<size_t>(bytes_read)) != 1) {
-      Logger::warn("Error updating SHA-256 for " + filepath);
-      return "";
-    }
+  if (have_stat) {
+    cache.store(st, digest);
   }
+  return FileDigest::toHex(digest);
+}
 
-  if (file.bad()) {
-    Logger::warn("Error reading file for hash: " + filepath);
+std::string statSignature(const std::string& filepath) {
+  struct stat st;
+  if (stat(filepath.c_str(), &st) != 0) {
     return "";
   }
-
-  unsigned char digest[EVP_MAX_MD_SIZE];
-  unsigned int digest_len = 0;
-  if (EVP_DigestFinal_ex(ctx.get(), digest, &digest_len) != 1) {
-    Logger::warn("Error finalizing SHA-256 for " + filepath);
+  auto to_ns = [](const struct timespec& ts) {
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  };
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  const long long racy_since = to_ns(now) - 2LL * 1000000000LL;
+  if (to_ns(st.st_mtim) >= racy_since || to_ns(st.st_ctim) >= racy_since) {
     return "";
   }
+  return std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+         std::to_string(to_ns(st.st_mtim)) + ":" +
+         std::to_string(to_ns(st.st_ctim));
+}
 
-  static constexpr char kHex[] = "0123456789abcdef";
-  std::string hash;
-  hash.resize(static_cast<size_t>(digest_len) * 2);
-  for (unsigned int i = 0; i < digest_len; ++i) {
-    hash[2 * i] = kHex[digest[i] >> 4];
-    hash[2 * i + 1] = kHex[digest[i] & 0x0f];
+std::string userCacheDir() {
+  if (const char* xdg = std::getenv("XDG_CACHE_HOME"); xdg && xdg[0] == '/') {
+    return std::string(xdg) + "/reprobuild";
+  }
+  if (const char* home = std::getenv("HOME"); home && home[0] == '/') {
+    return std::string(home) + "/.cache/reprobuild";
   }
-  return hash;
+  return "";
 }
 
 std::string getCurrentTimestamp() {
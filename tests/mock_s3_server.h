@@ -0,0 +1,299 @@
+#ifndef MOCK_S3_SERVER_H
+#define MOCK_S3_SERVER_H
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// In-memory S3 stand-in for tests: one bucket namespace keyed by request
+// path, HEAD/GET/PUT, ListObjectsV2 and multipart uploads, with
+// keep-alive, listening on an ephemeral port.
+class MockS3Server {
+ public:
+  MockS3Server() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+    socklen_t length = sizeof(address);
+    getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+    listen(listen_fd_, 64);
+    acceptor_ = std::thread([this] { acceptLoop(); });
+  }
+
+  ~MockS3Server() {
+    shutdown(listen_fd_, SHUT_RDWR);
+    close(listen_fd_);
+    acceptor_.join();
+    // The acceptor is gone, so the lists no longer change.
+    for (int fd : client_fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    for (auto& handler : handlers_) {
+      handler.join();
+    }
+    for (int fd : client_fds_) {
+      close(fd);
+    }
+  }
+
+  int port() const { return port_; }
+  size_t connections() const { return connections_.load(); }
+  size_t requests() const { return requests_.load(); }
+  size_t listings() const { return listings_.load(); }
+  // Parts in completed multipart uploads, and uploads still open.
+  size_t completedParts() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return parts_;
+  }
+  size_t openUploads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return uploads_.size();
+  }
+
+  // Largest ListObjectsV2 page served.
+  void setPageSize(size_t size) { page_size_ = size; }
+
+  // Close each connection after |count| requests (0 = keep it open).
+  void closeAfter(size_t count) { close_after_ = count; }
+
+  // Hold responses until resume(), so concurrent requests need
+  // connections of their own.
+  void pause() {
+    std::lock_guard<std::mutex> lock(pause_mutex_);
+    paused_ = true;
+  }
+  void resume() {
+    std::lock_guard<std::mutex> lock(pause_mutex_);
+    paused_ = false;
+    resumed_.notify_all();
+  }
+
+  // Close every client connection, as a server does with idle ones.
+  void dropConnections() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int fd : client_fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+  }
+
+  bool hasObject(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return objects_.count(path) > 0;
+  }
+  std::string object(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return objects_[path];
+  }
+  void putObject(const std::string& path, const std::string& body) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    objects_[path] = body;
+  }
+
+ private:
+  void acceptLoop() {
+    for (;;) {
+      const int fd = accept(listen_fd_, nullptr, nullptr);
+      if (fd < 0) {
+        return;
+      }
+      connections_.fetch_add(1);
+      std::lock_guard<std::mutex> lock(mutex_);
+      client_fds_.push_back(fd);
+      handlers_.emplace_back([this, fd] { serve(fd); });
+    }
+  }
+
+  void serve(int fd) {
+    std::string buffer;
+    size_t served = 0;
+    for (;;) {
+      size_t header_end;
+      while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos) {
+        if (!receive(fd, buffer)) {
+          return;
+        }
+      }
+      const std::string head = buffer.substr(0, header_end);
+      buffer.erase(0, header_end + 4);
+      const std::string method = head.substr(0, head.find(' '));
+      const size_t target_start = method.size() + 1;
+      const std::string target =
+          head.substr(target_start, head.find(' ', target_start) -
+                                        target_start);
+      size_t content_length = 0;
+      const size_t length_pos = head.find("Content-Length: ");
+      if (length_pos != std::string::npos) {
+        content_length = std::strtoul(head.c_str() + length_pos + 16,
+                                      nullptr, 10);
+      }
+      while (buffer.size() < content_length) {
+        if (!receive(fd, buffer)) {
+          return;
+        }
+      }
+      const std::string body = buffer.substr(0, content_length);
+      buffer.erase(0, content_length);
+      requests_.fetch_add(1);
+
+      {
+        std::unique_lock<std::mutex> lock(pause_mutex_);
+        resumed_.wait(lock, [this] { return !paused_; });
+      }
+      const bool last = close_after_ > 0 && ++served >= close_after_;
+      std::string response = handle(method, target, body);
+      if (last) {
+        response.insert(response.find("\r\n") + 2, "Connection: close\r\n");
+      }
+      send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+      if (last) {
+        shutdown(fd, SHUT_RDWR);
+        return;
+      }
+    }
+  }
+
+  std::string handle(const std::string& method, const std::string& target,
+                     const std::string& body) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t query = target.find('?');
+    const std::string path = target.substr(0, query);
+    const std::string params =
+        query == std::string::npos ? "" : target.substr(query + 1);
+    if (params == "uploads" && method == "POST") {
+      const std::string id = "upload" + std::to_string(++next_upload_);
+      uploads_[id];
+      const std::string xml = "<InitiateMultipartUploadResult><UploadId>" +
+                              id + "</UploadId></InitiateMultipartUploadResult>";
+      return "HTTP/1.1 200 OK\r\nContent-Length: " +
+             std::to_string(xml.size()) + "\r\n\r\n" + xml;
+    }
+    const size_t id_pos = params.find("uploadId=");
+    if (id_pos != std::string::npos) {
+      const std::string id = params.substr(id_pos + 9);
+      if (method == "PUT") {
+        const int part = std::atoi(params.c_str() + params.find('=') + 1);
+        uploads_[id][part] = body;
+        return "HTTP/1.1 200 OK\r\nETag: \"etag" + std::to_string(part) +
+               "\"\r\nContent-Length: 0\r\n\r\n";
+      }
+      if (method == "POST") {
+        std::string object;
+        for (const auto& [part, data] : uploads_[id]) {
+          object += data;
+        }
+        parts_ += uploads_[id].size();
+        objects_[path] = object;
+      }
+      uploads_.erase(id);
+      return "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    }
+    if (method == "PUT") {
+      objects_[target] = body;
+      return "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    }
+    if (method == "GET" && query != std::string::npos) {
+      return list(target.substr(0, query), target.substr(query + 1));
+    }
+    auto it = objects_.find(target);
+    if (it == objects_.end()) {
+      const std::string error = "<Error><Code>NoSuchKey</Code></Error>";
+      return "HTTP/1.1 404 Not Found\r\nContent-Length: " +
+             std::to_string(error.size()) + "\r\n\r\n" +
+             (method == "HEAD" ? "" : error);
+    }
+    return "HTTP/1.1 200 OK\r\nContent-Length: " +
+           std::to_string(it->second.size()) + "\r\n\r\n" +
+           (method == "HEAD" ? "" : it->second);
+  }
+
+  // ListObjectsV2 over the objects under |bucket_path| ("/bucket/"). The
+  // continuation token is simply the last key of the previous page.
+  std::string list(const std::string& bucket_path, const std::string& query) {
+    listings_.fetch_add(1);
+    size_t max_keys = 1000;
+    std::string token;
+    std::istringstream params(query);
+    std::string param;
+    while (std::getline(params, param, '&')) {
+      const size_t equals = param.find('=');
+      const std::string name = param.substr(0, equals);
+      const std::string value = param.substr(equals + 1);
+      if (name == "max-keys") {
+        max_keys = std::strtoul(value.c_str(), nullptr, 10);
+      } else if (name == "continuation-token") {
+        token = value;
+      }
+    }
+    max_keys = std::min(max_keys, page_size_.load());
+    std::string xml = "<ListBucketResult>";
+    std::string last;
+    size_t count = 0;
+    bool truncated = false;
+    for (auto it = objects_.upper_bound(bucket_path + token);
+         it != objects_.end() && it->first.compare(0, bucket_path.size(),
+                                                   bucket_path) == 0;
+         ++it) {
+      if (count == max_keys) {
+        truncated = true;
+        break;
+      }
+      last = it->first.substr(bucket_path.size());
+      xml += "<Contents><Key>" + last + "</Key></Contents>";
+      ++count;
+    }
+    xml += std::string("<IsTruncated>") + (truncated ? "true" : "false") +
+           "</IsTruncated>";
+    if (truncated) {
+      xml += "<NextContinuationToken>" + last + "</NextContinuationToken>";
+    }
+    xml += "</ListBucketResult>";
+    return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(xml.size()) +
+           "\r\n\r\n" + xml;
+  }
+
+  static bool receive(int fd, std::string& buffer) {
+    char chunk[65536];
+    const ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+    if (received <= 0) {
+      return false;
+    }
+    buffer.append(chunk, static_cast<size_t>(received));
+    return true;
+  }
+
+  int listen_fd_ = -1;
+  int port_ = 0;
+  std::thread acceptor_;
+  std::mutex mutex_;
+  std::map<std::string, std::string> objects_;
+  std::map<std::string, std::map<int, std::string>> uploads_;
+  size_t next_upload_ = 0;
+  size_t parts_ = 0;
+  std::vector<int> client_fds_;
+  std::vector<std::thread> handlers_;
+  std::atomic<size_t> connections_{0};
+  std::atomic<size_t> requests_{0};
+  std::atomic<size_t> close_after_{0};
+  std::atomic<size_t> listings_{0};
+  std::atomic<size_t> page_size_{1000};
+  std::mutex pause_mutex_;
+  std::condition_variable resumed_;
+  bool paused_ = false;
+};
+
+#endif  // MOCK_S3_SERVER_H
@@ -0,0 +1,236 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "archive_writer.h"
+
+namespace {
+std::string runCommand(const std::string& command) {
+  std::string output;
+  FILE* pipe = popen(command.c_str(), "r");
+  if (!pipe) {
+    return output;
+  }
+  char buffer[4096];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+    output.append(buffer, bytes);
+  }
+  pclose(pipe);
+  return output;
+}
+}  // namespace
+
+class ZipWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    if (std::system("command -v unzip >/dev/null 2>&1") != 0) {
+      GTEST_SKIP() << "unzip not installed";
+    }
+    dir_ = std::filesystem::temp_directory_path() /
+           ("reprobuild_zip_writer_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(ZipWriterTest, WritesArchiveThatUnzipReads) {
+  std::string large;
+  for (int i = 0; i < 200000; ++i) {
+    large += std::to_string(i * 7919 % 100003) + "\n";
+  }
+  const std::string input = (dir_ / "large.txt").string();
+  std::ofstream(input) << large;
+
+  std::string archive;
+  size_t pieces = 0;
+  ZipWriter zip([&](std::string_view data) {
+    archive.append(data);
+    ++pieces;
+    return true;
+  });
+  ASSERT_TRUE(zip.beginFile("small.txt", 1700000000, 0644));
+  ASSERT_TRUE(zip.write("hello "));
+  ASSERT_TRUE(zip.write("zip"));
+  ASSERT_TRUE(zip.endFile());
+  ASSERT_TRUE(zip.addFile(input, "large.txt"));
+  ASSERT_TRUE(zip.finish());
+  EXPECT_GT(pieces, 2u);
+  EXPECT_LT(archive.size(), large.size());
+
+  const std::string path = (dir_ / "out.zip").string();
+  std::ofstream(path, std::ios::binary) << archive;
+  EXPECT_EQ(runCommand("unzip -p " + path + " small.txt"), "hello zip");
+  EXPECT_EQ(runCommand("unzip -p " + path + " large.txt"), large);
+  EXPECT_NE(runCommand("unzip -t " + path).find("No errors"),
+            std::string::npos);
+}
+
+TEST_F(ZipWriterTest, StopsWhenTheSinkFails) {
+  ZipWriter zip([](std::string_view) { return false; });
+  EXPECT_FALSE(zip.beginFile("a", 0, 0644));
+  EXPECT_FALSE(zip.ok());
+  EXPECT_FALSE(zip.finish());
+}
+
+TEST_F(ZipWriterTest, WritesZip64EndRecordsPastEntryLimit) {
+  const std::string path = (dir_ / "many.zip").string();
+  std::ofstream output(path, std::ios::binary);
+  ZipWriter zip([&](std::string_view data) {
+    output.write(data.data(), data.size());
+    return true;
+  });
+  const int count = 66000;
+  for (int i = 0; i < count; ++i) {
+    ASSERT_TRUE(zip.beginFile("f" + std::to_string(i), 1700000000, 0644));
+    ASSERT_TRUE(zip.write(std::to_string(i)));
+    ASSERT_TRUE(zip.endFile());
+  }
+  ASSERT_TRUE(zip.finish());
+  output.close();
+
+  EXPECT_EQ(runCommand("unzip -p " + path + " f65999"), "65999");
+  EXPECT_NE(runCommand("unzip -l " + path + " | tail -1").find("66000 files"),
+            std::string::npos);
+  EXPECT_NE(runCommand("unzip -tq " + path).find("No errors"),
+            std::string::npos);
+}
+
+class TarWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() /
+           ("reprobuild_tar_writer_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir_);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(TarWriterTest, WritesGzipArchiveThatTarReads) {
+  std::string large;
+  for (int i = 0; i < 200000; ++i) {
+    large += std::to_string(i * 7919 % 100003) + "\n";
+  }
+  const std::string input = (dir_ / "large.txt").string();
+  std::ofstream(input) << large;
+  const std::string long_name =
+      "./src/" + std::string(120, 'd') + "/" + std::string(80, 'f') + ".c";
+
+  std::string archive;
+  auto gzip = StreamCompressor::create("gz", [&](std::string_view data) {
+    archive.append(data);
+    return true;
+  });
+  ASSERT_TRUE(gzip);
+  TarWriter tar([&](std::string_view data) { return gzip->write(data); });
+  struct stat st;
+  ASSERT_EQ(stat(dir_.c_str(), &st), 0);
+  ASSERT_TRUE(tar.addDirectory("./src", st));
+  ASSERT_TRUE(tar.addFile(input, "./src/large.txt"));
+  ASSERT_TRUE(tar.addData(long_name, "long", 1700000000, 0600));
+  ASSERT_TRUE(tar.addData("./empty", "", 1700000000, 0644));
+  ASSERT_TRUE(tar.finish());
+  ASSERT_TRUE(gzip->finish());
+  EXPECT_LT(archive.size(), large.size());
+
+  const std::string path = (dir_ / "out.tar.gz").string();
+  std::ofstream(path, std::ios::binary) << archive;
+  EXPECT_EQ(runCommand("tar -tzf " + path),
+            "./src/\n./src/large.txt\n" + long_name + "\n./empty\n");
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./src/large.txt"), large);
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " " + long_name), "long");
+}
+
+TEST_F(TarWriterTest, CompressesEveryConfiguredFormat) {
+  for (const std::string format : {"xz", "bz2"}) {
+    std::string archive;
+    auto compressor =
+        StreamCompressor::create(format, [&](std::string_view data) {
+          archive.append(data);
+          return true;
+        });
+    if (!compressor) {
+      continue;  // built without the library
+    }
+    TarWriter tar(
+        [&](std::string_view data) { return compressor->write(data); });
+    ASSERT_TRUE(tar.addData("./hello.txt", "hello " + format, 0, 0644));
+    ASSERT_TRUE(tar.finish());
+    ASSERT_TRUE(compressor->finish());
+
+    const std::string path = (dir_ / ("out.tar." + format)).string();
+    std::ofstream(path, std::ios::binary) << archive;
+    EXPECT_EQ(runCommand("tar -xOf " + path + " ./hello.txt"),
+              "hello " + format);
+  }
+  EXPECT_EQ(StreamCompressor::create("zst", nullptr), nullptr);
+}
+
+TEST_F(TarWriterTest, StopsWhenTheSinkFails) {
+  TarWriter tar([](std::string_view) { return false; });
+  EXPECT_FALSE(tar.addData("./a", "a", 0, 0644));
+  EXPECT_FALSE(tar.ok());
+  EXPECT_FALSE(tar.finish());
+}
+
+TEST_F(TarWriterTest, ParallelBlocksDecompressAsOneStream) {
+  std::string input;
+  for (int i = 0; i < 300000; ++i) {
+    input +=
+        std::to_string(static_cast<int64_t>(i) * 7919 % 100003) + "\n";
+  }
+  for (const std::string format : {"gz", "xz", "bz2"}) {
+    if (!StreamCompressor::supports(format)) {
+      continue;
+    }
+    std::string compressed;
+    ParallelCompressor compressor(
+        format,
+        [&](std::string_view data) {
+          compressed.append(data);
+          return true;
+        },
+        4, 64 << 10);
+    // Uneven writes so blocks do not line up with them.
+    for (size_t offset = 0; offset < input.size(); offset += 10007) {
+      ASSERT_TRUE(compressor.write(input.substr(offset, 10007)));
+    }
+    ASSERT_TRUE(compressor.finish());
+    EXPECT_EQ(compressor.blockCount(), (input.size() + 65535) / 65536);
+    EXPECT_LT(compressed.size(), input.size());
+
+    const std::string path = (dir_ / ("blocks." + format)).string();
+    std::ofstream(path, std::ios::binary) << compressed;
+    const std::string tool = format == "gz"   ? "gzip"
+                             : format == "xz" ? "xz"
+                                              : "bzip2";
+    EXPECT_EQ(runCommand(tool + " -dc " + path), input) << format;
+  }
+}
+
+TEST_F(TarWriterTest, ParallelCompressorWritesEmptyInputAsValidStream) {
+  std::string compressed;
+  ParallelCompressor compressor(
+      "gz",
+      [&](std::string_view data) {
+        compressed.append(data);
+        return true;
+      },
+      2);
+  ASSERT_TRUE(compressor.finish());
+  EXPECT_EQ(compressor.blockCount(), 1u);
+  const std::string path = (dir_ / "empty.gz").string();
+  std::ofstream(path, std::ios::binary) << compressed;
+  EXPECT_EQ(std::system(("gzip -t " + path).c_str()), 0);
+}
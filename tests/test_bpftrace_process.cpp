@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bpftrace_process.h"
+#include "bpftrace_script.h"
+#include "trace_stream.h"
+
+namespace fs = std::filesystem;
+
+TEST(BpftraceProcessTest, KeepsOnlyAbsolutePatternsAsProbePrefixes) {
+  const std::vector<std::string> prefixes = probeIgnorePrefixes(
+      {"/tmp/", "libreprobuild_interceptor.so", "/", "/we\"ird/", "/dev/"});
+  EXPECT_EQ(prefixes, (std::vector<std::string>{"/tmp/", "/dev/"}));
+}
+
+TEST(BpftraceProcessTest, LeavesPathMappedPrefixesToUserspace) {
+  // /tmp/build/... may be remapped out of /tmp/, and /srv/x's mapped paths
+  // may land under /srv/x/cache/.
+  const std::vector<std::string> prefixes = probeIgnorePrefixes(
+      {"/tmp/", "/dev/", "/srv/x/cache/", "/srv/xy/"},
+      {"/tmp/build", "/srv/x"});
+  EXPECT_EQ(prefixes, (std::vector<std::string>{"/dev/", "/srv/xy/"}));
+}
+
+TEST(BpftraceProcessTest, RendersScriptPlaceholders) {
+  const std::string script =
+      renderBpftraceScript(1234, {"/proc/"}, BpftraceScript::DAEMON_PROBES);
+
+  EXPECT_NE(script.find("$pid = 1234;"), std::string::npos);
+  EXPECT_EQ(script.find("$pid = *;"), std::string::npos);
+  EXPECT_NE(script.find("strncmp($path, \"/proc/\", 6)"), std::string::npos);
+  EXPECT_EQ(script.find("@PATH_FILTERS@"), std::string::npos);
+  EXPECT_EQ(script.find("@OPEN_FLAG_FILTERS@"), std::string::npos);
+  EXPECT_NE(script.find("/.reprobuild_register"), std::string::npos);
+  // Directory records are per process generation, not per PID.
+  EXPECT_NE(script.find("@dir_sent[pid, $start, $dir_id, $ino]"),
+            std::string::npos);
+}
+
+// Runs BpftraceProcess against a shell script standing in for bpftrace.
+class FakeBpftraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = fs::temp_directory_path() /
+           ("reprobuild_fake_bpftrace_" + std::to_string(getpid()));
+    fs::create_directories(dir_);
+  }
+
+  void TearDown() override {
+    unsetenv("REPROBUILD_BPFTRACE");
+    fs::remove_all(dir_);
+  }
+
+  void useFakeBpftrace(const std::string& body) {
+    const std::string path = (dir_ / "bpftrace").string();
+    std::ofstream(path) << "#!/bin/sh\n" << body;
+    chmod(path.c_str(), 0755);
+    setenv("REPROBUILD_BPFTRACE", path.c_str(), 1);
+  }
+
+  bool start(BpftraceProcess& bpftrace, BpftraceStreamDecoder* decoder) {
+    return bpftrace.start("", (dir_ / "script.bt").string(), stderrLog(),
+                          decoder, (dir_ / "stdout.log").string());
+  }
+
+  std::string stderrLog() const { return (dir_ / "stderr.log").string(); }
+
+  fs::path dir_;
+};
+
+TEST_F(FakeBpftraceTest, DetectsAttachFromStderr) {
+  // "Attaching" is printed before the probes are live; only the line
+  // reporting them attached counts, even when it arrives in pieces.
+  useFakeBpftrace(
+      "printf 'Attaching 3 probes...\\n' >&2\n"
+      "sleep 0.2\n"
+      "printf 'Atta' >&2\n"
+      "sleep 0.1\n"
+      "printf 'ched 3 probes\\n' >&2\n"
+      "exec sleep 30\n");
+  BpftraceProcess bpftrace;
+  ASSERT_TRUE(start(bpftrace, nullptr));
+  EXPECT_TRUE(bpftrace.waitAttached(10000));
+  EXPECT_TRUE(bpftrace.attached());
+  bpftrace.stop();
+
+  std::stringstream log;
+  log << std::ifstream(stderrLog()).rdbuf();
+  EXPECT_EQ(log.str(), "Attaching 3 probes...\nAttached 3 probes\n");
+}
+
+TEST_F(FakeBpftraceTest, ReportsExitBeforeAttach) {
+  useFakeBpftrace(
+      "printf 'Attaching 3 probes...\\nERROR: no BTF\\n' >&2\n"
+      "exit 1\n");
+  BpftraceProcess bpftrace;
+  ASSERT_TRUE(start(bpftrace, nullptr));
+  const auto begin = std::chrono::steady_clock::now();
+  EXPECT_FALSE(bpftrace.waitAttached(10000));
+  EXPECT_LT(std::chrono::steady_clock::now() - begin,
+            std::chrono::seconds(5));
+  EXPECT_FALSE(bpftrace.attached());
+}
+
+TEST_F(FakeBpftraceTest, DrainsOutputPastTheSyncMarkerUntilExit) {
+  // Lines flushed when bpftrace is interrupted still reach the decoder.
+  useFakeBpftrace(
+      "trap 'printf \"42\\200openat /late 0\\n\\200\"; exit 0' INT\n"
+      "printf 'Attached 4 probes\\n' >&2\n"
+      "printf '42\\200openat /early 0\\n\\200'\n"
+      "printf '42\\200openat /.reprobuild_sync_42 0\\n\\200'\n"
+      "while :; do sleep 0.05; done\n");
+  const std::string sync_line = "openat " + syncMarkerPath(42) + " ";
+  std::vector<std::string> lines;
+  OneShotEvent synced;
+  BpftraceStreamDecoder decoder([&](int pid, std::string_view line) {
+    EXPECT_EQ(pid, 42);
+    if (line.substr(0, sync_line.size()) == sync_line) {
+      synced.set();
+      return;
+    }
+    lines.emplace_back(line);
+  });
+
+  BpftraceProcess bpftrace;
+  ASSERT_TRUE(start(bpftrace, &decoder));
+  ASSERT_TRUE(bpftrace.waitAttached(10000));
+  ASSERT_TRUE(synced.waitFor(10000));
+  bpftrace.stop();
+  decoder.finish();
+
+  EXPECT_EQ(lines, (std::vector<std::string>{"openat /early 0",
+                                             "openat /late 0"}));
+  EXPECT_FALSE(decoder.corrupted());
+}
+
+TEST_F(FakeBpftraceTest, KillsABpftraceThatIgnoresInterrupts) {
+  useFakeBpftrace(
+      "trap '' INT TERM\n"
+      "printf 'Attached 4 probes\\n' >&2\n"
+      "printf '42\\200openat /early 0\\n\\200'\n"
+      "while :; do sleep 0.05; done\n");
+  std::vector<std::string> lines;
+  OneShotEvent seen;
+  BpftraceStreamDecoder decoder([&](int, std::string_view line) {
+    lines.emplace_back(line);
+    seen.set();
+  });
+
+  BpftraceProcess bpftrace;
+  ASSERT_TRUE(start(bpftrace, &decoder));
+  ASSERT_TRUE(bpftrace.waitAttached(10000));
+  ASSERT_TRUE(seen.waitFor(10000));
+  const auto begin = std::chrono::steady_clock::now();
+  bpftrace.stop(200);
+  EXPECT_LT(std::chrono::steady_clock::now() - begin,
+            std::chrono::seconds(5));
+  EXPECT_EQ(lines, std::vector<std::string>{"openat /early 0"});
+}
@@ -100,3 +100,68 @@ TEST_F(BuildRecordTest, RemoveDependencyAndClearArtifactsUpdateState) {
   EXPECT_EQ(record.getDependencyCount(), 1U);
   EXPECT_TRUE(record.getArtifacts().empty());
 }
+
+TEST_F(BuildRecordTest, ResolvedFilesRoundTripAndReuse) {
+  record.addDependency(openssl_pkg);
+  record.addResolvedFile(
+      "/usr/lib/x86_64-linux-gnu/libcrypto.so",
+      ResolvedFile("openssl", "/usr/lib/x86_64-linux-gnu/libcrypto.so.3",
+                   "sha256:crypto", "1:10:20:30"));
+  record.addResolvedFile("/usr/include/local.h",
+                         ResolvedFile("", "", "", "2:10:20:30"));
+
+  const std::string filename = "/tmp/test_build_record_resolved_files.yaml";
+  record.saveToFile(filename);
+  const BuildRecord loaded = BuildRecord::loadFromFile(filename);
+  ASSERT_EQ(loaded.getResolvedFiles().size(), 2u);
+  EXPECT_TRUE(record.matches(loaded));
+
+  DependencyPackage package;
+  ASSERT_TRUE(loaded.reuseResolvedFile(
+      "/usr/lib/x86_64-linux-gnu/libcrypto.so", "1:10:20:30", package));
+  EXPECT_EQ(package.getPackageName(), "openssl");
+  EXPECT_EQ(package.getVersion(), "1.1.1w");
+  EXPECT_EQ(package.getOriginalPath(),
+            "/usr/lib/x86_64-linux-gnu/libcrypto.so.3");
+  EXPECT_EQ(package.getHashValue(), "sha256:crypto");
+
+  // Entries without a package, from older records, are resolved again.
+  EXPECT_FALSE(
+      loaded.reuseResolvedFile("/usr/include/local.h", "2:10:20:30", package));
+
+  // Changed, unknown or racy files are resolved again.
+  EXPECT_FALSE(loaded.reuseResolvedFile(
+      "/usr/lib/x86_64-linux-gnu/libcrypto.so", "1:11:20:30", package));
+  EXPECT_FALSE(loaded.reuseResolvedFile("/usr/lib/libz.so", "3:1:2:3",
+                                        package));
+  EXPECT_FALSE(loaded.reuseResolvedFile("/usr/include/local.h", "", package));
+  std::remove(filename.c_str());
+}
+
+TEST_F(BuildRecordTest, FailedResolutionsAreRetriedByTheNextRun) {
+  const std::string path = "/usr/lib/x86_64-linux-gnu/libcrypto.so";
+  const std::string signature = "1:10:20:30";
+  DependencyPackage package;
+
+  // First run: the resolver failed (e.g. no version), giving an invalid
+  // package. Nothing is kept for the file.
+  record.addResolvedFile(path, DependencyPackage(), signature);
+  EXPECT_TRUE(record.getResolvedFiles().empty());
+  EXPECT_FALSE(record.reuseResolvedFile(path, signature, package));
+
+  // Second run, same file: resolution recovers and is kept from then on.
+  record.addDependency(openssl_pkg);
+  record.addResolvedFile(
+      path,
+      DependencyPackage("openssl", DependencyOrigin::APT,
+                        "/usr/lib/x86_64-linux-gnu/libcrypto.so.3", "1.1.1w",
+                        "sha256:crypto"),
+      signature);
+  ASSERT_TRUE(record.reuseResolvedFile(path, signature, package));
+  EXPECT_EQ(package.getPackageName(), "openssl");
+  EXPECT_EQ(package.getHashValue(), "sha256:crypto");
+
+  // A later failure does not leave the earlier result behind either.
+  record.addResolvedFile(path, DependencyPackage(), "1:11:20:30");
+  EXPECT_FALSE(record.reuseResolvedFile(path, "1:10:20:30", package));
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "bundle.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+std::string runCommand(const std::string& command) {
+  std::string output;
+  FILE* pipe = popen(command.c_str(), "r");
+  if (!pipe) {
+    return output;
+  }
+  char buffer[4096];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+    output.append(buffer, bytes);
+  }
+  pclose(pipe);
+  return output;
+}
+}  // namespace
+
+class BundleTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = fs::temp_directory_path() /
+           ("reprobuild_bundle_" + std::to_string(getpid()));
+    fs::create_directories(dir_ / "project" / "lib");
+    std::ofstream(dir_ / "project" / "main.c") << "int main() {}\n";
+    std::ofstream(dir_ / "project" / "lib" / "util.c") << "void util() {}\n";
+    fs::create_symlink("main.c", dir_ / "project" / "link.c");
+    std::ofstream(dir_ / "libcustom.so") << "custom library";
+
+    record_.setProjectName("bundle-test");
+    record_.setBuildPath((dir_ / "project").string());
+    record_.addDependency(DependencyPackage(
+        "libcustom.so", DependencyOrigin::CUSTOM,
+        (dir_ / "libcustom.so").string(), "1.0", "sha256:abc"));
+  }
+
+  void TearDown() override { fs::remove_all(dir_); }
+
+  fs::path dir_;
+  BuildRecord record_;
+};
+
+TEST_F(BundleTest, StreamsTarGzWithoutStaging) {
+  const std::string path = (dir_ / "bundle.tar.gz").string();
+  createBundle(record_, path);
+
+  const std::string listing = runCommand("tar -tzf " + path + " | sort");
+  EXPECT_EQ(listing,
+            "./\n./build_record.yaml\n./deps/\n./deps/libcustom.so\n"
+            "./src/\n./src/lib/\n./src/lib/util.c\n./src/link.c\n"
+            "./src/main.c\n");
+  // Symlinks are archived as the files they point to.
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./src/link.c"),
+            "int main() {}\n");
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./deps/libcustom.so"),
+            "custom library");
+  EXPECT_NE(runCommand("tar -xOzf " + path + " ./build_record.yaml")
+                .find("bundle-test"),
+            std::string::npos);
+}
+
+TEST_F(BundleTest, HonoursXzAndZipExtensions) {
+  const std::string xz_path = (dir_ / "bundle.tar.xz").string();
+  createBundle(record_, xz_path);
+  EXPECT_EQ(runCommand("tar -xOJf " + xz_path + " ./src/lib/util.c"),
+            "void util() {}\n");
+
+  if (std::system("command -v unzip >/dev/null 2>&1") != 0) {
+    GTEST_SKIP() << "unzip not installed";
+  }
+  const std::string zip_path = (dir_ / "bundle.zip").string();
+  createBundle(record_, zip_path);
+  EXPECT_EQ(runCommand("unzip -p " + zip_path + " src/lib/util.c"),
+            "void util() {}\n");
+  EXPECT_EQ(runCommand("unzip -p " + zip_path + " deps/libcustom.so"),
+            "custom library");
+  EXPECT_NE(runCommand("unzip -t " + zip_path).find("No errors"),
+            std::string::npos);
+}
+
+TEST_F(BundleTest, AppendsTarGzToUnknownExtensions) {
+  const std::string path = (dir_ / "bundle.out").string();
+  createBundle(record_, path);
+  EXPECT_FALSE(fs::exists(path));
+  EXPECT_EQ(runCommand("tar -xOzf " + path + ".tar.gz ./src/main.c"),
+            "int main() {}\n");
+}
+
+TEST_F(BundleTest, CompressesTarballsInParallelBlocks) {
+  std::string large;
+  for (int i = 0; i < 400000; ++i) {
+    large +=
+        std::to_string(static_cast<int64_t>(i) * 7919 % 100003) + "\n";
+  }
+  std::ofstream(dir_ / "project" / "large.txt") << large;
+
+  const std::string path = (dir_ / "bundle.tar.gz").string();
+  const BundleTiming timing = createBundle(record_, path, 4);
+  EXPECT_EQ(timing.threads, 4u);
+  EXPECT_GT(timing.blocks, 1u);
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./src/large.txt"), large);
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./src/main.c"),
+            "int main() {}\n");
+
+  const BundleTiming single = createBundle(record_, path, 1);
+  EXPECT_EQ(single.threads, 1u);
+  EXPECT_EQ(single.blocks, 0u);
+  EXPECT_EQ(runCommand("tar -xOzf " + path + " ./src/large.txt"), large);
+}
+
+TEST_F(BundleTest, LeavesOutTheBundleWhenWrittenInsideTheBuildTree) {
+  const std::string path = (dir_ / "project" / "bundle.tar.gz").string();
+  createBundle(record_, path);
+  const std::string listing = runCommand("tar -tzf " + path);
+  EXPECT_EQ(listing.find("bundle.tar.gz"), std::string::npos);
+  EXPECT_NE(listing.find("./src/main.c"), std::string::npos);
+}
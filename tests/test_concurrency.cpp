@@ -0,0 +1,47 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+#include "concurrency.h"
+
+TEST(ConcurrencyTest, AutomaticPlanOversubscribesIo) {
+  const ConcurrencyPlan small = Concurrency::automatic(4);
+  EXPECT_EQ(small.cpu_threads, 4u);
+  EXPECT_EQ(small.io_threads, 8u);
+  EXPECT_EQ(small.io_source, "auto");
+
+  const ConcurrencyPlan large = Concurrency::automatic(128);
+  EXPECT_EQ(large.cpu_threads, 128u);
+  EXPECT_EQ(large.io_threads, Concurrency::kMaxAutoIoThreads);
+
+  EXPECT_EQ(Concurrency::automatic(0).cpu_threads, 1u);
+}
+
+TEST(ConcurrencyTest, ParsesThreadCounts) {
+  EXPECT_EQ(Concurrency::parseThreadCount("16"), 16u);
+  EXPECT_EQ(Concurrency::parseThreadCount("0"), 0u);
+  EXPECT_EQ(Concurrency::parseThreadCount("-3"), 0u);
+  EXPECT_EQ(Concurrency::parseThreadCount("8x"), 0u);
+  EXPECT_EQ(Concurrency::parseThreadCount(""), 0u);
+}
+
+TEST(ConcurrencyTest, CommandLineOverridesEnvironment) {
+  setenv("REPROBUILD_IO_THREADS", "12", 1);
+  setenv("REPROBUILD_CPU_THREADS", "3", 1);
+  const ConcurrencyPlan from_env = Concurrency::configure();
+  EXPECT_EQ(from_env.io_threads, 12u);
+  EXPECT_EQ(from_env.io_source, "env");
+  EXPECT_EQ(from_env.cpu_threads, 3u);
+
+  const ConcurrencyPlan from_cli = Concurrency::configure(40, 0);
+  EXPECT_EQ(from_cli.io_threads, 40u);
+  EXPECT_EQ(from_cli.io_source, "cli");
+  EXPECT_EQ(from_cli.cpu_threads, 3u);
+  EXPECT_EQ(Concurrency::current().io_threads, 40u);
+
+  unsetenv("REPROBUILD_IO_THREADS");
+  unsetenv("REPROBUILD_CPU_THREADS");
+  const ConcurrencyPlan automatic = Concurrency::configure();
+  EXPECT_EQ(automatic.cpu_threads, Concurrency::usableCores());
+  EXPECT_EQ(automatic.cpu_source, "auto");
+}
@@ -1,9 +1,15 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
 
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <sstream>
+#include <thread>
+#include <vector>
 
 #include "dependency_package.h"
+#include "dependency_resolver.h"
 #include "build_info.h"
 #include "utils.h"
 
@@ -45,3 +51,83 @@ TEST_F(DependencyPackageTest, FromRawFileRPM) {
   EXPECT_EQ(pkg.getHashValue(),
             "069a4451877087e91a970a07ad34ad523c07488df75382cfd540b35f5039095a");
 }
+
+TEST_F(DependencyPackageTest, ResolveAllKeepsInputOrder) {
+  const PackageMgr pkg_mgr = Utils::checkPackageManager();
+  if (pkg_mgr != PackageMgr::APT && pkg_mgr != PackageMgr::DNF &&
+      pkg_mgr != PackageMgr::YUM && pkg_mgr != PackageMgr::PACMAN) {
+    GTEST_SKIP() << "Skipping test: no supported package manager detected.";
+  }
+
+  const std::filesystem::path dir =
+      std::filesystem::temp_directory_path() /
+      ("reprobuild_resolve_all_" + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+
+  std::vector<std::string> paths;
+  for (int i = 0; i < 37; ++i) {
+    const std::string path = (dir / ("file" + std::to_string(i))).string();
+    std::ofstream(path) << "content " << i;
+    paths.push_back(path);
+  }
+  paths.push_back((dir / "missing").string());
+
+  const auto packages = DependencyPackage::resolveAll(paths, pkg_mgr, 4);
+  ASSERT_EQ(packages.size(), paths.size());
+  for (int i = 0; i < 37; ++i) {
+    EXPECT_TRUE(packages[i].isValid());
+    EXPECT_EQ(packages[i].getPackageName(), "file" + std::to_string(i));
+    EXPECT_EQ(packages[i].getVersion(), "custom");
+  }
+  EXPECT_FALSE(packages.back().isValid());
+
+  // A second pass is served from the resolution cache and agrees with the
+  // single-file API.
+  const auto again = DependencyPackage::resolveAll(paths, pkg_mgr, 1);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    EXPECT_EQ(again[i].getHashValue(), packages[i].getHashValue());
+    EXPECT_EQ(DependencyPackage::fromRawFile(paths[i], pkg_mgr).getHashValue(),
+              packages[i].getHashValue());
+  }
+
+  std::filesystem::remove_all(dir);
+}
+
+TEST_F(DependencyPackageTest, ResolutionCacheCountsHitsAndMisses) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() /
+       ("reprobuild_cache_counts_" + std::to_string(getpid())))
+          .string();
+  std::ofstream(path) << "cached";
+
+  const size_t hits = DependencyResolver::cacheHitCount();
+  const size_t misses = DependencyResolver::cacheMissCount();
+  const DependencyPackage first =
+      DependencyPackage::fromRawFile(path, PackageMgr::APT);
+  EXPECT_EQ(DependencyResolver::cacheMissCount(), misses + 1);
+  EXPECT_EQ(DependencyResolver::cacheHitCount(), hits);
+
+  // Threads reading the same entry all see the cached package.
+  std::vector<std::thread> threads;
+  std::vector<std::string> seen(8);
+  for (size_t i = 0; i < seen.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      seen[i] =
+          DependencyPackage::fromRawFile(path, PackageMgr::APT).getHashValue();
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& hash : seen) {
+    EXPECT_EQ(hash, first.getHashValue());
+  }
+  EXPECT_EQ(DependencyResolver::cacheHitCount(), hits + seen.size());
+
+  // The package manager is part of the key.
+  DependencyPackage package;
+  EXPECT_FALSE(
+      DependencyResolver::getCachedPackage(PackageMgr::PACMAN, path, package));
+
+  std::filesystem::remove(path);
+}
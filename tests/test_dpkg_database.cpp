@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "dpkg_database.h"
+
+class DpkgDatabaseTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = std::filesystem::temp_directory_path() /
+            ("reprobuild_dpkg_" + std::to_string(getpid()));
+    std::filesystem::create_directories(root_ / "info");
+    std::ofstream(root_ / "status")
+        << "Package: libc6\nArchitecture: amd64\nVersion: 2.41-6\n\n"
+           "Package: zlib1g\nArchitecture: amd64\nVersion: 1:1.3\n\n"
+           "Package: libc-dev-bin\nArchitecture: amd64\nVersion: 2.41-6\n";
+    writeList("libc6:amd64",
+              "/.\n/usr\n/usr/lib\n/usr/lib/x86_64-linux-gnu\n"
+              "/usr/lib/x86_64-linux-gnu/libc.so.6\n");
+    writeList("zlib1g:amd64",
+              "/.\n/usr\n/usr/lib\n/usr/lib/x86_64-linux-gnu\n"
+              "/usr/lib/x86_64-linux-gnu/libz.so.1\n");
+    writeList("libc-dev-bin", "/.\n/usr\n/usr/bin\n/usr/bin/ldd\n");
+  }
+  void TearDown() override { std::filesystem::remove_all(root_); }
+
+  void writeList(const std::string& package, const std::string& paths) {
+    std::ofstream(root_ / "info" / (package + ".list")) << paths;
+  }
+
+  DpkgDatabase::Options options(DpkgDatabase::Mode mode) const {
+    DpkgDatabase::Options options;
+    options.status_path = (root_ / "status").string();
+    options.info_dir = (root_ / "info").string();
+    options.cache_path = (root_ / "cache.idx").string();
+    options.mode = mode;
+    return options;
+  }
+
+  std::filesystem::path root_;
+};
+
+TEST_F(DpkgDatabaseTest, IndexModeFindsOwnerAndVersion) {
+  DpkgDatabase database(options(DpkgDatabase::Mode::INDEX));
+  DebianPackageOwner owner;
+  ASSERT_TRUE(database.findOwner("/lib/x86_64-linux-gnu/libz.so.1",
+                                 "/usr/lib/x86_64-linux-gnu/libz.so.1", owner));
+  EXPECT_EQ(owner.query_name, "zlib1g:amd64");
+  EXPECT_EQ(owner.display_name, "zlib1g");
+  EXPECT_EQ(owner.version, "1:1.3");
+  EXPECT_FALSE(database.findOwner("/usr/bin/cc", "/usr/bin/cc", owner));
+  EXPECT_TRUE(std::filesystem::exists(root_ / "cache.idx"));
+}
+
+TEST_F(DpkgDatabaseTest, LazyModeReadsOnlyCandidateLists) {
+  {
+    DpkgDatabase database(options(DpkgDatabase::Mode::LAZY));
+    DebianPackageOwner owner;
+    ASSERT_TRUE(database.findOwner("/usr/bin/ldd", "/usr/bin/ldd", owner));
+    EXPECT_EQ(owner.display_name, "libc-dev-bin");
+    EXPECT_EQ(owner.version, "2.41-6");
+    EXPECT_EQ(database.loadedListCount(), 1u);
+  }
+
+  // A changed list is picked up from the cached directory index.
+  writeList("libc-dev-bin", "/.\n/usr\n/usr/bin\n/usr/bin/ldd\n"
+                            "/usr/include/gnu/lib-names.h\n");
+  DpkgDatabase database(options(DpkgDatabase::Mode::LAZY));
+  DebianPackageOwner owner;
+  ASSERT_TRUE(database.findOwner("/usr/include/gnu/lib-names.h",
+                                 "/usr/include/gnu/lib-names.h", owner));
+  EXPECT_EQ(owner.query_name, "libc-dev-bin");
+  ASSERT_TRUE(database.findOwner("/usr/lib/x86_64-linux-gnu/libc.so.6",
+                                 "/usr/lib/x86_64-linux-gnu/libc.so.6", owner));
+  EXPECT_EQ(owner.query_name, "libc6:amd64");
+  EXPECT_EQ(database.loadedListCount(), 2u);
+}
+
+TEST_F(DpkgDatabaseTest, LazyModeServesConcurrentLookups) {
+  DpkgDatabase database(options(DpkgDatabase::Mode::LAZY));
+  const std::vector<std::pair<std::string, std::string>> queries = {
+      {"/usr/lib/x86_64-linux-gnu/libc.so.6", "libc6:amd64"},
+      {"/usr/lib/x86_64-linux-gnu/libz.so.1", "zlib1g:amd64"},
+      {"/usr/bin/ldd", "libc-dev-bin"},
+      {"/usr/bin/cc", ""}};
+  std::atomic<int> mismatches{0};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 200; ++i) {
+        const auto& [path, expected] = queries[(t + i) % queries.size()];
+        DebianPackageOwner owner;
+        const bool found = database.findOwner(path, path, owner);
+        if (found != !expected.empty() ||
+            (found && owner.query_name != expected)) {
+          ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(mismatches.load(), 0);
+  // Every list is read once, however many threads asked for it.
+  EXPECT_EQ(database.loadedListCount(), 3u);
+}
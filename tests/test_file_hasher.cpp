@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "file_hasher.h"
+#include "utils.h"
+
+class FileHasherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() /
+           ("reprobuild_file_hasher_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir_);
+  }
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::string writeFile(const std::string& name, const std::string& content) {
+    const std::string path = (dir_ / name).string();
+    std::ofstream(path) << content;
+    return path;
+  }
+
+  std::filesystem::path dir_;
+};
+
+TEST_F(FileHasherTest, ComputesSha256) {
+  EXPECT_EQ(Utils::calculateFileHash(writeFile("empty", "")),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+  EXPECT_EQ(Utils::calculateFileHash(writeFile("abc", "abc")),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  // Larger than one read block.
+  const std::string large = writeFile("large", std::string(3 << 20, 'a'));
+  EXPECT_EQ(FileHasher(1).hash(large), Utils::calculateFileHash(large));
+  EXPECT_EQ(Utils::calculateFileHash((dir_ / "missing").string()), "");
+}
+
+TEST_F(FileHasherTest, HashesEachFileOnce) {
+  const std::string path = writeFile("a.o", "object");
+  const std::string link = (dir_ / "link.o").string();
+  std::filesystem::create_symlink(path, link);
+
+  FileHasher hasher(2);
+  EXPECT_EQ(hasher.hash(path), Utils::calculateFileHash(path));
+  EXPECT_EQ(hasher.hash(link), hasher.hash(path));
+  EXPECT_EQ(hasher.hashedCount(), 1u);
+  EXPECT_EQ(hasher.reusedCount(), 2u);
+}
+
+TEST_F(FileHasherTest, PrefetchesInBackground) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 32; ++i) {
+    paths.push_back(writeFile("f" + std::to_string(i), std::to_string(i)));
+  }
+  paths.push_back((dir_ / "missing").string());
+
+  FileHasher hasher(4);
+  hasher.prefetch(paths);
+  for (size_t i = 0; i + 1 < paths.size(); ++i) {
+    EXPECT_EQ(hasher.hash(paths[i]), Utils::calculateFileHash(paths[i]));
+  }
+  EXPECT_EQ(hasher.hash(paths.back()), "");
+  EXPECT_EQ(hasher.hashedCount(), 32u);
+}
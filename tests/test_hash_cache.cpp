@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "hash_cache.h"
+
+namespace {
+struct stat oldFileStat(const std::string& path) {
+  struct stat st;
+  stat(path.c_str(), &st);
+  // Backdate the timestamps past the window in which entries are skipped.
+  st.st_mtim.tv_sec -= 60;
+  st.st_ctim.tv_sec -= 60;
+  return st;
+}
+}  // namespace
+
+class HashCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() /
+           ("reprobuild_hash_cache_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir_);
+    file_ = (dir_ / "input.txt").string();
+    std::ofstream(file_) << "content";
+  }
+  void TearDown() override { std::filesystem::remove_all(dir_); }
+
+  std::filesystem::path dir_;
+  std::string file_;
+};
+
+TEST_F(HashCacheTest, PersistsDigestsAcrossInstances) {
+  const std::string cache_path = (dir_ / "cache" / "hash_cache.bin").string();
+  const struct stat st = oldFileStat(file_);
+  HashCache::Digest digest{};
+  digest[0] = 0xab;
+  digest[31] = 0xcd;
+
+  {
+    HashCache cache;
+    ASSERT_TRUE(cache.open(cache_path));
+    HashCache::Digest found;
+    EXPECT_FALSE(cache.lookup(st, found));
+    cache.store(st, digest);
+    ASSERT_TRUE(cache.save());
+  }
+
+  HashCache cache;
+  ASSERT_TRUE(cache.open(cache_path));
+  HashCache::Digest found{};
+  ASSERT_TRUE(cache.lookup(st, found));
+  EXPECT_EQ(found, digest);
+  EXPECT_EQ(cache.hitCount(), 1u);
+
+  struct stat changed = st;
+  changed.st_size += 1;
+  EXPECT_FALSE(cache.lookup(changed, found));
+  changed = st;
+  changed.st_ctim.tv_nsec ^= 1;
+  EXPECT_FALSE(cache.lookup(changed, found));
+  EXPECT_EQ(cache.missCount(), 2u);
+}
+
+TEST_F(HashCacheTest, SkipsRecentlyModifiedFiles) {
+  HashCache cache;
+  ASSERT_TRUE(cache.open((dir_ / "hash_cache.bin").string()));
+  struct stat st;
+  ASSERT_EQ(stat(file_.c_str(), &st), 0);
+
+  cache.store(st, HashCache::Digest{});
+  HashCache::Digest found;
+  EXPECT_FALSE(cache.lookup(st, found));
+}
+
+TEST_F(HashCacheTest, IgnoresMalformedCacheFile) {
+  const std::string cache_path = (dir_ / "hash_cache.bin").string();
+  std::ofstream(cache_path) << "not a hash cache at all";
+
+  HashCache cache;
+  ASSERT_TRUE(cache.open(cache_path));
+  HashCache::Digest found;
+  EXPECT_FALSE(cache.lookup(oldFileStat(file_), found));
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <string>
+
+#include "ownership_index.h"
+
+namespace {
+OwnershipIndex buildSample(uint64_t stamp) {
+  OwnershipIndex::Builder builder;
+  const uint32_t libc = builder.addPackage("libc6:amd64", "2.41-6");
+  const uint32_t zlib = builder.addPackage("zlib1g:amd64", "1:1.3");
+  builder.addPath("/usr/lib/x86_64-linux-gnu/libc.so.6", libc);
+  builder.addPath("/usr/lib", libc);
+  builder.addPath("/usr/lib/x86_64-linux-gnu/libz.so.1", zlib);
+  builder.addPath("/usr/lib", zlib);
+  return builder.build(stamp);
+}
+}  // namespace
+
+TEST(OwnershipIndexTest, FindsOwnersInBuiltIndex) {
+  const OwnershipIndex index = buildSample(7);
+  ASSERT_TRUE(index.valid());
+  EXPECT_EQ(index.packageCount(), 2u);
+  EXPECT_EQ(index.pathCount(), 3u);
+
+  OwnershipIndex::Package package;
+  ASSERT_TRUE(index.findOwner("/usr/lib/x86_64-linux-gnu/libz.so.1", package));
+  EXPECT_EQ(package.name, "zlib1g:amd64");
+  EXPECT_EQ(package.version, "1:1.3");
+  ASSERT_TRUE(index.findOwner("/usr/lib", package));
+  EXPECT_EQ(package.name, "libc6:amd64");
+  EXPECT_FALSE(index.findOwner("/usr/lib/x86_64-linux-gnu", package));
+  EXPECT_FALSE(index.findOwner("/usr/lib/x86_64-linux-gnu/libc.so", package));
+}
+
+TEST(OwnershipIndexTest, ReloadsOnlyMatchingStamp) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() /
+       ("reprobuild_owners_" + std::to_string(getpid())) / "owners.idx")
+          .string();
+  ASSERT_TRUE(buildSample(7).save(path));
+
+  OwnershipIndex stale;
+  EXPECT_FALSE(stale.load(path, 8));
+  EXPECT_FALSE(stale.valid());
+
+  OwnershipIndex index;
+  ASSERT_TRUE(index.load(path, 7));
+  OwnershipIndex::Package package;
+  ASSERT_TRUE(index.findOwner("/usr/lib/x86_64-linux-gnu/libc.so.6", package));
+  EXPECT_EQ(package.name, "libc6:amd64");
+  EXPECT_EQ(package.version, "2.41-6");
+
+  std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+}
@@ -0,0 +1,38 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "pacman_database.h"
+
+TEST(PacmanDatabaseTest, FindsOwnersInLocalDatabase) {
+  const std::filesystem::path root =
+      std::filesystem::temp_directory_path() /
+      ("reprobuild_pacman_" + std::to_string(getpid()));
+  const std::filesystem::path package = root / "local" / "zlib-1:1.3.1-2";
+  std::filesystem::create_directories(package);
+  std::ofstream(package / "desc")
+      << "%NAME%\nzlib\n\n%VERSION%\n1:1.3.1-2\n\n%DESC%\nCompression "
+         "library\n\n";
+  std::ofstream(package / "files")
+      << "%FILES%\nusr/\nusr/include/\nusr/include/zlib.h\nusr/lib/\n"
+         "usr/lib/libz.so.1\n\n%BACKUP%\netc/zlib.conf\t0123\n\n";
+
+  PacmanDatabase::Options options;
+  options.local_dir = (root / "local").string();
+  options.cache_path = (root / "pacman_owners.idx").string();
+  for (int run = 0; run < 2; ++run) {  // build, then load from the cache
+    PacmanDatabase database(options);
+    PacmanPackageOwner owner;
+    ASSERT_TRUE(database.findOwner("/lib/libz.so.1", "/usr/lib/libz.so.1",
+                                   owner));
+    EXPECT_EQ(owner.name, "zlib");
+    EXPECT_EQ(owner.version, "1:1.3.1-2");
+    EXPECT_TRUE(database.findOwner("/usr/include", "/usr/include", owner));
+    EXPECT_FALSE(database.findOwner("/etc/zlib.conf", "/etc/zlib.conf", owner));
+  }
+
+  std::filesystem::remove_all(root);
+}
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#include "ringbuf_tracer.h"
+#include "trace_record.h"
+
+namespace {
+
+size_t fillRecord(reprobuild_trace_record& record, __u16 syscall,
+                  const std::string& path, const std::string& args,
+                  __s32 flags) {
+  std::memset(&record, 0, sizeof(record));
+  record.pid = 42;
+  record.syscall = syscall;
+  record.flags = flags;
+  const std::string data = path + args;
+  std::memcpy(record.data, data.data(), data.size());
+  record.path_len = static_cast<__u16>(path.size());
+  record.data_len = static_cast<__u32>(data.size());
+  return offsetof(reprobuild_trace_record, data) + data.size();
+}
+
+}  // namespace
+
+TEST(RingbufTracerTest, DecodesRecords) {
+  reprobuild_trace_record record;
+  TraceEvent event;
+
+  size_t size = fillRecord(record, REPROBUILD_SYSCALL_EXEC, "/usr/bin/cc",
+                           " -c a.c -o a.o", 0);
+  ASSERT_TRUE(decodeTraceRecord(&record, size, event));
+  EXPECT_EQ(event.type, TraceEventType::EXEC);
+  EXPECT_EQ(event.pid, 42);
+  EXPECT_EQ(event.path, "/usr/bin/cc");
+  EXPECT_EQ(event.args, "-c a.c -o a.o");
+
+  size = fillRecord(record, REPROBUILD_SYSCALL_OPENAT, "/src/a.c", "", 577);
+  ASSERT_TRUE(decodeTraceRecord(&record, size, event));
+  EXPECT_EQ(event.type, TraceEventType::OPENAT);
+  EXPECT_EQ(event.path, "/src/a.c");
+  EXPECT_EQ(event.flags, 577);
+  EXPECT_TRUE(event.args.empty());
+
+  size = fillRecord(record, REPROBUILD_SYSCALL_CREAT, "/out/app", "", 0);
+  ASSERT_TRUE(decodeTraceRecord(&record, size, event));
+  EXPECT_EQ(event.type, TraceEventType::CREAT);
+  EXPECT_EQ(event.path, "/out/app");
+}
+
+TEST(RingbufTracerTest, RejectsMalformedRecords) {
+  reprobuild_trace_record record;
+  TraceEvent event;
+
+  size_t size = fillRecord(record, REPROBUILD_SYSCALL_OPENAT, "/a", "", 0);
+  EXPECT_FALSE(decodeTraceRecord(&record, size - 1, event));
+  EXPECT_FALSE(decodeTraceRecord(&record, 4, event));
+
+  record.syscall = 99;
+  EXPECT_FALSE(decodeTraceRecord(&record, size, event));
+
+  size = fillRecord(record, REPROBUILD_SYSCALL_OPENAT, "", "", 0);
+  EXPECT_FALSE(decodeTraceRecord(&record, size, event));
+}
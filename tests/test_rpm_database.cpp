@@ -0,0 +1,139 @@
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef REPROBUILD_HAVE_SQLITE
+#include <sqlite3.h>
+#endif
+
+#include "rpm_database.h"
+
+namespace {
+// Builds header blobs in the rpmdb.sqlite layout.
+class HeaderBlob {
+ public:
+  void addString(uint32_t tag, const std::string& value) {
+    addEntry(tag, 6, 1, value + '\0');
+  }
+  void addStrings(uint32_t tag, const std::vector<std::string>& values) {
+    std::string data;
+    for (const auto& value : values) {
+      data += value + '\0';
+    }
+    addEntry(tag, 8, static_cast<uint32_t>(values.size()), data);
+  }
+  void addInt32s(uint32_t tag, const std::vector<uint32_t>& values) {
+    while (store_.size() % 4 != 0) {
+      store_.push_back('\0');
+    }
+    std::string data;
+    for (uint32_t value : values) {
+      appendBigEndian(data, value);
+    }
+    addEntry(tag, 4, static_cast<uint32_t>(values.size()), data);
+  }
+
+  std::string bytes() const {
+    std::string blob;
+    appendBigEndian(blob, static_cast<uint32_t>(entries_.size() / 16));
+    appendBigEndian(blob, static_cast<uint32_t>(store_.size()));
+    return blob + entries_ + store_;
+  }
+
+ private:
+  static void appendBigEndian(std::string& out, uint32_t value) {
+    const uint32_t be = htonl(value);
+    out.append(reinterpret_cast<const char*>(&be), sizeof(be));
+  }
+  void addEntry(uint32_t tag, uint32_t type, uint32_t count,
+                const std::string& data) {
+    appendBigEndian(entries_, tag);
+    appendBigEndian(entries_, type);
+    appendBigEndian(entries_, static_cast<uint32_t>(store_.size()));
+    appendBigEndian(entries_, count);
+    store_ += data;
+  }
+
+  std::string entries_;
+  std::string store_;
+};
+
+std::string glibcHeader() {
+  HeaderBlob blob;
+  blob.addString(1000, "glibc");
+  blob.addString(1001, "2.39");
+  blob.addString(1002, "38.fc40");
+  blob.addInt32s(1003, {2});
+  blob.addString(1022, "x86_64");
+  blob.addInt32s(1116, {0, 0, 1});
+  blob.addStrings(1117, {"libc.so.6", "ld-linux-x86-64.so.2", "ldd"});
+  blob.addStrings(1118, {"/usr/lib64/", "/usr/bin/"});
+  return blob.bytes();
+}
+}  // namespace
+
+TEST(RpmDatabaseTest, ParsesHeaderBlob) {
+  const std::string blob = glibcHeader();
+  RpmHeader header;
+  ASSERT_TRUE(RpmDatabase::parseHeader(blob.data(), blob.size(), header));
+  EXPECT_EQ(header.name, "glibc");
+  EXPECT_EQ(header.versionRelease(), "2.39-38.fc40");
+  EXPECT_EQ(header.epoch, 2u);
+  EXPECT_EQ(header.arch, "x86_64");
+  EXPECT_EQ(header.files,
+            (std::vector<std::string>{"/usr/lib64/libc.so.6",
+                                      "/usr/lib64/ld-linux-x86-64.so.2",
+                                      "/usr/bin/ldd"}));
+
+  EXPECT_FALSE(RpmDatabase::parseHeader(blob.data(), blob.size() - 1, header));
+}
+
+#ifdef REPROBUILD_HAVE_SQLITE
+TEST(RpmDatabaseTest, FindsOwnersInFixtureDatabase) {
+  const std::filesystem::path dir =
+      std::filesystem::temp_directory_path() /
+      ("reprobuild_rpm_" + std::to_string(getpid()));
+  std::filesystem::create_directories(dir);
+  const std::string db_path = (dir / "rpmdb.sqlite").string();
+
+  sqlite3* db = nullptr;
+  ASSERT_EQ(sqlite3_open(db_path.c_str(), &db), SQLITE_OK);
+  ASSERT_EQ(sqlite3_exec(db,
+                         "CREATE TABLE Packages (hnum INTEGER PRIMARY KEY "
+                         "AUTOINCREMENT, blob BLOB NOT NULL)",
+                         nullptr, nullptr, nullptr),
+            SQLITE_OK);
+  sqlite3_stmt* insert = nullptr;
+  ASSERT_EQ(sqlite3_prepare_v2(db, "INSERT INTO Packages (blob) VALUES (?)",
+                               -1, &insert, nullptr),
+            SQLITE_OK);
+  const std::string blob = glibcHeader();
+  sqlite3_bind_blob(insert, 1, blob.data(), static_cast<int>(blob.size()),
+                    SQLITE_STATIC);
+  ASSERT_EQ(sqlite3_step(insert), SQLITE_DONE);
+  sqlite3_finalize(insert);
+  sqlite3_close(db);
+
+  RpmDatabase::Options options;
+  options.db_path = db_path;
+  options.cache_path = (dir / "rpm_owners.idx").string();
+  for (int run = 0; run < 2; ++run) {  // build, then load from the cache
+    RpmDatabase database(options);
+    ASSERT_TRUE(database.available());
+    RpmPackageOwner owner;
+    ASSERT_TRUE(database.findOwner("/lib64/libc.so.6", "/usr/lib64/libc.so.6",
+                                   owner));
+    EXPECT_EQ(owner.name, "glibc");
+    EXPECT_EQ(owner.version, "2.39-38.fc40");
+    EXPECT_FALSE(database.findOwner("/usr/bin/cc", "/usr/bin/cc", owner));
+  }
+
+  std::filesystem::remove_all(dir);
+}
+#endif
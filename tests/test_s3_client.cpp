@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mock_s3_server.h"
+#include "s3_client.h"
+
+TEST(S3ClientTest, SignsLikeAwsV2) {
+  // Example from the AWS signature version 2 documentation.
+  EXPECT_EQ(S3Client::sign("wJalrXUtnFEMI/K7MDENG/bPxRfiCYEXAMPLEKEY",
+                           "GET\n\n\nTue, 27 Mar 2007 19:36:42 +0000\n"
+                           "/awsexamplebucket1/photos/puppy.jpg"),
+            "qgk2+6Sv9/oM7G3qLEjTH1a1l1g=");
+}
+
+TEST(S3ClientTest, ReusesConnectionsAcrossRequests) {
+  MockS3Server server;
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  EXPECT_EQ(client.headObject("a.zip"), 404);
+  EXPECT_EQ(client.putObject("a.zip", "payload", "application/octet-stream"),
+            200);
+  EXPECT_EQ(client.headObject("a.zip"), 200);
+  EXPECT_EQ(server.object("/bucket/a.zip"), "payload");
+  EXPECT_EQ(server.connections(), 1u);
+  EXPECT_EQ(client.connectionCount(), 1u);
+}
+
+TEST(S3ClientTest, ReconnectsWhenTheServerClosesIdleConnections) {
+  MockS3Server server;
+  server.closeAfter(1);
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(client.putObject("obj" + std::to_string(i), "x", "text/plain"),
+              200);
+  }
+  EXPECT_EQ(server.requests(), 5u);
+  EXPECT_EQ(server.connections(), 5u);
+}
+
+TEST(S3ClientTest, RetriesOnANewConnectionWhenThePoolWentStale) {
+  MockS3Server server;
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  // Two requests in flight at once leave two connections in the pool.
+  server.pause();
+  std::thread first([&] { client.putObject("a", "a", "text/plain"); });
+  std::thread second([&] { client.putObject("b", "b", "text/plain"); });
+  while (server.connections() < 2) {
+    std::this_thread::yield();
+  }
+  server.resume();
+  first.join();
+  second.join();
+  ASSERT_EQ(client.connectionCount(), 2u);
+
+  server.dropConnections();
+  EXPECT_EQ(client.headObject("a"), 200);
+  EXPECT_EQ(client.connectionCount(), 3u);
+
+  // POSTs are not replayed: after another drop one request is all it takes.
+  server.dropConnections();
+  const size_t before = client.requestCount();
+  EXPECT_FALSE(client.createMultipartUpload("c", "text/plain").empty());
+  EXPECT_EQ(client.requestCount(), before + 1);
+}
+
+TEST(S3ClientTest, SharesPoolBetweenThreads) {
+  MockS3Server server;
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&client, t]() {
+      for (int i = 0; i < 25; ++i) {
+        const std::string key = std::to_string(t) + "-" + std::to_string(i);
+        EXPECT_EQ(client.putObject(key, key, "text/plain"), 200);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(server.requests(), 100u);
+  EXPECT_LE(server.connections(), 4u);
+  EXPECT_EQ(server.object("/bucket/3-24"), "3-24");
+}
+
+TEST(S3ClientTest, ReportsUnreachableServer) {
+  int port;
+  {
+    MockS3Server server;
+    port = server.port();
+  }
+  S3Client client("127.0.0.1", port, "key", "secret", "bucket");
+  EXPECT_EQ(client.headObject("a.zip"), 0);
+}
+
+TEST(S3ClientTest, ListsAllPages) {
+  MockS3Server server;
+  server.setPageSize(3);
+  for (int i = 0; i < 10; ++i) {
+    server.putObject("/bucket/obj" + std::to_string(i), "x");
+  }
+  server.putObject("/other/obj", "x");
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  std::vector<std::string> keys;
+  ASSERT_TRUE(client.listObjects("", keys));
+  EXPECT_EQ(keys.size(), 10u);
+  EXPECT_EQ(keys.front(), "obj0");
+  EXPECT_EQ(keys.back(), "obj9");
+  EXPECT_EQ(server.listings(), 4u);
+}
+
+TEST(S3ClientTest, EncodesQueryValues) {
+  EXPECT_EQ(S3Client::urlEncode("a/b+c=d~e"), "a%2Fb%2Bc%3Dd~e");
+}
+
+TEST(S3ClientTest, ObjectWriterSwitchesToMultipart) {
+  MockS3Server server;
+  S3Client client("127.0.0.1", server.port(), "key", "secret", "bucket");
+
+  {
+    S3ObjectWriter small(client, "small", "text/plain", 1000);
+    ASSERT_TRUE(small.write(std::string(1000, 's')));
+    ASSERT_TRUE(small.finish());
+    EXPECT_EQ(small.partCount(), 0u);
+  }
+  EXPECT_EQ(server.object("/bucket/small"), std::string(1000, 's'));
+
+  std::string data;
+  for (int i = 0; i < 3500; ++i) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  {
+    S3ObjectWriter large(client, "large", "text/plain", 1000);
+    for (size_t i = 0; i < data.size(); i += 300) {
+      ASSERT_TRUE(large.write(std::string_view(data).substr(i, 300)));
+    }
+    ASSERT_TRUE(large.finish());
+    EXPECT_EQ(large.partCount(), 4u);
+  }
+  EXPECT_EQ(server.object("/bucket/large"), data);
+  EXPECT_EQ(server.completedParts(), 4u);
+
+  // An unfinished multipart upload is aborted.
+  {
+    S3ObjectWriter abandoned(client, "abandoned", "text/plain", 1000);
+    ASSERT_TRUE(abandoned.write(data));
+  }
+  EXPECT_EQ(server.openUploads(), 0u);
+  EXPECT_FALSE(server.hasObject("/bucket/abandoned"));
+}
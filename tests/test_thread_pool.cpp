@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+
+TEST(ThreadPoolTest, EnqueueReturnsResultsAndExceptions) {
+  ThreadPool pool(3);
+  auto sum = pool.enqueue([](int a, int b) { return a + b; }, 2, 40);
+  auto text = pool.enqueue([](const std::string& s) { return s + "!"; },
+                           std::string("done"));
+  auto failure = pool.enqueue([]() { throw std::runtime_error("boom"); });
+  EXPECT_EQ(sum.get(), 42);
+  EXPECT_EQ(text.get(), "done!");
+  EXPECT_THROW(failure.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, RunsMoveOnlyAndLargeTasks) {
+  ThreadPool pool(2);
+  auto value = std::make_unique<int>(7);
+  auto moved = pool.enqueue([value = std::move(value)]() { return *value; });
+
+  // Too large for the inline buffer, stored on the heap instead.
+  std::array<int, 64> large;
+  std::iota(large.begin(), large.end(), 0);
+  auto sum = pool.enqueue(
+      [large]() { return std::accumulate(large.begin(), large.end(), 0); });
+
+  EXPECT_EQ(moved.get(), 7);
+  EXPECT_EQ(sum.get(), 64 * 63 / 2);
+}
+
+TEST(ThreadPoolTest, ParallelForVisitsEveryIndexOnce) {
+  for (size_t workers : {0, 1, 4}) {
+    ThreadPool pool(workers);
+    std::vector<std::atomic<int>> visits(10007);
+    pool.parallel_for(0, visits.size(), 64, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        visits[i].fetch_add(1);
+      }
+    });
+    for (const auto& count : visits) {
+      ASSERT_EQ(count.load(), 1) << workers << " workers";
+    }
+  }
+}
+
+TEST(ThreadPoolTest, ParallelForNestsAndRethrows) {
+  ThreadPool pool(2);
+  std::atomic<size_t> total{0};
+  pool.parallel_for(0, 8, 1, [&](size_t, size_t) {
+    pool.parallel_for(0, 100, 10, [&](size_t begin, size_t end) {
+      total.fetch_add(end - begin);
+    });
+  });
+  EXPECT_EQ(total.load(), 800u);
+
+  EXPECT_THROW(pool.parallel_for(0, 16, 1,
+                                 [](size_t begin, size_t) {
+                                   if (begin == 5) {
+                                     throw std::runtime_error("chunk 5");
+                                   }
+                                 }),
+               std::runtime_error);
+}
+
+TEST(ThreadPoolTest, DrainsQueuedTasksOnDestruction) {
+  std::atomic<int> ran{0};
+  {
+    ThreadPool pool(2);
+    for (int i = 0; i < 1000; ++i) {
+      pool.submit([&ran]() { ran.fetch_add(1); });
+    }
+  }
+  EXPECT_EQ(ran.load(), 1000);
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "trace_event.h"
+
+TEST(TraceEventTest, ParsesSyscallLines) {
+  TraceEvent event;
+
+  ASSERT_TRUE(parseTraceEvent(5, "openat /usr/include/stdio.h 577", event));
+  EXPECT_EQ(event.type, TraceEventType::OPENAT);
+  EXPECT_EQ(event.pid, 5);
+  EXPECT_EQ(event.path, "/usr/include/stdio.h");
+  EXPECT_EQ(event.flags, 577);
+
+  ASSERT_TRUE(parseTraceEvent(6, "execveat /usr/bin/cc -c a.c -o a.o", event));
+  EXPECT_EQ(event.type, TraceEventType::EXEC);
+  EXPECT_EQ(event.path, "/usr/bin/cc");
+  EXPECT_EQ(event.args, "-c a.c -o a.o");
+
+  ASSERT_TRUE(parseTraceEvent(7, "creat /out/app", event));
+  EXPECT_EQ(event.type, TraceEventType::CREAT);
+  EXPECT_EQ(event.path, "/out/app");
+
+  EXPECT_FALSE(parseTraceEvent(8, "ID 8: ", event));
+  EXPECT_FALSE(parseTraceEvent(8, "openatx /a 0", event));
+  EXPECT_FALSE(parseTraceEvent(8, "openat ", event));
+}
+
+TEST(TraceEventTest, DispatcherRoutesEventsBySubscribedType) {
+  TraceEventDispatcher dispatcher;
+  std::vector<std::string> opened;
+  std::vector<std::string> executed;
+  dispatcher.subscribe(TraceEventType::OPENAT, [&](const TraceEvent& event) {
+    opened.emplace_back(event.path);
+  });
+  dispatcher.subscribe(TraceEventType::EXEC, [&](const TraceEvent& event) {
+    executed.emplace_back(event.path);
+  });
+
+  dispatcher.dispatch(1, "openat /a.h 0");
+  dispatcher.dispatch(1, "execve /usr/bin/ld -o app");
+  dispatcher.dispatch(1, "creat /app");
+  dispatcher.dispatch(1, "garbage");
+
+  EXPECT_EQ(dispatcher.eventCount(), 3U);
+  EXPECT_EQ(opened, std::vector<std::string>{"/a.h"});
+  EXPECT_EQ(executed, std::vector<std::string>{"/usr/bin/ld"});
+}
+
+TEST(TraceEventTest, DispatcherResolvesRelativeOpens) {
+  TraceEventDispatcher dispatcher;
+  std::vector<std::string> opened;
+  dispatcher.subscribe(TraceEventType::OPENAT, [&](const TraceEvent& event) {
+    opened.emplace_back(std::string(event.path) + " " +
+                        std::to_string(event.flags));
+  });
+
+  dispatcher.dispatch(10, "dir 7 /src/proj");
+  dispatcher.dispatch(10, "openat_dir 7 config.h 0");
+  dispatcher.dispatch(10, "dir 8 ");
+  dispatcher.dispatch(10, "openat_dir 8 etc/hosts 0");
+
+  // Directory records are per process and may arrive after the open.
+  dispatcher.dispatch(11, "openat_dir 7 out.o 577");
+  dispatcher.dispatch(11, "openat_dir 9 lost.h 0");
+  dispatcher.dispatch(11, "dir 7 /build");
+
+  EXPECT_EQ(dispatcher.finish(), 1u);
+  EXPECT_EQ(opened, (std::vector<std::string>{"/src/proj/config.h 0",
+                                              "/etc/hosts 0",
+                                              "/build/out.o 577"}));
+}
+
+TEST(TraceEventTest, DispatcherForgetsDirectoriesOfExitedProcesses) {
+  TraceEventDispatcher dispatcher;
+  std::vector<std::string> opened;
+  dispatcher.subscribe(TraceEventType::OPENAT, [&](const TraceEvent& event) {
+    opened.emplace_back(event.path);
+  });
+
+  dispatcher.dispatch(10, "dir 7 /src/old");
+  dispatcher.dispatch(10, "openat_dir 7 a.h 0");
+  dispatcher.dispatch(10, "openat_dir 8 never.h 0");
+  dispatcher.dispatch(10, "exit");
+  // The PID is reused: its directory ids must not resolve to the old paths.
+  dispatcher.dispatch(10, "openat_dir 7 b.h 0");
+  dispatcher.dispatch(10, "dir 7 /src/new");
+
+  EXPECT_EQ(dispatcher.finish(), 1u);
+  EXPECT_EQ(opened, (std::vector<std::string>{"/src/old/a.h",
+                                              "/src/new/b.h"}));
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "trace_stream.h"
+
+namespace {
+
+using DecodedLines = std::vector<std::pair<int, std::string>>;
+
+std::string frame(int pid, const std::string& content) {
+  return std::to_string(pid) + "\x80" + content + "\x80";
+}
+
+}  // namespace
+
+TEST(BpftraceStreamDecoderTest, ReassemblesInterleavedPidStreams) {
+  DecodedLines lines;
+  BpftraceStreamDecoder decoder([&](int pid, std::string_view line) {
+    lines.emplace_back(pid, std::string(line));
+  });
+
+  decoder.feed(frame(10, "execve /usr/bin/gcc") + frame(11, "openat ") +
+               frame(10, " -c") + frame(11, "/src/a.h") + frame(10, "\n") +
+               frame(11, " 0\n"));
+  decoder.finish();
+
+  ASSERT_EQ(lines.size(), 2U);
+  EXPECT_EQ(lines[0], std::make_pair(10, std::string("execve /usr/bin/gcc -c")));
+  EXPECT_EQ(lines[1], std::make_pair(11, std::string("openat /src/a.h 0")));
+}
+
+TEST(BpftraceStreamDecoderTest, HandlesRecordsSplitAcrossChunks) {
+  const std::string raw = frame(42, "creat /out/app\n") +
+                          frame(42, "openat /usr/include/stdio.h") +
+                          frame(42, " 0\n");
+
+  DecodedLines lines;
+  BpftraceStreamDecoder decoder([&](int pid, std::string_view line) {
+    lines.emplace_back(pid, std::string(line));
+  });
+  for (char c : raw) {
+    decoder.feed(std::string_view(&c, 1));
+  }
+  decoder.finish();
+
+  ASSERT_EQ(lines.size(), 2U);
+  EXPECT_EQ(lines[0].second, "creat /out/app");
+  EXPECT_EQ(lines[1].second, "openat /usr/include/stdio.h 0");
+  EXPECT_FALSE(decoder.corrupted());
+}
+
+TEST(BpftraceStreamDecoderTest, StopsAtUnframedOutputAndFlushesPartialLines) {
+  DecodedLines lines;
+  BpftraceStreamDecoder decoder([&](int pid, std::string_view line) {
+    lines.emplace_back(pid, std::string(line));
+  });
+
+  decoder.feed(frame(7, "execve /bin/ld") + "\n\n@path_parts[7, 0]: x\n" +
+               frame(7, "openat /ignored 0\n"));
+  decoder.finish();
+
+  EXPECT_TRUE(decoder.corrupted());
+  ASSERT_EQ(lines.size(), 1U);
+  EXPECT_EQ(lines[0].second, "execve /bin/ld");
+}
+
+TEST(BpftraceTraceIndexTest, ReassemblesPidStreamsInPlace) {
+  const std::string raw = frame(10, "execve /usr/bin/gcc") +
+                          frame(11, "openat ") + frame(10, " -c") +
+                          frame(11, "/src/a.h") + frame(10, "\n") +
+                          frame(11, " 0\n") + frame(10, "creat /out/a.o\n") +
+                          "\n@path_parts[1, 0]: x\n" + frame(10, "lost\n");
+
+  DecodedLines lines;
+  const BpftraceTraceIndex index = BpftraceTraceIndex::build(raw, 4);
+  index.forEachLine([&](int pid, std::string_view line) {
+    lines.emplace_back(pid, std::string(line));
+  });
+
+  EXPECT_EQ(index.pidCount(), 2U);
+  EXPECT_EQ(lines, (DecodedLines{{10, "execve /usr/bin/gcc -c"},
+                                 {10, "creat /out/a.o"},
+                                 {11, "openat /src/a.h 0"}}));
+}
+
+TEST(BpftraceTraceIndexTest, ShardedIndexMatchesSingleShard) {
+  // Large enough to be split; lines of both PIDs cross shard boundaries.
+  std::string raw;
+  for (int i = 0; raw.size() < 12 * 1024 * 1024; ++i) {
+    raw += frame(100 + i % 3, "openat /usr/include/header_" +
+                                  std::to_string(i) + ".h") +
+           frame(200, "execve /usr/bin/cc") + frame(100 + i % 3, " 0\n") +
+           frame(200, " -c x.c\n");
+  }
+
+  DecodedLines serial;
+  BpftraceTraceIndex::build(raw, 1).forEachLine(
+      [&](int pid, std::string_view line) {
+        serial.emplace_back(pid, std::string(line));
+      });
+  DecodedLines sharded;
+  const BpftraceTraceIndex index = BpftraceTraceIndex::build(raw, 3);
+  index.forEachLine([&](int pid, std::string_view line) {
+    sharded.emplace_back(pid, std::string(line));
+  });
+
+  EXPECT_EQ(index.pidCount(), 4U);
+  EXPECT_EQ(sharded, serial);
+}
@@ -0,0 +1,174 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "mock_s3_server.h"
+#include "uploader.h"
+
+class UploaderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    dir_ = std::filesystem::temp_directory_path() /
+           ("reprobuild_uploader_" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir_);
+    setenv("MINIO_HOST", "127.0.0.1", 1);
+    setenv("MINIO_PORT", std::to_string(server_.port()).c_str(), 1);
+    setenv("MINIO_BUCKET", "bucket", 1);
+    setenv("MINIO_UPLOAD_THREADS", "4", 1);
+    setenv("XDG_CACHE_HOME", (dir_ / "cache").c_str(), 1);
+    unsetenv("MINIO_LISTING_TTL");
+    unsetenv("MINIO_PART_SIZE");
+  }
+
+  void TearDown() override {
+    std::filesystem::remove_all(dir_);
+    unsetenv("MINIO_HOST");
+    unsetenv("MINIO_PORT");
+    unsetenv("MINIO_BUCKET");
+    unsetenv("MINIO_UPLOAD_THREADS");
+    unsetenv("XDG_CACHE_HOME");
+    unsetenv("MINIO_LISTING_TTL");
+    unsetenv("MINIO_PART_SIZE");
+  }
+
+  DependencyPackage customFile(const std::string& name,
+                               DependencyOrigin origin =
+                                   DependencyOrigin::CUSTOM) {
+    const std::string path = (dir_ / name).string();
+    std::ofstream(path) << "contents of " << name;
+    return DependencyPackage(name, origin, path, "custom", "hash-" + name);
+  }
+
+  MockS3Server server_;
+  std::filesystem::path dir_;
+};
+
+TEST_F(UploaderTest, UploadsMissingCustomDependenciesInParallel) {
+  std::vector<DependencyPackage> deps;
+  for (int i = 0; i < 20; ++i) {
+    deps.push_back(customFile("lib" + std::to_string(i) + ".so"));
+  }
+  deps.push_back(customFile("libapt.so", DependencyOrigin::APT));
+  server_.putObject("/bucket/hash-lib0.so.zip", "already there");
+
+  Uploader uploader;
+  EXPECT_EQ(uploader.uploadCustomDependencies(deps), 19);
+  EXPECT_TRUE(server_.hasObject("/bucket/hash-lib19.so.zip"));
+  EXPECT_EQ(server_.object("/bucket/hash-lib0.so.zip"), "already there");
+  EXPECT_FALSE(server_.hasObject("/bucket/hash-libapt.so.zip"));
+  EXPECT_LE(server_.connections(), 4u);
+  // Existence came from one listing, not a HEAD per file.
+  EXPECT_EQ(server_.listings(), 1u);
+  EXPECT_EQ(server_.requests(), 20u);
+}
+
+TEST_F(UploaderTest, RepeatedRunUsesCachedListing) {
+  std::vector<DependencyPackage> deps = {customFile("liba.so"),
+                                         customFile("libb.so")};
+  {
+    Uploader uploader;
+    EXPECT_EQ(uploader.uploadCustomDependencies(deps), 2);
+  }
+  const size_t requests = server_.requests();
+  {
+    Uploader uploader;
+    EXPECT_EQ(uploader.uploadCustomDependencies(deps), 0);
+  }
+  EXPECT_EQ(server_.requests(), requests);
+
+  // A new file is missing from the cache: list once more, upload it.
+  deps.push_back(customFile("libc.so"));
+  {
+    Uploader uploader;
+    EXPECT_EQ(uploader.uploadCustomDependencies(deps), 1);
+  }
+  EXPECT_EQ(server_.listings(), 2u);
+}
+
+TEST_F(UploaderTest, ExpiredListingIsRefreshed) {
+  setenv("MINIO_LISTING_TTL", "0", 1);
+  std::vector<DependencyPackage> deps = {customFile("liba.so")};
+  for (int run = 0; run < 2; ++run) {
+    Uploader uploader;
+    uploader.uploadCustomDependencies(deps);
+  }
+  EXPECT_EQ(server_.listings(), 2u);
+  EXPECT_EQ(server_.requests(), 3u);
+}
+
+TEST_F(UploaderTest, FallsBackToHeadOnLargeSharedBucket) {
+  server_.setPageSize(3);
+  for (int i = 0; i < 30; ++i) {
+    server_.putObject("/bucket/aaa-" + std::to_string(i) + ".zip", "x");
+  }
+  server_.putObject("/bucket/hash-liba.so.zip", "already there");
+  std::vector<DependencyPackage> deps = {customFile("liba.so"),
+                                         customFile("libb.so")};
+
+  Uploader uploader;
+  EXPECT_EQ(uploader.uploadCustomDependencies(deps), 1);
+  // Two pages (no more than objects wanted), then a HEAD each and a PUT.
+  EXPECT_EQ(server_.listings(), 2u);
+  EXPECT_EQ(server_.requests(), 5u);
+  EXPECT_EQ(server_.object("/bucket/hash-liba.so.zip"), "already there");
+  EXPECT_TRUE(server_.hasObject("/bucket/hash-libb.so.zip"));
+
+  // Only the objects this client asked about are cached.
+  std::vector<std::string> cached;
+  for (const auto& entry :
+       std::filesystem::recursive_directory_iterator(dir_ / "cache")) {
+    std::ifstream file(entry.path());
+    std::string line;
+    while (std::getline(file, line)) {
+      cached.push_back(line);
+    }
+  }
+  ASSERT_EQ(cached.size(), 4u);  // magic, timestamp, two objects
+  std::sort(cached.begin() + 2, cached.end());
+  EXPECT_EQ(cached[2], "hash-liba.so.zip");
+  EXPECT_EQ(cached[3], "hash-libb.so.zip");
+}
+
+TEST_F(UploaderTest, StreamsZipWithoutTemporaryFiles) {
+  if (std::system("command -v unzip >/dev/null 2>&1") != 0) {
+    GTEST_SKIP() << "unzip not installed";
+  }
+  // Incompressible, and large enough for three 5 MiB parts.
+  std::string contents;
+  uint32_t state = 1;
+  for (int i = 0; i < 11 << 20; ++i) {
+    state = state * 1103515245 + 12345;
+    contents += static_cast<char>(state >> 24);
+  }
+  const std::string path = (dir_ / "libbig.a").string();
+  std::ofstream(path, std::ios::binary) << contents;
+  // Below the S3 minimum, so raised to 5 MiB.
+  setenv("MINIO_PART_SIZE", "65536", 1);
+
+  Uploader uploader;
+  ASSERT_TRUE(uploader.uploadFile(path, "hash-big"));
+  EXPECT_FALSE(std::filesystem::exists(path + ".zip"));
+  EXPECT_EQ(server_.completedParts(), 3u);
+
+  const std::string archive = (dir_ / "downloaded.zip").string();
+  std::ofstream(archive, std::ios::binary)
+      << server_.object("/bucket/hash-big.zip");
+  std::string extracted;
+  FILE* pipe = popen(("unzip -p " + archive + " libbig.a").c_str(), "r");
+  ASSERT_NE(pipe, nullptr);
+  char buffer[4096];
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+    extracted.append(buffer, bytes);
+  }
+  pclose(pipe);
+  EXPECT_EQ(extracted, contents);
+}